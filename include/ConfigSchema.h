@@ -0,0 +1,113 @@
+#ifndef _CONFIGSCHEMA_H
+#define _CONFIGSCHEMA_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "ArduinoJson.h"
+#include "config.h"
+
+// Subsystems that have to be restarted for a config change to take effect.
+enum ConfigChange: uint16_t {
+	CONFIG_CHANGE_NONE = 0,
+	CONFIG_CHANGE_WIFI = 1 << 0,
+	CONFIG_CHANGE_IP = 1 << 1,
+	CONFIG_CHANGE_MQTT = 1 << 2,
+	CONFIG_CHANGE_MQTT_TOPICS = 1 << 3,
+	CONFIG_CHANGE_OTA = 1 << 4,
+	CONFIG_CHANGE_MDNS = 1 << 5,
+	CONFIG_CHANGE_CLOCK = 1 << 6,
+	CONFIG_CHANGE_DIRECT = 1 << 7,
+	CONFIG_CHANGE_QUIET_HOURS = 1 << 8,
+	CONFIG_CHANGE_GROUPS = 1 << 9,
+	CONFIG_CHANGE_NETWORK = 1 << 10,
+	CONFIG_CHANGE_HEARTBEAT = 1 << 11,
+	CONFIG_CHANGE_POWER = 1 << 12,
+	CONFIG_CHANGE_OUTPUTS = 1 << 13
+};
+
+// Per-field flags in CONFIG_FIELDS.
+enum ConfigFlag: uint8_t {
+	CONFIG_FLAG_SECRET = 1 << 0,        // masked by show
+	CONFIG_FLAG_CHIP_ID = 1 << 1,       // default gets "_<chip id>" appended
+	CONFIG_FLAG_STATIC_IP = 1 << 2,     // only in use while useDhcp is off
+	CONFIG_FLAG_PRESENCE = 1 << 3,      // only whether it is set needs applying
+	CONFIG_FLAG_TOPIC_LEVEL = 1 << 4    // items are single MQTT topic levels
+};
+
+// The type column of CONFIG_FIELDS names these through CONFIG_TYPE_<type>.
+enum class ConfigType: uint8_t {
+	STRING = 0,
+	BOOLEAN,
+	INT8,
+	UINT8,
+	UINT16,
+	ADDRESS,
+	LIST,
+	QUIET_HOURS
+};
+
+// One row of the schema table. Strings point into flash.
+typedef struct {
+	const char* key;
+	const char* alias;
+	const char* defaultText;    // STRING, LIST and QUIET_HOURS
+	uint32_t defaultValue;      // everything else
+	int32_t min;
+	int32_t max;
+	uint16_t offset;
+	uint16_t countOffset;       // LIST and QUIET_HOURS
+	uint16_t size;              // bytes per item
+	uint8_t capacity;
+	ConfigType type;
+	uint8_t flags;
+	uint16_t changes;
+} config_field_t;
+
+// Binary image of a config_t, cached next to config.json so a normal
+// boot doesn't have to parse JSON. Fields are written in table order, and
+// any change to the table changes the schema hash and drops the cache.
+typedef struct {
+	uint32_t magic;
+	uint32_t schema;
+	uint32_t check;
+	uint16_t length;
+	uint16_t reserved;
+} config_cache_header_t;
+
+#define CONFIG_FIELD_ONE(...) + 1
+#define CONFIG_FIELD_COUNT (0 CONFIG_FIELDS(CONFIG_FIELD_ONE))
+
+// Defaults, config.json, the binary cache and the console's set, import,
+// show and describe commands, all driven by the CONFIG_FIELDS table.
+class ConfigSchemaClass
+{
+public:
+	ConfigSchemaClass();
+	uint8_t getCount() const;
+	void getField(uint8_t index, config_field_t &field) const;
+	int8_t find(const char* name, bool aliases = true) const;
+	void setDefaults(config_t &cfg) const;
+	void read(JsonObjectConst source, config_t &cfg, bool fillMissing) const;
+	void write(const config_t &cfg, JsonDocument &doc, bool maskSecrets) const;
+	bool set(config_t &cfg, uint8_t index, const char* text) const;
+	void describe(const config_t &cfg, uint8_t index, Print &out) const;
+	uint16_t diff(const config_t &running, const config_t &pending) const;
+	bool writeBinary(const config_t &cfg, File &file) const;
+	bool readBinary(File &file, config_t &cfg) const;
+
+private:
+	uint32_t getSchemaHash() const;
+	uint32_t getBodyHash(const config_t &cfg) const;
+	size_t getBodyLength() const;
+	void setDefault(const config_field_t &field, config_t &cfg) const;
+	const __FlashStringHelper* readField(const config_field_t &field, JsonVariantConst value, config_t &cfg) const;
+	const __FlashStringHelper* parseItem(const config_field_t &field, const char* text, uint8_t *dest) const;
+	const __FlashStringHelper* parseList(const config_field_t &field, const char* text, config_t &cfg) const;
+	bool isValid(const config_field_t &field, const config_t &cfg) const;
+	bool isEqual(const config_field_t &field, const config_t &a, const config_t &b) const;
+	void printValue(const config_field_t &field, const config_t &cfg, Print &out) const;
+};
+
+extern ConfigSchemaClass ConfigSchema;
+
+#endif
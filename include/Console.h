@@ -2,65 +2,88 @@
 #define _CONSOLE_H
 
 #include <Arduino.h>
-#include <IPAddress.h>
+#include "EventBus.h"
+#include "config.h"
 
+enum ConsoleStepFlag: uint8_t {
+	CONSOLE_STEP_SECRET = 1 << 0,       // don't echo the answer
+	CONSOLE_STEP_CLEARABLE = 1 << 1     // an empty answer clears the setting
+};
+
+// One step of a menu flow: asks for a setting, or sets it to value
+// without asking. Strings point into flash.
+typedef struct {
+	const char* key;
+	const char* value;
+	uint8_t flags;
+} console_step_t;
+
+// Serial failsafe menu and line command mode. Never blocks: poll() takes
+// whatever input has arrived, and every command goes out on the event bus.
+// Commands with an answer wait for complete() before the next prompt.
 class ConsoleClass
 {
 public:
-    ConsoleClass();
-    IPAddress getIPFromString(String value);
-    void waitForUserInput();
-    String getInputString(bool isPassword = false);
-    void enterCommandInterpreter();
-    void onRebootCommand(void (*rebootHandler)());
-    void onScanNetworks(void (*scanHandler)());
-    void setHostname(String hostname);
-    void setMqttConfig(String broker, int port, String username, String password, String conChan, String statChan);
-    void onHostnameChange(void (*hostnameChangedHandler)(const char* newHostname));
-    void onDhcpConfig(void (*dhcpHandler)());
-    void onStaticConfig(void (*staticHandler)(IPAddress newIp, IPAddress newSm, IPAddress newGw, IPAddress newDns));
-    void onReconnectCommand(void (*reconnectHandler)());
-    void onWifiConfigCommand(void (*wifiConfigHandler)(String newSsid, String newPassword));
-    void onResumeCommand(void (*resumeHandler)());
-    void onGetNetInfoCommand(void (*netinfoHandler)());
-    void onSaveConfigCommand(void (*saveConfigHandler)());
-    void onMqttConfigCommand(void (*mqttConfigHandler)(String newBroker, int newPort, String newUsername, String newPassword, String newConChan, String newStatChan));
-    void onConsoleInterrupt(void (*interruptHandler)());
-    void onFactoryRestore(void (*factoryRestoreHandler)());
-    void onStop(void (*stopHandler)());
-    void checkInterrupt();
+	ConsoleClass();
+	void poll();
+	void complete(const event_t &event, bool success);
 
 private:
-    void displayMenu();
-    void checkCommand();
-    void configureStaticIP();
-    void configureWiFiNetwork();
-    void configMQTT();
+	enum class Mode: uint8_t {
+		IDLE = 0,
+		MENU,
+		NETWORK_MODE,
+		STEP_VALUE,
+		SETTING_NAME,
+		CONFIRM_RESTORE,
+		LINE,
+		WAITING
+	};
+
+	// What to do once the event being waited for is done.
+	enum class Then: uint8_t {
+		MENU = 0,
+		LINE_RESULT,
+		RECONNECTED,
+		ASK_VALUE,
+		NEXT_STEP,
+		FLOW_DONE,
+		ASK_SETTING_NAME,
+		STAGED
+	};
+
+	void wait(EventType type, Then then, const char* key = NULL, const char* text = NULL);
+	bool send(EventType type);
+	void finish(bool success);
+	bool readLine(bool echo, bool mask);
+	void showMenu();
+	void runMenuCommand(char command);
+	void beginFlow(const console_step_t *steps, uint8_t count, bool apply, Mode after);
+	void runStep();
+	void askValue();
+	void onValue();
+	void onSettingName();
+	void onConfirmRestore();
+	void showNetworkModePrompt();
+	void enterLineMode();
+	void printReady();
+	void runLineCommand();
 
-    void (*rebootHandler)();
-    void (*scanHandler)();
-    void (*hostnameChangeHandler)(const char* newHostName);
-    void (*dhcpHandler)();
-    void (*staticHandler)(IPAddress newIp, IPAddress newSm, IPAddress newGw, IPAddress newDns);
-    void (*reconnectHandler)();
-    void (*wifiConfigHandler)(String newSsid, String newPassword);
-    void (*resumeHandler)();
-    void (*netInfoHandler)();
-    void (*saveConfigHandler)();
-    void (*mqttChangeHandler)(String newBroker, int newPort, String newUsername, String newPass, String newConChan, String newStatChan);
-    void (*interruptHandler)();
-    void (*factoryRestoreHandler)();
-    void (*stopHandler)();
-    
-    String _hostname;
-    String _mqttBroker;
-    int _mqttPort;
-    String _mqttUsername;
-    String _mqttPassword;
-    String _mqttControlChannel;
-    String _mqttStatusChannel;
+	Mode _mode;
+	Then _then;
+	EventType _pending;
+	const console_step_t *_steps;
+	uint8_t _stepCount;
+	uint8_t _step;
+	uint8_t _stepFlags;
+	bool _flowApply;
+	Mode _flowAfter;
+	char _key[EVENT_KEY_SIZE];
+	char _line[CONSOLE_LINE_SIZE];
+	uint16_t _length;
+	bool _overflow;
 };
 
 extern ConsoleClass Console;
 
-#endif
\ No newline at end of file
+#endif
@@ -0,0 +1,62 @@
+#ifndef _EVENTBUS_H
+#define _EVENTBUS_H
+
+#include <Arduino.h>
+#include "EventQueue.h"
+#include "config.h"
+
+// Work handed to main.cpp from outside the control path.
+enum class EventType: uint8_t {
+	NONE = 0,
+	CONSOLE_INTERRUPT,
+	RESUME,
+	REBOOT,
+	FACTORY_RESTORE,
+	SCAN_NETWORKS,
+	NETWORK_INFO,
+	RECONNECT_WIFI,
+	SET_SETTING,        // key, text is the value
+	IMPORT_SETTINGS,    // text is a JSON object
+	SHOW_SETTINGS,
+	DESCRIBE_SETTING,   // key, empty for all of them
+	APPLY_SETTINGS,
+	SAVE_SETTINGS,
+	MQTT_LOST
+};
+
+enum class EventSource: uint8_t {
+	CONSOLE = 0,
+	MQTT,
+	TIMER
+};
+
+// Fixed size, so the queue never allocates. text isn't copied: it points
+// into the publisher's own buffer, which has to stay put until the event
+// has been handled (the console waits for every event that carries text).
+typedef struct {
+	uint32_t queuedAt;      // micros()
+	const char* text;
+	EventType type;
+	EventSource source;
+	char key[EVENT_KEY_SIZE];
+} event_t;
+
+// Bounded queue between everything that wants something done (console,
+// MQTT, timers) and the one place in loop() that does it. All publishers
+// run in loop() context, never from an ISR.
+class EventBusClass
+{
+public:
+	EventBusClass();
+	bool publish(EventType type, EventSource source, const char* key = NULL, const char* text = NULL);
+	bool next(event_t &event);
+	uint32_t getDropped() const;
+
+private:
+	EventQueue<event_t, EVENT_QUEUE_SIZE> _queue;
+	uint32_t _dropped;
+};
+
+extern EventBusClass EventBus;
+
+#endif
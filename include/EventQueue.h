@@ -0,0 +1,53 @@
+#ifndef _EVENTQUEUE_H
+#define _EVENTQUEUE_H
+
+#include <Arduino.h>
+#include <atomic>
+
+// Lock-free ring buffer for exactly one producer and one consumer, e.g.
+// an ISR feeding loop(). Holds N - 1 items; N must be a power of two.
+template <typename T, uint8_t N>
+class EventQueue
+{
+	static_assert(N >= 2 && N <= 128 && (N & (N - 1)) == 0, "EventQueue size must be a power of two from 2 to 128.");
+
+public:
+	EventQueue() : _head(0), _tail(0) {}
+
+	// Producer side. Forced inline so that, called from an IRAM_ATTR
+	// handler, no part of it ends up in flash.
+	inline __attribute__((always_inline)) bool push(const T &item) {
+		uint8_t head = _head.load(std::memory_order_relaxed);
+		uint8_t next = (head + 1) & (N - 1);
+		if (next == _tail.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		_items[head] = item;
+		_head.store(next, std::memory_order_release);
+		return true;
+	}
+
+	// Consumer side.
+	bool pop(T &item) {
+		uint8_t tail = _tail.load(std::memory_order_relaxed);
+		if (tail == _head.load(std::memory_order_acquire)) {
+			return false;
+		}
+
+		item = _items[tail];
+		_tail.store((tail + 1) & (N - 1), std::memory_order_release);
+		return true;
+	}
+
+	bool isEmpty() const {
+		return _tail.load(std::memory_order_acquire) == _head.load(std::memory_order_acquire);
+	}
+
+private:
+	T _items[N];
+	std::atomic<uint8_t> _head;
+	std::atomic<uint8_t> _tail;
+};
+
+#endif
@@ -0,0 +1,77 @@
+#ifndef _FORENSICS_H
+#define _FORENSICS_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include "config.h"
+
+// Where the firmware currently is. Loop stages come first, then the
+// scheduler tasks; the last task entered is tracked separately.
+enum class Stage: uint8_t {
+	NONE = 0,
+	CONSOLE,
+	SCHEDULER,
+	MDNS,
+	OTA,
+	MQTT,
+	METRICS_HTTP,
+	BELL_EVENTS,
+	DIRECT_CONTROL,
+	EVENTS,
+	REBOOTING,
+	TASK_CHECK_WIFI,
+	TASK_CHECK_MQTT,
+	TASK_CLOCK_SYNC,
+	TASK_PUBLISH_METRICS,
+	TASK_HEARTBEAT,
+	TASK_CONTROL,
+	TASK_SYNTHETIC_LOAD,
+	TASK_HTTP_UPDATE,
+	TASK_MQTT_FAILOVER,
+	TASK_BROKER_PROBE,
+	TASK_JOURNAL,
+	TASK_QUIET_HOURS,
+	TASK_GROUPS,
+	COUNT
+};
+
+#define FIRST_TASK_STAGE Stage::TASK_CHECK_WIFI
+
+// Breadcrumbs kept in RTC user memory, which survives everything but a
+// power cycle. Must stay a multiple of 4 bytes, and lives past the first
+// 128 bytes (FORENSICS_RTC_OFFSET blocks) since eboot uses those for OTA.
+typedef struct {
+	uint32_t magic;
+	uint8_t stage;
+	uint8_t lastTask;
+	uint8_t commandHead;
+	uint8_t commandCount;
+	uint8_t commands[FORENSICS_COMMAND_HISTORY];
+	uint32_t maxLoopTime;
+} forensics_rtc_t;
+
+class ForensicsClass
+{
+public:
+	ForensicsClass();
+	void begin();
+	bool captureReport(fs::FS &fs, const char* hostname);
+	void enter(Stage stage);
+	void recordCommand(uint8_t cmd);
+	void recordLoopTime(unsigned long elapsed);
+
+private:
+	void writeStageWord();
+	void writeAll();
+	bool wasAbnormalReset();
+	static const __FlashStringHelper* getStageName(uint8_t stage);
+
+	forensics_rtc_t _current;
+	forensics_rtc_t _previous;
+	bool _previousValid;
+	unsigned long _stageStart;
+};
+
+extern ForensicsClass Forensics;
+
+#endif
@@ -0,0 +1,57 @@
+#ifndef _HEAPTRACKER_H
+#define _HEAPTRACKER_H
+
+#include <Arduino.h>
+#include "config.h"
+
+// Where a steady-state allocation came from: the address malloc() (or
+// new) was called from, and how often and how much it asked for.
+typedef struct {
+	uint32_t address;
+	uint32_t count;
+	uint32_t bytes;
+} heap_site_t;
+
+// Counts heap allocations made once boot is complete. The counts only
+// move in builds with ENABLE_HEAP_TRACKING (the huzzah_heapcheck
+// environment), which wrap malloc and friends at link time. Allocations
+// the SDK makes for itself don't go through malloc and aren't seen.
+class HeapTrackerClass
+{
+public:
+	HeapTrackerClass();
+	void arm();
+	void beginExempt();
+	void endExempt();
+	void recordAllocation(uint32_t site, size_t size);
+	uint32_t getAllocations() const;
+	uint32_t getBytes() const;
+	uint32_t getExemptAllocations() const;
+	bool takeChanged();
+	size_t getReportLength(const char* hostname) const;
+	void writeReport(Print &out, const char* hostname) const;
+	void printSummary(Print &out) const;
+
+private:
+	bool _armed;
+	uint8_t _exemptDepth;
+	uint32_t _allocations;
+	uint32_t _bytes;
+	uint32_t _exemptAllocations;
+	uint32_t _reported;
+	heap_site_t _sites[HEAP_TRACKING_SITES];
+	uint8_t _siteCount;
+};
+
+extern HeapTrackerClass HeapTracker;
+
+// Marks a scope whose allocations are expected, such as opening a
+// connection. They are counted separately and never trip the assert.
+class HeapExemption
+{
+public:
+	HeapExemption() { HeapTracker.beginExempt(); }
+	~HeapExemption() { HeapTracker.endExempt(); }
+};
+
+#endif
@@ -0,0 +1,81 @@
+#ifndef _JOURNAL_H
+#define _JOURNAL_H
+
+#include <Arduino.h>
+#include <FS.h>
+#include <time.h>
+#include "TelemetryHelper.h"
+#include "config.h"
+
+#define JOURNAL_STATE_MASK 0x0f
+#define JOURNAL_FLAG_UPTIME 0x40
+#define JOURNAL_FLAG_DISABLED 0x80
+
+// One state change. The timestamp is unix time, or uptime seconds when
+// JOURNAL_FLAG_UPTIME is set because the clock wasn't synced yet.
+typedef struct {
+	uint32_t sequence;
+	uint32_t timestamp;
+	uint32_t durationMs;    // how long the channels had been active, on the change that turned them all off
+	uint8_t source;         // CommandSource
+	uint8_t command;        // ControlCommand
+	uint8_t state;          // channel mask after the change, plus flags
+	uint8_t check;
+} journal_record_t;
+
+static_assert(sizeof(journal_record_t) == 16, "Journal records must stay 16 bytes.");
+
+// Running totals for one local calendar day.
+typedef struct {
+	uint32_t day;           // local days since the epoch
+	uint32_t silencedMs;
+	uint16_t activations;
+	uint16_t reserved;
+} journal_day_t;
+
+// Lives at the start of the journal file and is rewritten with every
+// batch, so the totals and the write position never have to be rebuilt
+// from the records.
+typedef struct {
+	uint32_t magic;
+	uint16_t capacity;
+	uint16_t recordSize;
+	uint32_t nextSequence;
+	journal_day_t days[JOURNAL_STAT_DAYS];
+} journal_header_t;
+
+// Append-only log of state changes in a file preallocated at
+// JOURNAL_CAPACITY records and written as a ring. Records are held in RAM
+// and written a batch at a time to keep flash writes down.
+class JournalClass
+{
+public:
+	JournalClass();
+	bool begin(fs::FS &fs);
+	bool record(CommandSource source, ControlCommand command, uint8_t state, bool disabled, uint32_t durationMs);
+	bool flush();
+	bool hasPending() const;
+	uint32_t getNextSequence() const;
+	uint8_t read(uint32_t before, journal_record_t *records, uint8_t max);
+	const journal_day_t* getDayStats(uint32_t day) const;
+	static uint32_t getLocalDay(time_t when);
+
+private:
+	bool create();
+	bool writeRecords(File &file, const journal_record_t *records, uint8_t count);
+	bool readRecord(File &file, uint32_t sequence, journal_record_t &entry);
+	journal_day_t* touchDay(uint32_t day);
+	void addSilenced(time_t end, uint32_t durationMs);
+	static uint8_t getCheck(const journal_record_t &entry);
+
+	fs::FS *_fs;
+	journal_header_t _header;
+	journal_record_t _pending[JOURNAL_BATCH_SIZE];
+	uint8_t _pendingCount;
+	uint8_t _lastState;
+	bool _ready;
+};
+
+extern JournalClass Journal;
+
+#endif
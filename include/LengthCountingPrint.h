@@ -0,0 +1,20 @@
+#ifndef _LENGTHCOUNTINGPRINT_H
+#define _LENGTHCOUNTINGPRINT_H
+
+#include <Arduino.h>
+
+// Counts what would be written without storing it, so a streamed payload
+// can be measured (e.g. for beginPublish()) by writing it twice.
+class LengthCountingPrint : public Print
+{
+public:
+	size_t length = 0;
+
+	size_t write(uint8_t c) override {
+		(void)c;
+		length++;
+		return 1;
+	}
+};
+
+#endif
@@ -0,0 +1,127 @@
+#ifndef _OUTPUTENGINE_H
+#define _OUTPUTENGINE_H
+
+#include <Arduino.h>
+#include "LED.h"
+#include "Relay.h"
+
+#define OUTPUT_CHANNEL_NAME_SIZE 16
+
+// Called once per state change with the channel masks before and after,
+// no matter how many channels switched.
+typedef void (*OutputChangeHandler)(uint8_t previous, uint8_t current);
+
+// Fixed-capacity set of named relay channels. Channel state is kept as a
+// bit mask (bit n = channel n closed), so capacity is capped at 8.
+template <uint8_t N>
+class OutputEngine
+{
+	static_assert(N > 0 && N <= 8, "OutputEngine supports 1 to 8 channels.");
+
+public:
+	OutputEngine(OutputChangeHandler changeHandler)
+		: _count(0), _state(0), _changeHandler(changeHandler) {}
+
+	bool addChannel(const char* name, Relay *relay, HAF_LED *led = NULL) {
+		if (_count >= N || relay == NULL) {
+			return false;
+		}
+
+		Channel &channel = _channels[_count++];
+		strncpy(channel.name, name, OUTPUT_CHANNEL_NAME_SIZE - 1);
+		channel.name[OUTPUT_CHANNEL_NAME_SIZE - 1] = '\0';
+		channel.relay = relay;
+		channel.led = led;
+		return true;
+	}
+
+	// Initializes every channel open (inactive). Mapped LEDs are left
+	// alone so they can still be used as boot indicators.
+	void begin() {
+		for (uint8_t i = 0; i < _count; i++) {
+			_channels[i].relay->init();
+			_channels[i].relay->open();
+		}
+
+		_state = 0;
+	}
+
+	// Switches every channel off and forgets them, so they can be added
+	// again and begin() re-run with a new set.
+	void end() {
+		setState(0);
+		_count = 0;
+	}
+
+	uint8_t getCount() const {
+		return _count;
+	}
+
+	uint8_t getAllMask() const {
+		return (uint8_t)((1U << _count) - 1);
+	}
+
+	uint8_t getState() const {
+		return _state;
+	}
+
+	bool isActive(uint8_t index) const {
+		return (_state & (1U << index)) != 0;
+	}
+
+	const char* getName(uint8_t index) const {
+		return index < _count ? _channels[index].name : NULL;
+	}
+
+	int8_t indexOf(const char* name) const {
+		for (uint8_t i = 0; i < _count; i++) {
+			if (strcasecmp(_channels[i].name, name) == 0) {
+				return i;
+			}
+		}
+
+		return -1;
+	}
+
+	// Switches every channel to the given mask in one pass. The change
+	// handler only fires after all relays have been driven.
+	void setState(uint8_t state) {
+		state &= getAllMask();
+		uint8_t changed = state ^ _state;
+		if (changed == 0) {
+			return;
+		}
+
+		for (uint8_t i = 0; i < _count; i++) {
+			if ((changed & (1U << i)) == 0) {
+				continue;
+			}
+
+			bool active = (state & (1U << i)) != 0;
+			active ? _channels[i].relay->close() : _channels[i].relay->open();
+			if (_channels[i].led != NULL) {
+				_channels[i].led->setState(active ? LEDState::LED_On : LEDState::LED_Off);
+			}
+		}
+
+		uint8_t previous = _state;
+		_state = state;
+		if (_changeHandler != NULL) {
+			_changeHandler(previous, _state);
+		}
+	}
+
+private:
+	struct Channel {
+		char name[OUTPUT_CHANNEL_NAME_SIZE];
+		Relay *relay;
+		HAF_LED *led;
+	};
+
+	Channel _channels[N];
+	uint8_t _count;
+	uint8_t _state;
+	OutputChangeHandler _changeHandler;
+};
+
+#endif
@@ -0,0 +1,36 @@
+#ifndef _QUIETHOURS_H
+#define _QUIETHOURS_H
+
+#include <Arduino.h>
+#include <time.h>
+#include "config.h"
+
+// Quiet hours kept on the device, so they don't depend on anything
+// sending timed commands. Windows are written as "<days> <start>-<end>
+// [mask]", e.g. "mon-fri 09:30-10:00" or "sat+sun 22:00-07:00 1", and
+// go by the same local time as the clock and journal (the TZ rule in
+// config.clockTimezone), daylight saving included.
+class QuietHoursClass
+{
+public:
+	QuietHoursClass();
+	void begin(const quiet_hours_t *entries, uint8_t count);
+	uint8_t getCount() const;
+	uint8_t getActiveMask(time_t now, uint8_t allMask) const;
+	time_t getNextTransition(time_t now) const;
+	static bool parse(const char* text, quiet_hours_t &entry);
+	static size_t format(const quiet_hours_t &entry, char* buffer, size_t size);
+
+private:
+	static bool opensOn(const quiet_hours_t &entry, const struct tm &today, int8_t day);
+	static time_t getLocalTime(const struct tm &today, int8_t day, uint16_t minutes);
+	static uint16_t getWindowLength(const quiet_hours_t &entry);
+	static bool parseDays(char* text, uint8_t &days);
+
+	quiet_hours_t _entries[MAX_QUIET_HOURS];
+	uint8_t _count;
+};
+
+extern QuietHoursClass QuietHours;
+
+#endif
@@ -15,13 +15,99 @@ enum class ControlCommand: uint8_t {
 	ENABLE = 1,
 	REBOOT = 2,
 	REQUEST_STATUS = 3,
-	ACTIVATE = 4
+	ACTIVATE = 4,
+	OUTPUTS_ON = 5,
+	OUTPUTS_OFF = 6,
+	UPDATE = 7
 };
 
+// Where a control command came from.
+enum class CommandSource: uint8_t {
+	SYSTEM = 0,
+	MQTT = 1,
+	DIRECT = 2,
+	QUIET_HOURS = 3
+};
+
+enum class MetricType: uint8_t {
+	COUNTER = 0,
+	GAUGE = 1
+};
+
+// Entries sharing a Prometheus family must stay adjacent (see metricTable).
+enum class Metric: uint8_t {
+	MESSAGES_RECEIVED = 0,
+	MESSAGES_ACCEPTED,
+	MESSAGES_GROUP,
+	REJECTED_PARSE_ERROR,
+	REJECTED_NO_CLIENT_ID,
+	REJECTED_WRONG_CLIENT,
+	REJECTED_INVALID_COMMAND,
+	REJECTED_DISABLED,
+	REJECTED_QUEUE_FULL,
+	REJECTED_RATE_LIMITED,
+	PUBLISH_OK,
+	PUBLISH_FAILED,
+	DISCOVERY_PUBLISHED,
+	DISCOVERY_SKIPPED,
+	WIFI_RECONNECTS,
+	MQTT_RECONNECTS,
+	MQTT_FAILOVERS,
+	MQTT_FAILBACKS,
+	RELAY_ACTUATIONS,
+	BELL_PRESSES,
+	BELL_PRESSES_SILENCED,
+	BELL_EVENTS_DROPPED,
+	SILENCED_SECONDS,
+	LOOP_OVERRUNS,
+	LOOP_STALLS,
+	LOOP_BUSY_MS,
+	LOOP_IDLE_MS,
+	IDLE_WAKE_DELAY_MS,
+	IDLE_DELAYED_MESSAGES,
+	CONTROL_BATCHES,
+	CONTROL_QUEUE_DELAY_MS,
+	EVENTS_DISPATCHED,
+	EVENTS_DROPPED,
+	EVENT_DELAY_US,
+	DIRECT_ACCEPTED,
+	DIRECT_REJECTED_RATE_LIMITED,
+	DIRECT_REJECTED_AUTH,
+	DIRECT_REJECTED_REPLAY,
+	DIRECT_REJECTED_INVALID,
+	JOURNAL_RECORDS,
+	JOURNAL_FLUSHES,
+	JOURNAL_FLUSH_FAILED,
+	HEAP_ALLOCATIONS,
+	HEAP_ALLOCATIONS_EXEMPT,
+	HEAP_ALLOCATED_BYTES,
+	QUIET_HOURS_TRANSITIONS,
+	UPTIME_SECONDS,
+	FREE_HEAP,
+	DUTY_CYCLE,
+	CONTROL_POLL_GAP_MAX,
+	MQTT_CONNECT_MS,
+	MQTT_CONNECTION_HEAP,
+	CONFIG_APPLY_MS,
+	MQTT_ACTIVE_BROKER,
+	COUNT
+};
+
+#define METRIC_COUNT ((uint8_t)Metric::COUNT)
+
 class TelemetryHelper
 {
 public:
-	static String getMqttStateDesc(int state);
+	static const __FlashStringHelper* getMqttStateDesc(int state);
+	static void increment(Metric metric, uint32_t amount = 1);
+	static void set(Metric metric, uint32_t value);
+	static uint32_t get(Metric metric);
+	static size_t getCompactLength();
+	static void writeCompact(Print &out);
+	static void writePrometheus(Print &out);
+
+private:
+	static uint32_t _values[METRIC_COUNT];
 };
 
 #endif
@@ -0,0 +1,52 @@
+#ifndef _TOKENBUCKET_H
+#define _TOKENBUCKET_H
+
+#include <Arduino.h>
+
+// Classic token bucket rate limiter. Allows bursts of up to 'capacity'
+// requests, then one more every 'refillMs' milliseconds.
+class TokenBucket
+{
+public:
+	TokenBucket(uint8_t capacity, uint16_t refillMs)
+		: _capacity(capacity), _tokens(capacity), _refillMs(refillMs), _lastRefill(0) {}
+
+	bool tryTake(unsigned long now = millis()) {
+		refill(now);
+		if (_tokens == 0) {
+			return false;
+		}
+
+		_tokens--;
+		return true;
+	}
+
+	uint8_t getTokens(unsigned long now = millis()) {
+		refill(now);
+		return _tokens;
+	}
+
+private:
+	void refill(unsigned long now) {
+		if (_tokens >= _capacity) {
+			// Full buckets don't bank time towards the next token.
+			_lastRefill = now;
+			return;
+		}
+
+		unsigned long earned = (now - _lastRefill) / _refillMs;
+		if (earned == 0) {
+			return;
+		}
+
+		_tokens = earned >= (unsigned long)(_capacity - _tokens) ? _capacity : _tokens + earned;
+		_lastRefill += earned * _refillMs;
+	}
+
+	uint8_t _capacity;
+	uint8_t _tokens;
+	uint16_t _refillMs;
+	unsigned long _lastRefill;
+};
+
+#endif
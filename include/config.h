@@ -10,52 +10,271 @@
 #define ENABLE_OTA
 #define ENABLE_MDNS
 #define CONFIG_FILE_PATH "/config.json"
+#define CONFIG_CACHE_PATH "/config.bin"
+// Bounds config.json both on flash and parsed, with every field at its
+// longest (about 2.8K parsed).
+#define CONFIG_DOC_SIZE 3072
 #define DEFAULT_SSID "your_ssid_here"
 #define DEFAULT_PASSWORD "your_wifi_password"
-#define CLOCK_TIMEZONE -4
+// POSIX TZ rule for the clock, the journal and quiet hours. TZ.h in the
+// core has one for most zones.
+#define CLOCK_TIMEZONE "EST5EDT,M3.2.0,M11.1.0"
+#define CLOCK_TIMEZONE_SIZE 48
+#define CLOCK_NTP_SERVER "pool.ntp.org"
+#define CLOCK_VALID_AFTER 1609459200
 #define CHECK_WIFI_INTERVAL 30000
 #define CLOCK_SYNC_INTERVAL 3600000
 #define CHECK_MQTT_INTERVAL 60000 * 5
+#define METRICS_PUBLISH_INTERVAL 60000
+#define HEARTBEAT_INTERVAL 60
+#define LOOP_OVERRUN_THRESHOLD 100
+#define IDLE_SLEEP_MS 5
+#define FORENSICS_STALL_THRESHOLD 1500
+#define FORENSICS_COMMAND_HISTORY 8
+#define FORENSICS_DUMP_LIMIT 1024
+#define FORENSICS_RTC_OFFSET 32
+#define FORENSICS_REPORT_PATH "/crash.json"
 #define MQTT_TOPIC_STATUS "cylence/status"
 #define MQTT_TOPIC_CONTROL "cylence/control"
 #define MQTT_TOPIC_DISCOVERY "redqueen/config"
+#define MQTT_TOPIC_METRICS_SUFFIX "metrics"
+#define DISCOVERY_BUFFER_SIZE 320
+#define STATUS_FIELD_VALUE_SIZE 33
+#define STATUS_PAYLOAD_SIZE 256
+#define MQTT_TOPIC_AVAILABILITY_SUFFIX "availability"
+#define MQTT_TOPIC_HEARTBEAT_SUFFIX "heartbeat"
+#define MQTT_TOPIC_DIAGNOSTICS_SUFFIX "diagnostics"
+#define MQTT_TOPIC_EVENTS_SUFFIX "events"
+#define MQTT_TOPIC_THROTTLED_SUFFIX "throttled"
+#define MQTT_TOPIC_JOURNAL_SUFFIX "journal"
+#define MQTT_TOPIC_JOURNAL_REQUEST_SUFFIX "journal/get"
+#define MQTT_TOPIC_HEAP_SUFFIX "heap"
+#define MQTT_TOPIC_GROUPS_SUFFIX "groups"
+#define MQTT_TOPIC_GROUPS_REQUEST_SUFFIX "groups/set"
+#define MQTT_TOPIC_GROUP_PREFIX "cylence/group/"
+#define MQTT_TOPIC_GROUP_CONTROL_SUFFIX "/control"
+#define MQTT_PAYLOAD_ONLINE "online"
+#define MQTT_PAYLOAD_OFFLINE "offline"
+#define ENABLE_METRICS_HTTP
+#ifdef ENABLE_METRICS_HTTP
+	#define METRICS_HTTP_PORT 9100
+	#define METRICS_HTTP_TIMEOUT 2000
+#endif
+#define ENABLE_BELL_INPUT
+#ifdef ENABLE_BELL_INPUT
+	#define BELL_DEBOUNCE_MS 250
+	#define BELL_EVENT_QUEUE_SIZE 16
+#endif
+#ifdef ENABLE_SYNTHETIC_LOAD
+	#define SYNTHETIC_LOAD_INTERVAL 5000
+	#define SYNTHETIC_LOAD_MS 250
+#endif
+#define HEAP_TRACKING_SITES 8
+#define HOSTNAME_SIZE 33
+#define WIFI_SSID_SIZE 33
+#define WIFI_PASSWORD_SIZE 65
+#define MQTT_HOST_SIZE 64
+#define MQTT_CREDENTIAL_SIZE 65
+#define MQTT_TOPIC_SIZE 64
+#define DIRECT_CONTROL_KEY_SIZE 65
 #define MQTT_BROKER "your_mqtt_broker_ip"
-#define MQTT_PORT 8883
+#define MQTT_PORT 1883
+#define MAX_MQTT_BROKERS 3
+#define MQTT_CONNECT_TIMEOUT 2000
+#define NETWORK_PROFILE_LOW_POWER 0
+#define NETWORK_PROFILE_LOW_LATENCY 1
+#define LOW_POWER_KEEPALIVE 15
+#define LOW_POWER_SOCKET_TIMEOUT 15
+#define LOW_LATENCY_KEEPALIVE 5
+#define LOW_LATENCY_SOCKET_TIMEOUT 3
+#define MQTT_FAILOVER_RETRY 5000
+#define MQTT_PROBE_INTERVAL 60000
+// Well under the 2 s watchdog, since a probe blocks the loop.
+#define MQTT_PROBE_TIMEOUT 500
+#define MQTT_LATENCY_TOLERANCE 50
+#define MQTT_INBOUND_BURST 20
+#define MQTT_INBOUND_REFILL_MS 100
+// One bucket per subscribed topic: control, journal/get, groups/set and
+// every group.
+#define MQTT_TOPIC_LIMITS (MAX_GROUPS + 3)
+#define MQTT_TOPIC_BURST 10
+#define MQTT_TOPIC_REFILL_MS 200
+#define MQTT_THROTTLE_HOLD 5000
+#define MAX_GROUPS 4
+#define GROUP_NAME_SIZE 24
+#define GROUPS_DOC_SIZE (JSON_OBJECT_SIZE(2) + JSON_ARRAY_SIZE(MAX_GROUPS) + MAX_GROUPS * GROUP_NAME_SIZE + 64)
+#define ENABLE_TLS
+#ifdef ENABLE_TLS
+	#define TLS_RX_BUFFER_SIZE 1024
+	#define TLS_FULL_RX_BUFFER_SIZE 16384
+	#define TLS_TX_BUFFER_SIZE 512
+	#define TLS_FINGERPRINT_SIZE 60
+	#define TLS_CA_FILE_SIZE 32
+#endif
+#define MAX_OUTPUT_CHANNELS 4
+#define CHANNEL_NAME_SIZE 16
+#define DEFAULT_CHANNEL_NAME "bell"
+#define MAX_BATCH_COMMANDS 8
+#define CONTROL_POLL_INTERVAL 10
+#define CONTROL_QUEUE_SIZE 4
+#define EVENT_QUEUE_SIZE 8
+#define EVENT_KEY_SIZE 24
+#define CONSOLE_LINE_SIZE 256
+#define CONTROL_DOC_SIZE (JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(MAX_BATCH_COMMANDS) + 192)
+#define ENABLE_DIRECT_CONTROL
+#ifdef ENABLE_DIRECT_CONTROL
+	#define DIRECT_CONTROL_PORT 4210
+	#define DIRECT_CONTROL_WINDOW 30
+	#define DIRECT_CONTROL_BURST 5
+	#define DIRECT_CONTROL_REFILL_MS 500
+#endif
+#define MAX_QUIET_HOURS 4
+#define QUIET_HOURS_TEXT_SIZE 40
+#define QUIET_HOURS_MAX_SLEEP 3600000
+#define JOURNAL_FILE_PATH "/journal.bin"
+#define JOURNAL_CAPACITY 1024
+#define JOURNAL_BATCH_SIZE 8
+#define JOURNAL_FLUSH_INTERVAL 300000
+#define JOURNAL_PAGE_SIZE 10
+#define JOURNAL_STAT_DAYS 7
+#define JOURNAL_DOC_SIZE (JSON_OBJECT_SIZE(5) + JSON_ARRAY_SIZE(JOURNAL_PAGE_SIZE) + JOURNAL_PAGE_SIZE * JSON_OBJECT_SIZE(7) + JSON_ARRAY_SIZE(JOURNAL_STAT_DAYS) + JOURNAL_STAT_DAYS * JSON_OBJECT_SIZE(3) + 160)
 #ifdef ENABLE_OTA
 	#include <ArduinoOTA.h>
 	#define OTA_HOST_PORT 8266
 	#define OTA_PASSWORD "your_ota_password_here"
+	#define OTA_PASSWORD_SIZE 33
+	#define OTA_PROGRESS_STEP 10
+	#define OTA_PROGRESS_INTERVAL 1000
+#endif
+#define ENABLE_HTTP_UPDATE
+#ifdef ENABLE_HTTP_UPDATE
+	#define HTTP_UPDATE_JITTER 5000
+	#define HTTP_UPDATE_TIMEOUT 10000
+	#define HTTP_UPDATE_URL_SIZE 128
+	#define HTTP_UPDATE_MANIFEST_SIZE 384
+	// RSA public key pulled images must be signed with. The matching
+	// private key signs firmware.bin.gz at build time (tools/gzip_firmware.py).
+	#define HTTP_UPDATE_SIGNING_KEY \
+		"-----BEGIN PUBLIC KEY-----\n" \
+		"your_update_signing_public_key_here\n" \
+		"-----END PUBLIC KEY-----\n"
 #endif
-const IPAddress defaultIp(192, 168, 0, 238);
-const IPAddress defaultGw(192, 168, 0, 1);
-const IPAddress defaultSm(255, 255, 255, 0);
-const IPAddress defaultDns(192, 168, 0, 1);
+// Packs an address the way IPAddress stores it, so it converts both ways.
+#define CONFIG_IP(a, b, c, d) ((uint32_t)(a) | ((uint32_t)(b) << 8) | ((uint32_t)(c) << 16) | ((uint32_t)(d) << 24))
+
+// One quiet-hours window. An end at or before the start runs into the next
+// day, so an equal start and end covers the whole day.
+typedef struct {
+	uint8_t days;       // bit 0 is Sunday
+	uint8_t mask;       // channels to silence, 0 for all of them
+	uint16_t start;     // minutes past local midnight
+	uint16_t end;
+} quiet_hours_t;
+
+// Every persisted setting, in config.json order. This one list generates
+// config_t as well as the defaults, JSON and binary I/O and the console's
+// set and show commands (see ConfigSchema.h), so a setting is added here
+// and nowhere else.
+//
+// X(type, member, capacity, size, key, alias, default, min, max, flags, changes)
+//
+//   STRING          char member[size], default is a string
+//   BOOL, INT8,     scalars, min and max bound the value
+//   UINT8, UINT16
+//   IP              uint32_t member, default is a CONFIG_IP()
+//   LIST            char member[capacity][size] plus uint8_t memberCount,
+//                   default is comma separated, min and max bound the count
+//   QUIET           quiet_hours_t member[capacity] plus memberCount
+//
+// changes are the ConfigChange bits a new value needs applied.
+#define CONFIG_NETWORK_FIELDS(X) \
+	X(STRING, hostname, 1, HOSTNAME_SIZE, "hostname", "net.hostname", DEVICE_NAME, 0, 0, CONFIG_FLAG_CHIP_ID, CONFIG_CHANGE_MDNS | CONFIG_CHANGE_OTA | CONFIG_CHANGE_MQTT) \
+	X(BOOL, useDhcp, 1, 0, "useDhcp", "net.dhcp", false, 0, 1, 0, CONFIG_CHANGE_IP) \
+	X(IP, ip, 1, 0, "ip", "net.ip", CONFIG_IP(192, 168, 0, 238), 0, 0, CONFIG_FLAG_STATIC_IP, CONFIG_CHANGE_IP) \
+	X(IP, gw, 1, 0, "gateway", "net.gw", CONFIG_IP(192, 168, 0, 1), 0, 0, CONFIG_FLAG_STATIC_IP, CONFIG_CHANGE_IP) \
+	X(IP, sm, 1, 0, "subnetmask", "net.sm", CONFIG_IP(255, 255, 255, 0), 0, 0, CONFIG_FLAG_STATIC_IP, CONFIG_CHANGE_IP) \
+	X(IP, dns, 1, 0, "dnsServer", "net.dns", CONFIG_IP(192, 168, 0, 1), 0, 0, CONFIG_FLAG_STATIC_IP, CONFIG_CHANGE_IP) \
+	X(STRING, ssid, 1, WIFI_SSID_SIZE, "wifiSSID", "wifi.ssid", DEFAULT_SSID, 0, 0, 0, CONFIG_CHANGE_WIFI) \
+	X(STRING, password, 1, WIFI_PASSWORD_SIZE, "wifiPassword", "wifi.password", DEFAULT_PASSWORD, 0, 0, CONFIG_FLAG_SECRET, CONFIG_CHANGE_WIFI) \
+	X(UINT8, networkProfile, 1, 0, "networkProfile", "net.profile", NETWORK_PROFILE_LOW_POWER, NETWORK_PROFILE_LOW_POWER, NETWORK_PROFILE_LOW_LATENCY, 0, CONFIG_CHANGE_NETWORK | CONFIG_CHANGE_MQTT)
+
+#define CONFIG_CLOCK_FIELDS(X) \
+	X(STRING, clockTimezone, 1, CLOCK_TIMEZONE_SIZE, "timezone", "clock.timezone", CLOCK_TIMEZONE, 0, 0, 0, CONFIG_CHANGE_CLOCK | CONFIG_CHANGE_QUIET_HOURS)
+
+#define CONFIG_MQTT_FIELDS(X) \
+	X(STRING, mqttBroker, 1, MQTT_HOST_SIZE, "mqttBroker", "mqtt.broker", MQTT_BROKER, 0, 0, 0, CONFIG_CHANGE_MQTT) \
+	X(UINT16, mqttPort, 1, 0, "mqttPort", "mqtt.port", MQTT_PORT, 1, 65535, 0, CONFIG_CHANGE_MQTT) \
+	X(LIST, mqttBackupBrokers, MAX_MQTT_BROKERS - 1, MQTT_HOST_SIZE, "mqttBackupBrokers", "mqtt.backups", "", 0, MAX_MQTT_BROKERS - 1, 0, CONFIG_CHANGE_MQTT) \
+	X(LIST, groups, MAX_GROUPS, GROUP_NAME_SIZE, "groups", "mqtt.groups", "", 0, MAX_GROUPS, CONFIG_FLAG_TOPIC_LEVEL, CONFIG_CHANGE_GROUPS) \
+	X(STRING, mqttTopicControl, 1, MQTT_TOPIC_SIZE, "mqttControlTopic", "mqtt.control", MQTT_TOPIC_CONTROL, 0, 0, 0, CONFIG_CHANGE_MQTT_TOPICS) \
+	X(STRING, mqttTopicStatus, 1, MQTT_TOPIC_SIZE, "mqttStatusTopic", "mqtt.status", MQTT_TOPIC_STATUS, 0, 0, 0, CONFIG_CHANGE_MQTT_TOPICS) \
+	X(STRING, mqttTopicDiscovery, 1, MQTT_TOPIC_SIZE, "mqttDiscoveryTopic", "mqtt.discovery", MQTT_TOPIC_DISCOVERY, 0, 0, 0, CONFIG_CHANGE_MQTT_TOPICS) \
+	X(BOOL, mqttStatusFields, 1, 0, "mqttStatusFields", "mqtt.fields", false, 0, 1, 0, CONFIG_CHANGE_NONE) \
+	X(BOOL, mqttStatusLegacy, 1, 0, "mqttStatusLegacy", "mqtt.legacy", true, 0, 1, 0, CONFIG_CHANGE_NONE) \
+	X(UINT16, heartbeatInterval, 1, 0, "heartbeatInterval", "mqtt.heartbeat", HEARTBEAT_INTERVAL, 0, 65535, 0, CONFIG_CHANGE_HEARTBEAT) \
+	X(STRING, mqttUsername, 1, MQTT_CREDENTIAL_SIZE, "mqttUsername", "mqtt.username", "", 0, 0, 0, CONFIG_CHANGE_MQTT) \
+	X(STRING, mqttPassword, 1, MQTT_CREDENTIAL_SIZE, "mqttPassword", "mqtt.password", "", 0, 0, CONFIG_FLAG_SECRET, CONFIG_CHANGE_MQTT)
+
+#ifdef ENABLE_TLS
+	#define CONFIG_TLS_FIELDS(X) \
+		X(BOOL, mqttUseTls, 1, 0, "mqttUseTls", "mqtt.tls", false, 0, 1, 0, CONFIG_CHANGE_MQTT) \
+		X(STRING, mqttFingerprint, 1, TLS_FINGERPRINT_SIZE, "mqttFingerprint", "mqtt.fingerprint", "", 0, 0, 0, CONFIG_CHANGE_MQTT) \
+		X(LIST, mqttBackupFingerprints, MAX_MQTT_BROKERS - 1, TLS_FINGERPRINT_SIZE, "mqttBackupFingerprints", "mqtt.backupFingerprints", "", 0, MAX_MQTT_BROKERS - 1, 0, CONFIG_CHANGE_MQTT) \
+		X(STRING, mqttCaFile, 1, TLS_CA_FILE_SIZE, "mqttCaFile", "mqtt.ca", "", 0, 0, 0, CONFIG_CHANGE_MQTT)
+#else
+	#define CONFIG_TLS_FIELDS(X)
+#endif
+
+#define CONFIG_POWER_FIELDS(X) \
+	X(UINT8, idleSleepMs, 1, 0, "idleSleepMs", "power.idle", IDLE_SLEEP_MS, 0, 255, 0, CONFIG_CHANGE_POWER) \
+	X(BOOL, idleLightSleep, 1, 0, "idleLightSleep", "power.light", false, 0, 1, 0, CONFIG_CHANGE_NETWORK)
+
+#define CONFIG_OUTPUT_FIELDS(X) \
+	X(LIST, channelNames, MAX_OUTPUT_CHANNELS, CHANNEL_NAME_SIZE, "outputChannels", "outputs.channels", DEFAULT_CHANNEL_NAME, 1, MAX_OUTPUT_CHANNELS, 0, CONFIG_CHANGE_OUTPUTS | CONFIG_CHANGE_QUIET_HOURS) \
+	X(QUIET, quietHours, MAX_QUIET_HOURS, QUIET_HOURS_TEXT_SIZE, "quietHours", "outputs.quiet", "", 0, MAX_QUIET_HOURS, 0, CONFIG_CHANGE_QUIET_HOURS)
+
+#define CONFIG_CONTROL_FIELDS(X) \
+	X(STRING, directControlKey, 1, DIRECT_CONTROL_KEY_SIZE, "directControlKey", "control.key", "", 0, 0, CONFIG_FLAG_SECRET | CONFIG_FLAG_PRESENCE, CONFIG_CHANGE_DIRECT | CONFIG_CHANGE_MDNS)
+
+#ifdef ENABLE_OTA
+	#define CONFIG_OTA_FIELDS(X) \
+		X(UINT16, otaPort, 1, 0, "otaPort", "ota.port", OTA_HOST_PORT, 1, 65535, 0, CONFIG_CHANGE_OTA) \
+		X(STRING, otaPassword, 1, OTA_PASSWORD_SIZE, "otaPassword", "ota.password", OTA_PASSWORD, 0, 0, CONFIG_FLAG_SECRET, CONFIG_CHANGE_OTA)
+#else
+	#define CONFIG_OTA_FIELDS(X)
+#endif
+
+#ifdef ENABLE_HTTP_UPDATE
+	#define CONFIG_UPDATE_FIELDS(X) \
+		X(STRING, updateManifestUrl, 1, HTTP_UPDATE_URL_SIZE, "updateManifestUrl", "ota.manifest", "", 0, 0, 0, CONFIG_CHANGE_NONE)
+#else
+	#define CONFIG_UPDATE_FIELDS(X)
+#endif
+
+#define CONFIG_FIELDS(X) \
+	CONFIG_NETWORK_FIELDS(X) \
+	CONFIG_CLOCK_FIELDS(X) \
+	CONFIG_MQTT_FIELDS(X) \
+	CONFIG_TLS_FIELDS(X) \
+	CONFIG_POWER_FIELDS(X) \
+	CONFIG_OUTPUT_FIELDS(X) \
+	CONFIG_CONTROL_FIELDS(X) \
+	CONFIG_OTA_FIELDS(X) \
+	CONFIG_UPDATE_FIELDS(X)
+
+#define CONFIG_MEMBER_STRING(member, capacity, size) char member[size];
+#define CONFIG_MEMBER_BOOL(member, capacity, size) bool member;
+#define CONFIG_MEMBER_INT8(member, capacity, size) int8_t member;
+#define CONFIG_MEMBER_UINT8(member, capacity, size) uint8_t member;
+#define CONFIG_MEMBER_UINT16(member, capacity, size) uint16_t member;
+#define CONFIG_MEMBER_IP(member, capacity, size) uint32_t member;
+#define CONFIG_MEMBER_LIST(member, capacity, size) char member[capacity][size]; uint8_t member##Count;
+#define CONFIG_MEMBER_QUIET(member, capacity, size) quiet_hours_t member[capacity]; uint8_t member##Count;
+#define CONFIG_MEMBER(type, member, capacity, size, ...) CONFIG_MEMBER_##type(member, capacity, size)
 
+// Plain data, so it can be copied, compared and cached byte for byte.
 typedef struct {
-	// Network stuff
-	String hostname;
-	String ssid;
-	String password;
-	IPAddress ip;
-	IPAddress gw;
-	IPAddress sm;
-	IPAddress dns;
-	bool useDhcp;
-
-	uint8_t clockTimezone;
-
-	// MQTT stuff
-	String mqttTopicStatus;
-	String mqttTopicControl;
-	String mqttTopicDiscovery;
-	String mqttBroker;
-	String mqttUsername;
-	String mqttPassword;
-	uint16_t mqttPort;
-
-	// OTA stuff
-	uint16_t otaPort;
-	String otaPassword;
+	CONFIG_FIELDS(CONFIG_MEMBER)
 } config_t;
 
 #endif
@@ -0,0 +1,757 @@
+#include "ConfigSchema.h"
+#include <stddef.h>
+#include "QuietHours.h"
+
+#define CONFIG_CACHE_MAGIC 0x46435943UL     // "CYCF"
+#define CONFIG_SECRET_MASK "********"
+
+#define CONFIG_TYPE_STRING ConfigType::STRING
+#define CONFIG_TYPE_BOOL ConfigType::BOOLEAN
+#define CONFIG_TYPE_INT8 ConfigType::INT8
+#define CONFIG_TYPE_UINT8 ConfigType::UINT8
+#define CONFIG_TYPE_UINT16 ConfigType::UINT16
+#define CONFIG_TYPE_IP ConfigType::ADDRESS
+#define CONFIG_TYPE_LIST ConfigType::LIST
+#define CONFIG_TYPE_QUIET ConfigType::QUIET_HOURS
+
+// Keys, aliases and text defaults live in flash, one string each.
+#define CONFIG_TEXT_STRING(member, value) static const char DEFAULT_##member[] PROGMEM = value;
+#define CONFIG_TEXT_LIST CONFIG_TEXT_STRING
+#define CONFIG_TEXT_QUIET CONFIG_TEXT_STRING
+#define CONFIG_TEXT_BOOL(member, value)
+#define CONFIG_TEXT_INT8(member, value)
+#define CONFIG_TEXT_UINT8(member, value)
+#define CONFIG_TEXT_UINT16(member, value)
+#define CONFIG_TEXT_IP(member, value)
+
+#define CONFIG_STRINGS(type, member, capacity, size, key, alias, value, ...) \
+	static const char KEY_##member[] PROGMEM = key; \
+	static const char ALIAS_##member[] PROGMEM = alias; \
+	CONFIG_TEXT_##type(member, value)
+
+CONFIG_FIELDS(CONFIG_STRINGS)
+
+#define CONFIG_DEFAULT_TEXT_STRING(member) DEFAULT_##member
+#define CONFIG_DEFAULT_TEXT_LIST CONFIG_DEFAULT_TEXT_STRING
+#define CONFIG_DEFAULT_TEXT_QUIET CONFIG_DEFAULT_TEXT_STRING
+#define CONFIG_DEFAULT_TEXT_BOOL(member) NULL
+#define CONFIG_DEFAULT_TEXT_INT8(member) NULL
+#define CONFIG_DEFAULT_TEXT_UINT8(member) NULL
+#define CONFIG_DEFAULT_TEXT_UINT16(member) NULL
+#define CONFIG_DEFAULT_TEXT_IP(member) NULL
+
+#define CONFIG_DEFAULT_VALUE_STRING(value) 0
+#define CONFIG_DEFAULT_VALUE_LIST(value) 0
+#define CONFIG_DEFAULT_VALUE_QUIET(value) 0
+#define CONFIG_DEFAULT_VALUE_BOOL(value) (uint32_t)(value)
+#define CONFIG_DEFAULT_VALUE_INT8(value) (uint32_t)(value)
+#define CONFIG_DEFAULT_VALUE_UINT8(value) (uint32_t)(value)
+#define CONFIG_DEFAULT_VALUE_UINT16(value) (uint32_t)(value)
+#define CONFIG_DEFAULT_VALUE_IP(value) (uint32_t)(value)
+
+#define CONFIG_COUNT_OFFSET_LIST(member) offsetof(config_t, member##Count)
+#define CONFIG_COUNT_OFFSET_QUIET CONFIG_COUNT_OFFSET_LIST
+#define CONFIG_COUNT_OFFSET_STRING(member) 0
+#define CONFIG_COUNT_OFFSET_BOOL(member) 0
+#define CONFIG_COUNT_OFFSET_INT8(member) 0
+#define CONFIG_COUNT_OFFSET_UINT8(member) 0
+#define CONFIG_COUNT_OFFSET_UINT16(member) 0
+#define CONFIG_COUNT_OFFSET_IP(member) 0
+
+#define CONFIG_DESCRIPTOR(type, member, capacity, size, key, alias, value, min, max, flags, changes) \
+	{ \
+		KEY_##member, ALIAS_##member, CONFIG_DEFAULT_TEXT_##type(member), CONFIG_DEFAULT_VALUE_##type(value), \
+		min, max, offsetof(config_t, member), CONFIG_COUNT_OFFSET_##type(member), \
+		sizeof(config_t::member) / (capacity), capacity, CONFIG_TYPE_##type, flags, changes \
+	},
+
+static const config_field_t configTable[] PROGMEM = {
+	CONFIG_FIELDS(CONFIG_DESCRIPTOR)
+};
+
+static const uint8_t* getValue(const config_field_t &field, const config_t &cfg) {
+	return (const uint8_t*)&cfg + field.offset;
+}
+
+static uint8_t* getValue(const config_field_t &field, config_t &cfg) {
+	return (uint8_t*)&cfg + field.offset;
+}
+
+static uint8_t& getItemCount(const config_field_t &field, config_t &cfg) {
+	return *((uint8_t*)&cfg + field.countOffset);
+}
+
+static uint8_t getItemCount(const config_field_t &field, const config_t &cfg) {
+	return *((const uint8_t*)&cfg + field.countOffset);
+}
+
+static bool isList(const config_field_t &field) {
+	return field.type == ConfigType::LIST || field.type == ConfigType::QUIET_HOURS;
+}
+
+static int32_t getNumber(const config_field_t &field, const uint8_t *value) {
+	switch (field.type) {
+		case ConfigType::BOOLEAN:
+			return *(const bool*)value ? 1 : 0;
+		case ConfigType::INT8:
+			return *(const int8_t*)value;
+		case ConfigType::UINT8:
+			return *value;
+		case ConfigType::UINT16:
+			return *(const uint16_t*)value;
+		default:
+			return 0;
+	}
+}
+
+static void setNumber(const config_field_t &field, uint8_t *value, int32_t number) {
+	switch (field.type) {
+		case ConfigType::BOOLEAN:
+			*(bool*)value = number != 0;
+			break;
+		case ConfigType::INT8:
+			*(int8_t*)value = number;
+			break;
+		case ConfigType::UINT8:
+			*value = number;
+			break;
+		case ConfigType::UINT16:
+			*(uint16_t*)value = number;
+			break;
+		default:
+			break;
+	}
+}
+
+static void formatAddress(uint32_t address, char* buffer, size_t size) {
+	snprintf(buffer, size, "%u.%u.%u.%u", (unsigned)(address & 0xff), (unsigned)((address >> 8) & 0xff),
+		(unsigned)((address >> 16) & 0xff), (unsigned)(address >> 24));
+}
+
+static uint32_t hashBytes(uint32_t hash, const uint8_t *data, size_t length) {
+	// 32-bit FNV-1a.
+	for (size_t i = 0; i < length; i++) {
+		hash ^= data[i];
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+ConfigSchemaClass::ConfigSchemaClass() {}
+
+uint8_t ConfigSchemaClass::getCount() const {
+	return CONFIG_FIELD_COUNT;
+}
+
+void ConfigSchemaClass::getField(uint8_t index, config_field_t &field) const {
+	memcpy_P(&field, &configTable[index], sizeof(field));
+}
+
+// Keys match exactly, aliases in any case. -1 if neither matches.
+int8_t ConfigSchemaClass::find(const char* name, bool aliases) const {
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		if (strcmp_P(name, field.key) == 0) {
+			return i;
+		}
+
+		if (aliases && pgm_read_byte(field.alias) != '\0' && strcasecmp_P(name, field.alias) == 0) {
+			return i;
+		}
+	}
+
+	return -1;
+}
+
+void ConfigSchemaClass::setDefault(const config_field_t &field, config_t &cfg) const {
+	uint8_t *value = getValue(field, cfg);
+	switch (field.type) {
+		case ConfigType::STRING:
+			strncpy_P((char*)value, field.defaultText, field.size - 1);
+			value[field.size - 1] = '\0';
+			if (field.flags & CONFIG_FLAG_CHIP_ID) {
+				size_t length = strlen((char*)value);
+				snprintf((char*)value + length, field.size - length, "_%x", (unsigned)ESP.getChipId());
+			}
+			break;
+		case ConfigType::LIST:
+		case ConfigType::QUIET_HOURS: {
+			char text[MQTT_HOST_SIZE];
+			strncpy_P(text, field.defaultText, sizeof(text) - 1);
+			text[sizeof(text) - 1] = '\0';
+			getItemCount(field, cfg) = 0;
+			parseList(field, text, cfg);
+			break;
+		}
+		case ConfigType::ADDRESS:
+			*(uint32_t*)value = field.defaultValue;
+			break;
+		default:
+			setNumber(field, value, (int32_t)field.defaultValue);
+			break;
+	}
+}
+
+void ConfigSchemaClass::setDefaults(config_t &cfg) const {
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		setDefault(field, cfg);
+	}
+}
+
+// Checks one value in text form and, if dest isn't NULL, stores it there.
+// Returns why it was rejected, or NULL.
+const __FlashStringHelper* ConfigSchemaClass::parseItem(const config_field_t &field, const char* text, uint8_t *dest) const {
+	switch (field.type) {
+		case ConfigType::STRING:
+		case ConfigType::LIST: {
+			size_t length = strlen(text);
+			if (length >= field.size) {
+				return F("Too long.");
+			}
+
+			if ((field.flags & CONFIG_FLAG_TOPIC_LEVEL) && (length == 0 || strpbrk(text, "/+#") != NULL)) {
+				return F("Expected a single MQTT topic level.");
+			}
+
+			if (dest != NULL) {
+				memcpy(dest, text, length + 1);
+			}
+			return NULL;
+		}
+		case ConfigType::QUIET_HOURS: {
+			quiet_hours_t entry;
+			if (!QuietHours.parse(text, entry)) {
+				return F("Expected quiet hours, e.g. mon-fri 22:00-07:00.");
+			}
+
+			if (dest != NULL) {
+				memcpy(dest, &entry, sizeof(entry));
+			}
+			return NULL;
+		}
+		case ConfigType::ADDRESS: {
+			IPAddress address;
+			if (!address.fromString(text)) {
+				return F("Expected an IP address.");
+			}
+
+			if (dest != NULL) {
+				*(uint32_t*)dest = (uint32_t)address;
+			}
+			return NULL;
+		}
+		case ConfigType::BOOLEAN:
+			if (strcasecmp(text, "true") != 0 && strcasecmp(text, "false") != 0) {
+				return F("Expected true or false.");
+			}
+
+			if (dest != NULL) {
+				setNumber(field, dest, strcasecmp(text, "true") == 0);
+			}
+			return NULL;
+		default: {
+			char* end = NULL;
+			long number = strtol(text, &end, 10);
+			if (*text == '\0' || *end != '\0') {
+				return F("Expected a number.");
+			}
+
+			if (number < field.min || number > field.max) {
+				return F("Out of range.");
+			}
+
+			if (dest != NULL) {
+				setNumber(field, dest, number);
+			}
+			return NULL;
+		}
+	}
+}
+
+// Comma separated. Nothing is stored unless every item is valid, and an
+// empty list clears the field.
+const __FlashStringHelper* ConfigSchemaClass::parseList(const config_field_t &field, const char* text, config_t &cfg) const {
+	for (uint8_t pass = 0; pass < 2; pass++) {
+		uint8_t count = 0;
+		const char* start = text;
+		while (*start != '\0') {
+			const char* comma = strchr(start, ',');
+			const char* end = comma != NULL ? comma : start + strlen(start);
+			while (start < end && isspace(*start)) {
+				start++;
+			}
+
+			size_t length = end - start;
+			while (length > 0 && isspace(start[length - 1])) {
+				length--;
+			}
+
+			if (length > 0) {
+				char item[MQTT_HOST_SIZE];
+				if (length >= sizeof(item)) {
+					return F("Too long.");
+				}
+
+				if (count >= field.capacity) {
+					return F("Too many items.");
+				}
+
+				memcpy(item, start, length);
+				item[length] = '\0';
+				const __FlashStringHelper *error = parseItem(field, item,
+					pass == 0 ? NULL : getValue(field, cfg) + count * field.size);
+				if (error != NULL) {
+					return error;
+				}
+
+				count++;
+			}
+
+			start = comma != NULL ? comma + 1 : end;
+		}
+
+		if (count < field.min) {
+			return F("Too few items.");
+		}
+
+		if (pass == 1) {
+			getItemCount(field, cfg) = count;
+		}
+	}
+
+	return NULL;
+}
+
+const __FlashStringHelper* ConfigSchemaClass::readField(const config_field_t &field, JsonVariantConst value, config_t &cfg) const {
+	switch (field.type) {
+		case ConfigType::STRING:
+		case ConfigType::ADDRESS:
+			if (!value.is<const char*>()) {
+				return F("Expected a string.");
+			}
+
+			return parseItem(field, value.as<const char*>(), getValue(field, cfg));
+		case ConfigType::BOOLEAN:
+			if (!value.is<bool>()) {
+				return F("Expected true or false.");
+			}
+
+			setNumber(field, getValue(field, cfg), value.as<bool>());
+			return NULL;
+		case ConfigType::LIST:
+		case ConfigType::QUIET_HOURS: {
+			if (!value.is<JsonArrayConst>()) {
+				return F("Expected a list.");
+			}
+
+			// Bad items are dropped rather than losing the whole list.
+			uint8_t count = 0;
+			for (JsonVariantConst item : value.as<JsonArrayConst>()) {
+				if (count >= field.capacity) {
+					Serial.print(F("WARN: Too many items in "));
+					Serial.print(FPSTR(field.key));
+					Serial.println(F(". Ignoring the rest."));
+					break;
+				}
+
+				const __FlashStringHelper *error = item.is<const char*>()
+					? parseItem(field, item.as<const char*>(), getValue(field, cfg) + count * field.size)
+					: F("Expected a string.");
+				if (error != NULL) {
+					Serial.print(F("WARN: Ignoring "));
+					serializeJson(item, Serial);
+					Serial.print(F(" in "));
+					Serial.print(FPSTR(field.key));
+					Serial.print(F(": "));
+					Serial.println(error);
+					continue;
+				}
+
+				count++;
+			}
+
+			getItemCount(field, cfg) = count;
+			return count < field.min ? F("Too few items.") : NULL;
+		}
+		default:
+			if (!value.is<long>()) {
+				return F("Expected a number.");
+			}
+
+			if (value.as<long>() < field.min || value.as<long>() > field.max) {
+				return F("Out of range.");
+			}
+
+			setNumber(field, getValue(field, cfg), value.as<long>());
+			return NULL;
+	}
+}
+
+// One pass over the table. Fields that are missing (if fillMissing) or
+// invalid get their defaults. Keys not in the table are ignored.
+void ConfigSchemaClass::read(JsonObjectConst source, config_t &cfg, bool fillMissing) const {
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		JsonVariantConst value = source[FPSTR(field.key)];
+		if (value.isNull()) {
+			if (fillMissing) {
+				setDefault(field, cfg);
+			}
+			continue;
+		}
+
+		const __FlashStringHelper *error = readField(field, value, cfg);
+		if (error != NULL) {
+			Serial.print(F("WARN: Invalid "));
+			Serial.print(FPSTR(field.key));
+			Serial.print(F(" in configuration ("));
+			Serial.print(error);
+			Serial.println(F(") Falling back to factory default."));
+			setDefault(field, cfg);
+		}
+	}
+}
+
+void ConfigSchemaClass::write(const config_t &cfg, JsonDocument &doc, bool maskSecrets) const {
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		const __FlashStringHelper *key = FPSTR(field.key);
+		const uint8_t *value = getValue(field, cfg);
+		switch (field.type) {
+			case ConfigType::STRING:
+				// const char* values are stored by reference, not copied.
+				if (maskSecrets && (field.flags & CONFIG_FLAG_SECRET) && value[0] != '\0') {
+					doc[key] = CONFIG_SECRET_MASK;
+				}
+				else {
+					doc[key] = (const char*)value;
+				}
+				break;
+			case ConfigType::BOOLEAN:
+				doc[key] = *(const bool*)value;
+				break;
+			case ConfigType::ADDRESS: {
+				char text[16];
+				formatAddress(*(const uint32_t*)value, text, sizeof(text));
+				doc[key] = (char*)text;
+				break;
+			}
+			case ConfigType::LIST: {
+				JsonArray list = doc.createNestedArray(key);
+				for (uint8_t item = 0; item < getItemCount(field, cfg); item++) {
+					list.add((const char*)(value + item * field.size));
+				}
+				break;
+			}
+			case ConfigType::QUIET_HOURS: {
+				JsonArray list = doc.createNestedArray(key);
+				for (uint8_t item = 0; item < getItemCount(field, cfg); item++) {
+					char text[QUIET_HOURS_TEXT_SIZE];
+					QuietHours.format(*(const quiet_hours_t*)(value + item * field.size), text, sizeof(text));
+					list.add((char*)text);
+				}
+				break;
+			}
+			default:
+				doc[key] = getNumber(field, value);
+				break;
+		}
+	}
+}
+
+// Console form: lists are comma separated, booleans true or false.
+bool ConfigSchemaClass::set(config_t &cfg, uint8_t index, const char* text) const {
+	config_field_t field;
+	getField(index, field);
+	const __FlashStringHelper *error = isList(field)
+		? parseList(field, text, cfg)
+		: parseItem(field, text, getValue(field, cfg));
+	if (error != NULL) {
+		Serial.print(F("ERROR: "));
+		Serial.println(error);
+		return false;
+	}
+
+	return true;
+}
+
+void ConfigSchemaClass::printValue(const config_field_t &field, const config_t &cfg, Print &out) const {
+	const uint8_t *value = getValue(field, cfg);
+	switch (field.type) {
+		case ConfigType::STRING:
+			out.print((field.flags & CONFIG_FLAG_SECRET) && value[0] != '\0' ? CONFIG_SECRET_MASK : (const char*)value);
+			break;
+		case ConfigType::BOOLEAN:
+			out.print(*(const bool*)value ? F("true") : F("false"));
+			break;
+		case ConfigType::ADDRESS: {
+			char text[16];
+			formatAddress(*(const uint32_t*)value, text, sizeof(text));
+			out.print(text);
+			break;
+		}
+		case ConfigType::LIST:
+		case ConfigType::QUIET_HOURS:
+			for (uint8_t item = 0; item < getItemCount(field, cfg); item++) {
+				if (item > 0) {
+					out.print(',');
+				}
+
+				if (field.type == ConfigType::LIST) {
+					out.print((const char*)(value + item * field.size));
+				}
+				else {
+					char text[QUIET_HOURS_TEXT_SIZE];
+					QuietHours.format(*(const quiet_hours_t*)(value + item * field.size), text, sizeof(text));
+					out.print(text);
+				}
+			}
+			break;
+		default:
+			out.print(getNumber(field, value));
+			break;
+	}
+}
+
+// e.g. "mqttPort (mqtt.port) uint16 1..65535 = 1883"
+void ConfigSchemaClass::describe(const config_t &cfg, uint8_t index, Print &out) const {
+	config_field_t field;
+	getField(index, field);
+	out.print(FPSTR(field.key));
+	if (pgm_read_byte(field.alias) != '\0') {
+		out.print(F(" ("));
+		out.print(FPSTR(field.alias));
+		out.print(')');
+	}
+
+	switch (field.type) {
+		case ConfigType::STRING:
+			out.printf_P(PSTR(" string[%u]"), field.size - 1);
+			break;
+		case ConfigType::BOOLEAN:
+			out.print(F(" bool"));
+			break;
+		case ConfigType::ADDRESS:
+			out.print(F(" ip"));
+			break;
+		case ConfigType::LIST:
+			out.printf_P(PSTR(" list[%ld..%ld] of string[%u]"), (long)field.min, (long)field.max, field.size - 1);
+			break;
+		case ConfigType::QUIET_HOURS:
+			out.printf_P(PSTR(" list[%ld..%ld] of quiet hours"), (long)field.min, (long)field.max);
+			break;
+		default:
+			out.printf_P(PSTR(" %s %ld..%ld"), field.type == ConfigType::INT8 ? "int8"
+				: field.type == ConfigType::UINT8 ? "uint8" : "uint16", (long)field.min, (long)field.max);
+			break;
+	}
+
+	out.print(F(" = "));
+	printValue(field, cfg, out);
+	out.println();
+}
+
+bool ConfigSchemaClass::isEqual(const config_field_t &field, const config_t &a, const config_t &b) const {
+	const uint8_t *left = getValue(field, a);
+	const uint8_t *right = getValue(field, b);
+	switch (field.type) {
+		case ConfigType::STRING:
+			return strcmp((const char*)left, (const char*)right) == 0;
+		case ConfigType::LIST:
+			if (getItemCount(field, a) != getItemCount(field, b)) {
+				return false;
+			}
+
+			for (uint8_t item = 0; item < getItemCount(field, a); item++) {
+				if (strcmp((const char*)(left + item * field.size), (const char*)(right + item * field.size)) != 0) {
+					return false;
+				}
+			}
+			return true;
+		case ConfigType::QUIET_HOURS:
+			return getItemCount(field, a) == getItemCount(field, b)
+				&& memcmp(left, right, getItemCount(field, a) * field.size) == 0;
+		default:
+			return memcmp(left, right, field.size) == 0;
+	}
+}
+
+// The ConfigChange bits of every field that differs.
+uint16_t ConfigSchemaClass::diff(const config_t &running, const config_t &pending) const {
+	uint16_t changes = CONFIG_CHANGE_NONE;
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		if (field.changes == CONFIG_CHANGE_NONE || (changes & field.changes) == field.changes) {
+			continue;
+		}
+
+		if ((field.flags & CONFIG_FLAG_STATIC_IP) && pending.useDhcp) {
+			continue;
+		}
+
+		bool changed;
+		if (field.flags & CONFIG_FLAG_PRESENCE) {
+			changed = (getValue(field, running)[0] != '\0') != (getValue(field, pending)[0] != '\0');
+		}
+		else {
+			changed = !isEqual(field, running, pending);
+		}
+
+		if (changed) {
+			changes |= field.changes;
+		}
+	}
+
+	return changes;
+}
+
+size_t ConfigSchemaClass::getBodyLength() const {
+	size_t length = 0;
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		length += field.size * field.capacity + (isList(field) ? 1 : 0);
+	}
+
+	return length;
+}
+
+uint32_t ConfigSchemaClass::getSchemaHash() const {
+	uint32_t hash = 2166136261UL;
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		char key[32];
+		strncpy_P(key, field.key, sizeof(key) - 1);
+		key[sizeof(key) - 1] = '\0';
+		uint8_t layout[4] = { (uint8_t)field.type, (uint8_t)field.size, (uint8_t)(field.size >> 8), field.capacity };
+		hash = hashBytes(hash, (const uint8_t*)key, strlen(key) + 1);
+		hash = hashBytes(hash, layout, sizeof(layout));
+	}
+
+	return hash;
+}
+
+uint32_t ConfigSchemaClass::getBodyHash(const config_t &cfg) const {
+	uint32_t hash = 2166136261UL;
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		hash = hashBytes(hash, getValue(field, cfg), field.size * field.capacity);
+		if (isList(field)) {
+			uint8_t count = getItemCount(field, cfg);
+			hash = hashBytes(hash, &count, 1);
+		}
+	}
+
+	return hash;
+}
+
+bool ConfigSchemaClass::writeBinary(const config_t &cfg, File &file) const {
+	config_cache_header_t header;
+	header.magic = CONFIG_CACHE_MAGIC;
+	header.schema = getSchemaHash();
+	header.check = getBodyHash(cfg);
+	header.length = getBodyLength();
+	header.reserved = 0;
+	size_t written = file.write((const uint8_t*)&header, sizeof(header));
+
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		written += file.write(getValue(field, cfg), field.size * field.capacity);
+		if (isList(field)) {
+			uint8_t count = getItemCount(field, cfg);
+			written += file.write(&count, 1);
+		}
+	}
+
+	return written == sizeof(header) + header.length;
+}
+
+bool ConfigSchemaClass::isValid(const config_field_t &field, const config_t &cfg) const {
+	const uint8_t *value = getValue(field, cfg);
+	uint8_t count = isList(field) ? getItemCount(field, cfg) : 1;
+	if (count > field.capacity || (isList(field) && count < field.min)) {
+		return false;
+	}
+
+	for (uint8_t item = 0; item < count; item++) {
+		const uint8_t *entry = value + item * field.size;
+		switch (field.type) {
+			case ConfigType::STRING:
+			case ConfigType::LIST:
+				if (memchr(entry, '\0', field.size) == NULL) {
+					return false;
+				}
+				break;
+			case ConfigType::QUIET_HOURS: {
+				const quiet_hours_t *window = (const quiet_hours_t*)entry;
+				if (window->days == 0 || window->days > 0x7f || window->start >= 1440 || window->end > 1440) {
+					return false;
+				}
+				break;
+			}
+			case ConfigType::ADDRESS:
+				break;
+			case ConfigType::BOOLEAN:
+				if (*entry > 1) {
+					return false;
+				}
+				break;
+			default:
+				if (getNumber(field, entry) < field.min || getNumber(field, entry) > field.max) {
+					return false;
+				}
+				break;
+		}
+	}
+
+	return true;
+}
+
+// Fails on anything short of an intact cache written by this exact
+// schema, leaving cfg partly overwritten.
+bool ConfigSchemaClass::readBinary(File &file, config_t &cfg) const {
+	config_cache_header_t header;
+	if (file.read((uint8_t*)&header, sizeof(header)) != sizeof(header)
+		|| header.magic != CONFIG_CACHE_MAGIC || header.schema != getSchemaHash()
+		|| header.length != getBodyLength() || file.size() != sizeof(header) + header.length) {
+		return false;
+	}
+
+	config_field_t field;
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		size_t length = field.size * field.capacity;
+		if (file.read(getValue(field, cfg), length) != length) {
+			return false;
+		}
+
+		if (isList(field) && file.read(&getItemCount(field, cfg), 1) != 1) {
+			return false;
+		}
+	}
+
+	if (getBodyHash(cfg) != header.check) {
+		return false;
+	}
+
+	for (uint8_t i = 0; i < CONFIG_FIELD_COUNT; i++) {
+		getField(i, field);
+		if (!isValid(field, cfg)) {
+			return false;
+		}
+	}
+
+	return true;
+}
+
+ConfigSchemaClass ConfigSchema;
@@ -1,226 +1,205 @@
 #include "Console.h"
-#include "ESPCrashMonitor.h"
 
-ConsoleClass::ConsoleClass() {}
-
-void ConsoleClass::onRebootCommand(void (*rebootHandler)()) {
-	this->rebootHandler = rebootHandler;
-}
-
-void ConsoleClass::onScanNetworks(void (*scanHandler)()) {
-	this->scanHandler = scanHandler;
-}
-
-void ConsoleClass::setHostname(String hostname) {
-	_hostname = hostname;
-}
-
-void ConsoleClass::onHostnameChange(void (*hostnameChangeHandler)(const char* newHostname)) {
-	this->hostnameChangeHandler = hostnameChangeHandler;
-}
-
-void ConsoleClass::onDhcpConfig(void (*dhcpHandler)()) {
-	this->dhcpHandler = dhcpHandler;
+static const char KEY_HOSTNAME[] PROGMEM = "hostname";
+static const char KEY_USE_DHCP[] PROGMEM = "useDhcp";
+static const char KEY_IP[] PROGMEM = "ip";
+static const char KEY_GATEWAY[] PROGMEM = "gateway";
+static const char KEY_SUBNET_MASK[] PROGMEM = "subnetmask";
+static const char KEY_DNS[] PROGMEM = "dnsServer";
+static const char KEY_SSID[] PROGMEM = "wifiSSID";
+static const char KEY_WIFI_PASSWORD[] PROGMEM = "wifiPassword";
+static const char KEY_BROKER[] PROGMEM = "mqttBroker";
+static const char KEY_PORT[] PROGMEM = "mqttPort";
+static const char KEY_CONTROL_TOPIC[] PROGMEM = "mqttControlTopic";
+static const char KEY_STATUS_TOPIC[] PROGMEM = "mqttStatusTopic";
+static const char KEY_USERNAME[] PROGMEM = "mqttUsername";
+static const char KEY_MQTT_PASSWORD[] PROGMEM = "mqttPassword";
+static const char VALUE_TRUE[] PROGMEM = "true";
+static const char VALUE_FALSE[] PROGMEM = "false";
+
+// The guided menu options, as settings in the config schema. Each flow
+// applies its changes once the last step is set.
+static const console_step_t hostnameSteps[] PROGMEM = {
+	{ KEY_HOSTNAME, NULL, 0 }
+};
+
+static const console_step_t dhcpSteps[] PROGMEM = {
+	{ KEY_USE_DHCP, VALUE_TRUE, 0 }
+};
+
+static const console_step_t staticSteps[] PROGMEM = {
+	{ KEY_IP, NULL, 0 },
+	{ KEY_GATEWAY, NULL, 0 },
+	{ KEY_SUBNET_MASK, NULL, 0 },
+	{ KEY_DNS, NULL, 0 },
+	{ KEY_USE_DHCP, VALUE_FALSE, 0 }
+};
+
+static const console_step_t wifiSteps[] PROGMEM = {
+	{ KEY_SSID, NULL, 0 },
+	{ KEY_WIFI_PASSWORD, NULL, CONSOLE_STEP_SECRET }
+};
+
+static const console_step_t mqttSteps[] PROGMEM = {
+	{ KEY_BROKER, NULL, 0 },
+	{ KEY_PORT, NULL, 0 },
+	{ KEY_CONTROL_TOPIC, NULL, 0 },
+	{ KEY_STATUS_TOPIC, NULL, 0 },
+	{ KEY_USERNAME, NULL, CONSOLE_STEP_CLEARABLE },
+	{ KEY_MQTT_PASSWORD, NULL, CONSOLE_STEP_SECRET | CONSOLE_STEP_CLEARABLE }
+};
+
+#define STEP_COUNT(steps) (sizeof(steps) / sizeof(steps[0]))
+
+ConsoleClass::ConsoleClass() {
+	_mode = Mode::IDLE;
+	_then = Then::MENU;
+	_pending = EventType::NONE;
+	_steps = NULL;
+	_stepCount = 0;
+	_step = 0;
+	_stepFlags = 0;
+	_flowApply = false;
+	_flowAfter = Mode::MENU;
+	_key[0] = '\0';
+	_line[0] = '\0';
+	_length = 0;
+	_overflow = false;
 }
 
-void ConsoleClass::onStaticConfig(void (*staticHandler)(IPAddress ip, IPAddress sm, IPAddress gw, IPAddress dns)) {
-	this->staticHandler = staticHandler;
-}
-
-void ConsoleClass::onReconnectCommand(void (*reconnectHandler)()) {
-	this->reconnectHandler = reconnectHandler;
-}
-
-void ConsoleClass::onWifiConfigCommand(void (*wifiConfigHandler)(String ssid, String password)) {
-	this->wifiConfigHandler = wifiConfigHandler;
-}
-
-void ConsoleClass::onResumeCommand(void (*resumeHandler)()) {
-	this->resumeHandler = resumeHandler;
-}
-
-void ConsoleClass::onGetNetInfoCommand(void (*netInfoHandler)()) {
-	this->netInfoHandler = netInfoHandler;
+// Publishes and parks the console until main.cpp hands the event back
+// through complete().
+void ConsoleClass::wait(EventType type, Then then, const char* key, const char* text) {
+	_then = then;
+	_pending = type;
+	_mode = Mode::WAITING;
+	if (!EventBus.publish(type, EventSource::CONSOLE, key, text)) {
+		Serial.println(F("ERROR: Event queue full."));
+		_pending = EventType::NONE;
+		finish(false);
+	}
 }
 
-void ConsoleClass::onSaveConfigCommand(void (*saveConfigHandler)()) {
-	this->saveConfigHandler = saveConfigHandler;
-}
+// For commands that don't answer.
+bool ConsoleClass::send(EventType type) {
+	if (!EventBus.publish(type, EventSource::CONSOLE)) {
+		Serial.println(F("ERROR: Event queue full."));
+		return false;
+	}
 
-void ConsoleClass::onMqttConfigCommand(void (*mqttChangeHandler)(String newBroker, int newPort, String newUsername, String newPassword, String newConTopic, String newStatTopic)) {
-	this->mqttChangeHandler = mqttChangeHandler;
+	return true;
 }
 
-void ConsoleClass::onConsoleInterrupt(void (*interruptHandler)()) {
-	this->interruptHandler = interruptHandler;
-}
+void ConsoleClass::complete(const event_t &event, bool success) {
+	if (_mode != Mode::WAITING || event.type != _pending) {
+		return;
+	}
 
-void ConsoleClass::onFactoryRestore(void (*factoryRestoreHandler)()) {
-	this->factoryRestoreHandler = factoryRestoreHandler;
+	_pending = EventType::NONE;
+	finish(success);
 }
 
-void ConsoleClass::setMqttConfig(String broker, int port, String username, String password, String conTopic, String statTopic) {
-	_mqttBroker = broker;
-	_mqttPort = port;
-	_mqttUsername = username;
-	_mqttPassword = password;
-	_mqttControlChannel = conTopic;
-	_mqttStatusChannel = statTopic;
+void ConsoleClass::finish(bool success) {
+	switch (_then) {
+		case Then::MENU:
+			showMenu();
+			break;
+		case Then::LINE_RESULT:
+			Serial.println(success ? F("OK") : F("FAIL"));
+			printReady();
+			break;
+		case Then::RECONNECTED:
+			// Back online means back to normal operation.
+			if (success) {
+				_mode = Mode::IDLE;
+			}
+			else {
+				showMenu();
+			}
+			break;
+		case Then::ASK_VALUE:
+			if (success) {
+				askValue();
+			}
+			else {
+				showMenu();
+			}
+			break;
+		case Then::NEXT_STEP:
+			if (success) {
+				_step++;
+				runStep();
+			}
+			else {
+				askValue();
+			}
+			break;
+		case Then::FLOW_DONE:
+			if (_flowAfter == Mode::NETWORK_MODE) {
+				showNetworkModePrompt();
+			}
+			else {
+				showMenu();
+			}
+			break;
+		case Then::ASK_SETTING_NAME:
+			Serial.println(F("Enter setting name: "));
+			_length = 0;
+			_overflow = false;
+			_mode = Mode::SETTING_NAME;
+			break;
+		case Then::STAGED:
+			Serial.println(F("INFO: Save config changes to apply."));
+			showMenu();
+			break;
+	}
 }
 
-IPAddress ConsoleClass::getIPFromString(String value) {
-	unsigned int ip[4];
-	unsigned char buf[value.length()];
-	value.getBytes(buf, value.length());
-	const char* ipBuf = (const char*)buf;
-	sscanf(ipBuf, "%u.%u.%u.%u", &ip[0], &ip[1], &ip[2], &ip[3]);
-	return IPAddress(ip[0], ip[1], ip[2], ip[3]);
-}
+// Collects input without blocking. True once a whole line is in _line.
+bool ConsoleClass::readLine(bool echo, bool mask) {
+	while (Serial.available() > 0) {
+		char c = Serial.read();
+		if (c == '\n') {
+			_line[_length] = '\0';
+			return true;
+		}
 
-void ConsoleClass::waitForUserInput() {
-	while (Serial.available() < 1) {
-		ESPCrashMonitor.iAmAlive();
-		delay(5);
-	}
-}
+		if (c == '\r') {
+			continue;
+		}
 
-String ConsoleClass::getInputString(bool isPassword) {
-	char c;
-	String result = "";
-	bool gotEndMarker = false;
-	while (!gotEndMarker) {
-		ESPCrashMonitor.iAmAlive();
-		if (Serial.available() > 0) {
-			c = Serial.read();
-			if (c == '\n') {
-				gotEndMarker = true;
-				break;
-			}
+		if (echo) {
+			Serial.print(mask ? '*' : c);
+		}
 
-			Serial.print(isPassword ? '*' : c);
-			result += c;
+		if (_length < sizeof(_line) - 1) {
+			_line[_length++] = c;
+		}
+		else {
+			_overflow = true;
 		}
 	}
 
-	return result;
+	return false;
 }
 
-void ConsoleClass::configureStaticIP() {
-	Serial.println(F("Enter IP address: "));
-	waitForUserInput();
-	IPAddress ip = getIPFromString(getInputString());
-	Serial.print(F("New IP: "));
-	Serial.println(ip);
-
-	Serial.println(F("Enter gateway: "));
-	waitForUserInput();
-	IPAddress gw = getIPFromString(getInputString());
-	Serial.print(F("New gateway: "));
-	Serial.println(gw);
-
-	Serial.println(F("Enter subnet mask: "));
-	waitForUserInput();
-	IPAddress sm = getIPFromString(getInputString());
-	Serial.print(F("New subnet mask: "));
-	Serial.println(sm);
-
-	Serial.println(F("Enter DNS server: "));
-	waitForUserInput();
-	IPAddress dns = getIPFromString(getInputString());
-	Serial.print(F("New DNS server: "));
-	Serial.println(dns);
-
-	if (staticHandler != NULL) {
-		staticHandler(ip, sm, gw, dns);
+static void trim(char* text) {
+	size_t length = strlen(text);
+	while (length > 0 && isspace((unsigned char)text[length - 1])) {
+		text[--length] = '\0';
 	}
-}
 
-void ConsoleClass::configureWiFiNetwork() {
-	Serial.println(F("Enter new SSID: "));
-	waitForUserInput();
-	String ssid = getInputString();
-	Serial.print(F("SSID = "));
-	Serial.println(ssid);
-
-	Serial.println(F("Enter new password: "));
-	waitForUserInput();
-	String password = getInputString();
-	Serial.print(F("Password = "));
-	Serial.println(password);
-
-	if (wifiConfigHandler != NULL) {
-		wifiConfigHandler(ssid, password);
+	size_t start = 0;
+	while (isspace((unsigned char)text[start])) {
+		start++;
 	}
-}
-
-void ConsoleClass::configMQTT() {
-	Serial.print(F("Current MQTT broker = "));
-	Serial.println(_mqttBroker);
-	Serial.println(F("Enter MQTT broker address: "));
-	waitForUserInput();
-	_mqttBroker = getInputString();
-	Serial.println();
-	Serial.print(F("New broker = "));
-	Serial.println(_mqttBroker);
-
-	Serial.print(F("Current port = "));
-    Serial.println(_mqttPort);
-    Serial.println(F("Enter MQTT broker port:"));
-    waitForUserInput();
-    String str = getInputString();
-    _mqttPort = str.toInt();
-    Serial.println();
-    Serial.print(F("New port = "));
-    Serial.println(_mqttPort);
-
-	Serial.print(F("Current control topic = "));
-    Serial.println(_mqttControlChannel);
-    Serial.println(F("Enter MQTT control topic:"));
-    waitForUserInput();
-    _mqttControlChannel = getInputString();
-    Serial.println();
-    Serial.print(F("New control topic = "));
-    Serial.println(_mqttControlChannel);
-
-	Serial.print(F("Current status topic = "));
-    Serial.println(_mqttStatusChannel);
-    Serial.println(F("Enter MQTT status topic:"));
-    waitForUserInput();
-    _mqttStatusChannel = getInputString();
-    Serial.println();
-    Serial.print(F("New status topic = "));
-    Serial.println(_mqttStatusChannel);
-
-	Serial.print(F("Current username: "));
-    Serial.println(_mqttUsername);
-    Serial.println(F("Enter new username, or just press enter to clear:"));
-    waitForUserInput();
-    _mqttUsername = getInputString();
-    Serial.print(F("New MQTT username = "));
-    Serial.println(_mqttUsername);
-
-	Serial.print(F("Current password: "));
-    for (uint8_t i = 0; i < _mqttPassword.length(); i++) {
-        Serial.print(F("*"));
-    }
 
-    Serial.println();
-    Serial.print(F("Enter new password, or just press enter to clear"));
-    waitForUserInput();
-    _mqttPassword = this->getInputString(true);
-
-	if (mqttChangeHandler != NULL) {
-        mqttChangeHandler(
-            _mqttBroker, _mqttPort,
-            _mqttUsername,
-            _mqttPassword,
-            _mqttControlChannel,
-            _mqttStatusChannel
-        );
-    }
+	if (start > 0) {
+		memmove(text, text + start, length - start + 1);
+	}
 }
 
-void ConsoleClass::displayMenu() {
+void ConsoleClass::showMenu() {
 	Serial.println();
     Serial.println(F("=============================="));
     Serial.println(F("= Command menu:              ="));
@@ -228,6 +207,7 @@ void ConsoleClass::displayMenu() {
     Serial.println(F("= r: Reboot                  ="));
     Serial.println(F("= c: Configure network       ="));
     Serial.println(F("= m: Configure MQTT settings ="));
+    Serial.println(F("= a: Edit any setting        ="));
     Serial.println(F("= s: Scan wireless networks  ="));
     Serial.println(F("= n: Connect to new network  ="));
     Serial.println(F("= w: Reconnect to WiFi       ="));
@@ -235,117 +215,342 @@ void ConsoleClass::displayMenu() {
     Serial.println(F("= g: Get network info        ="));
     Serial.println(F("= f: Save config changes     ="));
     Serial.println(F("= z: Restore default config  ="));
+    Serial.println(F("= l: Line command mode       ="));
     Serial.println(F("=                            ="));
     Serial.println(F("=============================="));
     Serial.println();
-    Serial.println(F("Enter command choice (r/c/m/s/n/w/e/g/f/z): "));
-    waitForUserInput();
+    Serial.println(F("Enter command choice (r/c/m/a/s/n/w/e/g/f/z/l): "));
+    _mode = Mode::MENU;
 }
 
-void ConsoleClass::enterCommandInterpreter() {
-    displayMenu();
-    checkCommand();
+void ConsoleClass::showNetworkModePrompt() {
+	Serial.println(F("Choose network mode (d = DHCP, t = Static):"));
+	_mode = Mode::NETWORK_MODE;
 }
 
-void ConsoleClass::checkCommand() {
-    String str = "";
-    char incomingByte = Serial.read();
-    switch (incomingByte) {
+void ConsoleClass::runMenuCommand(char command) {
+    switch (command) {
         case 'r':
-            // Reset the controller.
-            if (rebootHandler != NULL) {
-                rebootHandler();
-            }
+            send(EventType::REBOOT);
             break;
         case 's':
-            // Scan for available networks.
-            if (scanHandler != NULL) {
-                scanHandler();
-            }
-            
-            enterCommandInterpreter();
+            wait(EventType::SCAN_NETWORKS, Then::MENU);
             break;
         case 'c':
-            // Set hostname.
-            Serial.print(F("Current host name: "));
-            Serial.println(_hostname);
-            Serial.println(F("Set new host name: "));
-            waitForUserInput();
-
-            str = getInputString();
-            if (hostnameChangeHandler != NULL) {
-                hostnameChangeHandler(str.c_str());
-            }
-
-            // Change network mode.
-            _hostname = str;
-            Serial.println(F("Choose network mode (d = DHCP, t = Static):"));
-            waitForUserInput();
-            checkCommand();
+            // Host name, then network mode.
+            beginFlow(hostnameSteps, STEP_COUNT(hostnameSteps), true, Mode::NETWORK_MODE);
             break;
         case 'd':
-            if (dhcpHandler != NULL) {
-                dhcpHandler();
-            }
-
-            enterCommandInterpreter();
+            beginFlow(dhcpSteps, STEP_COUNT(dhcpSteps), true, Mode::MENU);
             break;
         case 't':
-            // Switch to static IP mode. Request IP settings.
-            configureStaticIP();
-            enterCommandInterpreter();
+            beginFlow(staticSteps, STEP_COUNT(staticSteps), true, Mode::MENU);
             break;
         case 'w':
-            if (reconnectHandler != NULL) {
-                reconnectHandler();
-            }
+            wait(EventType::RECONNECT_WIFI, Then::RECONNECTED);
             break;
         case 'n':
-            configureWiFiNetwork();
-            enterCommandInterpreter();
+            beginFlow(wifiSteps, STEP_COUNT(wifiSteps), true, Mode::MENU);
             break;
         case 'e':
-            if (resumeHandler != NULL) {
-                resumeHandler();
+            if (send(EventType::RESUME)) {
+                _mode = Mode::IDLE;
             }
             break;
         case 'g':
-            if (netInfoHandler != NULL) {
-                netInfoHandler();
-            }
-
-            enterCommandInterpreter();
+            wait(EventType::NETWORK_INFO, Then::MENU);
             break;
         case 'f':
-            if (saveConfigHandler != NULL) {
-                saveConfigHandler();
-            }
-
-            enterCommandInterpreter();
+            wait(EventType::SAVE_SETTINGS, Then::MENU);
             break;
         case 'm':
-            configMQTT();
-            enterCommandInterpreter();
+            beginFlow(mqttSteps, STEP_COUNT(mqttSteps), true, Mode::MENU);
+            break;
+        case 'a':
+            // Any setting in the config schema, by key or alias. Staged like
+            // the line mode's set command, so it takes effect once saved.
+            wait(EventType::DESCRIBE_SETTING, Then::ASK_SETTING_NAME, "");
             break;
         case 'z':
-            if (factoryRestoreHandler != NULL) {
-                factoryRestoreHandler();
-            }
+            Serial.println();
+            Serial.println(F("Are you sure you wish to restore to factory defaults? (Y/n)"));
+            _length = 0;
+            _overflow = false;
+            _mode = Mode::CONFIRM_RESTORE;
+            break;
+        case 'l':
+            enterLineMode();
             break;
         default:
             // Specified command is invalid.
             Serial.println(F("WARN: Unrecognized command."));
-            enterCommandInterpreter();
+            showMenu();
             break;
     }
 }
 
-void ConsoleClass::checkInterrupt() {
-    if (Serial.available() > 0 && Serial.read() == 'i') {
-        if (interruptHandler != NULL) {
-            interruptHandler();
-        }
-    }
+void ConsoleClass::beginFlow(const console_step_t *steps, uint8_t count, bool apply, Mode after) {
+	_steps = steps;
+	_stepCount = count;
+	_step = 0;
+	_flowApply = apply;
+	_flowAfter = after;
+	runStep();
+}
+
+// Shows the current value before asking for a new one. Fixed steps are
+// set straight away.
+void ConsoleClass::runStep() {
+	if (_step >= _stepCount) {
+		if (_flowApply) {
+			wait(EventType::APPLY_SETTINGS, Then::FLOW_DONE);
+		}
+		else {
+			wait(EventType::DESCRIBE_SETTING, Then::STAGED, _key);
+		}
+		return;
+	}
+
+	if (_steps == NULL) {
+		// A single setting named at the prompt, already in _key.
+		_stepFlags = 0;
+		wait(EventType::DESCRIBE_SETTING, Then::ASK_VALUE, _key);
+		return;
+	}
+
+	console_step_t step;
+	memcpy_P(&step, &_steps[_step], sizeof(step));
+	strncpy_P(_key, step.key, sizeof(_key) - 1);
+	_key[sizeof(_key) - 1] = '\0';
+	_stepFlags = step.flags;
+	if (step.value != NULL) {
+		strncpy_P(_line, step.value, sizeof(_line) - 1);
+		_line[sizeof(_line) - 1] = '\0';
+		wait(EventType::SET_SETTING, Then::NEXT_STEP, _key, _line);
+		return;
+	}
+
+	wait(EventType::DESCRIBE_SETTING, Then::ASK_VALUE, _key);
+}
+
+void ConsoleClass::askValue() {
+	if (_stepFlags & CONSOLE_STEP_CLEARABLE) {
+		Serial.println(F("Enter new value, or just press enter to clear it: "));
+	}
+	else {
+		Serial.println(F("Enter new value, or just press enter to keep it (lists are comma separated): "));
+	}
+
+	_length = 0;
+	_overflow = false;
+	_mode = Mode::STEP_VALUE;
+}
+
+void ConsoleClass::onValue() {
+	Serial.println();
+	if (_overflow) {
+		Serial.println(F("ERROR: Value too long."));
+		askValue();
+		return;
+	}
+
+	if (_length == 0 && !(_stepFlags & CONSOLE_STEP_CLEARABLE)) {
+		_step++;
+		runStep();
+		return;
+	}
+
+	wait(EventType::SET_SETTING, Then::NEXT_STEP, _key, _line);
+}
+
+void ConsoleClass::onSettingName() {
+	Serial.println();
+	trim(_line);
+	if (_overflow || _line[0] == '\0' || strlen(_line) >= sizeof(_key)) {
+		Serial.print(F("ERROR: Unknown setting: "));
+		Serial.println(_line);
+		showMenu();
+		return;
+	}
+
+	strlcpy(_key, _line, sizeof(_key));
+	beginFlow(NULL, 1, false, Mode::MENU);
+}
+
+void ConsoleClass::onConfirmRestore() {
+	Serial.println();
+	trim(_line);
+	if (!_overflow && (strcmp(_line, "y") == 0 || strcmp(_line, "Y") == 0)) {
+		wait(EventType::FACTORY_RESTORE, Then::MENU);
+	}
+	else {
+		showMenu();
+	}
+}
+
+void ConsoleClass::enterLineMode() {
+	Serial.println(F("Line mode. Commands: set <key>=<value>, import <json>, show, describe [key], save, reboot, resume, menu"));
+	printReady();
+}
+
+void ConsoleClass::printReady() {
+	Serial.println(F("READY"));
+	_length = 0;
+	_overflow = false;
+	_mode = Mode::LINE;
+}
+
+// Every command is answered by exactly one line reading OK or FAIL, after
+// any log output it caused, so scripts know when to send the next one.
+void ConsoleClass::runLineCommand() {
+	if (_overflow) {
+		Serial.println(F("ERROR: Line too long."));
+		Serial.println(F("FAIL"));
+		printReady();
+		return;
+	}
+
+	trim(_line);
+	if (_line[0] == '\0') {
+		printReady();
+		return;
+	}
+
+	if (strcmp_P(_line, PSTR("menu")) == 0) {
+		showMenu();
+		return;
+	}
+
+	if (strcmp_P(_line, PSTR("resume")) == 0) {
+		if (send(EventType::RESUME)) {
+			Serial.println(F("OK"));
+			_mode = Mode::IDLE;
+		}
+		else {
+			Serial.println(F("FAIL"));
+			printReady();
+		}
+		return;
+	}
+
+	if (strcmp_P(_line, PSTR("reboot")) == 0) {
+		wait(EventType::REBOOT, Then::LINE_RESULT);
+		return;
+	}
+
+	if (strncmp_P(_line, PSTR("set "), 4) == 0) {
+		// Split in place. The value stays in _line until the set is done.
+		char* equals = strchr(_line, '=');
+		if (equals == NULL) {
+			Serial.println(F("FAIL"));
+			printReady();
+			return;
+		}
+
+		*equals = '\0';
+		char* key = _line + 4;
+		char* value = equals + 1;
+		trim(key);
+		trim(value);
+		if (strlen(key) >= sizeof(_key)) {
+			Serial.print(F("ERROR: Unknown setting: "));
+			Serial.println(key);
+			Serial.println(F("FAIL"));
+			printReady();
+			return;
+		}
+
+		wait(EventType::SET_SETTING, Then::LINE_RESULT, key, value);
+		return;
+	}
+
+	if (strncmp_P(_line, PSTR("import "), 7) == 0) {
+		wait(EventType::IMPORT_SETTINGS, Then::LINE_RESULT, NULL, _line + 7);
+		return;
+	}
+
+	if (strcmp_P(_line, PSTR("show")) == 0) {
+		wait(EventType::SHOW_SETTINGS, Then::LINE_RESULT);
+		return;
+	}
+
+	if (strcmp_P(_line, PSTR("describe")) == 0 || strncmp_P(_line, PSTR("describe "), 9) == 0) {
+		char* key = _line + 8;
+		trim(key);
+		if (strlen(key) >= sizeof(_key)) {
+			Serial.print(F("ERROR: Unknown setting: "));
+			Serial.println(key);
+			Serial.println(F("FAIL"));
+			printReady();
+			return;
+		}
+
+		wait(EventType::DESCRIBE_SETTING, Then::LINE_RESULT, key);
+		return;
+	}
+
+	if (strcmp_P(_line, PSTR("save")) == 0) {
+		wait(EventType::SAVE_SETTINGS, Then::LINE_RESULT);
+		return;
+	}
+
+	Serial.print(F("ERROR: Unknown command: "));
+	Serial.println(_line);
+	Serial.println(F("FAIL"));
+	printReady();
+}
+
+// Called every pass of loop(). Only an 'i' does anything until the menu
+// is up.
+void ConsoleClass::poll() {
+	switch (_mode) {
+		case Mode::IDLE:
+			if (Serial.available() > 0 && Serial.read() == 'i') {
+				wait(EventType::CONSOLE_INTERRUPT, Then::MENU);
+			}
+			break;
+		case Mode::MENU:
+		case Mode::NETWORK_MODE:
+			while (Serial.available() > 0) {
+				char c = Serial.read();
+				if (isspace((unsigned char)c)) {
+					continue;
+				}
+
+				if (_mode == Mode::NETWORK_MODE && c != 'd' && c != 't') {
+					Serial.println(F("WARN: Unrecognized network mode."));
+					showMenu();
+					break;
+				}
+
+				runMenuCommand(c);
+				break;
+			}
+			break;
+		case Mode::STEP_VALUE:
+			if (readLine(true, _stepFlags & CONSOLE_STEP_SECRET)) {
+				onValue();
+			}
+			break;
+		case Mode::SETTING_NAME:
+			if (readLine(true, false)) {
+				onSettingName();
+			}
+			break;
+		case Mode::CONFIRM_RESTORE:
+			if (readLine(true, false)) {
+				onConfirmRestore();
+			}
+			break;
+		case Mode::LINE:
+			if (readLine(false, false)) {
+				runLineCommand();
+			}
+			break;
+		case Mode::WAITING:
+			// Input waits in the UART buffer until the event is done.
+			break;
+	}
 }
 
-ConsoleClass Console;
\ No newline at end of file
+ConsoleClass Console;
@@ -0,0 +1,34 @@
+#include "EventBus.h"
+
+EventBusClass::EventBusClass() {
+	_dropped = 0;
+}
+
+bool EventBusClass::publish(EventType type, EventSource source, const char* key, const char* text) {
+	event_t event;
+	event.queuedAt = micros();
+	event.text = text;
+	event.type = type;
+	event.source = source;
+	event.key[0] = '\0';
+	if (key != NULL) {
+		strlcpy(event.key, key, sizeof(event.key));
+	}
+
+	if (!_queue.push(event)) {
+		_dropped++;
+		return false;
+	}
+
+	return true;
+}
+
+bool EventBusClass::next(event_t &event) {
+	return _queue.pop(event);
+}
+
+uint32_t EventBusClass::getDropped() const {
+	return _dropped;
+}
+
+EventBusClass EventBus;
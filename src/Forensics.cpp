@@ -0,0 +1,229 @@
+#include "Forensics.h"
+#include "ESPCrashMonitor.h"
+
+#define FORENSICS_MAGIC 0x43594c46
+
+// Escapes everything written through it into the body of a JSON string
+// and silently drops output past the given limit.
+class JsonEscapingPrint : public Print
+{
+public:
+	JsonEscapingPrint(Print &out, size_t limit) : _out(out), _remaining(limit) {}
+
+	size_t write(uint8_t c) override {
+		if (_remaining == 0) {
+			return 1;
+		}
+
+		_remaining--;
+		switch (c) {
+			case '"':
+			case '\\':
+				_out.write('\\');
+				_out.write(c);
+				break;
+			case '\n':
+				_out.print(F("\\n"));
+				break;
+			case '\t':
+				_out.print(F("\\t"));
+				break;
+			default:
+				if (c >= 0x20) {
+					_out.write(c);
+				}
+				break;
+		}
+
+		return 1;
+	}
+
+private:
+	Print &_out;
+	size_t _remaining;
+};
+
+ForensicsClass::ForensicsClass() {
+	memset(&_current, 0, sizeof(_current));
+	memset(&_previous, 0, sizeof(_previous));
+	_previousValid = false;
+	_stageStart = 0;
+}
+
+void ForensicsClass::begin() {
+	_previousValid = ESP.rtcUserMemoryRead(FORENSICS_RTC_OFFSET, (uint32_t*)&_previous, sizeof(_previous))
+		&& _previous.magic == FORENSICS_MAGIC;
+
+	memset(&_current, 0, sizeof(_current));
+	_current.magic = FORENSICS_MAGIC;
+	_stageStart = millis();
+	writeAll();
+}
+
+void ForensicsClass::writeStageWord() {
+	// Only the word holding stage/lastTask changes on the hot path.
+	uint32_t word;
+	memcpy(&word, &_current.stage, sizeof(word));
+	ESP.rtcUserMemoryWrite(FORENSICS_RTC_OFFSET + 1, &word, sizeof(word));
+}
+
+void ForensicsClass::writeAll() {
+	ESP.rtcUserMemoryWrite(FORENSICS_RTC_OFFSET, (uint32_t*)&_current, sizeof(_current));
+}
+
+void ForensicsClass::enter(Stage stage) {
+	unsigned long now = millis();
+	unsigned long elapsed = now - _stageStart;
+	if (elapsed >= FORENSICS_STALL_THRESHOLD && _current.stage != (uint8_t)Stage::CONSOLE) {
+		Serial.print(F("WARN: Stalled for "));
+		Serial.print(elapsed);
+		Serial.print(F(" ms in stage: "));
+		Serial.println(getStageName(_current.stage));
+	}
+
+	_stageStart = now;
+	_current.stage = (uint8_t)stage;
+	if (stage >= FIRST_TASK_STAGE) {
+		_current.lastTask = (uint8_t)stage;
+	}
+
+	writeStageWord();
+}
+
+void ForensicsClass::recordCommand(uint8_t cmd) {
+	_current.commands[_current.commandHead] = cmd;
+	_current.commandHead = (_current.commandHead + 1) % FORENSICS_COMMAND_HISTORY;
+	if (_current.commandCount < FORENSICS_COMMAND_HISTORY) {
+		_current.commandCount++;
+	}
+
+	writeAll();
+}
+
+void ForensicsClass::recordLoopTime(unsigned long elapsed) {
+	if (elapsed > _current.maxLoopTime) {
+		_current.maxLoopTime = elapsed;
+		writeAll();
+	}
+}
+
+bool ForensicsClass::wasAbnormalReset() {
+	rst_info *info = ESP.getResetInfoPtr();
+	switch (info->reason) {
+		case REASON_WDT_RST:
+		case REASON_EXCEPTION_RST:
+		case REASON_SOFT_WDT_RST:
+			return true;
+		case REASON_SOFT_RESTART:
+			// Deliberate restarts mark the breadcrumbs first. Anything else
+			// (such as the crash monitor's watchdog firing) was a stall.
+			return _previousValid && _previous.stage != (uint8_t)Stage::REBOOTING;
+		default:
+			return false;
+	}
+}
+
+bool ForensicsClass::captureReport(fs::FS &fs, const char* hostname) {
+	if (!wasAbnormalReset()) {
+		return false;
+	}
+
+	File report = fs.open(FORENSICS_REPORT_PATH, "w");
+	if (!report) {
+		return false;
+	}
+
+	rst_info *info = ESP.getResetInfoPtr();
+	report.printf_P(PSTR("{\"clientId\":\"%s\",\"reason\":%u,\"exccause\":%u,"),
+		hostname, info->reason, info->exccause);
+	report.printf_P(PSTR("\"epc1\":\"0x%08x\",\"epc2\":\"0x%08x\",\"epc3\":\"0x%08x\",\"excvaddr\":\"0x%08x\",\"depc\":\"0x%08x\""),
+		info->epc1, info->epc2, info->epc3, info->excvaddr, info->depc);
+
+	if (_previousValid) {
+		report.print(F(",\"stage\":\""));
+		report.print(getStageName(_previous.stage));
+		report.print(F("\",\"lastTask\":\""));
+		report.print(getStageName(_previous.lastTask));
+		report.print(F("\",\"maxLoopMs\":"));
+		report.print(_previous.maxLoopTime);
+		report.print(F(",\"commands\":["));
+
+		// Oldest first.
+		uint8_t count = min(_previous.commandCount, (uint8_t)FORENSICS_COMMAND_HISTORY);
+		uint8_t index = (_previous.commandHead + FORENSICS_COMMAND_HISTORY - count) % FORENSICS_COMMAND_HISTORY;
+		for (uint8_t i = 0; i < count; i++) {
+			if (i > 0) {
+				report.print(',');
+			}
+
+			report.print(_previous.commands[index]);
+			index = (index + 1) % FORENSICS_COMMAND_HISTORY;
+		}
+
+		report.print(']');
+	}
+
+	report.print(F(",\"dump\":\""));
+	JsonEscapingPrint dump(report, FORENSICS_DUMP_LIMIT);
+	ESPCrashMonitor.dump(dump);
+	report.print(F("\"}"));
+
+	report.flush();
+	report.close();
+	return true;
+}
+
+const __FlashStringHelper* ForensicsClass::getStageName(uint8_t stage) {
+	switch ((Stage)stage) {
+		case Stage::CONSOLE:
+			return F("console");
+		case Stage::SCHEDULER:
+			return F("scheduler");
+		case Stage::MDNS:
+			return F("mdns");
+		case Stage::OTA:
+			return F("ota");
+		case Stage::MQTT:
+			return F("mqtt");
+		case Stage::METRICS_HTTP:
+			return F("metricsHttp");
+		case Stage::BELL_EVENTS:
+			return F("bellEvents");
+		case Stage::DIRECT_CONTROL:
+			return F("directControl");
+		case Stage::EVENTS:
+			return F("events");
+		case Stage::REBOOTING:
+			return F("rebooting");
+		case Stage::TASK_CHECK_WIFI:
+			return F("checkWiFi");
+		case Stage::TASK_CHECK_MQTT:
+			return F("checkMqtt");
+		case Stage::TASK_CLOCK_SYNC:
+			return F("clockSync");
+		case Stage::TASK_PUBLISH_METRICS:
+			return F("publishMetrics");
+		case Stage::TASK_HEARTBEAT:
+			return F("heartbeat");
+		case Stage::TASK_CONTROL:
+			return F("control");
+		case Stage::TASK_SYNTHETIC_LOAD:
+			return F("syntheticLoad");
+		case Stage::TASK_HTTP_UPDATE:
+			return F("httpUpdate");
+		case Stage::TASK_MQTT_FAILOVER:
+			return F("mqttFailover");
+		case Stage::TASK_BROKER_PROBE:
+			return F("brokerProbe");
+		case Stage::TASK_JOURNAL:
+			return F("journal");
+		case Stage::TASK_QUIET_HOURS:
+			return F("quietHours");
+		case Stage::TASK_GROUPS:
+			return F("groups");
+		default:
+			return F("none");
+	}
+}
+
+ForensicsClass Forensics;
@@ -0,0 +1,175 @@
+#include "HeapTracker.h"
+#include "LengthCountingPrint.h"
+
+HeapTrackerClass::HeapTrackerClass() {
+	memset(_sites, 0, sizeof(_sites));
+	_armed = false;
+	_exemptDepth = 0;
+	_allocations = 0;
+	_bytes = 0;
+	_exemptAllocations = 0;
+	_reported = 0;
+	_siteCount = 0;
+}
+
+void HeapTrackerClass::arm() {
+	_armed = true;
+}
+
+void HeapTrackerClass::beginExempt() {
+	_exemptDepth++;
+}
+
+void HeapTrackerClass::endExempt() {
+	if (_exemptDepth > 0) {
+		_exemptDepth--;
+	}
+}
+
+void HeapTrackerClass::recordAllocation(uint32_t site, size_t size) {
+	// Runs inside malloc(), so nothing in here may allocate.
+	if (!_armed) {
+		return;
+	}
+
+	if (_exemptDepth > 0) {
+		_exemptAllocations++;
+		return;
+	}
+
+	_allocations++;
+	_bytes += size;
+
+	// Sites past the end of the table are lumped into its last entry.
+	uint8_t index = 0;
+	while (index < _siteCount && _sites[index].address != site) {
+		index++;
+	}
+
+	if (index == _siteCount) {
+		if (_siteCount < HEAP_TRACKING_SITES) {
+			_siteCount++;
+			_sites[index].address = site;
+		}
+		else {
+			index = HEAP_TRACKING_SITES - 1;
+			_sites[index].address = 0;
+		}
+	}
+
+	_sites[index].count++;
+	_sites[index].bytes += size;
+
+	#ifdef HEAP_TRACKING_ASSERT
+		// The crash report this leaves behind carries the whole stack, not
+		// just the immediate caller.
+		abort();
+	#endif
+}
+
+uint32_t HeapTrackerClass::getAllocations() const {
+	return _allocations;
+}
+
+uint32_t HeapTrackerClass::getBytes() const {
+	return _bytes;
+}
+
+uint32_t HeapTrackerClass::getExemptAllocations() const {
+	return _exemptAllocations;
+}
+
+bool HeapTrackerClass::takeChanged() {
+	if (_allocations == _reported) {
+		return false;
+	}
+
+	_reported = _allocations;
+	return true;
+}
+
+size_t HeapTrackerClass::getReportLength(const char* hostname) const {
+	LengthCountingPrint counter;
+	writeReport(counter, hostname);
+	return counter.length;
+}
+
+void HeapTrackerClass::writeReport(Print &out, const char* hostname) const {
+	out.printf_P(PSTR("{\"clientId\":\"%s\",\"allocations\":%u,\"bytes\":%u,\"exempt\":%u,\"sites\":["),
+		hostname, (unsigned)_allocations, (unsigned)_bytes, (unsigned)_exemptAllocations);
+	for (uint8_t i = 0; i < _siteCount; i++) {
+		out.printf_P(PSTR("%s{\"addr\":\"0x%08x\",\"count\":%u,\"bytes\":%u}"),
+			i > 0 ? "," : "", (unsigned)_sites[i].address, (unsigned)_sites[i].count, (unsigned)_sites[i].bytes);
+	}
+
+	out.print(F("]}"));
+}
+
+void HeapTrackerClass::printSummary(Print &out) const {
+	out.print(F("WARN: "));
+	out.print(_allocations);
+	out.print(F(" heap allocations ("));
+	out.print(_bytes);
+	out.print(F(" bytes) since boot completed. Call sites:"));
+	for (uint8_t i = 0; i < _siteCount; i++) {
+		out.printf_P(PSTR(" 0x%08x x%u"), (unsigned)_sites[i].address, (unsigned)_sites[i].count);
+	}
+
+	out.println();
+}
+
+HeapTrackerClass HeapTracker;
+
+#ifdef ENABLE_HEAP_TRACKING
+	// Linked in place of the real functions with -Wl,--wrap=<name>. The
+	// operators are wrapped too, or every 'new' would be charged to the
+	// runtime's operator new rather than to the code calling it.
+	extern "C" {
+		void* __real_malloc(size_t size);
+		void* __real_calloc(size_t count, size_t size);
+		void* __real_realloc(void *ptr, size_t size);
+		void* __real__Znwj(size_t size);
+		void* __real__Znaj(size_t size);
+
+		// Set while the real operator new runs, so the malloc() it makes
+		// isn't counted a second time.
+		static bool inOperatorNew = false;
+
+		void* __wrap_malloc(size_t size) {
+			if (!inOperatorNew) {
+				HeapTracker.recordAllocation((uint32_t)(uintptr_t)__builtin_return_address(0), size);
+			}
+
+			return __real_malloc(size);
+		}
+
+		void* __wrap_calloc(size_t count, size_t size) {
+			HeapTracker.recordAllocation((uint32_t)(uintptr_t)__builtin_return_address(0), count * size);
+			return __real_calloc(count, size);
+		}
+
+		void* __wrap_realloc(void *ptr, size_t size) {
+			if (size > 0) {
+				HeapTracker.recordAllocation((uint32_t)(uintptr_t)__builtin_return_address(0), size);
+			}
+
+			return __real_realloc(ptr, size);
+		}
+
+		void* __wrap__Znwj(size_t size) {
+			HeapTracker.recordAllocation((uint32_t)(uintptr_t)__builtin_return_address(0), size);
+			inOperatorNew = true;
+			void *ptr = __real__Znwj(size);
+			inOperatorNew = false;
+			return ptr;
+		}
+
+		void* __wrap__Znaj(size_t size) {
+			HeapTracker.recordAllocation((uint32_t)(uintptr_t)__builtin_return_address(0), size);
+			inOperatorNew = true;
+			void *ptr = __real__Znaj(size);
+			inOperatorNew = false;
+			return ptr;
+		}
+	}
+#endif
@@ -0,0 +1,261 @@
+#include "Journal.h"
+
+#define JOURNAL_MAGIC 0x43594a31
+
+JournalClass::JournalClass() {
+	memset(&_header, 0, sizeof(_header));
+	memset(_pending, 0, sizeof(_pending));
+	_fs = NULL;
+	_pendingCount = 0;
+	_lastState = 0;
+	_ready = false;
+}
+
+bool JournalClass::begin(fs::FS &fs) {
+	_fs = &fs;
+	File file = fs.open(JOURNAL_FILE_PATH, "r");
+	bool valid = file
+		&& file.size() == sizeof(journal_header_t) + JOURNAL_CAPACITY * sizeof(journal_record_t)
+		&& file.read((uint8_t*)&_header, sizeof(_header)) == sizeof(_header)
+		&& _header.magic == JOURNAL_MAGIC
+		&& _header.capacity == JOURNAL_CAPACITY
+		&& _header.recordSize == sizeof(journal_record_t);
+	if (file) {
+		file.close();
+	}
+
+	_ready = valid || create();
+	return _ready;
+}
+
+bool JournalClass::create() {
+	// Every slot is written up front so the file never grows (or moves)
+	// once it is in use. An all-zero record fails its check.
+	memset(&_header, 0, sizeof(_header));
+	_header.magic = JOURNAL_MAGIC;
+	_header.capacity = JOURNAL_CAPACITY;
+	_header.recordSize = sizeof(journal_record_t);
+	_header.nextSequence = 1;
+
+	File file = _fs->open(JOURNAL_FILE_PATH, "w");
+	if (!file) {
+		return false;
+	}
+
+	bool success = file.write((const uint8_t*)&_header, sizeof(_header)) == sizeof(_header);
+	uint8_t blank[sizeof(journal_record_t) * 8];
+	memset(blank, 0, sizeof(blank));
+	for (uint16_t i = 0; success && i < JOURNAL_CAPACITY; i += 8) {
+		size_t chunk = min(8, JOURNAL_CAPACITY - i) * sizeof(journal_record_t);
+		success = file.write(blank, chunk) == chunk;
+	}
+
+	file.close();
+	return success;
+}
+
+uint8_t JournalClass::getCheck(const journal_record_t &entry) {
+	const uint8_t *bytes = (const uint8_t*)&entry;
+	uint8_t check = 0x5a;
+	for (uint8_t i = 0; i < sizeof(journal_record_t) - 1; i++) {
+		check = (check << 1 | check >> 7) ^ bytes[i];
+	}
+
+	return check;
+}
+
+bool JournalClass::record(CommandSource source, ControlCommand command, uint8_t state, bool disabled, uint32_t durationMs) {
+	if (!_ready) {
+		return false;
+	}
+
+	if (_pendingCount >= JOURNAL_BATCH_SIZE && !flush()) {
+		// The scheduled flush hasn't run yet and writing now failed too.
+		return false;
+	}
+
+	time_t now = time(nullptr);
+	bool clockValid = now >= CLOCK_VALID_AFTER;
+	journal_record_t &entry = _pending[_pendingCount];
+	entry.sequence = _header.nextSequence + _pendingCount;
+	entry.timestamp = clockValid ? (uint32_t)now : millis() / 1000;
+	entry.durationMs = durationMs;
+	entry.source = (uint8_t)source;
+	entry.command = (uint8_t)command;
+	entry.state = (state & JOURNAL_STATE_MASK)
+		| (clockValid ? 0 : JOURNAL_FLAG_UPTIME)
+		| (disabled ? JOURNAL_FLAG_DISABLED : 0);
+	entry.check = getCheck(entry);
+	_pendingCount++;
+
+	// The daily totals are kept up to date as records come in. Changes
+	// made before the clock was set can't be placed on a day.
+	if (clockValid) {
+		if (_lastState == 0 && (state & JOURNAL_STATE_MASK) != 0) {
+			journal_day_t *day = touchDay(getLocalDay(now));
+			if (day != NULL) {
+				day->activations++;
+			}
+		}
+
+		if (durationMs > 0) {
+			addSilenced(now, durationMs);
+		}
+	}
+
+	_lastState = state & JOURNAL_STATE_MASK;
+	return _pendingCount >= JOURNAL_BATCH_SIZE;
+}
+
+bool JournalClass::writeRecords(File &file, const journal_record_t *records, uint8_t count) {
+	// A batch that runs past the end of the ring is written in two parts.
+	uint8_t written = 0;
+	while (written < count) {
+		uint16_t slot = (records[written].sequence - 1) % JOURNAL_CAPACITY;
+		uint8_t run = min((uint16_t)(count - written), (uint16_t)(JOURNAL_CAPACITY - slot));
+		size_t size = run * sizeof(journal_record_t);
+		if (!file.seek(sizeof(journal_header_t) + slot * sizeof(journal_record_t), SeekSet)
+			|| file.write((const uint8_t*)&records[written], size) != size) {
+			return false;
+		}
+
+		written += run;
+	}
+
+	return true;
+}
+
+bool JournalClass::flush() {
+	if (!_ready || _pendingCount == 0) {
+		return true;
+	}
+
+	File file = _fs->open(JOURNAL_FILE_PATH, "r+");
+	if (!file) {
+		return false;
+	}
+
+	// Records go first, the header last. If power fails in between, the
+	// old header still points at the old end and the partial batch is
+	// simply overwritten later.
+	journal_header_t header = _header;
+	header.nextSequence += _pendingCount;
+	bool success = writeRecords(file, _pending, _pendingCount)
+		&& file.seek(0, SeekSet)
+		&& file.write((const uint8_t*)&header, sizeof(header)) == sizeof(header);
+	file.close();
+	if (success) {
+		_header.nextSequence = header.nextSequence;
+		_pendingCount = 0;
+	}
+
+	return success;
+}
+
+bool JournalClass::hasPending() const {
+	return _pendingCount > 0;
+}
+
+uint32_t JournalClass::getNextSequence() const {
+	return _header.nextSequence + _pendingCount;
+}
+
+bool JournalClass::readRecord(File &file, uint32_t sequence, journal_record_t &entry) {
+	uint16_t slot = (sequence - 1) % JOURNAL_CAPACITY;
+	return file.seek(sizeof(journal_header_t) + slot * sizeof(journal_record_t), SeekSet)
+		&& file.read((uint8_t*)&entry, sizeof(entry)) == sizeof(entry)
+		&& entry.sequence == sequence
+		&& entry.check == getCheck(entry);
+}
+
+uint8_t JournalClass::read(uint32_t before, journal_record_t *records, uint8_t max) {
+	// Newest first, starting just below 'before' (0 means the newest).
+	uint32_t next = getNextSequence();
+	uint32_t sequence = (before == 0 || before > next) ? next : before;
+	uint32_t oldest = _header.nextSequence > JOURNAL_CAPACITY ? _header.nextSequence - JOURNAL_CAPACITY : 1;
+	uint8_t count = 0;
+	File file;
+	while (count < max && sequence > oldest) {
+		sequence--;
+		if (sequence >= _header.nextSequence) {
+			records[count++] = _pending[sequence - _header.nextSequence];
+			continue;
+		}
+
+		if (!file) {
+			file = _fs->open(JOURNAL_FILE_PATH, "r");
+			if (!file) {
+				break;
+			}
+		}
+
+		if (!readRecord(file, sequence, records[count])) {
+			break;
+		}
+
+		count++;
+	}
+
+	if (file) {
+		file.close();
+	}
+
+	return count;
+}
+
+uint32_t JournalClass::getLocalDay(time_t when) {
+	struct tm local;
+	localtime_r(&when, &local);
+
+	// Days from the civil date, so local midnight is the day boundary
+	// whatever the UTC offset or DST.
+	int32_t year = local.tm_year + 1900 - (local.tm_mon < 2 ? 1 : 0);
+	int32_t era = year / 400;
+	uint32_t yearOfEra = year - era * 400;
+	uint32_t month = local.tm_mon + 1;
+	uint32_t dayOfYear = (153 * (month > 2 ? month - 3 : month + 9) + 2) / 5 + local.tm_mday - 1;
+	uint32_t dayOfEra = yearOfEra * 365 + yearOfEra / 4 - yearOfEra / 100 + dayOfYear;
+	return era * 146097 + dayOfEra - 719468;
+}
+
+const journal_day_t* JournalClass::getDayStats(uint32_t day) const {
+	const journal_day_t &stats = _header.days[day % JOURNAL_STAT_DAYS];
+	return stats.day == day ? &stats : NULL;
+}
+
+journal_day_t* JournalClass::touchDay(uint32_t day) {
+	journal_day_t &stats = _header.days[day % JOURNAL_STAT_DAYS];
+	if (stats.day > day) {
+		// Older than anything still kept.
+		return NULL;
+	}
+
+	if (stats.day != day) {
+		memset(&stats, 0, sizeof(stats));
+		stats.day = day;
+	}
+
+	return &stats;
+}
+
+void JournalClass::addSilenced(time_t end, uint32_t durationMs) {
+	// Walks back a day at a time so silences that span midnight count
+	// towards each day they cover.
+	while (durationMs > 0) {
+		time_t last = end - 1;
+		struct tm local;
+		localtime_r(&last, &local);
+		uint32_t sinceMidnightMs = ((local.tm_hour * 60UL + local.tm_min) * 60UL + local.tm_sec + 1) * 1000UL;
+		journal_day_t *day = touchDay(getLocalDay(last));
+		if (day == NULL) {
+			return;
+		}
+
+		uint32_t part = min(durationMs, sinceMidnightMs);
+		day->silencedMs += part;
+		durationMs -= part;
+		end -= sinceMidnightMs / 1000;
+	}
+}
+
+JournalClass Journal;
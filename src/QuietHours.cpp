@@ -0,0 +1,198 @@
+#include "QuietHours.h"
+
+#define MINUTES_PER_DAY 1440
+#define ALL_DAYS 0x7f
+
+static const char* const dayNames[] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat" };
+
+QuietHoursClass::QuietHoursClass() {
+	memset(_entries, 0, sizeof(_entries));
+	_count = 0;
+}
+
+void QuietHoursClass::begin(const quiet_hours_t *entries, uint8_t count) {
+	// A copy, so edits staged from the console don't take effect until
+	// they are applied.
+	_count = min(count, (uint8_t)MAX_QUIET_HOURS);
+	memcpy(_entries, entries, _count * sizeof(quiet_hours_t));
+}
+
+uint8_t QuietHoursClass::getCount() const {
+	return _count;
+}
+
+uint16_t QuietHoursClass::getWindowLength(const quiet_hours_t &entry) {
+	// An end at or before the start is on the next day.
+	uint16_t end = entry.end > entry.start ? entry.end : entry.end + MINUTES_PER_DAY;
+	return end - entry.start;
+}
+
+// Whether the window opens on the local day 'day' days after 'today'.
+bool QuietHoursClass::opensOn(const quiet_hours_t &entry, const struct tm &today, int8_t day) {
+	uint8_t weekday = (today.tm_wday + day + 7) % 7;
+	return (entry.days & (1 << weekday)) != 0;
+}
+
+// The time at 'minutes' past local midnight 'day' days after 'today'.
+// mktime() carries the overflow into the date and applies whichever of
+// standard or daylight time is in effect then.
+time_t QuietHoursClass::getLocalTime(const struct tm &today, int8_t day, uint16_t minutes) {
+	struct tm local = today;
+	local.tm_mday += day;
+	local.tm_hour = 0;
+	local.tm_min = minutes;
+	local.tm_sec = 0;
+	local.tm_isdst = -1;
+	return mktime(&local);
+}
+
+uint8_t QuietHoursClass::getActiveMask(time_t now, uint8_t allMask) const {
+	struct tm today;
+	localtime_r(&now, &today);
+	int32_t minute = today.tm_hour * 60 + today.tm_min;
+	uint8_t mask = 0;
+	for (uint8_t i = 0; i < _count; i++) {
+		// Yesterday's window may still be open past midnight.
+		for (int8_t day = -1; day <= 0; day++) {
+			int32_t elapsed = minute - day * MINUTES_PER_DAY - _entries[i].start;
+			if (opensOn(_entries[i], today, day) && elapsed >= 0 && elapsed < getWindowLength(_entries[i])) {
+				mask |= _entries[i].mask != 0 ? _entries[i].mask & allMask : allMask;
+			}
+		}
+	}
+
+	return mask;
+}
+
+time_t QuietHoursClass::getNextTransition(time_t now) const {
+	struct tm today;
+	localtime_r(&now, &today);
+	time_t next = 0;
+	for (uint8_t i = 0; i < _count; i++) {
+		// A week ahead always reaches the next opening of every window.
+		for (int8_t day = -1; day <= 7; day++) {
+			if (!opensOn(_entries[i], today, day)) {
+				continue;
+			}
+
+			time_t start = getLocalTime(today, day, _entries[i].start);
+			time_t end = getLocalTime(today, day, _entries[i].start + getWindowLength(_entries[i]));
+			if (start > now && (next == 0 || start < next)) {
+				next = start;
+			}
+
+			if (end > now && (next == 0 || end < next)) {
+				next = end;
+			}
+		}
+	}
+
+	return next;
+}
+
+// Days are names, ranges of them and lists of both joined with '+', such
+// as "mon-fri", "sat+sun", "mon+wed-fri" or "daily".
+bool QuietHoursClass::parseDays(char* text, uint8_t &days) {
+	days = 0;
+	char* saveptr = NULL;
+	for (char* token = strtok_r(text, "+", &saveptr); token != NULL; token = strtok_r(NULL, "+", &saveptr)) {
+		if (strcasecmp(token, "daily") == 0) {
+			days = ALL_DAYS;
+			continue;
+		}
+
+		char* last = strchr(token, '-');
+		if (last != NULL) {
+			*last++ = '\0';
+		}
+		else {
+			last = token;
+		}
+
+		int8_t from = -1;
+		int8_t to = -1;
+		for (uint8_t day = 0; day < 7; day++) {
+			if (strcasecmp(token, dayNames[day]) == 0) {
+				from = day;
+			}
+
+			if (strcasecmp(last, dayNames[day]) == 0) {
+				to = day;
+			}
+		}
+
+		if (from < 0 || to < 0) {
+			return false;
+		}
+
+		// Ranges may wrap around the weekend, as in "fri-mon".
+		for (int8_t day = from; ; day = (day + 1) % 7) {
+			days |= 1 << day;
+			if (day == to) {
+				break;
+			}
+		}
+	}
+
+	return days != 0;
+}
+
+bool QuietHoursClass::parse(const char* text, quiet_hours_t &entry) {
+	char days[32];
+	unsigned int startHour, startMinute, endHour, endMinute;
+	int mask = 0;
+	int fields = sscanf(text, " %31s %u:%u-%u:%u %i", days, &startHour, &startMinute, &endHour, &endMinute, &mask);
+	if (fields < 5 || startHour > 23 || startMinute > 59 || endMinute > 59
+		|| endHour > 24 || (endHour == 24 && endMinute > 0) || mask < 0 || mask > 0xff) {
+		return false;
+	}
+
+	if (!parseDays(days, entry.days)) {
+		return false;
+	}
+
+	entry.start = startHour * 60 + startMinute;
+	entry.end = endHour * 60 + endMinute;
+	entry.mask = mask;
+	return true;
+}
+
+size_t QuietHoursClass::format(const quiet_hours_t &entry, char* buffer, size_t size) {
+	char days[32] = "daily";
+	if (entry.days != ALL_DAYS) {
+		size_t used = 0;
+		days[0] = '\0';
+		for (uint8_t day = 0; day < 7; day++) {
+			if ((entry.days & (1 << day)) == 0) {
+				continue;
+			}
+
+			uint8_t last = day;
+			while (last < 6 && (entry.days & (1 << (last + 1))) != 0) {
+				last++;
+			}
+
+			// Only runs of three or more are written as a range.
+			if (last - day < 2) {
+				last = day;
+			}
+
+			used += snprintf(days + used, sizeof(days) - used, "%s%s", used > 0 ? "+" : "", dayNames[day]);
+			if (last != day) {
+				used += snprintf(days + used, sizeof(days) - used, "-%s", dayNames[last]);
+			}
+
+			day = last;
+		}
+	}
+
+	if (entry.mask != 0) {
+		return snprintf(buffer, size, "%s %02u:%02u-%02u:%02u %u", days, entry.start / 60, entry.start % 60,
+			entry.end / 60, entry.end % 60, entry.mask);
+	}
+
+	return snprintf(buffer, size, "%s %02u:%02u-%02u:%02u", days, entry.start / 60, entry.start % 60,
+		entry.end / 60, entry.end % 60);
+}
+
+QuietHoursClass QuietHours;
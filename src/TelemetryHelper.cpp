@@ -1,42 +1,281 @@
 #include "TelemetryHelper.h"
 #include "PubSubClient.h"
+#include "LengthCountingPrint.h"
 
-String TelemetryHelper::getMqttStateDesc(int state) {
-    String desc = "";
+struct MetricInfo {
+    const char* family;
+    const char* reason;
+    const char* key;
+    MetricType type;
+};
+
+// Metric names live in flash. Entries of the same family point at the
+// same string so the exposition can emit a single TYPE line for them.
+static const char FAMILY_RECEIVED[] PROGMEM = "cylence_mqtt_messages_received_total";
+static const char FAMILY_ACCEPTED[] PROGMEM = "cylence_mqtt_messages_accepted_total";
+static const char FAMILY_GROUP[] PROGMEM = "cylence_mqtt_group_messages_total";
+static const char FAMILY_REJECTED[] PROGMEM = "cylence_mqtt_messages_rejected_total";
+static const char FAMILY_PUBLISHES[] PROGMEM = "cylence_mqtt_publishes_total";
+static const char FAMILY_DISCOVERY[] PROGMEM = "cylence_discovery_announcements_total";
+static const char FAMILY_WIFI_RECONNECTS[] PROGMEM = "cylence_wifi_reconnects_total";
+static const char FAMILY_MQTT_RECONNECTS[] PROGMEM = "cylence_mqtt_reconnects_total";
+static const char FAMILY_BROKER_SWITCHES[] PROGMEM = "cylence_mqtt_broker_switches_total";
+static const char FAMILY_RELAY_ACTUATIONS[] PROGMEM = "cylence_relay_actuations_total";
+static const char FAMILY_BELL_PRESSES[] PROGMEM = "cylence_bell_presses_total";
+static const char FAMILY_BELL_DROPPED[] PROGMEM = "cylence_bell_events_dropped_total";
+static const char FAMILY_SILENCED[] PROGMEM = "cylence_silenced_seconds_total";
+static const char FAMILY_LOOP_OVERRUNS[] PROGMEM = "cylence_loop_overruns_total";
+static const char FAMILY_LOOP_STALLS[] PROGMEM = "cylence_loop_stalls_total";
+static const char FAMILY_LOOP_BUSY[] PROGMEM = "cylence_loop_busy_milliseconds_total";
+static const char FAMILY_LOOP_IDLE[] PROGMEM = "cylence_loop_idle_milliseconds_total";
+static const char FAMILY_WAKE_DELAY[] PROGMEM = "cylence_idle_wake_delay_milliseconds_total";
+static const char FAMILY_DELAYED_MESSAGES[] PROGMEM = "cylence_idle_delayed_messages_total";
+static const char FAMILY_CONTROL_BATCHES[] PROGMEM = "cylence_control_batches_total";
+static const char FAMILY_CONTROL_DELAY[] PROGMEM = "cylence_control_queue_delay_milliseconds_total";
+static const char FAMILY_EVENTS[] PROGMEM = "cylence_events_total";
+static const char FAMILY_EVENT_DELAY[] PROGMEM = "cylence_event_dispatch_delay_microseconds_total";
+static const char FAMILY_DIRECT[] PROGMEM = "cylence_direct_requests_total";
+static const char FAMILY_JOURNAL_RECORDS[] PROGMEM = "cylence_journal_records_total";
+static const char FAMILY_JOURNAL_FLUSHES[] PROGMEM = "cylence_journal_flushes_total";
+static const char FAMILY_HEAP_ALLOCATIONS[] PROGMEM = "cylence_heap_allocations_total";
+static const char FAMILY_HEAP_BYTES[] PROGMEM = "cylence_heap_allocated_bytes_total";
+static const char FAMILY_QUIET_HOURS[] PROGMEM = "cylence_quiet_hours_transitions_total";
+static const char FAMILY_UPTIME[] PROGMEM = "cylence_uptime_seconds";
+static const char FAMILY_FREE_HEAP[] PROGMEM = "cylence_free_heap_bytes";
+static const char FAMILY_DUTY_CYCLE[] PROGMEM = "cylence_loop_duty_cycle_percent";
+static const char FAMILY_CONTROL_GAP[] PROGMEM = "cylence_control_poll_gap_max_milliseconds";
+static const char FAMILY_CONNECT_TIME[] PROGMEM = "cylence_mqtt_connect_milliseconds";
+static const char FAMILY_CONNECTION_HEAP[] PROGMEM = "cylence_mqtt_connection_heap_bytes";
+static const char FAMILY_CONFIG_APPLY[] PROGMEM = "cylence_config_apply_milliseconds";
+static const char FAMILY_ACTIVE_BROKER[] PROGMEM = "cylence_mqtt_active_broker";
+
+static const char REASON_PARSE_ERROR[] PROGMEM = "reason=\"parse_error\"";
+static const char REASON_NO_CLIENT_ID[] PROGMEM = "reason=\"no_client_id\"";
+static const char REASON_WRONG_CLIENT[] PROGMEM = "reason=\"wrong_client\"";
+static const char REASON_INVALID_COMMAND[] PROGMEM = "reason=\"invalid_command\"";
+static const char REASON_DISABLED[] PROGMEM = "reason=\"disabled\"";
+static const char REASON_QUEUE_FULL[] PROGMEM = "reason=\"queue_full\"";
+static const char REASON_RATE_LIMITED[] PROGMEM = "reason=\"rate_limited\"";
+static const char REASON_FAILOVER[] PROGMEM = "reason=\"failover\"";
+static const char REASON_FAILBACK[] PROGMEM = "reason=\"failback\"";
+static const char PHASE_STEADY[] PROGMEM = "phase=\"steady\"";
+static const char PHASE_EXEMPT[] PROGMEM = "phase=\"exempt\"";
+static const char SILENCED_FALSE[] PROGMEM = "silenced=\"false\"";
+static const char SILENCED_TRUE[] PROGMEM = "silenced=\"true\"";
+static const char RESULT_OK[] PROGMEM = "result=\"ok\"";
+static const char RESULT_FAILED[] PROGMEM = "result=\"failed\"";
+static const char RESULT_PUBLISHED[] PROGMEM = "result=\"published\"";
+static const char RESULT_SKIPPED[] PROGMEM = "result=\"skipped\"";
+static const char RESULT_ACCEPTED[] PROGMEM = "result=\"accepted\"";
+static const char RESULT_RATE_LIMITED[] PROGMEM = "result=\"rate_limited\"";
+static const char RESULT_BAD_AUTH[] PROGMEM = "result=\"bad_auth\"";
+static const char RESULT_REPLAY[] PROGMEM = "result=\"replay\"";
+static const char RESULT_INVALID[] PROGMEM = "result=\"invalid\"";
+static const char RESULT_DISPATCHED[] PROGMEM = "result=\"dispatched\"";
+static const char RESULT_DROPPED[] PROGMEM = "result=\"dropped\"";
+
+static const char KEY_RECEIVED[] PROGMEM = "rx";
+static const char KEY_ACCEPTED[] PROGMEM = "acc";
+static const char KEY_GROUP[] PROGMEM = "accGroup";
+static const char KEY_PARSE_ERROR[] PROGMEM = "rejParse";
+static const char KEY_NO_CLIENT_ID[] PROGMEM = "rejNoId";
+static const char KEY_WRONG_CLIENT[] PROGMEM = "rejClient";
+static const char KEY_INVALID_COMMAND[] PROGMEM = "rejCmd";
+static const char KEY_DISABLED[] PROGMEM = "rejDisabled";
+static const char KEY_QUEUE_FULL[] PROGMEM = "rejQueueFull";
+static const char KEY_RATE_LIMITED[] PROGMEM = "rejRate";
+static const char KEY_PUBLISH_OK[] PROGMEM = "pubOk";
+static const char KEY_PUBLISH_FAILED[] PROGMEM = "pubFail";
+static const char KEY_DISCOVERY_PUBLISHED[] PROGMEM = "discPub";
+static const char KEY_DISCOVERY_SKIPPED[] PROGMEM = "discSkip";
+static const char KEY_WIFI_RECONNECTS[] PROGMEM = "wifiRecon";
+static const char KEY_MQTT_RECONNECTS[] PROGMEM = "mqttRecon";
+static const char KEY_FAILOVERS[] PROGMEM = "failovers";
+static const char KEY_FAILBACKS[] PROGMEM = "failbacks";
+static const char KEY_RELAY_ACTUATIONS[] PROGMEM = "relay";
+static const char KEY_BELL_PRESSES[] PROGMEM = "bell";
+static const char KEY_BELL_PRESSES_SILENCED[] PROGMEM = "bellSilenced";
+static const char KEY_BELL_DROPPED[] PROGMEM = "bellDropped";
+static const char KEY_SILENCED[] PROGMEM = "silencedSec";
+static const char KEY_LOOP_OVERRUNS[] PROGMEM = "overruns";
+static const char KEY_LOOP_STALLS[] PROGMEM = "stalls";
+static const char KEY_LOOP_BUSY[] PROGMEM = "busyMs";
+static const char KEY_LOOP_IDLE[] PROGMEM = "idleMs";
+static const char KEY_WAKE_DELAY[] PROGMEM = "wakeDelayMs";
+static const char KEY_DELAYED_MESSAGES[] PROGMEM = "wakeDelayed";
+static const char KEY_CONTROL_BATCHES[] PROGMEM = "ctlBatches";
+static const char KEY_CONTROL_DELAY[] PROGMEM = "ctlDelayMs";
+static const char KEY_EVENTS[] PROGMEM = "events";
+static const char KEY_EVENTS_DROPPED[] PROGMEM = "eventsDropped";
+static const char KEY_EVENT_DELAY[] PROGMEM = "eventDelayUs";
+static const char KEY_DIRECT_ACCEPTED[] PROGMEM = "directAcc";
+static const char KEY_DIRECT_RATE_LIMITED[] PROGMEM = "directRejRate";
+static const char KEY_DIRECT_BAD_AUTH[] PROGMEM = "directRejAuth";
+static const char KEY_DIRECT_REPLAY[] PROGMEM = "directRejReplay";
+static const char KEY_DIRECT_INVALID[] PROGMEM = "directRejCmd";
+static const char KEY_JOURNAL_RECORDS[] PROGMEM = "jrnRecords";
+static const char KEY_JOURNAL_FLUSHES[] PROGMEM = "jrnFlush";
+static const char KEY_JOURNAL_FLUSH_FAILED[] PROGMEM = "jrnFlushFail";
+static const char KEY_HEAP_ALLOCATIONS[] PROGMEM = "heapAllocs";
+static const char KEY_HEAP_ALLOCATIONS_EXEMPT[] PROGMEM = "heapAllocsExempt";
+static const char KEY_HEAP_BYTES[] PROGMEM = "heapAllocBytes";
+static const char KEY_QUIET_HOURS[] PROGMEM = "quietTransitions";
+static const char KEY_UPTIME[] PROGMEM = "uptime";
+static const char KEY_FREE_HEAP[] PROGMEM = "heap";
+static const char KEY_DUTY_CYCLE[] PROGMEM = "duty";
+static const char KEY_CONTROL_GAP[] PROGMEM = "ctlGapMax";
+static const char KEY_CONNECT_TIME[] PROGMEM = "connMs";
+static const char KEY_CONNECTION_HEAP[] PROGMEM = "connHeap";
+static const char KEY_CONFIG_APPLY[] PROGMEM = "cfgApplyMs";
+static const char KEY_ACTIVE_BROKER[] PROGMEM = "broker";
+
+// Must be kept in the same order as the Metric enum.
+static const MetricInfo metricTable[METRIC_COUNT] PROGMEM = {
+    { FAMILY_RECEIVED, NULL, KEY_RECEIVED, MetricType::COUNTER },
+    { FAMILY_ACCEPTED, NULL, KEY_ACCEPTED, MetricType::COUNTER },
+    { FAMILY_GROUP, NULL, KEY_GROUP, MetricType::COUNTER },
+    { FAMILY_REJECTED, REASON_PARSE_ERROR, KEY_PARSE_ERROR, MetricType::COUNTER },
+    { FAMILY_REJECTED, REASON_NO_CLIENT_ID, KEY_NO_CLIENT_ID, MetricType::COUNTER },
+    { FAMILY_REJECTED, REASON_WRONG_CLIENT, KEY_WRONG_CLIENT, MetricType::COUNTER },
+    { FAMILY_REJECTED, REASON_INVALID_COMMAND, KEY_INVALID_COMMAND, MetricType::COUNTER },
+    { FAMILY_REJECTED, REASON_DISABLED, KEY_DISABLED, MetricType::COUNTER },
+    { FAMILY_REJECTED, REASON_QUEUE_FULL, KEY_QUEUE_FULL, MetricType::COUNTER },
+    { FAMILY_REJECTED, REASON_RATE_LIMITED, KEY_RATE_LIMITED, MetricType::COUNTER },
+    { FAMILY_PUBLISHES, RESULT_OK, KEY_PUBLISH_OK, MetricType::COUNTER },
+    { FAMILY_PUBLISHES, RESULT_FAILED, KEY_PUBLISH_FAILED, MetricType::COUNTER },
+    { FAMILY_DISCOVERY, RESULT_PUBLISHED, KEY_DISCOVERY_PUBLISHED, MetricType::COUNTER },
+    { FAMILY_DISCOVERY, RESULT_SKIPPED, KEY_DISCOVERY_SKIPPED, MetricType::COUNTER },
+    { FAMILY_WIFI_RECONNECTS, NULL, KEY_WIFI_RECONNECTS, MetricType::COUNTER },
+    { FAMILY_MQTT_RECONNECTS, NULL, KEY_MQTT_RECONNECTS, MetricType::COUNTER },
+    { FAMILY_BROKER_SWITCHES, REASON_FAILOVER, KEY_FAILOVERS, MetricType::COUNTER },
+    { FAMILY_BROKER_SWITCHES, REASON_FAILBACK, KEY_FAILBACKS, MetricType::COUNTER },
+    { FAMILY_RELAY_ACTUATIONS, NULL, KEY_RELAY_ACTUATIONS, MetricType::COUNTER },
+    { FAMILY_BELL_PRESSES, SILENCED_FALSE, KEY_BELL_PRESSES, MetricType::COUNTER },
+    { FAMILY_BELL_PRESSES, SILENCED_TRUE, KEY_BELL_PRESSES_SILENCED, MetricType::COUNTER },
+    { FAMILY_BELL_DROPPED, NULL, KEY_BELL_DROPPED, MetricType::COUNTER },
+    { FAMILY_SILENCED, NULL, KEY_SILENCED, MetricType::COUNTER },
+    { FAMILY_LOOP_OVERRUNS, NULL, KEY_LOOP_OVERRUNS, MetricType::COUNTER },
+    { FAMILY_LOOP_STALLS, NULL, KEY_LOOP_STALLS, MetricType::COUNTER },
+    { FAMILY_LOOP_BUSY, NULL, KEY_LOOP_BUSY, MetricType::COUNTER },
+    { FAMILY_LOOP_IDLE, NULL, KEY_LOOP_IDLE, MetricType::COUNTER },
+    { FAMILY_WAKE_DELAY, NULL, KEY_WAKE_DELAY, MetricType::COUNTER },
+    { FAMILY_DELAYED_MESSAGES, NULL, KEY_DELAYED_MESSAGES, MetricType::COUNTER },
+    { FAMILY_CONTROL_BATCHES, NULL, KEY_CONTROL_BATCHES, MetricType::COUNTER },
+    { FAMILY_CONTROL_DELAY, NULL, KEY_CONTROL_DELAY, MetricType::COUNTER },
+    { FAMILY_EVENTS, RESULT_DISPATCHED, KEY_EVENTS, MetricType::COUNTER },
+    { FAMILY_EVENTS, RESULT_DROPPED, KEY_EVENTS_DROPPED, MetricType::COUNTER },
+    { FAMILY_EVENT_DELAY, NULL, KEY_EVENT_DELAY, MetricType::COUNTER },
+    { FAMILY_DIRECT, RESULT_ACCEPTED, KEY_DIRECT_ACCEPTED, MetricType::COUNTER },
+    { FAMILY_DIRECT, RESULT_RATE_LIMITED, KEY_DIRECT_RATE_LIMITED, MetricType::COUNTER },
+    { FAMILY_DIRECT, RESULT_BAD_AUTH, KEY_DIRECT_BAD_AUTH, MetricType::COUNTER },
+    { FAMILY_DIRECT, RESULT_REPLAY, KEY_DIRECT_REPLAY, MetricType::COUNTER },
+    { FAMILY_DIRECT, RESULT_INVALID, KEY_DIRECT_INVALID, MetricType::COUNTER },
+    { FAMILY_JOURNAL_RECORDS, NULL, KEY_JOURNAL_RECORDS, MetricType::COUNTER },
+    { FAMILY_JOURNAL_FLUSHES, RESULT_OK, KEY_JOURNAL_FLUSHES, MetricType::COUNTER },
+    { FAMILY_JOURNAL_FLUSHES, RESULT_FAILED, KEY_JOURNAL_FLUSH_FAILED, MetricType::COUNTER },
+    { FAMILY_HEAP_ALLOCATIONS, PHASE_STEADY, KEY_HEAP_ALLOCATIONS, MetricType::COUNTER },
+    { FAMILY_HEAP_ALLOCATIONS, PHASE_EXEMPT, KEY_HEAP_ALLOCATIONS_EXEMPT, MetricType::COUNTER },
+    { FAMILY_HEAP_BYTES, NULL, KEY_HEAP_BYTES, MetricType::COUNTER },
+    { FAMILY_QUIET_HOURS, NULL, KEY_QUIET_HOURS, MetricType::COUNTER },
+    { FAMILY_UPTIME, NULL, KEY_UPTIME, MetricType::GAUGE },
+    { FAMILY_FREE_HEAP, NULL, KEY_FREE_HEAP, MetricType::GAUGE },
+    { FAMILY_DUTY_CYCLE, NULL, KEY_DUTY_CYCLE, MetricType::GAUGE },
+    { FAMILY_CONTROL_GAP, NULL, KEY_CONTROL_GAP, MetricType::GAUGE },
+    { FAMILY_CONNECT_TIME, NULL, KEY_CONNECT_TIME, MetricType::GAUGE },
+    { FAMILY_CONNECTION_HEAP, NULL, KEY_CONNECTION_HEAP, MetricType::GAUGE },
+    { FAMILY_CONFIG_APPLY, NULL, KEY_CONFIG_APPLY, MetricType::GAUGE },
+    { FAMILY_ACTIVE_BROKER, NULL, KEY_ACTIVE_BROKER, MetricType::GAUGE }
+};
+
+uint32_t TelemetryHelper::_values[METRIC_COUNT] = { 0 };
+
+const __FlashStringHelper* TelemetryHelper::getMqttStateDesc(int state) {
     switch(state) {
         case MQTT_CONNECTION_TIMEOUT:
-            desc = "Connection timed out. No response from server";
-            break;
+            return F("Connection timed out. No response from server");
         case MQTT_CONNECTION_LOST:
-            desc = "Connection lost.";
-            break;
+            return F("Connection lost.");
         case MQTT_CONNECT_FAILED:
-            desc = "Network connection failed.";
-            break;
+            return F("Network connection failed.");
         case MQTT_DISCONNECTED:
-            desc = "Client disconnected cleanly.";
-            break;
+            return F("Client disconnected cleanly.");
         case MQTT_CONNECTED:
-            desc = "Client connected.";
-            break;
+            return F("Client connected.");
         case MQTT_CONNECT_BAD_PROTOCOL:
-            desc = "Bad protocol. Unsupported version.";
-            break;
+            return F("Bad protocol. Unsupported version.");
         case MQTT_CONNECT_BAD_CLIENT_ID:
-            desc = "Server rejected client ID.";
-            break;
+            return F("Server rejected client ID.");
         case MQTT_CONNECT_UNAVAILABLE:
-            desc = "Server unavailable.";
-            break;
+            return F("Server unavailable.");
         case MQTT_CONNECT_BAD_CREDENTIALS:
-            desc = "Bad username or password.";
-            break;
+            return F("Bad username or password.");
         case MQTT_CONNECT_UNAUTHORIZED:
-            desc = "Client not authorized.";
-            break;
+            return F("Client not authorized.");
         default:
-            desc = "Unknown MQTT status code: " + String(state);
-            break;
+            return F("Unknown MQTT status code.");
+    }
+}
+
+void TelemetryHelper::increment(Metric metric, uint32_t amount) {
+    _values[(uint8_t)metric] += amount;
+}
+
+void TelemetryHelper::set(Metric metric, uint32_t value) {
+    _values[(uint8_t)metric] = value;
+}
+
+uint32_t TelemetryHelper::get(Metric metric) {
+    return _values[(uint8_t)metric];
+}
+
+size_t TelemetryHelper::getCompactLength() {
+    LengthCountingPrint counter;
+    writeCompact(counter);
+    return counter.length;
+}
+
+void TelemetryHelper::writeCompact(Print &out) {
+    out.print('{');
+    for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+        MetricInfo info;
+        memcpy_P(&info, &metricTable[i], sizeof(info));
+
+        if (i > 0) {
+            out.print(',');
+        }
+
+        out.print('"');
+        out.print(FPSTR(info.key));
+        out.print(F("\":"));
+        out.print(_values[i]);
+    }
+
+    out.print('}');
+}
+
+void TelemetryHelper::writePrometheus(Print &out) {
+    const char* lastFamily = NULL;
+    for (uint8_t i = 0; i < METRIC_COUNT; i++) {
+        MetricInfo info;
+        memcpy_P(&info, &metricTable[i], sizeof(info));
+
+        if (info.family != lastFamily) {
+            out.print(F("# TYPE "));
+            out.print(FPSTR(info.family));
+            out.print(info.type == MetricType::COUNTER ? F(" counter\n") : F(" gauge\n"));
+            lastFamily = info.family;
+        }
+
+        out.print(FPSTR(info.family));
+        if (info.reason != NULL) {
+            out.print('{');
+            out.print(FPSTR(info.reason));
+            out.print('}');
+        }
+
+        // Exposition format wants bare LF line endings, not println()'s CRLF.
+        out.print(' ');
+        out.print(_values[i]);
+        out.print('\n');
     }
-    return desc;
-}
\ No newline at end of file
+}
@@ -2,21 +2,34 @@
 	#error This firmware is only compatible with ESP8266 controllers.
 #endif
 
+// Hands passes where no task was due to onSchedulerIdle().
+#define _TASK_SLEEP_ON_IDLE_RUN
+// Layers the control path above the housekeeping tasks.
+#define _TASK_PRIORITY
+
 #include <Arduino.h>
 #include <ESP8266WiFi.h>
 #include <WiFiClient.h>
 #include <FS.h>
 #include <time.h>
-#include <TZ.h>
 #include "ArduinoJson.h"
+#include "ConfigSchema.h"
 #include "Console.h"
 #include "ESPCrashMonitor.h"
+#include "EventBus.h"
+#include "EventQueue.h"
+#include "Forensics.h"
+#include "HeapTracker.h"
+#include "Journal.h"
 #include "LED.h"
+#include "OutputEngine.h"
 #include "PubSubClient.h"
+#include "QuietHours.h"
 #include "Relay.h"
 #include "ResetManager.h"
 #include "TaskScheduler.h"
 #include "TelemetryHelper.h"
+#include "TokenBucket.h"
 #include "config.h"
 
 #define FIRMWARE_VERSION "1.0"
@@ -25,12 +38,29 @@
 #define PIN_LED_ACTIVE 12
 #define PIN_LED_NET 15
 #define PIN_RELAY 14
+#define PIN_RELAY_2 13
+#define PIN_RELAY_3 16
+#define PIN_RELAY_4 5
+#define PIN_BELL_INPUT 4
 
 // Forward declarations
-void onRelayStateChange(RelayInfo *sender);
+void onOutputStateChange(uint8_t previous, uint8_t current);
 void onCheckWiFi();
 void onCheckMqtt();
 void onSyncClock();
+void onPublishMetrics();
+void onHeartbeat();
+void onSchedulerIdle(unsigned long duration);
+void onControlPoll();
+void onControlQueue();
+void onSyntheticLoad();
+void onHttpUpdate();
+void onMqttFailover();
+void onBrokerProbe();
+void onJournalFlush();
+void onJournalQuery();
+void onQuietHours();
+void onGroupUpdate();
 void onMqttMessage(char* topic, byte* payload, unsigned int length);
 
 // Global vars
@@ -38,19 +68,219 @@ void onMqttMessage(char* topic, byte* payload, unsigned int length);
 	#include <ESP8266mDNS.h>
 	MDNSResponder mdns;
 #endif
+#ifdef ENABLE_HTTP_UPDATE
+	#include <ESP8266HTTPClient.h>
+	#include <ESP8266httpUpdate.h>
+	Task tHttpUpdate(TASK_IMMEDIATE, TASK_ONCE, &onHttpUpdate);
+	BearSSL::PublicKey updateSigningKey(HTTP_UPDATE_SIGNING_KEY);
+	BearSSL::HashSHA256 updateHash;
+	BearSSL::SigningVerifier updateVerifier(&updateSigningKey);
+#endif
+#ifdef ENABLE_TLS
+	#include <WiFiClientSecure.h>
+	BearSSL::WiFiClientSecure secureClient;
+	BearSSL::Session tlsSession;
+	BearSSL::X509List *tlsTrustAnchors = NULL;
+#endif
+#ifdef ENABLE_DIRECT_CONTROL
+	#include <WiFiUdp.h>
+	#include <bearssl/bearssl.h>
+	WiFiUDP directUdp;
+	TokenBucket directLimiter(DIRECT_CONTROL_BURST, DIRECT_CONTROL_REFILL_MS);
+	uint32_t directLastTimestamp = 0;
+	uint32_t directLastSequence = 0;
+#endif
 WiFiClient wifiClient;
+Client *mqttTransport = &wifiClient;
 PubSubClient mqttClient(wifiClient);
 Task tCheckWiFi(CHECK_WIFI_INTERVAL, TASK_FOREVER, &onCheckWiFi);
 Task tCheckMqtt(CHECK_MQTT_INTERVAL, TASK_FOREVER, &onCheckMqtt);
 Task tClockSync(CLOCK_SYNC_INTERVAL, TASK_FOREVER, &onSyncClock);
+Task tPublishMetrics(METRICS_PUBLISH_INTERVAL, TASK_FOREVER, &onPublishMetrics);
+Task tHeartbeat(HEARTBEAT_INTERVAL * 1000UL, TASK_FOREVER, &onHeartbeat);
+Task tControlPoll(CONTROL_POLL_INTERVAL, TASK_FOREVER, &onControlPoll);
+Task tControlQueue(TASK_IMMEDIATE, TASK_ONCE, &onControlQueue);
+Task tMqttFailover(TASK_IMMEDIATE, TASK_ONCE, &onMqttFailover);
+Task tBrokerProbe(MQTT_PROBE_INTERVAL, TASK_FOREVER, &onBrokerProbe);
+Task tJournalFlush(JOURNAL_FLUSH_INTERVAL, TASK_FOREVER, &onJournalFlush);
+Task tJournalQuery(TASK_IMMEDIATE, TASK_ONCE, &onJournalQuery);
+Task tQuietHours(TASK_IMMEDIATE, TASK_ONCE, &onQuietHours);
+Task tGroupUpdate(TASK_IMMEDIATE, TASK_ONCE, &onGroupUpdate);
+#ifdef ENABLE_SYNTHETIC_LOAD
+	Task tSyntheticLoad(SYNTHETIC_LOAD_INTERVAL, TASK_FOREVER, &onSyntheticLoad);
+#endif
 Scheduler taskMan;
+Scheduler controlMan;
 HAF_LED activationLED(PIN_LED_ACTIVE, NULL);
 HAF_LED netLED(PIN_LED_NET, NULL);
-Relay bellRelay(PIN_RELAY, onRelayStateChange, "Killswitch");
+Relay outputRelays[MAX_OUTPUT_CHANNELS] = {
+	Relay(PIN_RELAY, NULL, "Killswitch"),
+	Relay(PIN_RELAY_2, NULL, "Channel2"),
+	Relay(PIN_RELAY_3, NULL, "Channel3"),
+	Relay(PIN_RELAY_4, NULL, "Channel4")
+};
+OutputEngine<MAX_OUTPUT_CHANNELS> outputs(onOutputStateChange);
+#ifdef ENABLE_METRICS_HTTP
+	WiFiServer metricsServer(METRICS_HTTP_PORT);
+	WiFiClient metricsClient;
+	unsigned long metricsRequestStart = 0;
+	uint8_t metricsLineLength = 0;
+	bool metricsHeadersStarted = false;
+	char metricsRequestLine[16];
+#endif
 config_t config;
+config_t runningConfig;
 bool filesystemMounted = false;
 volatile SystemState sysState = SystemState::BOOTING;
-volatile bool isActive = false;
+bool deferStatusPublish = false;
+bool rebootPending = false;
+bool mqttEverConnected = false;
+bool mqttWasConnected = false;
+unsigned long silencedSince = 0;
+unsigned long silencedTotalMs = 0;
+unsigned long lastLoopMicros = 0;
+unsigned long loopMicros = 0;
+unsigned long idleMicros = 0;
+unsigned long idleSleepStart = 0;
+bool idleWokeWithData = false;
+#ifdef ENABLE_BELL_INPUT
+	typedef struct {
+		uint32_t timestamp;
+	} bell_event_t;
+
+	EventQueue<bell_event_t, BELL_EVENT_QUEUE_SIZE> bellEvents;
+	volatile uint32_t lastBellPress = 0;
+	volatile uint32_t bellEventsDropped = 0;
+#endif
+unsigned long updateStart = 0;
+unsigned long updateLastReport = 0;
+uint8_t updateLastPercent = 0;
+size_t updateBytes = 0;
+unsigned long lastControlPoll = 0;
+unsigned long previousControlPoll = 0;
+unsigned long controlPollGapMax = 0;
+uint32_t journalQueryBefore = 0;
+uint8_t journalQueryLimit = JOURNAL_PAGE_SIZE;
+time_t quietHoursNext = 0;
+uint8_t quietHoursMask = 0;
+char pendingGroups[MAX_GROUPS][GROUP_NAME_SIZE];
+uint8_t pendingGroupCount = 0;
+char retiredHostname[HOSTNAME_SIZE] = "";
+char retiredDiscoveryTopic[MQTT_TOPIC_SIZE] = "";
+
+typedef struct {
+	ControlCommand cmds[MAX_BATCH_COMMANDS];
+	uint8_t count;
+	uint8_t mask;
+	CommandSource source;
+	unsigned long queuedAt;
+} control_batch_t;
+
+// Brokers in order of preference. The primary comes from mqttBroker and
+// mqttPort, the rest from mqttBackupBrokers.
+typedef struct {
+	char host[MQTT_HOST_SIZE];
+	uint16_t port;
+	unsigned long connectMs;
+	bool healthy;
+	#ifdef ENABLE_TLS
+		const char* fingerprint;    // points into config, empty for the CA file
+		int8_t maxFragment;         // MFLN support: -1 not probed yet, 0 no, 1 yes
+	#endif
+} broker_t;
+
+broker_t brokers[MAX_MQTT_BROKERS];
+uint8_t brokerCount = 0;
+uint8_t activeBroker = 0;
+uint8_t nextBrokerProbe = 0;
+int8_t failbackBroker = -1;
+
+// Socket and radio settings that trade command latency against power,
+// applied together. Indexed by config.networkProfile.
+typedef struct {
+	bool noDelay;
+	bool noSleep;
+	uint16_t keepAlive;
+	uint16_t socketTimeout;
+} network_profile_t;
+
+const network_profile_t networkProfiles[] PROGMEM = {
+	// Low power: Nagle coalesces small writes and the radio dozes between
+	// DTIM beacons, so a command can wait at the AP for a beacon interval.
+	{ false, false, LOW_POWER_KEEPALIVE, LOW_POWER_SOCKET_TIMEOUT },
+	// Low latency: every write goes out at once, the radio stays on, and a
+	// dead broker is noticed within a couple of keepalive periods.
+	{ true, true, LOW_LATENCY_KEEPALIVE, LOW_LATENCY_SOCKET_TIMEOUT }
+};
+
+// Inbound message limits, applied before a message is even copied. MQTT
+// doesn't say who published a message, so the finest grain available is
+// the topic it arrived on. The table has a slot for every topic the device
+// subscribes to. Slots are handed out as messages arrive and freed when
+// the subscriptions change.
+struct topic_limit_t {
+	uint32_t topicHash;
+	TokenBucket bucket;
+
+	topic_limit_t() : topicHash(0), bucket(MQTT_TOPIC_BURST, MQTT_TOPIC_REFILL_MS) {}
+};
+
+TokenBucket inboundLimiter(MQTT_INBOUND_BURST, MQTT_INBOUND_REFILL_MS);
+topic_limit_t topicLimits[MQTT_TOPIC_LIMITS];
+bool throttled = false;
+bool throttledPublished = false;
+unsigned long lastThrottledDrop = 0;
+
+control_batch_t controlQueue[CONTROL_QUEUE_SIZE];
+uint8_t controlQueueHead = 0;
+uint8_t controlQueueCount = 0;
+
+#ifdef ENABLE_DIRECT_CONTROL
+	#define DIRECT_PACKET_MAGIC_0 'C'
+	#define DIRECT_PACKET_MAGIC_1 'Y'
+	#define DIRECT_PACKET_VERSION 1
+	#define DIRECT_PACKET_HEADER_SIZE 14
+	#define DIRECT_PACKET_MAC_SIZE 32
+	#define DIRECT_PACKET_SIZE (DIRECT_PACKET_HEADER_SIZE + DIRECT_PACKET_MAC_SIZE)
+
+	// Direct control datagram, multi-byte fields in network byte order:
+	//   0  magic "CY"     6  timestamp (unix seconds)
+	//   2  version        10 sequence
+	//   3  command        14 HMAC-SHA256 of bytes 0-13
+	//   4  channel mask (0 = all channels)
+	//   5  status (replies only)
+	// Replies echo the header with the status filled in and are signed the
+	// same way.
+	enum DirectStatus: uint8_t {
+		DIRECT_STATUS_ACCEPTED = 0,
+		DIRECT_STATUS_REPLAY,
+		DIRECT_STATUS_INVALID,
+		DIRECT_STATUS_QUEUE_FULL
+	};
+#endif
+
+enum StatusField: uint8_t {
+	STATUS_FIELD_CLIENT_ID = 0,
+	STATUS_FIELD_FIRMWARE_VERSION,
+	STATUS_FIELD_SYSTEM_STATE,
+	STATUS_FIELD_SILENCER_STATE,
+	STATUS_FIELD_CHANNEL_MASK,
+	STATUS_FIELD_LAST_UPDATE,
+	STATUS_FIELD_COUNT
+};
+
+const char* const statusFieldNames[STATUS_FIELD_COUNT] = {
+	"clientId",
+	"firmwareVersion",
+	"systemState",
+	"silencerState",
+	"channelMask",
+	"lastUpdate"
+};
+
+// Last value published on each status sub-topic. An empty entry forces
+// the field to be (re)published.
+char statusFieldCache[STATUS_FIELD_COUNT][STATUS_FIELD_VALUE_SIZE];
 
 String getTimeInfo() {
 	time_t now = time(nullptr);
@@ -60,9 +290,28 @@ String getTimeInfo() {
 	return result;
 }
 
+void getTimeInfo(char* buffer, size_t size, time_t when) {
+	struct tm *timeinfo = localtime(&when);
+	strftime(buffer, size, "%a %b %e %H:%M:%S %Y", timeinfo);
+}
+
+void getTimeInfo(char* buffer, size_t size) {
+	getTimeInfo(buffer, size, time(nullptr));
+}
+
+// Sets the zone the clock, the journal and quiet hours all go by, and
+// (re)starts SNTP. The time already kept carries on across a zone change.
+void initClock() {
+	Serial.print(F("INFO: Time zone: "));
+	Serial.println(config.clockTimezone);
+	configTime(config.clockTimezone, CLOCK_NTP_SERVER);
+}
+
 void onSyncClock() {
+	Forensics.enter(Stage::TASK_CLOCK_SYNC);
+	HeapExemption exempt;
 	netLED.on();
-	configTime(TZ_America_New_York, "pool.ntp.org");
+	initClock();
 
 	Serial.print(F("INIT: Waiting for NTP time sync... "));
 	delay(500);
@@ -78,61 +327,418 @@ void onSyncClock() {
 	Serial.println(F("DONE"));
 	Serial.print(F("INFO: Current time: "));
 	Serial.println(getTimeInfo());
+
+	// Re-arms against the corrected clock.
+	tQuietHours.restart();
 }
 
-void publishSystemState() {
+bool publishMessage(const char* topic, const char* payload, bool retained) {
+	if (!mqttClient.publish(topic, payload, retained)) {
+		Serial.println(F("ERROR: Failed to publish message."));
+		TelemetryHelper::increment(Metric::PUBLISH_FAILED);
+		return false;
+	}
+
+	TelemetryHelper::increment(Metric::PUBLISH_OK);
+	return true;
+}
+
+uint32_t getContentHash(const char* data) {
+	// 32-bit FNV-1a. Only used to tell announcements and topics
+	// apart.
+	uint32_t hash = 2166136261UL;
+	while (*data) {
+		hash ^= (uint8_t)*data++;
+		hash *= 16777619UL;
+	}
+
+	return hash;
+}
+
+void getDeviceTopic(char* buffer, size_t size, const char* suffix) {
+	snprintf(buffer, size, "%s/%s/%s", DEVICE_CLASS, config.hostname, suffix);
+}
+
+// A group's control topic, "cylence/group/<name>/control". Every member
+// subscribes to it, so the broker fans one publish out to all of them.
+void getGroupTopic(char* buffer, size_t size, const char* group) {
+	snprintf(buffer, size, "%s%s%s", MQTT_TOPIC_GROUP_PREFIX, group, MQTT_TOPIC_GROUP_CONTROL_SUFFIX);
+}
+
+bool isValidGroupName(const char* name) {
+	size_t length = strlen(name);
+	return length > 0 && length < GROUP_NAME_SIZE && strpbrk(name, "/+#") == NULL;
+}
+
+bool isGroupControlTopic(const char* topic) {
+	size_t prefixLength = strlen(MQTT_TOPIC_GROUP_PREFIX);
+	if (strncmp(topic, MQTT_TOPIC_GROUP_PREFIX, prefixLength) != 0) {
+		return false;
+	}
+
+	const char* name = topic + prefixLength;
+	for (uint8_t i = 0; i < config.groupsCount; i++) {
+		size_t length = strlen(config.groups[i]);
+		if (strncmp(name, config.groups[i], length) == 0
+			&& strcmp(name + length, MQTT_TOPIC_GROUP_CONTROL_SUFFIX) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+// Called when every subscription is made again on connect.
+void resetTopicLimits() {
+	for (uint8_t i = 0; i < MQTT_TOPIC_LIMITS; i++) {
+		topicLimits[i] = topic_limit_t();
+	}
+}
+
+// Frees the slot of a topic the device no longer listens on. Topics it
+// still listens on keep their buckets, tokens spent and all.
+void releaseTopicLimit(const char* topic) {
+	uint32_t hash = getContentHash(topic);
+	for (uint8_t i = 0; i < MQTT_TOPIC_LIMITS; i++) {
+		if (topicLimits[i].topicHash == hash) {
+			topicLimits[i] = topic_limit_t();
+		}
+	}
+}
+
+bool containsGroup(const char groups[][GROUP_NAME_SIZE], uint8_t count, const char* name) {
+	for (uint8_t i = 0; i < count; i++) {
+		if (strcmp(groups[i], name) == 0) {
+			return true;
+		}
+	}
+
+	return false;
+}
+
+void subscribeGroup(const char* group) {
+	char topic[64];
+	getGroupTopic(topic, sizeof(topic), group);
+	Serial.print(F("INFO: Subscribing to group topic: "));
+	Serial.println(topic);
+	mqttClient.subscribe(topic);
+}
+
+void unsubscribeGroup(const char* group) {
+	char topic[64];
+	getGroupTopic(topic, sizeof(topic), group);
+	mqttClient.unsubscribe(topic);
+	releaseTopicLimit(topic);
+}
+
+void subscribeGroups(const config_t &groupConfig) {
+	for (uint8_t i = 0; i < groupConfig.groupsCount; i++) {
+		subscribeGroup(groupConfig.groups[i]);
+	}
+}
+
+// Only touches the groups that were added or removed.
+void updateGroupSubscriptions(const char from[][GROUP_NAME_SIZE], uint8_t fromCount,
+	const char to[][GROUP_NAME_SIZE], uint8_t toCount) {
+	for (uint8_t i = 0; i < fromCount; i++) {
+		if (!containsGroup(to, toCount, from[i])) {
+			unsubscribeGroup(from[i]);
+		}
+	}
+
+	for (uint8_t i = 0; i < toCount; i++) {
+		if (!containsGroup(from, fromCount, to[i])) {
+			subscribeGroup(to[i]);
+		}
+	}
+}
+
+// Retained, so a controller can see who is in which group.
+void publishGroups() {
+	StaticJsonDocument<GROUPS_DOC_SIZE> doc;
+	doc["clientId"] = config.hostname;
+	JsonArray groups = doc.createNestedArray("groups");
+	for (uint8_t i = 0; i < config.groupsCount; i++) {
+		groups.add(config.groups[i]);
+	}
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_GROUPS_SUFFIX);
+	bool success = mqttClient.beginPublish(topic, measureJson(doc), true);
+	if (success) {
+		serializeJson(doc, mqttClient);
+		success = mqttClient.endPublish() == 1;
+	}
+
+	if (success) {
+		TelemetryHelper::increment(Metric::PUBLISH_OK);
+	}
+	else {
+		Serial.println(F("ERROR: Failed to publish message."));
+		TelemetryHelper::increment(Metric::PUBLISH_FAILED);
+	}
+}
+
+void updateRuntimeMetrics() {
+	unsigned long silencedMs = silencedTotalMs;
+	if (outputs.getState() != 0) {
+		silencedMs += millis() - silencedSince;
+	}
+
+	TelemetryHelper::set(Metric::SILENCED_SECONDS, silencedMs / 1000);
+	TelemetryHelper::set(Metric::UPTIME_SECONDS, millis() / 1000);
+	TelemetryHelper::set(Metric::FREE_HEAP, ESP.getFreeHeap());
+	TelemetryHelper::set(Metric::HEAP_ALLOCATIONS, HeapTracker.getAllocations());
+	TelemetryHelper::set(Metric::HEAP_ALLOCATIONS_EXEMPT, HeapTracker.getExemptAllocations());
+	TelemetryHelper::set(Metric::HEAP_ALLOCATED_BYTES, HeapTracker.getBytes());
+	#ifdef ENABLE_BELL_INPUT
+		TelemetryHelper::set(Metric::BELL_EVENTS_DROPPED, bellEventsDropped);
+	#endif
+	TelemetryHelper::set(Metric::EVENTS_DROPPED, EventBus.getDropped());
+}
+
+void closeMetricsWindow() {
+	// Fold the loop timing accumulators into the counters. The duty cycle
+	// and poll gap gauges cover the window since the previous call, so
+	// only the metrics task calls this. Scrapes just read the result.
+	unsigned long idleMs = idleMicros / 1000;
+	unsigned long busyMs = (loopMicros - idleMicros) / 1000;
+	loopMicros = 0;
+	idleMicros = 0;
+	TelemetryHelper::increment(Metric::LOOP_IDLE_MS, idleMs);
+	TelemetryHelper::increment(Metric::LOOP_BUSY_MS, busyMs);
+	if (idleMs + busyMs > 0) {
+		TelemetryHelper::set(Metric::DUTY_CYCLE, (busyMs * 100) / (idleMs + busyMs));
+	}
+
+	TelemetryHelper::set(Metric::CONTROL_POLL_GAP_MAX, controlPollGapMax);
+	controlPollGapMax = 0;
+}
+
+void reportHeapAllocations() {
+	// Only reports when there is something new. Formatting the report
+	// may allocate, so it doesn't count against itself.
+	HeapExemption exempt;
+	if (!HeapTracker.takeChanged()) {
+		return;
+	}
+
+	HeapTracker.printSummary(Serial);
 	if (!mqttClient.connected()) {
 		return;
 	}
 
-	netLED.on();
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_HEAP_SUFFIX);
+	bool success = mqttClient.beginPublish(topic, HeapTracker.getReportLength(config.hostname), true);
+	if (success) {
+		HeapTracker.writeReport(mqttClient, config.hostname);
+		success = mqttClient.endPublish() == 1;
+	}
+
+	if (success) {
+		TelemetryHelper::increment(Metric::PUBLISH_OK);
+	}
+	else {
+		Serial.println(F("ERROR: Failed to publish message."));
+		TelemetryHelper::increment(Metric::PUBLISH_FAILED);
+	}
+}
 
-	DynamicJsonDocument doc(400);
-	doc["clientId"] = config.hostname.c_str();
+void onPublishMetrics() {
+	Forensics.enter(Stage::TASK_PUBLISH_METRICS);
+
+	// Runs even while offline so the loop timing accumulators never wrap.
+	closeMetricsWindow();
+	updateRuntimeMetrics();
+	reportHeapAllocations();
+	if (!mqttClient.connected()) {
+		return;
+	}
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_METRICS_SUFFIX);
+
+	// Streamed so the payload is not bound by the MQTT buffer size.
+	bool success = mqttClient.beginPublish(topic, TelemetryHelper::getCompactLength(), false);
+	if (success) {
+		TelemetryHelper::writeCompact(mqttClient);
+		success = mqttClient.endPublish() == 1;
+	}
+
+	if (success) {
+		TelemetryHelper::increment(Metric::PUBLISH_OK);
+	}
+	else {
+		Serial.println(F("ERROR: Failed to publish message."));
+		TelemetryHelper::increment(Metric::PUBLISH_FAILED);
+	}
+}
+
+void resetStatusFieldCache() {
+	for (uint8_t i = 0; i < STATUS_FIELD_COUNT; i++) {
+		statusFieldCache[i][0] = '\0';
+	}
+}
+
+void publishStatusFields() {
+	char values[STATUS_FIELD_COUNT][STATUS_FIELD_VALUE_SIZE];
+	strncpy(values[STATUS_FIELD_CLIENT_ID], config.hostname, STATUS_FIELD_VALUE_SIZE - 1);
+	values[STATUS_FIELD_CLIENT_ID][STATUS_FIELD_VALUE_SIZE - 1] = '\0';
+	strncpy(values[STATUS_FIELD_FIRMWARE_VERSION], FIRMWARE_VERSION, STATUS_FIELD_VALUE_SIZE);
+	snprintf(values[STATUS_FIELD_SYSTEM_STATE], STATUS_FIELD_VALUE_SIZE, "%u", (uint8_t)sysState);
+	strncpy(values[STATUS_FIELD_SILENCER_STATE], outputs.getState() != 0 ? "ON" : "OFF", STATUS_FIELD_VALUE_SIZE);
+	snprintf(values[STATUS_FIELD_CHANNEL_MASK], STATUS_FIELD_VALUE_SIZE, "%u", outputs.getState());
+	getTimeInfo(values[STATUS_FIELD_LAST_UPDATE], STATUS_FIELD_VALUE_SIZE);
+
+	char topic[96];
+	char suffix[32];
+	for (uint8_t i = 0; i < STATUS_FIELD_COUNT; i++) {
+		if (strcmp(values[i], statusFieldCache[i]) == 0) {
+			continue;
+		}
+
+		snprintf(suffix, sizeof(suffix), "status/%s", statusFieldNames[i]);
+		getDeviceTopic(topic, sizeof(topic), suffix);
+		if (publishMessage(topic, values[i], true)) {
+			strcpy(statusFieldCache[i], values[i]);
+		}
+	}
+}
+
+void publishLegacyStatus() {
+	char lastUpdate[STATUS_FIELD_VALUE_SIZE];
+	getTimeInfo(lastUpdate, sizeof(lastUpdate));
+
+	StaticJsonDocument<JSON_OBJECT_SIZE(6)> doc;
+	doc["clientId"] = (const char*)config.hostname;
 	doc["firmwareVersion"] = FIRMWARE_VERSION;
 	doc["systemState"] = (uint8_t)sysState;
-	doc["silencerState"] = isActive ? "ON" : "OFF";
-	doc["lastUpdate"] = getTimeInfo();
+	doc["silencerState"] = outputs.getState() != 0 ? "ON" : "OFF";
+	doc["channelMask"] = outputs.getState();
+	doc["lastUpdate"] = (const char*)lastUpdate;
 
-	String jsonStr;
-	size_t len = serializeJson(doc, jsonStr);
+	char payload[STATUS_PAYLOAD_SIZE];
+	serializeJson(doc, payload, sizeof(payload));
 	Serial.print(F("INFO: Publishing system state: "));
-	Serial.println(jsonStr);
-	if (!mqttClient.publish(config.mqttTopicStatus.c_str(), jsonStr.c_str(), len)) {
-		Serial.println(F("ERROR: Failed to publish message."));
+	Serial.println(payload);
+	publishMessage(config.mqttTopicStatus, payload, true);
+}
+
+void onHeartbeat() {
+	Forensics.enter(Stage::TASK_HEARTBEAT);
+	if (!mqttClient.connected()) {
+		return;
+	}
+
+	char payload[64];
+	snprintf(payload, sizeof(payload), "{\"uptime\":%lu,\"rssi\":%d,\"heap\":%u}",
+		millis() / 1000, (int)WiFi.RSSI(), (unsigned int)ESP.getFreeHeap());
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_HEARTBEAT_SUFFIX);
+	publishMessage(topic, payload, false);
+}
+
+void publishSystemState() {
+	if (!mqttClient.connected()) {
+		return;
+	}
+
+	netLED.on();
+	if (config.mqttStatusLegacy) {
+		publishLegacyStatus();
+	}
+
+	if (config.mqttStatusFields) {
+		publishStatusFields();
 	}
 
-	doc.clear();
 	netLED.off();
 }
 
+void getDiscoveryTopic(char* buffer, size_t size) {
+	// Per-device sub-topic, so every device's retained announcement survives.
+	snprintf(buffer, size, "%s/%s", config.mqttTopicDiscovery, config.hostname);
+}
+
 void publishDiscoveryPacket() {
 	if (!mqttClient.connected()) {
 		return;
 	}
 
-	DynamicJsonDocument doc(250);
-	doc["name"] = config.hostname;
-	doc["class"] = DEVICE_CLASS;
-	doc["statusTopic"] = config.mqttTopicStatus;
-	doc["controlTopic"] = config.mqttTopicControl;
+	char body[DISCOVERY_BUFFER_SIZE];
+	int len = snprintf(body, sizeof(body), "\"name\":\"%s\",\"class\":\"%s\",\"statusTopic\":\"%s\",\"controlTopic\":\"%s\",\"channels\":[",
+		config.hostname, DEVICE_CLASS, config.mqttTopicStatus, config.mqttTopicControl);
+
+	// Channel names in bit order, so consumers can decode channelMask.
+	for (uint8_t i = 0; i < outputs.getCount() && len >= 0 && (size_t)len < sizeof(body); i++) {
+		len += snprintf(body + len, sizeof(body) - len, "%s\"%s\"", i > 0 ? "," : "", outputs.getName(i));
+	}
+
+	if (len >= 0 && (size_t)len < sizeof(body)) {
+		len += snprintf(body + len, sizeof(body) - len, "]");
+	}
+
+	if (len < 0 || (size_t)len >= sizeof(body)) {
+		Serial.println(F("ERROR: Discovery packet exceeds buffer size."));
+		return;
+	}
+
+	// The version lets RedQueen skip announcements it has already processed.
+	char payload[DISCOVERY_BUFFER_SIZE + 24];
+	snprintf(payload, sizeof(payload), "{%s,\"version\":\"%08x\"}", body, getContentHash(body));
+
+	char topic[96];
+	getDiscoveryTopic(topic, sizeof(topic));
 
-	String jsonStr;
-	size_t len = serializeJson(doc, jsonStr);
+	netLED.on();
 	Serial.print(F("INFO: Publishing discovery packet: "));
-	Serial.println(jsonStr);
-	if (!mqttClient.publish(config.mqttTopicDiscovery.c_str(), jsonStr.c_str(), len)) {
-		Serial.println(F("ERROR: Failed to publish message."));
+	Serial.println(payload);
+	if (publishMessage(topic, payload, true)) {
+		TelemetryHelper::increment(Metric::DISCOVERY_PUBLISHED);
 	}
 
-	doc.clear();
 	netLED.off();
 }
 
-void onRelayStateChange(RelayInfo *sender) {
-	isActive = sender->state == RelayState::RelayClosed;
-	activationLED.setState(isActive ? LEDState::LED_On : LEDState::LED_Off);
-	publishSystemState();
+void clearDiscoveryPacket() {
+	if (!mqttClient.connected()) {
+		return;
+	}
+
+	// An empty retained message removes the announcement from the broker.
+	char topic[96];
+	getDiscoveryTopic(topic, sizeof(topic));
+	Serial.print(F("INFO: Clearing discovery packet: "));
+	Serial.println(topic);
+	publishMessage(topic, "", true);
+}
+
+void onOutputStateChange(uint8_t previous, uint8_t current) {
+	uint8_t changed = previous ^ current;
+	for (uint8_t i = 0; i < outputs.getCount(); i++) {
+		if ((changed & (1U << i)) == 0) {
+			continue;
+		}
+
+		TelemetryHelper::increment(Metric::RELAY_ACTUATIONS);
+		Serial.print(F("INFO: Channel "));
+		Serial.print(outputs.getName(i));
+		Serial.println(outputs.isActive(i) ? F(" active.") : F(" deactivated."));
+	}
+
+	// Silenced time accrues while any channel is active.
+	if (previous == 0 && current != 0) {
+		silencedSince = millis();
+	}
+	else if (previous != 0 && current == 0) {
+		silencedTotalMs += millis() - silencedSince;
+	}
+
+	if (!deferStatusPublish) {
+		publishSystemState();
+	}
 }
 
 void resumeNormal() {
@@ -159,14 +765,45 @@ void printNetworkInfo() {
 	#endif
 }
 
+void flushJournal() {
+	if (!Journal.hasPending()) {
+		return;
+	}
+
+	if (Journal.flush()) {
+		TelemetryHelper::increment(Metric::JOURNAL_FLUSHES);
+	}
+	else {
+		Serial.println(F("ERROR: Failed to write activation journal."));
+		TelemetryHelper::increment(Metric::JOURNAL_FLUSH_FAILED);
+	}
+}
+
 void reboot() {
+	Forensics.enter(Stage::REBOOTING);
+	flushJournal();
 	Serial.println(F("INFO: Rebooting..."));
 	Serial.flush();
 	delay(1000);
 	ResetManager.softReset();
 }
 
-void saveConfiguration() {
+// Binary copy of config.json, loaded at boot instead of parsing JSON.
+// Rewritten whenever config.json is.
+void saveConfigurationCache(const config_t &source) {
+	File cacheFile = SPIFFS.open(CONFIG_CACHE_PATH, "w");
+	bool saved = cacheFile && ConfigSchema.writeBinary(source, cacheFile);
+	if (cacheFile) {
+		cacheFile.close();
+	}
+
+	if (!saved) {
+		Serial.println(F("WARN: Failed to write config cache."));
+		SPIFFS.remove(CONFIG_CACHE_PATH);
+	}
+}
+
+void saveConfiguration(const config_t &source) {
 	Serial.print(F("INFO: Saving configuration to: "));
 	Serial.print(CONFIG_FILE_PATH);
 	Serial.println(F(" ... "));
@@ -176,31 +813,8 @@ void saveConfiguration() {
 		return;
 	}
 
-	DynamicJsonDocument doc(400);
-	doc["hostname"] = config.hostname;
-	doc["useDhcp"] = config.useDhcp;
-	IPAddress ipAddr = IPAddress(config.ip);
-	doc["ip"] = ipAddr.toString();
-	ipAddr = IPAddress(config.gw);
-	doc["gateway"] = ipAddr.toString();
-	ipAddr = IPAddress(config.sm);
-	doc["subnetmask"] = ipAddr.toString();
-	ipAddr = IPAddress(config.dns);
-	doc["dnsServer"] = ipAddr.toString();
-	doc["wifiSSID"] = config.ssid;
-	doc["wifiPassword"] = config.password;
-	doc["timezone"] = config.clockTimezone;
-	doc["mqttBroker"] = config.mqttBroker;
-	doc["mqttPort"] = config.mqttPort;
-	doc["mqttControlTopic"] = config.mqttTopicControl;
-	doc["mqttStatusTopic"] = config.mqttTopicStatus;
-	doc["mqttDiscoveryTopic"] = config.mqttTopicDiscovery;
-	doc["mqttUsername"] = config.mqttUsername;
-	doc["mqttPassword"] = config.mqttPassword;
-	#ifdef ENABLE_OTA
-		doc["otaPort"] = config.otaPort;
-		doc["otaPassword"] = config.otaPassword;
-	#endif
+	DynamicJsonDocument doc(CONFIG_DOC_SIZE);
+	ConfigSchema.write(source, doc, false);
 
 	File configFile = SPIFFS.open(CONFIG_FILE_PATH, "w");
 	if (!configFile) {
@@ -214,44 +828,32 @@ void saveConfiguration() {
 	doc.clear();
 	configFile.flush();
 	configFile.close();
+	saveConfigurationCache(source);
 	Serial.println(F("DONE"));
 }
 
-void printWarningAndContinue(const __FlashStringHelper *message) {
-	Serial.println();
-	Serial.println(message);
-	Serial.println(F("INFO: Continuing... "));
-}
-
-void setConfigurationDefaults() {
-	String chipId = String(ESP.getChipId(), HEX);
-	String defHostname = String(DEVICE_NAME) + "_" + chipId;
-
-	config.hostname = defHostname;
-	config.ip = defaultIp;
-	config.mqttBroker = MQTT_BROKER;
-	config.mqttPassword = "";
-	config.mqttPort = MQTT_PORT;
-	config.mqttTopicControl = MQTT_TOPIC_CONTROL;
-	config.mqttTopicStatus = MQTT_TOPIC_STATUS;
-	config.mqttTopicDiscovery = MQTT_TOPIC_DISCOVERY;
-	config.mqttUsername = "";
-	config.password = DEFAULT_PASSWORD;
-	config.sm = defaultSm;
-	config.ssid = DEFAULT_SSID;
-	config.useDhcp = false;
-	config.clockTimezone = CLOCK_TIMEZONE;
-	config.dns = defaultDns;
-	config.gw = defaultGw;
-	
-	#ifdef ENABLE_OTA
-		config.otaPort = config.otaPort;
-		config.otaPassword = config.otaPassword;
-	#endif
+bool loadConfigurationCache() {
+	if (!SPIFFS.exists(CONFIG_CACHE_PATH)) {
+		return false;
+	}
+
+	File cacheFile = SPIFFS.open(CONFIG_CACHE_PATH, "r");
+	if (!cacheFile) {
+		return false;
+	}
+
+	bool loaded = ConfigSchema.readBinary(cacheFile, config);
+	cacheFile.close();
+	if (!loaded) {
+		// Written by another firmware or damaged. config.json replaces it.
+		ConfigSchema.setDefaults(config);
+	}
+
+	return loaded;
 }
 
 void loadConfiguration() {
-	memset(&config, 0, sizeof(config));
+	ConfigSchema.setDefaults(config);
 
 	Serial.print(F("INFO: Loading config file "));
 	Serial.print(CONFIG_FILE_PATH);
@@ -265,7 +867,12 @@ void loadConfiguration() {
 	if (!SPIFFS.exists(CONFIG_FILE_PATH)) {
 		Serial.println(F("FAIL"));
 		Serial.println(F("WARN: Config file does not exist. Creating with default config... "));
-		saveConfiguration();
+		saveConfiguration(config);
+		return;
+	}
+
+	if (loadConfigurationCache()) {
+		Serial.println(F("DONE (cached)"));
 		return;
 	}
 
@@ -276,19 +883,21 @@ void loadConfiguration() {
 		return;
 	}
 
+	// Nothing the schema writes comes close, so a bigger file is damaged
+	// and isn't allowed to take the heap with it.
 	size_t size = configFile.size();
-	uint16_t freeMem = ESP.getMaxFreeBlockSize() - 512;
-	if (size > freeMem) {
+	if (size > CONFIG_DOC_SIZE) {
 		Serial.println(F("FAIL"));
-		Serial.print(F("ERROR: Not enough free memory to load document. Size = "));
+		Serial.print(F("ERROR: Config file too large. Size = "));
 		Serial.print(size);
-		Serial.print(F(", Free = "));
-		Serial.println(freeMem);
+		Serial.print(F(", Max = "));
+		Serial.print(CONFIG_DOC_SIZE);
+		Serial.println(F(". Using default config."));
 		configFile.close();
 		return;
 	}
 
-	DynamicJsonDocument doc(freeMem);
+	DynamicJsonDocument doc(CONFIG_DOC_SIZE);
 	DeserializationError error = deserializeJson(doc, configFile);
 	if (error) {
 		Serial.println(F("FAIL"));
@@ -297,107 +906,45 @@ void loadConfiguration() {
 		return;
 	}
 
-	doc.shrinkToFit();
 	configFile.close();
 
-	String chipId = String(ESP.getChipId(), HEX);
-	String defHostname = String(DEVICE_NAME) + "_" + chipId;
-
-	config.hostname = doc.containsKey("hostname") ? doc["hostname"].as<String>() : defHostname;
-	config.useDhcp = doc.containsKey("isDhcp") ? doc["isDhcp"].as<bool>() : false;
-
-	if (doc.containsKey("ip")) {
-		if (!config.ip.fromString(doc["ip"].as<String>())) {
-			printWarningAndContinue(F("WARN: Invalid IP in configuration. Falling back to factory default."));
-		}
-	}
-	else {
-		config.ip = defaultIp;
-	}
-
-	if (doc.containsKey("gateway")) {
-		if (!config.gw.fromString(doc["gateway"].as<String>())) {
-			printWarningAndContinue(F("WARN: Invalid gateway in configuration. Falling back to factory default."));
-		}
-	}
-	else {
-		config.gw = defaultGw;
-	}
+	ConfigSchema.read(doc.as<JsonObjectConst>(), config, true);
+	doc.clear();
+	saveConfigurationCache(config);
+	Serial.println(F("DONE"));
+}
 
-	if (doc.containsKey("subnetmask")) {
-		if (!config.sm.fromString(doc["subnetmask"].as<String>())) {
-			printWarningAndContinue(F("WARN: Invalid subnet mask in configuration. Falling back to factory default."));
-		}
-	}
-	else {
-		config.sm = defaultSm;
+// Confirmed at the console before it gets here.
+bool doFactoryRestore() {
+	Serial.println();
+	clearDiscoveryPacket();
+	Serial.print(F("INFO: Clearing current config... "));
+	if (!filesystemMounted) {
+		Serial.println(F("FAIL"));
+		Serial.println(F("ERROR: Filesystem not mounted."));
+		return false;
 	}
 
-	if (doc.containsKey("dnsServer")) {
-		if (!config.dns.fromString(doc["dnsServer"].as<String>())) {
-			printWarningAndContinue(F("WARN: Invalid DNS IP in configuration. Falling back to factory default."));
-		}
-	}
-	else {
-		config.dns = defaultDns;
+	if (!SPIFFS.remove(CONFIG_FILE_PATH)) {
+		Serial.println(F("FAIL"));
+		Serial.println(F("ERROR: Failed to delete configuration file."));
+		return false;
 	}
 
-	config.ssid = doc.containsKey("wifiSSID") ? doc["wifiSSID"].as<String>() : DEFAULT_SSID;
-	config.password = doc.containsKey("wifiPassword") ? doc["wifiPassword"].as<String>() : DEFAULT_PASSWORD;
-	config.clockTimezone = doc.containsKey("timezone") ? doc["timezone"].as<uint8_t>() : CLOCK_TIMEZONE;
-	config.mqttBroker = doc.containsKey("mqttBroker") ? doc["mqttBroker"].as<String>() : MQTT_BROKER;
-	config.mqttPort = doc.containsKey("mqttPort") ? doc["mqttPort"].as<int>() : MQTT_PORT;
-	config.mqttTopicControl = doc.containsKey("mqttControlTopic") ? doc["mqttControlTopic"].as<String>() : MQTT_TOPIC_CONTROL;
-	config.mqttTopicStatus = doc.containsKey("mqttStatusTopic") ? doc["mqttStatusTopic"].as<String>() : MQTT_TOPIC_STATUS;
-	config.mqttTopicDiscovery = doc.containsKey("mqttDiscoveryTopic") ? doc["mqttDiscoveryTopic"].as<String>() : MQTT_TOPIC_DISCOVERY;
-	config.mqttUsername = doc.containsKey("mqttUsername") ? doc["mqttUsername"].as<String>() : "";
-	config.mqttPassword = doc.containsKey("mqttPassword") ? doc["mqttPassword"].as<String>() : "";
-
-	#ifdef ENABLE_OTA
-		config.otaPort = doc.containsKey("otaPort") ? doc["otaPort"].as<uint16_t>() : OTA_HOST_PORT;
-		config.otaPassword = doc.containsKey("otaPassword") ? doc["otaPassword"].as<String>() : OTA_PASSWORD;
-	#endif
-
-	doc.clear();
+	SPIFFS.remove(CONFIG_CACHE_PATH);
 	Serial.println(F("DONE"));
-}
+	Serial.print(F("INFO: Removed file: "));
+	Serial.println(CONFIG_FILE_PATH);
 
-void doFactoryRestore() {
-	Serial.println();
-	Serial.println(F("Are you sure you wish to restore to factory defaults? (Y/n)"));
-	Console.waitForUserInput();
-
-	String str = Console.getInputString();
-	str.toLowerCase();
-	if (str == "y") {
-		Serial.print(F("INFO: Clearing current config... "));
-		if (filesystemMounted) {
-			if (SPIFFS.remove(CONFIG_FILE_PATH)) {
-				Serial.println(F("DONE"));
-				Serial.print(F("INFO: Removed file: "));
-				Serial.println(CONFIG_FILE_PATH);
-
-				Serial.print(F("INFO: Rebooting in "));
-				for (uint8_t i = 5; i >= 1; i--) {
-					Serial.print(i);
-					Serial.print(F(" "));
-					delay(1000);
-				}
-
-				reboot();
-			}
-			else {
-				Serial.println(F("FAIL"));
-				Serial.println(F("ERROR: Failed to delete configuration file."));
-			}
-		}
-		else {
-			Serial.println(F("FAIL"));
-			Serial.println(F("ERROR: Filesystem not mounted."));
-		}
+	Serial.print(F("INFO: Rebooting in "));
+	for (uint8_t i = 5; i >= 1; i--) {
+		Serial.print(i);
+		Serial.print(F(" "));
+		delay(1000);
 	}
 
-	Serial.println();
+	reboot();
+	return true;
 }
 
 void printAvailableNetworks() {
@@ -416,41 +963,169 @@ void printAvailableNetworks() {
 	Serial.println(F("----------------------------------"));
 }
 
-bool reconnectMqttClient() {
-	if (mqttClient.connected()) {
-		return true;
+void publishDiagnostics() {
+	if (!filesystemMounted || !SPIFFS.exists(FORENSICS_REPORT_PATH)) {
+		return;
 	}
 
-	netLED.on();
-	Serial.print(F("INFO: Attempting to establish MQTT connection to "));
-	Serial.print(config.mqttBroker);
-	Serial.print(F(" on port "));
-	Serial.print(config.mqttPort);
-	Serial.println(F(" ... "));
-	
-	bool didConnect = false;
-	if (config.mqttUsername.length() > 0 && config.mqttPassword.length() > 0) {
-		didConnect = mqttClient.connect(config.hostname.c_str(), config.mqttUsername.c_str(), config.mqttPassword.c_str());
+	File report = SPIFFS.open(FORENSICS_REPORT_PATH, "r");
+	if (!report) {
+		return;
 	}
-	else {
-		didConnect = mqttClient.connect(config.hostname.c_str());
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_DIAGNOSTICS_SUFFIX);
+	Serial.print(F("INFO: Publishing crash report to: "));
+	Serial.println(topic);
+
+	// Streamed straight from flash so the report never has to fit in RAM.
+	bool success = mqttClient.beginPublish(topic, report.size(), true);
+	if (success) {
+		uint8_t chunk[64];
+		size_t count;
+		while ((count = report.read(chunk, sizeof(chunk))) > 0) {
+			mqttClient.write(chunk, count);
+		}
+
+		success = mqttClient.endPublish() == 1;
+	}
+
+	report.close();
+	if (success) {
+		TelemetryHelper::increment(Metric::PUBLISH_OK);
+		SPIFFS.remove(FORENSICS_REPORT_PATH);
+	}
+	else {
+		Serial.println(F("ERROR: Failed to publish message."));
+		TelemetryHelper::increment(Metric::PUBLISH_FAILED);
+	}
+}
+
+// Removes the retained availability and discovery announcements left
+// under the name the device went by before a live rename. A clean
+// disconnect sends no will, so the old availability would say "online"
+// for good.
+void clearRetiredIdentity() {
+	if (retiredHostname[0] == '\0') {
+		return;
+	}
+
+	bool success = true;
+	char topic[96];
+	if (strcmp(retiredHostname, config.hostname) != 0) {
+		snprintf(topic, sizeof(topic), "%s/%s/%s", DEVICE_CLASS, retiredHostname, MQTT_TOPIC_AVAILABILITY_SUFFIX);
+		success &= publishMessage(topic, "", true);
+	}
+
+	if (strcmp(retiredHostname, config.hostname) != 0 || strcmp(retiredDiscoveryTopic, config.mqttTopicDiscovery) != 0) {
+		snprintf(topic, sizeof(topic), "%s/%s", retiredDiscoveryTopic, retiredHostname);
+		Serial.print(F("INFO: Clearing discovery packet: "));
+		Serial.println(topic);
+		success &= publishMessage(topic, "", true);
+	}
+
+	if (success) {
+		retiredHostname[0] = '\0';
+	}
+}
+
+bool reconnectMqttClient() {
+	// Opening a connection allocates its socket (and TLS buffers).
+	HeapExemption exempt;
+	if (mqttClient.connected()) {
+		return true;
+	}
+
+	netLED.on();
+	Serial.print(F("INFO: Attempting to establish MQTT connection to "));
+	Serial.print(brokers[activeBroker].host);
+	Serial.print(F(" on port "));
+	Serial.print(brokers[activeBroker].port);
+	Serial.println(F(" ... "));
+	
+	// The broker publishes the retained "offline" will for us as soon as the
+	// keepalive window lapses, so controllers don't have to wait on status.
+	char availabilityTopic[96];
+	getDeviceTopic(availabilityTopic, sizeof(availabilityTopic), MQTT_TOPIC_AVAILABILITY_SUFFIX);
+
+	#ifdef ENABLE_TLS
+		// Certificate validity dates can only be checked once NTP has run.
+		if (mqttTransport == &secureClient && time(nullptr) > CLOCK_VALID_AFTER) {
+			secureClient.setX509Time(time(nullptr));
+		}
+	#endif
+
+	uint32_t heapBefore = ESP.getFreeHeap();
+	unsigned long connectStart = millis();
+	bool didConnect = false;
+	if (config.mqttUsername[0] != '\0' && config.mqttPassword[0] != '\0') {
+		didConnect = mqttClient.connect(config.hostname, config.mqttUsername, config.mqttPassword,
+			availabilityTopic, 0, true, MQTT_PAYLOAD_OFFLINE);
+	}
+	else {
+		didConnect = mqttClient.connect(config.hostname, availabilityTopic, 0, true, MQTT_PAYLOAD_OFFLINE);
 	}
 
 	if (didConnect) {
+		// Covers TCP, any TLS handshake and the MQTT CONNECT exchange. The
+		// heap figure is what the open connection holds on to.
+		unsigned long connectTime = millis() - connectStart;
+		uint32_t heapAfter = ESP.getFreeHeap();
+		uint32_t heapUsed = heapBefore > heapAfter ? heapBefore - heapAfter : 0;
+		TelemetryHelper::set(Metric::MQTT_CONNECT_MS, connectTime);
+		TelemetryHelper::set(Metric::MQTT_CONNECTION_HEAP, heapUsed);
+		brokers[activeBroker].connectMs = connectTime;
+		brokers[activeBroker].healthy = true;
+		Serial.print(F("INFO: MQTT connected in "));
+		Serial.print(connectTime);
+		Serial.print(F(" ms, connection heap: "));
+		Serial.print(heapUsed);
+		Serial.println(F(" bytes"));
+
+		if (mqttEverConnected) {
+			TelemetryHelper::increment(Metric::MQTT_RECONNECTS);
+		}
+
+		mqttEverConnected = true;
+		mqttWasConnected = true;
+
+		clearRetiredIdentity();
+		publishMessage(availabilityTopic, MQTT_PAYLOAD_ONLINE, true);
+
+		// The broker may have lost our retained fields while we were away.
+		resetStatusFieldCache();
+		resetTopicLimits();
 		Serial.print(F("INFO: Subscribing to topic: "));
 		Serial.println(config.mqttTopicControl);
-		mqttClient.subscribe(config.mqttTopicControl.c_str());
+		mqttClient.subscribe(config.mqttTopicControl);
+
+		char journalTopic[96];
+		getDeviceTopic(journalTopic, sizeof(journalTopic), MQTT_TOPIC_JOURNAL_REQUEST_SUFFIX);
+		mqttClient.subscribe(journalTopic);
+
+		char groupsTopic[96];
+		getDeviceTopic(groupsTopic, sizeof(groupsTopic), MQTT_TOPIC_GROUPS_REQUEST_SUFFIX);
+		mqttClient.subscribe(groupsTopic);
+		subscribeGroups(config);
+		publishGroups();
 
 		Serial.print(F("INFO: Publishing to topic: "));
 		Serial.println(config.mqttTopicStatus);
 
 		Serial.print(F("INFO: Discovery topic: "));
 		Serial.println(config.mqttTopicDiscovery);
+
+		publishDiagnostics();
+		publishDiscoveryPacket();
 	}
 	else {
-		String failReason = TelemetryHelper::getMqttStateDesc(mqttClient.state());
+		brokers[activeBroker].healthy = false;
+		int state = mqttClient.state();
 		Serial.print(F("ERROR: Failed to connect to MQTT broker: "));
-		Serial.println(failReason);
+		Serial.print(TelemetryHelper::getMqttStateDesc(state));
+		Serial.print(F(" (rc = "));
+		Serial.print(state);
+		Serial.println(F(")"));
 	}
 
 	netLED.off();
@@ -458,37 +1133,284 @@ bool reconnectMqttClient() {
 }
 
 void onCheckMqtt() {
+	Forensics.enter(Stage::TASK_CHECK_MQTT);
 	Serial.println(F("INFO: Checking MQTT connection status... "));
+	bool wasConnected = mqttClient.connected();
 	if (reconnectMqttClient()) {
 		Serial.println(F("INFO: Successfully reconnected to MQTT broker."));
 		publishSystemState();
-		publishDiscoveryPacket();
+		if (wasConnected) {
+			// Still retained on the broker from when we connected.
+			TelemetryHelper::increment(Metric::DISCOVERY_SKIPPED);
+		}
 	}
 	else {
 		Serial.println(F("ERROR: MQTT connection lost and reconnect failed."));
-		Serial.print(F("INFO: Retrying connection in "));
-		Serial.print(CHECK_MQTT_INTERVAL % 1000);
-		Serial.println(F(" seconds ..."));
+		if (!tMqttFailover.isEnabled()) {
+			tMqttFailover.restart();
+		}
+	}
+}
+
+void initBrokers() {
+	brokerCount = 0;
+	broker_t &primary = brokers[brokerCount++];
+	strlcpy(primary.host, config.mqttBroker, sizeof(primary.host));
+	primary.port = config.mqttPort;
+	primary.connectMs = 0;
+	primary.healthy = true;
+	#ifdef ENABLE_TLS
+		primary.fingerprint = config.mqttFingerprint;
+		primary.maxFragment = -1;
+		if (config.mqttBackupFingerprintsCount > config.mqttBackupBrokersCount) {
+			Serial.println(F("WARN: More backup broker fingerprints than backup brokers. Extras are ignored."));
+		}
+	#endif
+	for (uint8_t i = 0; i < config.mqttBackupBrokersCount && brokerCount < MAX_MQTT_BROKERS; i++) {
+		// "host" or "host:port". The port defaults to the primary's.
+		const char* entry = config.mqttBackupBrokers[i];
+		const char* colon = strrchr(entry, ':');
+		broker_t &broker = brokers[brokerCount++];
+		strlcpy(broker.host, entry, colon > entry ? colon - entry + 1 : sizeof(broker.host));
+		broker.port = colon > entry ? atoi(colon + 1) : config.mqttPort;
+		broker.connectMs = 0;
+		broker.healthy = true;
+		#ifdef ENABLE_TLS
+			// Backups without their own pin share the primary's certificate
+			// (or the CA file).
+			broker.fingerprint = i < config.mqttBackupFingerprintsCount ? config.mqttBackupFingerprints[i] : config.mqttFingerprint;
+			broker.maxFragment = -1;
+		#endif
+	}
+
+	activeBroker = 0;
+	nextBrokerProbe = 0;
+	failbackBroker = -1;
+}
+
+// Measures a bare TCP connect, which is what separates one broker from
+// another on the LAN. Bounded by MQTT_PROBE_TIMEOUT.
+void probeBroker(uint8_t index) {
+	HeapExemption exempt;
+	ESPCrashMonitor.defer();
+	WiFiClient probe;
+	probe.setTimeout(MQTT_PROBE_TIMEOUT);
+	unsigned long start = millis();
+	bool reachable = probe.connect(brokers[index].host, brokers[index].port);
+	unsigned long elapsed = millis() - start;
+	probe.stop();
+
+	brokers[index].healthy = reachable;
+	if (reachable) {
+		brokers[index].connectMs = elapsed;
+	}
+
+	Serial.print(F("INFO: Broker probe "));
+	Serial.print(brokers[index].host);
+	Serial.print(F(":"));
+	Serial.print(brokers[index].port);
+	if (reachable) {
+		Serial.print(F(" connected in "));
+		Serial.print(elapsed);
+		Serial.println(F(" ms"));
+	}
+	else {
+		Serial.println(F(" unreachable"));
 	}
 }
 
-void activate() {
-	Serial.println(F("INFO: Killswitch active."));
-	bellRelay.close();
+// Whether the broker honours the TLS max fragment length extension, which
+// is what lets configureTls() use the small buffers. A handshake of its
+// own, so it gets a probe run to itself.
+void probeMaxFragment(uint8_t index) {
+	#ifdef ENABLE_TLS
+		HeapExemption exempt;
+		ESPCrashMonitor.defer();
+		broker_t &broker = brokers[index];
+		bool supported = BearSSL::WiFiClientSecure::probeMaxFragmentLength(broker.host, broker.port, TLS_RX_BUFFER_SIZE);
+		broker.maxFragment = supported ? 1 : 0;
+		Serial.print(F("INFO: Broker "));
+		Serial.print(broker.host);
+		Serial.println(supported ? F(" supports TLS max fragment length") : F(" lacks TLS max fragment length"));
+	#endif
 }
 
-void deactivate() {
-	Serial.println(F("INFO: Killswitch deactivated."));
-	bellRelay.open();
+// Picks the earliest listed healthy broker that is within
+// MQTT_LATENCY_TOLERANCE of the fastest one, so list order wins unless a
+// broker is clearly slower. With nothing healthy, moves down the list.
+uint8_t selectBroker() {
+	unsigned long fastest = ULONG_MAX;
+	for (uint8_t i = 0; i < brokerCount; i++) {
+		if (brokers[i].healthy && brokers[i].connectMs < fastest) {
+			fastest = brokers[i].connectMs;
+		}
+	}
+
+	if (fastest == ULONG_MAX) {
+		return (activeBroker + 1) % brokerCount;
+	}
+
+	for (uint8_t i = 0; i < brokerCount; i++) {
+		if (brokers[i].healthy && brokers[i].connectMs <= fastest + MQTT_LATENCY_TOLERANCE) {
+			return i;
+		}
+	}
+
+	return activeBroker;
 }
 
-void handleControlRequest(ControlCommand cmd) {
+// Trust and buffer sizes depend on the broker, so they are set again on
+// every switch. Anything that fails here fails the handshake, never
+// downgrades it.
+void configureTls(uint8_t index) {
+	#ifdef ENABLE_TLS
+		if (mqttTransport != &secureClient) {
+			return;
+		}
+
+		const broker_t &broker = brokers[index];
+		Serial.print(F("INFO: Configuring TLS for "));
+		Serial.print(broker.host);
+		Serial.print(F("... "));
+		if (broker.fingerprint[0] != '\0') {
+			if (!secureClient.setFingerprint(broker.fingerprint)) {
+				secureClient.setTrustAnchors(NULL);
+				Serial.println(F("FAIL"));
+				Serial.println(F("ERROR: Invalid MQTT broker fingerprint."));
+				return;
+			}
+		}
+		else if (tlsTrustAnchors != NULL) {
+			secureClient.setTrustAnchors(tlsTrustAnchors);
+		}
+		else {
+			secureClient.setTrustAnchors(NULL);
+			Serial.println(F("FAIL"));
+			Serial.println(F("ERROR: TLS requires a pinned fingerprint or a CA file."));
+			return;
+		}
+
+		// Smaller buffers are only safe once probeMaxFragment() has found
+		// the broker honours the max fragment length extension. Until then
+		// BearSSL needs the full 16K.
+		if (broker.maxFragment > 0) {
+			secureClient.setBufferSizes(TLS_RX_BUFFER_SIZE, TLS_TX_BUFFER_SIZE);
+			Serial.println(F("DONE (reduced buffers)"));
+		}
+		else {
+			secureClient.setBufferSizes(TLS_FULL_RX_BUFFER_SIZE, TLS_TX_BUFFER_SIZE);
+			Serial.println(F("DONE (full buffers)"));
+		}
+	#endif
+}
+
+void useBroker(uint8_t index) {
+	activeBroker = index;
+	mqttClient.setServer(brokers[index].host, brokers[index].port);
+	configureTls(index);
+	TelemetryHelper::set(Metric::MQTT_ACTIVE_BROKER, index);
+}
+
+// Runs once the control task notices the connection dropped. Tries one
+// broker per run so the loop keeps turning between attempts.
+void onMqttFailover() {
+	Forensics.enter(Stage::TASK_MQTT_FAILOVER);
+	if (mqttClient.connected()) {
+		return;
+	}
+
+	brokers[activeBroker].healthy = false;
+	uint8_t next = selectBroker();
+	if (next != activeBroker) {
+		Serial.print(F("WARN: Failing over to MQTT broker "));
+		Serial.println(brokers[next].host);
+		TelemetryHelper::increment(Metric::MQTT_FAILOVERS);
+		useBroker(next);
+	}
+
+	if (reconnectMqttClient()) {
+		publishSystemState();
+		return;
+	}
+
+	tMqttFailover.restartDelayed(MQTT_FAILOVER_RETRY);
+}
+
+// Moves back to a better broker (normally the primary) that a probe found
+// healthy again.
+void returnToBroker(uint8_t index) {
+	Serial.print(F("INFO: Returning to MQTT broker "));
+	Serial.println(brokers[index].host);
+	ESPCrashMonitor.defer();
+	mqttClient.disconnect();
+	useBroker(index);
+	if (reconnectMqttClient()) {
+		TelemetryHelper::increment(Metric::MQTT_FAILBACKS);
+		publishSystemState();
+	}
+	else {
+		// Failover finds the one that was working, one broker per run.
+		tMqttFailover.restart();
+	}
+}
+
+// Does one blocking step per run, each bounded well under the watchdog:
+// a pending return to a better broker, or one probe of one broker.
+// Standby brokers get their connect time measured, and over TLS every
+// broker (the active one too) gets one max fragment length probe.
+void onBrokerProbe() {
+	Forensics.enter(Stage::TASK_BROKER_PROBE);
+	if (!mqttClient.connected()) {
+		return;
+	}
+
+	if (failbackBroker >= 0) {
+		uint8_t target = failbackBroker;
+		failbackBroker = -1;
+		if (target != activeBroker && brokers[target].healthy) {
+			returnToBroker(target);
+		}
+		return;
+	}
+
+	nextBrokerProbe = (nextBrokerProbe + 1) % brokerCount;
+	#ifdef ENABLE_TLS
+		if (mqttTransport == &secureClient && brokers[nextBrokerProbe].maxFragment < 0) {
+			probeMaxFragment(nextBrokerProbe);
+			return;
+		}
+	#endif
+
+	if (nextBrokerProbe == activeBroker) {
+		// Measured by its own connect.
+		nextBrokerProbe = (nextBrokerProbe + 1) % brokerCount;
+		if (nextBrokerProbe == activeBroker) {
+			return;
+		}
+	}
+
+	probeBroker(nextBrokerProbe);
+	uint8_t best = selectBroker();
+	if (best != activeBroker && brokers[best].healthy) {
+		// On the next run, not on top of this probe.
+		failbackBroker = best;
+		tBrokerProbe.forceNextIteration();
+	}
+}
+
+bool isValidControlCommand(uint8_t cmd) {
+	return cmd <= (uint8_t)ControlCommand::UPDATE;
+}
+
+void applyControlCommand(ControlCommand cmd, uint8_t mask, uint8_t &state) {
+	Forensics.recordCommand((uint8_t)cmd);
 	if (sysState == SystemState::DISABLED && cmd != ControlCommand::ENABLE) {
 		// THOU SHALT NOT PASS!!!
 		// We can't process this command because we are disabled.
 		Serial.print(F("WARN: Ignoring command "));
 		Serial.print((uint8_t)cmd);
 		Serial.println(F(" because the system is currently disabled."));
+		TelemetryHelper::increment(Metric::REJECTED_DISABLED);
 		return;
 	}
 
@@ -502,72 +1424,691 @@ void handleControlRequest(ControlCommand cmd) {
 			sysState = SystemState::DISABLED;
 			break;
 		case ControlCommand::REBOOT:
-			reboot();
+			// Deferred until the resulting state has been published.
+			rebootPending = true;
 			break;
 		case ControlCommand::REQUEST_STATUS:
 			break;
 		case ControlCommand::ACTIVATE:
-			isActive ? deactivate() : activate();
+			// Toggles the addressed channels as a group. If any of them is
+			// active they all go off, otherwise they all come on.
+			state = (state & mask) != 0 ? (state & ~mask) : (state | mask);
+			break;
+		case ControlCommand::OUTPUTS_ON:
+			state |= mask;
+			break;
+		case ControlCommand::OUTPUTS_OFF:
+			state &= ~mask;
+			break;
+		case ControlCommand::UPDATE:
+			#ifdef ENABLE_HTTP_UPDATE
+				// Jittered so a fleet-wide rollout doesn't hit the update
+				// server all at once.
+				Serial.println(F("INFO: HTTP update requested."));
+				tHttpUpdate.restartDelayed(random(HTTP_UPDATE_JITTER + 1));
+			#else
+				Serial.println(F("WARN: HTTP update support is not enabled."));
+			#endif
 			break;
 		default:
 			Serial.print(F("WARN: Unknown command: "));
 			Serial.println((uint8_t)cmd);
 			break;
 	}
+}
+
+void recordStateChange(CommandSource source, ControlCommand cmd, uint8_t previous, uint8_t current) {
+	// Silenced time is charged to the change that ends it.
+	uint32_t durationMs = previous != 0 && current == 0 ? millis() - silencedSince : 0;
+	TelemetryHelper::increment(Metric::JOURNAL_RECORDS);
+	if (Journal.record(source, cmd, current, sysState == SystemState::DISABLED, durationMs)) {
+		// A full batch is written by the housekeeping layer, not here.
+		tJournalFlush.forceNextIteration();
+	}
+}
+
+void handleControlBatch(const ControlCommand *cmds, uint8_t count, uint8_t mask, CommandSource source) {
+	// Apply every command in order and publish the resulting state once,
+	// rather than once per command (and once more per relay change). The
+	// channels only switch after the whole batch has been worked out, so
+	// they all change together.
+	deferStatusPublish = true;
+	uint8_t previous = outputs.getState();
+	SystemState previousSysState = sysState;
+	uint8_t state = previous;
+	ControlCommand changedBy = cmds[0];
+	for (uint8_t i = 0; i < count; i++) {
+		uint8_t before = state;
+		SystemState sysBefore = sysState;
+		applyControlCommand(cmds[i], mask, state);
+		if (state != before || sysState != sysBefore) {
+			changedBy = cmds[i];
+		}
+	}
+
+	if (state != previous || sysState != previousSysState) {
+		recordStateChange(source, changedBy, previous, state);
+	}
 
+	outputs.setState(state);
+	deferStatusPublish = false;
 	publishSystemState();
+	if (rebootPending) {
+		rebootPending = false;
+		reboot();
+	}
+}
+
+void handleControlRequest(ControlCommand cmd) {
+	handleControlBatch(&cmd, 1, outputs.getAllMask(), CommandSource::SYSTEM);
+}
+
+bool enqueueControlBatch(const ControlCommand *cmds, uint8_t count, uint8_t mask, CommandSource source) {
+	if (controlQueueCount >= CONTROL_QUEUE_SIZE) {
+		Serial.println(F("WARN: Control queue full. Ignoring command batch..."));
+		TelemetryHelper::increment(Metric::REJECTED_QUEUE_FULL);
+		return false;
+	}
+
+	control_batch_t &batch = controlQueue[(controlQueueHead + controlQueueCount) % CONTROL_QUEUE_SIZE];
+	memcpy(batch.cmds, cmds, count * sizeof(ControlCommand));
+	batch.count = count;
+	batch.mask = mask;
+	batch.source = source;
+
+	// The message may have arrived any time since the previous poll, so
+	// that is where its queueing delay starts.
+	batch.queuedAt = previousControlPoll;
+	controlQueueCount++;
+	tControlQueue.restart();
+	return true;
+}
+
+// Switches the channels whose quiet hours opened or closed since the last
+// transition. Nothing else is touched, so a manual command holds until the
+// next transition, and none of it needs the broker.
+void applyQuietHours(time_t now, bool reassert) {
+	uint8_t active = QuietHours.getActiveMask(now, outputs.getAllMask());
+	uint8_t on = reassert ? active : active & ~quietHoursMask;
+	uint8_t off = quietHoursMask & ~active;
+	quietHoursMask = active;
+	if (on == 0 && off == 0) {
+		return;
+	}
+
+	TelemetryHelper::increment(Metric::QUIET_HOURS_TRANSITIONS);
+	if (on != 0) {
+		ControlCommand cmd = ControlCommand::OUTPUTS_ON;
+		handleControlBatch(&cmd, 1, on, CommandSource::QUIET_HOURS);
+	}
+
+	if (off != 0) {
+		ControlCommand cmd = ControlCommand::OUTPUTS_OFF;
+		handleControlBatch(&cmd, 1, off, CommandSource::QUIET_HOURS);
+	}
+}
+
+// Arms tQuietHours for the next window to open or close instead of
+// checking every so often. The wait is capped so the timer can't drift
+// far from the clock.
+void updateQuietHours(bool reassert) {
+	time_t now = time(nullptr);
+	if (now < CLOCK_VALID_AFTER) {
+		// onSyncClock() calls back once there is a time to go by.
+		tQuietHours.disable();
+		return;
+	}
+
+	if (reassert || quietHoursNext == 0 || now >= quietHoursNext) {
+		applyQuietHours(now, reassert || quietHoursNext == 0);
+	}
+
+	quietHoursNext = QuietHours.getNextTransition(now);
+	if (quietHoursNext == 0) {
+		tQuietHours.disable();
+		return;
+	}
+
+	uint32_t wait = quietHoursNext - now;
+	tQuietHours.restartDelayed(wait < QUIET_HOURS_MAX_SLEEP / 1000 ? wait * 1000UL : QUIET_HOURS_MAX_SLEEP);
+}
+
+void onQuietHours() {
+	Forensics.enter(Stage::TASK_QUIET_HOURS);
+	updateQuietHours(false);
+}
+
+void onJournalFlush() {
+	Forensics.enter(Stage::TASK_JOURNAL);
+	// SPIFFS file handles live on the heap.
+	HeapExemption exempt;
+	flushJournal();
+}
+
+const __FlashStringHelper* getCommandSourceName(uint8_t source) {
+	switch ((CommandSource)source) {
+		case CommandSource::MQTT:
+			return F("mqtt");
+		case CommandSource::DIRECT:
+			return F("direct");
+		case CommandSource::QUIET_HOURS:
+			return F("quietHours");
+		default:
+			return F("system");
+	}
+}
+
+void publishJournalPage(uint32_t before, uint8_t limit) {
+	HeapExemption exempt;
+	journal_record_t records[JOURNAL_PAGE_SIZE];
+	uint8_t count = Journal.read(before, records, limit);
+
+	DynamicJsonDocument doc(JOURNAL_DOC_SIZE);
+	doc["clientId"] = config.hostname;
+
+	// Pass 'next' back as 'before' for the following page.
+	doc["next"] = count == limit && records[count - 1].sequence > 1 ? records[count - 1].sequence : 0;
+	JsonArray entries = doc.createNestedArray("entries");
+	for (uint8_t i = 0; i < count; i++) {
+		const journal_record_t &entry = records[i];
+		JsonObject item = entries.createNestedObject();
+		item["seq"] = entry.sequence;
+		item[(entry.state & JOURNAL_FLAG_UPTIME) != 0 ? "uptime" : "ts"] = entry.timestamp;
+		item["src"] = getCommandSourceName(entry.source);
+		item["cmd"] = entry.command;
+		item["mask"] = entry.state & JOURNAL_STATE_MASK;
+		item["disabled"] = (entry.state & JOURNAL_FLAG_DISABLED) != 0;
+		item["durMs"] = entry.durationMs;
+	}
+
+	// Totals only cover finished silences; 'activeSec' is the current one.
+	doc["activeSec"] = outputs.getState() != 0 ? (millis() - silencedSince) / 1000 : 0;
+	JsonArray days = doc.createNestedArray("days");
+	time_t now = time(nullptr);
+	if (now >= CLOCK_VALID_AFTER) {
+		for (uint8_t i = 0; i < JOURNAL_STAT_DAYS; i++) {
+			time_t then = now - i * 86400L;
+			const journal_day_t *stats = Journal.getDayStats(JournalClass::getLocalDay(then));
+			if (stats == NULL) {
+				continue;
+			}
+
+			char date[11];
+			strftime(date, sizeof(date), "%Y-%m-%d", localtime(&then));
+			JsonObject day = days.createNestedObject();
+			day["day"] = date;
+			day["silencedSec"] = stats->silencedMs / 1000;
+			day["activations"] = stats->activations;
+		}
+	}
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_JOURNAL_SUFFIX);
+
+	// Streamed so the page is not bound by the MQTT buffer size.
+	bool success = mqttClient.beginPublish(topic, measureJson(doc), false);
+	if (success) {
+		serializeJson(doc, mqttClient);
+		success = mqttClient.endPublish() == 1;
+	}
+
+	if (success) {
+		TelemetryHelper::increment(Metric::PUBLISH_OK);
+	}
+	else {
+		Serial.println(F("ERROR: Failed to publish message."));
+		TelemetryHelper::increment(Metric::PUBLISH_FAILED);
+	}
+
+	doc.clear();
+}
+
+void onJournalQuery() {
+	Forensics.enter(Stage::TASK_JOURNAL);
+	if (mqttClient.connected()) {
+		publishJournalPage(journalQueryBefore, journalQueryLimit);
+	}
+}
+
+void handleJournalRequest(byte* payload, unsigned int length) {
+	// Reading flash is left to the housekeeping layer. An empty payload
+	// asks for the newest page.
+	StaticJsonDocument<JSON_OBJECT_SIZE(2) + 32> doc;
+	journalQueryBefore = 0;
+	journalQueryLimit = JOURNAL_PAGE_SIZE;
+	if (length > 0 && !deserializeJson(doc, (const char*)payload, length)) {
+		journalQueryBefore = doc["before"] | 0UL;
+		journalQueryLimit = constrain(doc["limit"] | JOURNAL_PAGE_SIZE, 1, JOURNAL_PAGE_SIZE);
+	}
+
+	tJournalQuery.restart();
+}
+
+// {"groups":["building","floor2"]} replaces this device's group
+// membership. Applying and saving it is left to the housekeeping layer.
+void handleGroupsRequest(byte* payload, unsigned int length) {
+	StaticJsonDocument<GROUPS_DOC_SIZE> doc;
+	if (deserializeJson(doc, (const char*)payload, length) || !doc["groups"].is<JsonArray>()) {
+		Serial.println(F("WARN: Invalid group membership request. Ignoring..."));
+		TelemetryHelper::increment(Metric::REJECTED_PARSE_ERROR);
+		return;
+	}
+
+	JsonArray groups = doc["groups"].as<JsonArray>();
+	if (groups.size() > MAX_GROUPS) {
+		Serial.println(F("WARN: Too many groups in membership request. Ignoring..."));
+		TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+		return;
+	}
+
+	for (JsonVariant group : groups) {
+		if (!isValidGroupName(group | "")) {
+			Serial.println(F("WARN: Invalid group name in membership request. Ignoring..."));
+			TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+			return;
+		}
+	}
+
+	pendingGroupCount = 0;
+	for (JsonVariant group : groups) {
+		strcpy(pendingGroups[pendingGroupCount++], group.as<const char*>());
+	}
+
+	tGroupUpdate.restart();
+}
+
+void onControlQueue() {
+	Forensics.enter(Stage::TASK_CONTROL);
+	while (controlQueueCount > 0) {
+		control_batch_t &batch = controlQueue[controlQueueHead];
+		TelemetryHelper::increment(Metric::CONTROL_BATCHES);
+		TelemetryHelper::increment(Metric::CONTROL_QUEUE_DELAY_MS, millis() - batch.queuedAt);
+		handleControlBatch(batch.cmds, batch.count, batch.mask, batch.source);
+		controlQueueHead = (controlQueueHead + 1) % CONTROL_QUEUE_SIZE;
+		controlQueueCount--;
+	}
+}
+
+TokenBucket& getTopicLimiter(const char* topic) {
+	uint32_t hash = getContentHash(topic);
+	for (uint8_t i = 0; i < MQTT_TOPIC_LIMITS; i++) {
+		if (topicLimits[i].topicHash == hash) {
+			return topicLimits[i].bucket;
+		}
+	}
+
+	// Released slots can sit ahead of taken ones, so a topic only gets a
+	// new slot once it is known not to have one.
+	for (uint8_t i = 0; i < MQTT_TOPIC_LIMITS; i++) {
+		if (topicLimits[i].topicHash == 0) {
+			topicLimits[i].topicHash = hash;
+			return topicLimits[i].bucket;
+		}
+	}
+
+	// Only reachable if a topic arrives that the device never subscribed to.
+
+	return topicLimits[MQTT_TOPIC_LIMITS - 1].bucket;
+}
+
+// Both buckets are always charged, so a flood on one topic still counts
+// against the overall budget.
+bool acceptInboundMessage(const char* topic) {
+	bool topicOk = getTopicLimiter(topic).tryTake();
+	bool inboundOk = inboundLimiter.tryTake();
+	if (topicOk && inboundOk) {
+		return true;
+	}
+
+	TelemetryHelper::increment(Metric::REJECTED_RATE_LIMITED);
+	lastThrottledDrop = millis();
+	throttled = true;
+	return false;
+}
+
+// Publishes the retained throttled flag whenever it changes. Runs from
+// the control poll rather than the message callback, since publishing
+// reuses the buffer the incoming message sits in.
+void updateThrottledState() {
+	if (throttled && millis() - lastThrottledDrop > MQTT_THROTTLE_HOLD) {
+		throttled = false;
+	}
+
+	if (throttled == throttledPublished || !mqttClient.connected()) {
+		return;
+	}
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_THROTTLED_SUFFIX);
+	if (publishMessage(topic, throttled ? "true" : "false", true)) {
+		throttledPublished = throttled;
+		Serial.println(throttled
+			? F("WARN: Inbound MQTT messages are being throttled.")
+			: F("INFO: Inbound MQTT throttling ended."));
+	}
+}
+
+#ifdef ENABLE_DIRECT_CONTROL
+void signDirectPacket(const uint8_t *header, uint8_t *mac) {
+	br_hmac_key_context keyContext;
+	br_hmac_context context;
+	br_hmac_key_init(&keyContext, &br_sha256_vtable, config.directControlKey, strlen(config.directControlKey));
+	br_hmac_init(&context, &keyContext, 0);
+	br_hmac_update(&context, header, DIRECT_PACKET_HEADER_SIZE);
+	br_hmac_out(&context, mac);
+}
+
+bool verifyDirectPacket(const uint8_t *packet) {
+	uint8_t expected[DIRECT_PACKET_MAC_SIZE];
+	signDirectPacket(packet, expected);
+
+	// Constant time, so the MAC can't be guessed a byte at a time.
+	uint8_t diff = 0;
+	for (uint8_t i = 0; i < DIRECT_PACKET_MAC_SIZE; i++) {
+		diff |= expected[i] ^ packet[DIRECT_PACKET_HEADER_SIZE + i];
+	}
+
+	return diff == 0;
+}
+
+uint32_t readDirectField(const uint8_t *data) {
+	return ((uint32_t)data[0] << 24) | ((uint32_t)data[1] << 16) | ((uint32_t)data[2] << 8) | data[3];
+}
+
+void sendDirectReply(uint8_t *packet, DirectStatus status) {
+	packet[5] = status;
+	signDirectPacket(packet, packet + DIRECT_PACKET_HEADER_SIZE);
+	directUdp.beginPacket(directUdp.remoteIP(), directUdp.remotePort());
+	directUdp.write(packet, DIRECT_PACKET_SIZE);
+	directUdp.endPacket();
+}
+
+// Only a sender holding the key gets a reply, so the endpoint can't be
+// used to reflect traffic at someone else.
+DirectStatus handleDirectPacket(const uint8_t *packet) {
+	uint32_t timestamp = readDirectField(packet + 6);
+	uint32_t sequence = readDirectField(packet + 10);
+	uint32_t now = (uint32_t)time(nullptr);
+	if (directLastTimestamp < CLOCK_VALID_AFTER) {
+		// Nothing sent before this boot is accepted, even if it is still
+		// inside the window.
+		directLastTimestamp = now - millis() / 1000;
+	}
+
+	// Anything outside the window or not newer than the last accepted
+	// command is a replay. The last accepted time starts at boot, so
+	// packets sent before a reboot can't be replayed after it either.
+	bool fresh = (timestamp > now ? timestamp - now : now - timestamp) <= DIRECT_CONTROL_WINDOW;
+	bool newer = timestamp > directLastTimestamp
+		|| (timestamp == directLastTimestamp && sequence > directLastSequence);
+	if (!fresh || !newer) {
+		TelemetryHelper::increment(Metric::DIRECT_REJECTED_REPLAY);
+		return DIRECT_STATUS_REPLAY;
+	}
+
+	directLastTimestamp = timestamp;
+	directLastSequence = sequence;
+
+	uint8_t mask = packet[4] == 0 ? outputs.getAllMask() : packet[4];
+	if (packet[2] != DIRECT_PACKET_VERSION || !isValidControlCommand(packet[3])
+		|| (mask & ~outputs.getAllMask()) != 0) {
+		TelemetryHelper::increment(Metric::DIRECT_REJECTED_INVALID);
+		return DIRECT_STATUS_INVALID;
+	}
+
+	ControlCommand cmd = (ControlCommand)packet[3];
+	if (!enqueueControlBatch(&cmd, 1, mask, CommandSource::DIRECT)) {
+		return DIRECT_STATUS_QUEUE_FULL;
+	}
+
+	TelemetryHelper::increment(Metric::DIRECT_ACCEPTED);
+	return DIRECT_STATUS_ACCEPTED;
+}
+#endif
+
+void handleDirectControl() {
+	#ifdef ENABLE_DIRECT_CONTROL
+		// Drains at most a burst worth per poll so a flood can't starve MQTT.
+		for (uint8_t i = 0; i < DIRECT_CONTROL_BURST; i++) {
+			int size = directUdp.parsePacket();
+			if (size <= 0) {
+				return;
+			}
+
+			Forensics.enter(Stage::DIRECT_CONTROL);
+			uint8_t packet[DIRECT_PACKET_SIZE];
+			bool wellFormed = size == DIRECT_PACKET_SIZE
+				&& directUdp.read(packet, sizeof(packet)) == DIRECT_PACKET_SIZE
+				&& packet[0] == DIRECT_PACKET_MAGIC_0 && packet[1] == DIRECT_PACKET_MAGIC_1;
+
+			// Cheap checks first: HMAC costs far more than dropping a packet.
+			if (!directLimiter.tryTake()) {
+				TelemetryHelper::increment(Metric::DIRECT_REJECTED_RATE_LIMITED);
+				continue;
+			}
+
+			if (!wellFormed || config.directControlKey[0] == '\0'
+				|| time(nullptr) < CLOCK_VALID_AFTER || !verifyDirectPacket(packet)) {
+				TelemetryHelper::increment(Metric::DIRECT_REJECTED_AUTH);
+				continue;
+			}
+
+			sendDirectReply(packet, handleDirectPacket(packet));
+		}
+	#endif
+}
+
+void initDirectControl() {
+	#ifdef ENABLE_DIRECT_CONTROL
+		Serial.print(F("INIT: Starting direct control listener on port "));
+		Serial.print(DIRECT_CONTROL_PORT);
+		Serial.print(F("... "));
+		if (config.directControlKey[0] == '\0') {
+			Serial.println(F("SKIPPED (no key)"));
+			return;
+		}
+
+		directUdp.begin(DIRECT_CONTROL_PORT);
+		Serial.println(F("DONE"));
+	#endif
+}
+
+void onControlPoll() {
+	Forensics.enter(Stage::MQTT);
+	unsigned long now = millis();
+	if (lastControlPoll != 0 && now - lastControlPoll > controlPollGapMax) {
+		controlPollGapMax = now - lastControlPoll;
+	}
+
+	previousControlPoll = lastControlPoll != 0 ? lastControlPoll : now;
+	lastControlPoll = now;
+	mqttClient.loop();
+	updateThrottledState();
+	if (mqttWasConnected && !mqttClient.connected()) {
+		// Hand off to the housekeeping layer, connecting blocks. Tried again
+		// next poll if the event bus is full.
+		mqttWasConnected = !EventBus.publish(EventType::MQTT_LOST, EventSource::MQTT);
+	}
+
+	handleDirectControl();
+	idleWokeWithData = false;
+}
+
+void onSyntheticLoad() {
+	#ifdef ENABLE_SYNTHETIC_LOAD
+		// Stands in for a slow housekeeping job (reconnect, NTP sync, scan)
+		// so the control path's queueing delay can be measured under load.
+		Forensics.enter(Stage::TASK_SYNTHETIC_LOAD);
+		unsigned long start = millis();
+		while (millis() - start < SYNTHETIC_LOAD_MS) {
+			yield();
+		}
+	#endif
+}
+
+bool parseControlCommands(JsonDocument &doc, ControlCommand *cmds, uint8_t &count) {
+	count = 0;
+	if (doc.containsKey("commands")) {
+		JsonArray list = doc["commands"].as<JsonArray>();
+		if (list.isNull() || list.size() == 0 || list.size() > MAX_BATCH_COMMANDS) {
+			Serial.print(F("WARN: Command batch must contain 1 to "));
+			Serial.print(MAX_BATCH_COMMANDS);
+			Serial.println(F(" commands. Ignoring..."));
+			TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+			return false;
+		}
+
+		// The batch is validated as a whole before anything is applied.
+		for (JsonVariant item : list) {
+			if (!item.is<uint8_t>() || !isValidControlCommand(item.as<uint8_t>())) {
+				Serial.println(F("WARN: Command batch contains an invalid command. Ignoring..."));
+				TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+				return false;
+			}
+
+			cmds[count++] = (ControlCommand)item.as<uint8_t>();
+			if (cmds[count - 1] == ControlCommand::REBOOT && count < list.size()) {
+				Serial.println(F("WARN: Reboot must be the last command in a batch. Ignoring..."));
+				TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+				return false;
+			}
+		}
+
+		return true;
+	}
+
+	if (!doc.containsKey("command")) {
+		Serial.println(F("WARN: MQTT message does not contain a control command. Ignoring..."));
+		TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+		return false;
+	}
+
+	// Checked the same as a batch item, before it can be queued.
+	JsonVariant command = doc["command"];
+	if (!command.is<uint8_t>() || !isValidControlCommand(command.as<uint8_t>())) {
+		Serial.println(F("WARN: MQTT message contains an invalid command. Ignoring..."));
+		TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+		return false;
+	}
+
+	cmds[count++] = (ControlCommand)command.as<uint8_t>();
+	return true;
+}
+
+bool parseControlTarget(JsonDocument &doc, uint8_t &mask) {
+	// Commands address every channel unless narrowed by mask or by a
+	// single channel given by name or index.
+	mask = outputs.getAllMask();
+	if (doc.containsKey("mask")) {
+		uint8_t requested = doc["mask"].as<uint8_t>();
+		if (!doc["mask"].is<uint8_t>() || requested == 0 || (requested & ~mask) != 0) {
+			Serial.println(F("WARN: Control message has an invalid channel mask. Ignoring..."));
+			TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+			return false;
+		}
+
+		mask = requested;
+	}
+	else if (doc.containsKey("channel")) {
+		JsonVariant channel = doc["channel"];
+		int index = -1;
+		if (channel.is<const char*>()) {
+			index = outputs.indexOf(channel.as<const char*>());
+		}
+		else if (channel.is<uint8_t>()) {
+			index = channel.as<uint8_t>();
+		}
+
+		if (index < 0 || index >= outputs.getCount()) {
+			Serial.println(F("WARN: Control message addresses an unknown channel. Ignoring..."));
+			TelemetryHelper::increment(Metric::REJECTED_INVALID_COMMAND);
+			return false;
+		}
+
+		mask = 1U << index;
+	}
+
+	return true;
 }
 
 void onMqttMessage(char* topic, byte* payload, unsigned int length) {
-	Serial.print(F("INFO: [MQTT] Message arrived: ["));
-	Serial.print(topic);
-	Serial.print(F("] "));
+	TelemetryHelper::increment(Metric::MESSAGES_RECEIVED);
+	if (!acceptInboundMessage(topic)) {
+		// Dropped before the copy, parse, serial echo and status publish
+		// that make a message expensive.
+		return;
+	}
 
-	// It's a lot easier to deal with if we just convert the payload
-	// to a string first.
-	String msg;
-	for (unsigned int i = 0; i < length; i++) {
-		msg += (char)payload[i];
+	char journalTopic[96];
+	getDeviceTopic(journalTopic, sizeof(journalTopic), MQTT_TOPIC_JOURNAL_REQUEST_SUFFIX);
+	if (strcmp(topic, journalTopic) == 0) {
+		handleJournalRequest(payload, length);
+		return;
 	}
 
-	Serial.println(msg);
+	char groupsTopic[96];
+	getDeviceTopic(groupsTopic, sizeof(groupsTopic), MQTT_TOPIC_GROUPS_REQUEST_SUFFIX);
+	if (strcmp(topic, groupsTopic) == 0) {
+		handleGroupsRequest(payload, length);
+		return;
+	}
 
-	DynamicJsonDocument doc(100);
-	DeserializationError error = deserializeJson(doc, msg.c_str());
+	if (idleWokeWithData) {
+		// The message landed at some point during the idle sleep, so this
+		// is an upper bound on the latency idling added to it.
+		TelemetryHelper::increment(Metric::IDLE_WAKE_DELAY_MS, millis() - idleSleepStart);
+		TelemetryHelper::increment(Metric::IDLE_DELAYED_MESSAGES);
+		idleWokeWithData = false;
+	}
+
+	Serial.print(F("INFO: [MQTT] Message arrived: ["));
+	Serial.print(topic);
+	Serial.print(F("] "));
+	Serial.write(payload, length);
+	Serial.println();
+
+	// Parsed straight out of the client's buffer into a fixed document,
+	// so handling a message never touches the heap.
+	StaticJsonDocument<CONTROL_DOC_SIZE> doc;
+	DeserializationError error = deserializeJson(doc, (const char*)payload, length);
 	if (error) {
 		Serial.print(F("ERROR: Failed to parse MQTT message to JSON: "));
 		Serial.println(error.c_str());
+		TelemetryHelper::increment(Metric::REJECTED_PARSE_ERROR);
 		doc.clear();
 		return;
 	}
 
-	if (doc.containsKey("clientId")) {
-		String id = doc["clientId"].as<String>();
-		id.toUpperCase();
-		if (!id.equals(config.hostname)) {
+	// Group messages are addressed by their topic alone.
+	bool groupMessage = isGroupControlTopic(topic);
+	if (groupMessage) {
+		TelemetryHelper::increment(Metric::MESSAGES_GROUP);
+	}
+	else if (doc.containsKey("clientId")) {
+		if (strcasecmp(doc["clientId"] | "", config.hostname) != 0) {
 			Serial.println(F("WARN: Control message not intended for this host. Ignoring..."));
+			TelemetryHelper::increment(Metric::REJECTED_WRONG_CLIENT);
 			doc.clear();
 			return;
 		}
 	}
 	else {
 		Serial.println(F("WARN: MQTT message does not contain client ID. Ignoring..."));
-		doc.clear();
-		return;
-	}
-
-	if (!doc.containsKey("command")) {
-		Serial.println(F("WARN: MQTT message does not contain a control command. Ignoring..."));
+		TelemetryHelper::increment(Metric::REJECTED_NO_CLIENT_ID);
 		doc.clear();
 		return;
 	}
 
 	// When system is in the "disabled" state, the only command it will accept
 	// is "enable". All other commands are ignored.
-	ControlCommand cmd = (ControlCommand)doc["command"].as<uint8_t>();
-
+	ControlCommand cmds[MAX_BATCH_COMMANDS];
+	uint8_t count = 0;
+	uint8_t mask = 0;
+	bool valid = parseControlCommands(doc, cmds, count) && parseControlTarget(doc, mask);
 	doc.clear();
-	handleControlRequest(cmd);
+	if (valid && enqueueControlBatch(cmds, count, mask, CommandSource::MQTT)) {
+		TelemetryHelper::increment(Metric::MESSAGES_ACCEPTED);
+	}
 }
 
 void failSafe() {
@@ -578,7 +2119,6 @@ void failSafe() {
 	Serial.println(F("ERROR: Entering failsafe (config) mode..."));
 	taskMan.disableAll();
 	netLED.on();
-	Console.enterCommandInterpreter();
 }
 
 void initMDNS() {
@@ -594,9 +2134,15 @@ void initMDNS() {
 			}
 
 			#ifdef ENABLE_OTA
-				bool authUpload = config.otaPassword.length() > 0;
+				bool authUpload = config.otaPassword[0] != '\0';
 				mdns.enableArduino(config.otaPort, authUpload);
 			#endif
+			#ifdef ENABLE_DIRECT_CONTROL
+				if (config.directControlKey[0] != '\0') {
+					mdns.addService(DEVICE_CLASS, "udp", DIRECT_CONTROL_PORT);
+					mdns.addServiceTxt(DEVICE_CLASS, "udp", "auth", "hmac-sha256");
+				}
+			#endif
 			Serial.println(F(" DONE"));
 		}
 		else {
@@ -607,21 +2153,86 @@ void initMDNS() {
 
 void initFilesystem() {
 	Serial.print(F("INIT: Initializing SPIFFS and mounting filesystem... "));
-	if (!SPIFFS.begin()) {
+	if (SPIFFS.begin()) {
+		filesystemMounted = true;
+		Serial.println(F("DONE"));
+	}
+	else {
 		Serial.println(F("FAIL"));
 		Serial.println(F("ERROR: Unable to mount filesystem."));
+	}
+
+	// Falls back to the defaults without a filesystem.
+	loadConfiguration();
+}
+
+void initForensics() {
+	Serial.print(F("INIT: Checking for crash forensics... "));
+	Forensics.begin();
+	bool captured = filesystemMounted && Forensics.captureReport(SPIFFS, config.hostname);
+	Serial.println(F("DONE"));
+	if (captured) {
+		Serial.println(F("WARN: Abnormal reset detected. Crash report will be published."));
+	}
+}
+
+void initJournal() {
+	Serial.print(F("INIT: Opening activation journal... "));
+	if (!filesystemMounted || !Journal.begin(SPIFFS)) {
+		Serial.println(F("FAIL"));
+		Serial.println(F("WARN: State changes will not be journaled."));
 		return;
 	}
 
-	filesystemMounted = true;
 	Serial.println(F("DONE"));
-	setConfigurationDefaults();
-	loadConfiguration();
+}
+
+void initQuietHours() {
+	Serial.print(F("INIT: Loading quiet hours... "));
+	QuietHours.begin(config.quietHours, config.quietHoursCount);
+	Serial.print(QuietHours.getCount());
+	Serial.println(F(" window(s)"));
+}
+
+void initTls() {
+	#ifdef ENABLE_TLS
+		Serial.print(F("INIT: Configuring TLS... "));
+
+		// The CA file covers every broker without a pinned fingerprint.
+		// configureTls() picks the trust anchor per broker.
+		delete tlsTrustAnchors;
+		tlsTrustAnchors = NULL;
+		if (config.mqttCaFile[0] != '\0' && filesystemMounted && SPIFFS.exists(config.mqttCaFile)) {
+			File caFile = SPIFFS.open(config.mqttCaFile, "r");
+			String pem = caFile.readString();
+			caFile.close();
+			tlsTrustAnchors = new BearSSL::X509List(pem.c_str());
+		}
+
+		// Reconnects resume this session instead of doing a full handshake.
+		secureClient.setSession(&tlsSession);
+		Serial.println(F("DONE"));
+	#endif
 }
 
 void initMQTT() {
+	// The first connect goes down the list from the primary. Brokers are
+	// measured one per tBrokerProbe run after that.
+	initBrokers();
+
+	wifiClient.setTimeout(MQTT_CONNECT_TIMEOUT);
+	mqttTransport = &wifiClient;
+	#ifdef ENABLE_TLS
+		if (config.mqttUseTls) {
+			initTls();
+			mqttTransport = &secureClient;
+		}
+	#endif
+
+	useBroker(selectBroker());
+
 	Serial.print(F("INIT: Initializing MQTT client... "));
-	mqttClient.setServer(config.mqttBroker.c_str(), config.mqttPort);
+	mqttClient.setClient(*mqttTransport);
 	mqttClient.setCallback(onMqttMessage);
 	mqttClient.setBufferSize(500);
 	Serial.println(F("DONE"));
@@ -629,15 +2240,45 @@ void initMQTT() {
 		delay(500);
 		publishSystemState();
 	}
+	else {
+		tMqttFailover.restartDelayed(MQTT_FAILOVER_RETRY);
+	}
+}
+
+void applyNetworkProfile() {
+	network_profile_t profile;
+	memcpy_P(&profile, &networkProfiles[config.networkProfile], sizeof(profile));
+	if (profile.noSleep) {
+		WiFi.setSleepMode(WIFI_NONE_SLEEP);
+	}
+	else {
+		WiFi.setSleepMode(config.idleLightSleep ? WIFI_LIGHT_SLEEP : WIFI_MODEM_SLEEP);
+	}
+
+	// The default covers sockets opened from here on, including TLS ones.
+	WiFiClient::setDefaultNoDelay(profile.noDelay);
+	wifiClient.setNoDelay(profile.noDelay);
+	#ifdef ENABLE_TLS
+		secureClient.setNoDelay(profile.noDelay);
+	#endif
+
+	// The broker holds us to the keepalive sent in CONNECT, so a new value
+	// only counts once reconnected.
+	mqttClient.setKeepAlive(profile.keepAlive);
+	mqttClient.setSocketTimeout(profile.socketTimeout);
+
+	Serial.print(F("INFO: Network profile: "));
+	Serial.println(config.networkProfile == NETWORK_PROFILE_LOW_LATENCY ? F("low latency") : F("low power"));
 }
 
 void connectWiFi() {
-	if (config.hostname) {
-		WiFi.hostname(config.hostname.c_str());
+	if (config.hostname[0] != '\0') {
+		WiFi.hostname(config.hostname);
 	}
 
 	Serial.println(F("DEBUG: Setting mode..."));
 	WiFi.mode(WIFI_STA);
+	applyNetworkProfile();
 	Serial.println(F("DEBUG: Disconnect and clear to prevent auto connect..."));
 	WiFi.persistent(false);
 	WiFi.disconnect(true);
@@ -664,25 +2305,167 @@ void connectWiFi() {
 		delay(500);
 	}
 
-	if (WiFi.status() != WL_CONNECTED) {
-		// Connection failed. May the AP went down? Let's try again later.
-		Serial.println(F("ERROR: Failed to connect to WiFi!"));
-		Serial.println(F("WARN: Will attempt to reconnect at scheduled interval."));
+	if (WiFi.status() != WL_CONNECTED) {
+		// Connection failed. May the AP went down? Let's try again later.
+		Serial.println(F("ERROR: Failed to connect to WiFi!"));
+		Serial.println(F("WARN: Will attempt to reconnect at scheduled interval."));
+	}
+	else {
+		printNetworkInfo();
+	}
+}
+
+void initWiFi() {
+	Serial.println(F("INIT: Initializing WiFi..."));
+	printAvailableNetworks();
+
+	Serial.print(F("INFO: Connecting to SSID: "));
+	Serial.print(config.ssid);
+	Serial.print(F("..."));
+
+	connectWiFi();
+}
+
+void beginUpdateProgress() {
+	// Updates end in a reboot that doesn't go through reboot().
+	flushJournal();
+	updateStart = millis();
+	updateLastReport = updateStart;
+	updateLastPercent = 0;
+	updateBytes = 0;
+}
+
+void reportUpdateProgress(size_t progress, size_t total) {
+	// Called for every chunk, so it only feeds the watchdog unless the
+	// update has moved on by a step or the interval has passed.
+	ESPCrashMonitor.iAmAlive();
+	updateBytes = progress;
+	if (total == 0) {
+		return;
+	}
+
+	uint8_t percent = (uint8_t)(((uint64_t)progress * 100) / total);
+	unsigned long now = millis();
+	if (percent < 100 && percent < updateLastPercent + OTA_PROGRESS_STEP && now - updateLastReport < OTA_PROGRESS_INTERVAL) {
+		return;
+	}
+
+	updateLastPercent = percent;
+	updateLastReport = now;
+	netLED.isOn() ? netLED.off() : netLED.on();
+	Serial.print(F("INFO: Update progress: "));
+	Serial.print(percent);
+	Serial.println(F("%"));
+}
+
+void publishUpdateResult(bool success, const char* error) {
+	unsigned long elapsed = millis() - updateStart;
+	Serial.print(success ? F("INFO: Update complete. Bytes: ") : F("ERROR: Update failed. Bytes: "));
+	Serial.print(updateBytes);
+	Serial.print(F(", ms: "));
+	Serial.println(elapsed);
+	if (!mqttClient.connected()) {
+		return;
+	}
+
+	char payload[128];
+	if (success) {
+		snprintf(payload, sizeof(payload), "{\"event\":\"updateComplete\",\"bytes\":%u,\"ms\":%lu,\"bytesPerSec\":%lu}",
+			(unsigned int)updateBytes, elapsed, elapsed > 0 ? (unsigned long)(((uint64_t)updateBytes * 1000) / elapsed) : 0UL);
 	}
 	else {
-		printNetworkInfo();
+		snprintf(payload, sizeof(payload), "{\"event\":\"updateFailed\",\"bytes\":%u,\"error\":\"%s\"}",
+			(unsigned int)updateBytes, error);
 	}
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_EVENTS_SUFFIX);
+	publishMessage(topic, payload, false);
 }
 
-void initWiFi() {
-	Serial.println(F("INIT: Initializing WiFi..."));
-	printAvailableNetworks();
+void onHttpUpdate() {
+	HeapExemption exempt;
+	#ifdef ENABLE_HTTP_UPDATE
+		Forensics.enter(Stage::TASK_HTTP_UPDATE);
+		const char* manifestUrl = config.updateManifestUrl;
+		if (strlen(manifestUrl) == 0) {
+			Serial.println(F("ERROR: No update manifest URL configured."));
+			return;
+		}
 
-	Serial.print(F("INFO: Connecting to SSID: "));
-	Serial.print(config.ssid);
-	Serial.print(F("..."));
+		if (!updateSigningKey.isRSA()) {
+			Serial.println(F("ERROR: No valid update signing key. Refusing to pull updates."));
+			return;
+		}
 
-	connectWiFi();
+		Serial.print(F("INFO: Fetching update manifest: "));
+		Serial.println(manifestUrl);
+
+		// The manifest is a small JSON document naming the image:
+		// {"version":"1.1","url":"http://server/firmware.bin.gz"}
+		WiFiClient client;
+		HTTPClient http;
+		http.setTimeout(HTTP_UPDATE_TIMEOUT);
+		if (!http.begin(client, manifestUrl)) {
+			Serial.println(F("ERROR: Invalid update manifest URL."));
+			return;
+		}
+
+		int code = http.GET();
+		if (code != HTTP_CODE_OK) {
+			Serial.print(F("ERROR: Failed to fetch update manifest. HTTP code: "));
+			Serial.println(code);
+			http.end();
+			return;
+		}
+
+		DynamicJsonDocument doc(HTTP_UPDATE_MANIFEST_SIZE);
+		DeserializationError error = deserializeJson(doc, http.getStream());
+		http.end();
+		if (error || !doc["url"].is<const char*>()) {
+			Serial.println(F("ERROR: Invalid update manifest."));
+			doc.clear();
+			return;
+		}
+
+		if (doc["version"].is<const char*>() && strcmp(doc["version"].as<const char*>(), FIRMWARE_VERSION) == 0) {
+			Serial.println(F("INFO: Firmware is already up to date."));
+			doc.clear();
+			return;
+		}
+
+		String imageUrl = doc["url"].as<String>();
+		doc.clear();
+
+		Serial.print(F("INFO: Pulling firmware image: "));
+		Serial.println(imageUrl);
+		sysState = SystemState::UPDATING;
+		publishSystemState();
+
+		// Compressed (.bin.gz) images are unpacked by the bootloader.
+		ESPhttpUpdate.rebootOnUpdate(false);
+		ESPhttpUpdate.onStart(beginUpdateProgress);
+		ESPhttpUpdate.onProgress([](int progress, int total) {
+			reportUpdateProgress(progress, total);
+		});
+
+		// The manifest and image come over plain HTTP, so the image has to
+		// carry a signature from the build's private key. Only pulls are
+		// checked: ArduinoOTA pushes are covered by the OTA password.
+		beginUpdateProgress();
+		Update.installSignature(&updateHash, &updateVerifier);
+		t_httpUpdate_return result = ESPhttpUpdate.update(client, imageUrl, FIRMWARE_VERSION);
+		Update.installSignature(NULL, NULL);
+		if (result == HTTP_UPDATE_OK) {
+			publishUpdateResult(true, NULL);
+			reboot();
+			return;
+		}
+
+		publishUpdateResult(false, ESPhttpUpdate.getLastErrorString().c_str());
+		sysState = SystemState::NORMAL;
+		publishSystemState();
+	#endif
 }
 
 void initOTA() {
@@ -690,8 +2473,8 @@ void initOTA() {
 		Serial.print(F("INIT: Starting OTA updater... "));
 		if (WiFi.status() == WL_CONNECTED) {
 			ArduinoOTA.setPort(config.otaPort);
-			ArduinoOTA.setHostname(config.hostname.c_str());
-			ArduinoOTA.setPassword(config.otaPassword.c_str());
+			ArduinoOTA.setHostname(config.hostname);
+			ArduinoOTA.setPassword(config.otaPassword);
 			ArduinoOTA.onStart([]() {
 				// Handle start of OTA update. Determines update type.
 				String type;
@@ -704,40 +2487,53 @@ void initOTA() {
 
 				sysState = SystemState::UPDATING;
 				publishSystemState();
+				beginUpdateProgress();
 				Serial.println("INFO: Starting OTA update (type: " + type + ") ...");
 			});
 			ArduinoOTA.onEnd([]() {
 				// Handles update completion.
+				publishUpdateResult(true, NULL);
+				Forensics.enter(Stage::REBOOTING);
 				Serial.println(F("INFO: OTA updater stopped."));
 			});
 			ArduinoOTA.onProgress([](unsigned int progress, unsigned int total) {
 				// Reports update progress.
-				netLED.blink(100);
-				ESPCrashMonitor.iAmAlive();
-				Serial.printf("INFO: OTA Update Progress: %u%%\r", (progress / (total / 100)));
+				reportUpdateProgress(progress, total);
 			});
 			ArduinoOTA.onError([](ota_error_t error) {
 				// Handles OTA update errors.
 				Serial.printf("ERROR: OTA update error [%u]: ", error);
+				const char* reason = "unknown";
 				switch (error) {
 					case OTA_AUTH_ERROR:
 						Serial.println(F("Auth failed."));
+						reason = "auth";
 						break;
 					case OTA_BEGIN_ERROR:
 						Serial.println(F("Begin failed."));
+						reason = "begin";
 						break;
 					case OTA_CONNECT_ERROR:
 						Serial.println(F("Connect failed."));
+						reason = "connect";
 						break;
 					case OTA_RECEIVE_ERROR:
 						Serial.println(F("Receive failed."));
+						reason = "receive";
 						break;
 					case OTA_END_ERROR:
 						Serial.println(F("End failed."));
+						reason = "end";
 						break;
 					default:
 						break;
 				}
+
+				publishUpdateResult(false, reason);
+				if (sysState == SystemState::UPDATING) {
+					sysState = SystemState::NORMAL;
+					publishSystemState();
+				}
 			});
 			ArduinoOTA.begin();
 			Serial.println(F("DONE"));
@@ -749,15 +2545,210 @@ void initOTA() {
 }
 
 void onCheckWiFi() {
+	Forensics.enter(Stage::TASK_CHECK_WIFI);
 	Serial.println(F("INFO: Checking WiFi connectivity..."));
 	if (WiFi.status() != WL_CONNECTED) {
-		Serial.println(F("WARN: Lost connection. Attempting reconnect..."));
-		connectWiFi();
-		if (WiFi.status() == WL_CONNECTED) {
-			initMDNS();
-			initMQTT();
+		EventBus.publish(EventType::RECONNECT_WIFI, EventSource::TIMER);
+	}
+}
+
+bool reconnectWiFi() {
+	if (WiFi.status() == WL_CONNECTED) {
+		return true;
+	}
+
+	Serial.println(F("WARN: Lost connection. Attempting reconnect..."));
+	connectWiFi();
+	if (WiFi.status() != WL_CONNECTED) {
+		return false;
+	}
+
+	TelemetryHelper::increment(Metric::WIFI_RECONNECTS);
+	initMDNS();
+	initMQTT();
+	return true;
+}
+
+void initMetricsServer() {
+	#ifdef ENABLE_METRICS_HTTP
+		Serial.print(F("INIT: Starting metrics listener on port "));
+		Serial.print(METRICS_HTTP_PORT);
+		Serial.print(F("... "));
+		metricsServer.begin();
+		Serial.println(F("DONE"));
+	#endif
+}
+
+void handleMetricsHttp() {
+	// Each accepted connection gets a heap-allocated context.
+	HeapExemption exempt;
+	#ifdef ENABLE_METRICS_HTTP
+		// Serves one client at a time and never waits on the socket. The
+		// request is consumed as it trickles in across loop() passes and
+		// answered once the blank line ending the headers shows up.
+		if (!metricsClient) {
+			metricsClient = metricsServer.available();
+			if (!metricsClient) {
+				return;
+			}
+
+			metricsRequestStart = millis();
+			metricsLineLength = 0;
+			metricsHeadersStarted = false;
+			metricsRequestLine[0] = '\0';
+		}
+
+		while (metricsClient.available() > 0) {
+			char c = metricsClient.read();
+			if (c == '\r') {
+				continue;
+			}
+
+			if (c != '\n') {
+				// Only the start of the request line matters.
+				if (!metricsHeadersStarted && metricsLineLength < sizeof(metricsRequestLine) - 1) {
+					metricsRequestLine[metricsLineLength] = c;
+					metricsRequestLine[metricsLineLength + 1] = '\0';
+				}
+
+				if (metricsLineLength < UINT8_MAX) {
+					metricsLineLength++;
+				}
+
+				continue;
+			}
+
+			if (metricsLineLength > 0) {
+				metricsHeadersStarted = true;
+				metricsLineLength = 0;
+				continue;
+			}
+
+			if (strncmp(metricsRequestLine, "GET /metrics", 12) == 0) {
+				updateRuntimeMetrics();
+				metricsClient.print(F("HTTP/1.0 200 OK\r\nContent-Type: text/plain; version=0.0.4\r\nConnection: close\r\n\r\n"));
+				TelemetryHelper::writePrometheus(metricsClient);
+			}
+			else {
+				metricsClient.print(F("HTTP/1.0 404 Not Found\r\nConnection: close\r\n\r\n"));
+			}
+
+			metricsClient.stop();
+			return;
+		}
+
+		if (millis() - metricsRequestStart > METRICS_HTTP_TIMEOUT) {
+			metricsClient.stop();
+		}
+	#endif
+}
+
+bool isWorkPending() {
+	if (sysState == SystemState::UPDATING || Serial.available() > 0) {
+		return true;
+	}
+
+	#ifdef ENABLE_BELL_INPUT
+		if (!bellEvents.isEmpty()) {
+			return true;
+		}
+	#endif
+
+	if (mqttTransport->available() > 0) {
+		return true;
+	}
+
+	#ifdef ENABLE_METRICS_HTTP
+		if (metricsClient || metricsServer.hasClient()) {
+			return true;
 		}
+	#endif
+	return false;
+}
+
+void onSchedulerIdle(unsigned long duration) {
+	(void)duration;
+	if (isWorkPending()) {
+		yield();
+		return;
+	}
+
+	// delay() (unlike busy-waiting) lets the SDK idle the CPU and, with
+	// light sleep enabled, power down the radio between DTIM beacons.
+	unsigned long start = micros();
+	idleSleepStart = millis();
+	delay(config.idleSleepMs);
+	idleMicros += micros() - start;
+	idleWokeWithData = mqttTransport->available() > 0;
+}
+
+#ifdef ENABLE_BELL_INPUT
+void IRAM_ATTR onBellPressInterrupt() {
+	// Runs in interrupt context, so nothing here may touch flash or Serial.
+	// Anything within the lockout window of the last press is contact
+	// bounce (or the release).
+	uint32_t now = millis();
+	if (now - lastBellPress < BELL_DEBOUNCE_MS) {
+		return;
+	}
+
+	lastBellPress = now;
+	bell_event_t event = { now };
+	if (!bellEvents.push(event)) {
+		bellEventsDropped++;
+	}
+}
+#endif
+
+void publishBellEvent(uint8_t presses, uint32_t lastPress) {
+	if (!mqttClient.connected()) {
+		return;
 	}
+
+	char when[STATUS_FIELD_VALUE_SIZE];
+	getTimeInfo(when, sizeof(when), time(nullptr) - (millis() - lastPress) / 1000);
+
+	char payload[128];
+	snprintf(payload, sizeof(payload), "{\"event\":\"rangWhileSilenced\",\"presses\":%u,\"total\":%lu,\"time\":\"%s\"}",
+		presses, (unsigned long)TelemetryHelper::get(Metric::BELL_PRESSES_SILENCED), when);
+
+	char topic[96];
+	getDeviceTopic(topic, sizeof(topic), MQTT_TOPIC_EVENTS_SUFFIX);
+	publishMessage(topic, payload, false);
+}
+
+void handleBellEvents() {
+	#ifdef ENABLE_BELL_INPUT
+		// Presses drained in the same pass go out as one event.
+		bell_event_t event;
+		uint8_t silencedPresses = 0;
+		uint32_t lastPress = 0;
+		while (bellEvents.pop(event)) {
+			if (outputs.getState() == 0) {
+				TelemetryHelper::increment(Metric::BELL_PRESSES);
+				continue;
+			}
+
+			TelemetryHelper::increment(Metric::BELL_PRESSES_SILENCED);
+			silencedPresses++;
+			lastPress = event.timestamp;
+		}
+
+		if (silencedPresses > 0) {
+			Serial.print(F("INFO: Bell pressed while silenced. Presses: "));
+			Serial.println(silencedPresses);
+			publishBellEvent(silencedPresses, lastPress);
+		}
+	#endif
+}
+
+void initBellInput() {
+	#ifdef ENABLE_BELL_INPUT
+		Serial.print(F("INIT: Initializing bell input... "));
+		pinMode(PIN_BELL_INPUT, INPUT_PULLUP);
+		attachInterrupt(digitalPinToInterrupt(PIN_BELL_INPUT), onBellPressInterrupt, FALLING);
+		Serial.println(F("DONE"));
+	#endif
 }
 
 void initSerial() {
@@ -780,121 +2771,415 @@ void initOutputs() {
 	activationLED.on();
 	netLED.init();
 	netLED.on();
-	bellRelay.init();
-	bellRelay.open();
+
+	// The primary relay is forced open straight away. The rest are only
+	// touched once the configured channel list is known.
+	outputRelays[0].init();
+	outputRelays[0].open();
 	Serial.println(F("DONE"));
 }
 
-void handleNewHostname(const char* newHostname) {
-	if (strcmp(newHostname, config.hostname.c_str()) == 0) {
-		config.hostname = newHostname;
-		initMDNS();
+void initOutputChannels() {
+	Serial.print(F("INIT: Configuring output channels... "));
+	for (uint8_t i = 0; i < config.channelNamesCount && i < MAX_OUTPUT_CHANNELS; i++) {
+		outputs.addChannel(config.channelNames[i], &outputRelays[i], i == 0 ? &activationLED : NULL);
+	}
+
+	if (outputs.getCount() == 0) {
+		outputs.addChannel(DEFAULT_CHANNEL_NAME, &outputRelays[0], &activationLED);
 	}
+
+	outputs.begin();
+	Serial.print(outputs.getCount());
+	Serial.println(F(" channel(s) DONE"));
 }
 
-void handleSwitchToDhcp() {
-	if (config.useDhcp) {
-		Serial.println(F("INFO: DHCP mode already set. Skipping..."));
-		Serial.println();
+void initHeartbeat() {
+	if (config.heartbeatInterval > 0) {
+		tHeartbeat.setInterval(config.heartbeatInterval * 1000UL);
+		tHeartbeat.enableDelayed(config.heartbeatInterval * 1000UL);
 	}
 	else {
-		config.useDhcp = true;
-		Serial.println(F("INFO: Set DHCP mode."));
-		WiFi.config(0U, 0U, 0U, 0U);
+		tHeartbeat.disable();
 	}
 }
 
-void handleSwitchToStatic(IPAddress newIp, IPAddress newSm, IPAddress newGw, IPAddress newDns) {
-	config.ip = newIp;
-	config.sm = newSm;
-	config.gw = newGw;
-	config.dns = newDns;
-	Serial.println(F("INFO: Set static network config."));
-	WiFi.config(config.ip, config.gw, config.sm, config.dns);
-}
+// Restarts only the subsystems whose settings differ from what they are
+// currently running with. Anything else (e.g. status format changes) is
+// read where it is used, so it is picked up as-is on next use.
+void applyConfigChanges() {
+	HeapExemption exempt;
+	unsigned long start = millis();
+	uint16_t changes = ConfigSchema.diff(runningConfig, config);
+	if (changes == CONFIG_CHANGE_NONE) {
+		Serial.println(F("INFO: No configuration changes to apply."));
+		return;
+	}
 
-void handleReconnectFromConsole() {
-	onCheckWiFi();
-	if (WiFi.status() == WL_CONNECTED) {
-		printNetworkInfo();
-		resumeNormal();
+	Serial.print(F("INFO: Applying configuration changes (mask 0x"));
+	Serial.print(changes, HEX);
+	Serial.println(F(")..."));
+
+	// Dropping the link or the local address kills the broker connection
+	// and the mDNS announcement with it.
+	if (changes & (CONFIG_CHANGE_WIFI | CONFIG_CHANGE_IP)) {
+		changes |= CONFIG_CHANGE_MQTT | CONFIG_CHANGE_MDNS;
+	}
+
+	if (changes & CONFIG_CHANGE_WIFI) {
+		// Also applies the IP settings and the network profile.
+		connectWiFi();
 	}
 	else {
-		Serial.println(F("ERROR: Still no network connection."));
-		Console.enterCommandInterpreter();
+		// Both may change in one save. The address first, so the profile
+		// is applied to the link as it will stay.
+		if (changes & CONFIG_CHANGE_IP) {
+			if (config.useDhcp) {
+				WiFi.config(0U, 0U, 0U, 0U);
+			}
+			else {
+				WiFi.config(config.ip, config.gw, config.sm, config.dns);
+			}
+		}
+
+		if (changes & CONFIG_CHANGE_NETWORK) {
+			applyNetworkProfile();
+		}
+	}
+
+	if (changes & CONFIG_CHANGE_MDNS) {
+		#ifdef ENABLE_MDNS
+			mdns.end();
+		#endif
+		initMDNS();
+	}
+
+	if (changes & CONFIG_CHANGE_OTA) {
+		#ifdef ENABLE_OTA
+			ArduinoOTA.end();
+		#endif
+		initOTA();
+	}
+
+	if (changes & CONFIG_CHANGE_MQTT) {
+		// The hostname is the client ID and the device topic prefix, so a
+		// rename reconnects as the new device. The old name's retained
+		// announcements are cleared once connected. If an earlier rename
+		// is still pending, the name before that is the one to clear.
+		bool renamed = strcmp(runningConfig.hostname, config.hostname) != 0
+			|| strcmp(runningConfig.mqttTopicDiscovery, config.mqttTopicDiscovery) != 0;
+		if (renamed && retiredHostname[0] == '\0') {
+			strlcpy(retiredHostname, runningConfig.hostname, sizeof(retiredHostname));
+			strlcpy(retiredDiscoveryTopic, runningConfig.mqttTopicDiscovery, sizeof(retiredDiscoveryTopic));
+		}
+
+		if (mqttClient.connected()) {
+			mqttClient.unsubscribe(runningConfig.mqttTopicControl);
+			mqttClient.disconnect();
+		}
+
+		// Subscribes to the new control topic on connect.
+		initMQTT();
+	}
+	else if (changes & CONFIG_CHANGE_MQTT_TOPICS) {
+		if (strcmp(runningConfig.mqttTopicDiscovery, config.mqttTopicDiscovery) != 0) {
+			// Clear the retained packet under the old topic first.
+			char newTopic[MQTT_TOPIC_SIZE];
+			strlcpy(newTopic, config.mqttTopicDiscovery, sizeof(newTopic));
+			strlcpy(config.mqttTopicDiscovery, runningConfig.mqttTopicDiscovery, sizeof(config.mqttTopicDiscovery));
+			clearDiscoveryPacket();
+			strlcpy(config.mqttTopicDiscovery, newTopic, sizeof(config.mqttTopicDiscovery));
+		}
+
+		if (mqttClient.connected()) {
+			if (strcmp(runningConfig.mqttTopicControl, config.mqttTopicControl) != 0) {
+				mqttClient.unsubscribe(runningConfig.mqttTopicControl);
+				releaseTopicLimit(runningConfig.mqttTopicControl);
+				mqttClient.subscribe(config.mqttTopicControl);
+			}
+
+			resetStatusFieldCache();
+			publishSystemState();
+			publishDiscoveryPacket();
+		}
+	}
+
+	if ((changes & CONFIG_CHANGE_GROUPS) && !(changes & CONFIG_CHANGE_MQTT) && mqttClient.connected()) {
+		updateGroupSubscriptions(runningConfig.groups, runningConfig.groupsCount, config.groups, config.groupsCount);
+		publishGroups();
+	}
+
+	if (changes & CONFIG_CHANGE_CLOCK) {
+		// Right away rather than through tClockSync, so the quiet hours
+		// below are matched against the new zone.
+		initClock();
+	}
+
+	if (changes & CONFIG_CHANGE_HEARTBEAT) {
+		initHeartbeat();
+	}
+
+	if (changes & CONFIG_CHANGE_POWER) {
+		taskMan.allowSleep(config.idleSleepMs > 0);
+	}
+
+	if (changes & CONFIG_CHANGE_OUTPUTS) {
+		// Rebuilt open, as at boot. Channels that are still there are then
+		// switched back, and quiet hours below cover the new set.
+		uint8_t state = outputs.getState();
+		outputs.end();
+		initOutputChannels();
+		outputs.setState(state);
+		publishDiscoveryPacket();
+	}
+
+	if (changes & CONFIG_CHANGE_QUIET_HOURS) {
+		QuietHours.begin(config.quietHours, config.quietHoursCount);
+		updateQuietHours(true);
+	}
+
+	#ifdef ENABLE_DIRECT_CONTROL
+		if (changes & CONFIG_CHANGE_DIRECT) {
+			directUdp.stop();
+			initDirectControl();
+		}
+	#endif
+
+	runningConfig = config;
+	unsigned long elapsed = millis() - start;
+	TelemetryHelper::set(Metric::CONFIG_APPLY_MS, elapsed);
+	Serial.print(F("INFO: Configuration changes applied in "));
+	Serial.print(elapsed);
+	Serial.println(F(" ms"));
+}
+
+void onGroupUpdate() {
+	Forensics.enter(Stage::TASK_GROUPS);
+	HeapExemption exempt;
+	bool changed = pendingGroupCount != runningConfig.groupsCount;
+	for (uint8_t i = 0; i < pendingGroupCount && !changed; i++) {
+		changed = strcmp(pendingGroups[i], runningConfig.groups[i]) != 0;
+	}
+
+	if (!changed) {
+		Serial.println(F("INFO: Group membership unchanged."));
+		return;
+	}
+
+	if (mqttClient.connected()) {
+		updateGroupSubscriptions(runningConfig.groups, runningConfig.groupsCount, pendingGroups, pendingGroupCount);
+	}
+
+	// Only the groups change, in both copies. Anything else staged from
+	// the console stays staged, and stays off flash until it is saved.
+	runningConfig.groupsCount = pendingGroupCount;
+	config.groupsCount = pendingGroupCount;
+	for (uint8_t i = 0; i < pendingGroupCount; i++) {
+		strlcpy(runningConfig.groups[i], pendingGroups[i], sizeof(runningConfig.groups[i]));
+		strlcpy(config.groups[i], pendingGroups[i], sizeof(config.groups[i]));
 	}
+
+	if (mqttClient.connected()) {
+		publishGroups();
+	}
+
+	saveConfiguration(runningConfig);
 }
 
-void handleWiFiConfig(String newSsid, String newPassword) {
-	if (config.ssid != newSsid || config.password != newPassword) {
-		config.ssid = newSsid;
-		config.password = newPassword;
-		connectWiFi();
+bool handleReconnectFromConsole() {
+	if (!reconnectWiFi()) {
+		Serial.println(F("ERROR: Still no network connection."));
+		return false;
 	}
+
+	printNetworkInfo();
+	resumeNormal();
+	return true;
 }
 
 void handleSaveConfig() {
-	saveConfiguration();
-	WiFi.disconnect(true);
-	onCheckWiFi();
+	saveConfiguration(config);
+	applyConfigChanges();
 }
 
-void handleMqttConfigCommand(String newBroker, int newPort, String newUsername, String newPassw, String newConTopic, String newStatTopic) {
-	if (config.mqttBroker != newBroker || config.mqttPort != newPort
-		|| config.mqttUsername != newUsername || config.mqttPassword != newPassw
-		|| config.mqttTopicControl != newConTopic || config.mqttTopicStatus != newStatTopic) {
-		mqttClient.unsubscribe(config.mqttTopicControl.c_str());
-		mqttClient.disconnect();
+// Console set and import commands stage changes in config through the
+// config schema, the same as config.json. Nothing restarts until they are
+// saved.
+bool handleSetCommand(const char* key, const char* value) {
+	int8_t index = ConfigSchema.find(key);
+	if (index < 0) {
+		Serial.print(F("ERROR: Unknown setting: "));
+		Serial.println(key);
+		return false;
+	}
 
-		config.mqttBroker = newBroker;
-		config.mqttPort = newPort;
-		config.mqttUsername = newUsername;
-		config.mqttPassword = newPassw;
-		config.mqttTopicControl = newConTopic;
-		config.mqttTopicStatus = newStatTopic;
+	return ConfigSchema.set(config, index, value);
+}
 
-		initMQTT();
-		Serial.println();
-	}
-}
-
-void initConsole() {
-	Serial.print(F("INIT: Initializing console... "));
-	Console.setHostname(config.hostname);
-	Console.setMqttConfig(
-		config.mqttBroker,
-		config.mqttPort,
-		config.mqttUsername,
-		config.mqttPassword,
-		config.mqttTopicControl,
-		config.mqttTopicStatus
-	);
-	Console.onRebootCommand(reboot);
-	Console.onScanNetworks(printAvailableNetworks);
-	Console.onFactoryRestore(doFactoryRestore);
-	Console.onHostnameChange(handleNewHostname);
-	Console.onDhcpConfig(handleSwitchToDhcp);
-	Console.onStaticConfig(handleSwitchToStatic);
-	Console.onReconnectCommand(handleReconnectFromConsole);
-	Console.onWifiConfigCommand(handleWiFiConfig);
-	Console.onSaveConfigCommand(handleSaveConfig);
-	Console.onMqttConfigCommand(handleMqttConfigCommand);
-	Console.onConsoleInterrupt(failSafe);
-	Console.onResumeCommand(resumeNormal);
-	Serial.println(F("DONE"));
+// Takes a single-line JSON object using config.json keys. Keys it leaves
+// out keep their current values.
+bool handleImportCommand(const char* json) {
+	DynamicJsonDocument imported(CONFIG_DOC_SIZE);
+	DeserializationError error = deserializeJson(imported, json);
+	if (error || !imported.is<JsonObject>()) {
+		Serial.print(F("ERROR: Invalid import document: "));
+		Serial.println(error ? error.c_str() : "not an object");
+		return false;
+	}
+
+	// Check every key before touching anything, so a typo can't leave a
+	// half-imported config behind.
+	JsonObject settings = imported.as<JsonObject>();
+	for (JsonPair setting : settings) {
+		if (ConfigSchema.find(setting.key().c_str(), false) < 0) {
+			Serial.print(F("ERROR: Unknown setting: "));
+			Serial.println(setting.key().c_str());
+			return false;
+		}
+	}
+
+	ConfigSchema.read(imported.as<JsonObjectConst>(), config, false);
+	return true;
+}
+
+void handleShowCommand() {
+	DynamicJsonDocument doc(CONFIG_DOC_SIZE);
+	ConfigSchema.write(config, doc, true);
+	serializeJson(doc, Serial);
+	Serial.println();
+}
+
+// One setting, or all of them with no key, with its type and range.
+bool handleDescribeCommand(const char* key) {
+	if (key[0] == '\0') {
+		for (uint8_t i = 0; i < ConfigSchema.getCount(); i++) {
+			ConfigSchema.describe(config, i, Serial);
+		}
+
+		return true;
+	}
+
+	int8_t index = ConfigSchema.find(key);
+	if (index < 0) {
+		Serial.print(F("ERROR: Unknown setting: "));
+		Serial.println(key);
+		return false;
+	}
+
+	ConfigSchema.describe(config, index, Serial);
+	return true;
+}
+
+bool handleEvent(const event_t &event) {
+	// Console commands are config and flash I/O, and reconnecting opens
+	// sockets. None of it is on the control path.
+	HeapExemption exempt;
+	switch (event.type) {
+		case EventType::CONSOLE_INTERRUPT:
+			failSafe();
+			return true;
+		case EventType::RESUME:
+			resumeNormal();
+			return true;
+		case EventType::REBOOT:
+			// reboot() doesn't return, so the console is answered first.
+			if (event.source == EventSource::CONSOLE) {
+				Console.complete(event, true);
+			}
+
+			reboot();
+			return true;
+		case EventType::FACTORY_RESTORE:
+			return doFactoryRestore();
+		case EventType::SCAN_NETWORKS:
+			printAvailableNetworks();
+			return true;
+		case EventType::NETWORK_INFO:
+			printNetworkInfo();
+			return true;
+		case EventType::RECONNECT_WIFI:
+			if (event.source == EventSource::CONSOLE) {
+				return handleReconnectFromConsole();
+			}
+			return reconnectWiFi();
+		case EventType::SET_SETTING:
+			return handleSetCommand(event.key, event.text);
+		case EventType::IMPORT_SETTINGS:
+			return handleImportCommand(event.text);
+		case EventType::SHOW_SETTINGS:
+			handleShowCommand();
+			return true;
+		case EventType::DESCRIBE_SETTING:
+			return handleDescribeCommand(event.key);
+		case EventType::APPLY_SETTINGS:
+			applyConfigChanges();
+			return true;
+		case EventType::SAVE_SETTINGS:
+			handleSaveConfig();
+			return true;
+		case EventType::MQTT_LOST:
+			tMqttFailover.restart();
+			return true;
+		default:
+			return false;
+	}
+}
+
+// The one place console, MQTT and timer events are acted on, between
+// passes of everything else, so no handler ever runs inside another.
+void dispatchEvents() {
+	event_t event;
+	while (EventBus.next(event)) {
+		TelemetryHelper::increment(Metric::EVENTS_DISPATCHED);
+		TelemetryHelper::increment(Metric::EVENT_DELAY_US, micros() - event.queuedAt);
+		bool success = handleEvent(event);
+		if (event.source == EventSource::CONSOLE) {
+			Console.complete(event, success);
+		}
+	}
 }
 
 void initTaskManager() {
 	Serial.print(F("INIT: Initializing task scheduler..."));
 
+	// Control work gets its own layer, which runs ahead of every task in
+	// the housekeeping layer rather than waiting for the whole pass.
+	controlMan.init();
+	controlMan.addTask(tControlPoll);
+	controlMan.addTask(tControlQueue);
+	controlMan.allowSleep(false);
+
 	taskMan.init();
+	taskMan.setHighPriorityScheduler(&controlMan);
 	taskMan.addTask(tCheckWiFi);
 	taskMan.addTask(tCheckMqtt);
 	taskMan.addTask(tClockSync);
+	taskMan.addTask(tPublishMetrics);
+	taskMan.addTask(tHeartbeat);
+	taskMan.addTask(tMqttFailover);
+	taskMan.addTask(tBrokerProbe);
+	taskMan.addTask(tJournalFlush);
+	taskMan.addTask(tJournalQuery);
+	taskMan.addTask(tQuietHours);
+	taskMan.addTask(tGroupUpdate);
+	#ifdef ENABLE_HTTP_UPDATE
+		taskMan.addTask(tHttpUpdate);
+	#endif
+	#ifdef ENABLE_SYNTHETIC_LOAD
+		taskMan.addTask(tSyntheticLoad);
+		tSyntheticLoad.enableDelayed(SYNTHETIC_LOAD_INTERVAL);
+	#endif
 	
+	tControlPoll.enable();
 	tCheckWiFi.enableDelayed(30000);
 	tCheckMqtt.enableDelayed(1000);
 	tClockSync.enable();
+	tPublishMetrics.enableDelayed(METRICS_PUBLISH_INTERVAL);
+	tBrokerProbe.enableDelayed(MQTT_PROBE_INTERVAL);
+	tJournalFlush.enableDelayed(JOURNAL_FLUSH_INTERVAL);
+	taskMan.setSleepMethod(&onSchedulerIdle);
+	taskMan.allowSleep(config.idleSleepMs > 0);
+	initHeartbeat();
 	Serial.println(F("DONE"));
 }
 
@@ -911,27 +3196,68 @@ void setup() {
 	initCrashMonitor();
 	initOutputs();
 	initFilesystem();
+	initForensics();
+	initJournal();
+	initOutputChannels();
+	initQuietHours();
+	initBellInput();
 	initWiFi();
 	initMDNS();
+	initOTA();
 	initMQTT();
+	initMetricsServer();
+	initDirectControl();
 	initTaskManager();
-	initConsole();
+	runningConfig = config;
 	Serial.println(F("INFO: Boot sequence complete."));
 	sysState = SystemState::NORMAL;
 	netLED.off();
 	activationLED.off();
 	ESPCrashMonitor.enableWatchdog(ESPCrashMonitorClass::ETimeout::Timeout_2s);
+
+	// From here on the heap should only be needed by the exempt paths.
+	HeapTracker.arm();
 }
 
 void loop() {
+	unsigned long loopStart = millis();
+	unsigned long now = micros();
+	if (lastLoopMicros != 0) {
+		loopMicros += now - lastLoopMicros;
+	}
+
+	lastLoopMicros = now;
 	ESPCrashMonitor.iAmAlive();
-	Console.checkInterrupt();
+	Forensics.enter(Stage::CONSOLE);
+	Console.poll();
+	Forensics.enter(Stage::EVENTS);
+	dispatchEvents();
+	Forensics.enter(Stage::SCHEDULER);
 	taskMan.execute();
 	#ifdef ENABLE_MDNS
-		mdns.update();
+		Forensics.enter(Stage::MDNS);
+		{
+			// The responder allocates for each query it answers.
+			HeapExemption exempt;
+			mdns.update();
+		}
 	#endif
 	#ifdef ENABLE_OTA
+		Forensics.enter(Stage::OTA);
 		ArduinoOTA.handle();
 	#endif
-	mqttClient.loop();
+	Forensics.enter(Stage::METRICS_HTTP);
+	handleMetricsHttp();
+	Forensics.enter(Stage::BELL_EVENTS);
+	handleBellEvents();
+
+	unsigned long elapsed = millis() - loopStart;
+	Forensics.recordLoopTime(elapsed);
+	if (elapsed > LOOP_OVERRUN_THRESHOLD) {
+		TelemetryHelper::increment(Metric::LOOP_OVERRUNS);
+	}
+
+	if (elapsed >= FORENSICS_STALL_THRESHOLD) {
+		TelemetryHelper::increment(Metric::LOOP_STALLS);
+	}
 }
@@ -0,0 +1,380 @@
+// Minimal stand-in for the Arduino core, so the firmware can be compiled
+// and tested on the host. Strings and Print behave like the ESP8266
+// core's, the clock only moves when the test (or delay()) moves it.
+#ifndef _HOST_ARDUINO_H
+#define _HOST_ARDUINO_H
+
+#include <stdint.h>
+#include <stddef.h>
+#include <stdarg.h>
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+#include <stdlib.h>
+#include <ctype.h>
+#include <math.h>
+#include <limits.h>
+#include <time.h>
+#include <algorithm>
+
+using std::min;
+using std::max;
+
+// ArduinoJson only turns these on by itself for real Arduino builds.
+#ifndef ARDUINOJSON_ENABLE_ARDUINO_STRING
+	#define ARDUINOJSON_ENABLE_ARDUINO_STRING 1
+#endif
+#ifndef ARDUINOJSON_ENABLE_ARDUINO_STREAM
+	#define ARDUINOJSON_ENABLE_ARDUINO_STREAM 1
+#endif
+#ifndef ARDUINOJSON_ENABLE_ARDUINO_PRINT
+	#define ARDUINOJSON_ENABLE_ARDUINO_PRINT 1
+#endif
+#ifndef ARDUINOJSON_ENABLE_PROGMEM
+	#define ARDUINOJSON_ENABLE_PROGMEM 1
+#endif
+
+#define IRAM_ATTR
+#define ICACHE_RAM_ATTR
+#define HEX 16
+#define DEC 10
+#define LOW 0
+#define HIGH 1
+#define INPUT 0x00
+#define OUTPUT 0x01
+#define INPUT_PULLUP 0x02
+#define RISING 0x01
+#define FALLING 0x02
+#define CHANGE 0x03
+
+typedef uint8_t byte;
+typedef bool boolean;
+
+// Flash is just memory on the host.
+#define PROGMEM
+#define PGM_P const char*
+#define PSTR(s) (s)
+#define pgm_read_byte(addr) (*reinterpret_cast<const uint8_t*>(addr))
+#define pgm_read_word(addr) (*reinterpret_cast<const uint16_t*>(addr))
+#define pgm_read_dword(addr) (*reinterpret_cast<const uint32_t*>(addr))
+#define pgm_read_float(addr) (*reinterpret_cast<const float*>(addr))
+#define pgm_read_ptr(addr) (*reinterpret_cast<const void* const*>(addr))
+#define strlen_P(s) strlen(s)
+#define strcmp_P(a, b) strcmp((a), (b))
+#define strncmp_P(a, b, n) strncmp((a), (b), (n))
+#define strcasecmp_P(a, b) strcasecmp((a), (b))
+#define strcpy_P(dest, src) strcpy((dest), (src))
+#define strncpy_P(dest, src, n) strncpy((dest), (src), (n))
+#define memcpy_P(dest, src, n) memcpy((dest), (src), (n))
+#define snprintf_P snprintf
+#define sprintf_P sprintf
+
+class __FlashStringHelper;
+#define F(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+#define FPSTR(s) (reinterpret_cast<const __FlashStringHelper*>(s))
+
+inline size_t strlcpy(char* dest, const char* src, size_t size) {
+	size_t length = strlen(src);
+	if (size > 0) {
+		size_t count = length < size - 1 ? length : size - 1;
+		memcpy(dest, src, count);
+		dest[count] = '\0';
+	}
+
+	return length;
+}
+
+// Heap-backed like the core's, so code that builds Strings shows up in
+// the heap tests.
+class String
+{
+public:
+	String(const char* text = "") : _buffer(NULL), _length(0) { copy(text, strlen(text)); }
+	String(const __FlashStringHelper* text) : String(reinterpret_cast<const char*>(text)) {}
+	String(const String &other) : _buffer(NULL), _length(0) { copy(other.c_str(), other._length); }
+	explicit String(char c) : _buffer(NULL), _length(0) { copy(&c, 1); }
+	explicit String(int value, unsigned char base = DEC) : String((long)value, base) {}
+	explicit String(unsigned int value, unsigned char base = DEC) : String((unsigned long)value, base) {}
+	explicit String(long value, unsigned char base = DEC) : _buffer(NULL), _length(0) {
+		char text[24];
+		snprintf(text, sizeof(text), base == HEX ? "%lx" : "%ld", value);
+		copy(text, strlen(text));
+	}
+	explicit String(unsigned long value, unsigned char base = DEC) : _buffer(NULL), _length(0) {
+		char text[24];
+		snprintf(text, sizeof(text), base == HEX ? "%lx" : "%lu", value);
+		copy(text, strlen(text));
+	}
+	~String() { free(_buffer); }
+
+	String& operator=(const String &other) {
+		if (this != &other) {
+			copy(other.c_str(), other._length);
+		}
+
+		return *this;
+	}
+	String& operator=(const char* text) { copy(text, strlen(text)); return *this; }
+
+	const char* c_str() const { return _buffer != NULL ? _buffer : ""; }
+	unsigned int length() const { return _length; }
+	bool isEmpty() const { return _length == 0; }
+	char operator[](unsigned int index) const { return index < _length ? _buffer[index] : '\0'; }
+	bool operator==(const char* text) const { return strcmp(c_str(), text) == 0; }
+	bool operator==(const String &other) const { return strcmp(c_str(), other.c_str()) == 0; }
+	bool operator!=(const char* text) const { return !(*this == text); }
+	bool operator!=(const String &other) const { return !(*this == other); }
+
+	bool reserve(unsigned int size) {
+		char* buffer = (char*)realloc(_buffer, size + 1);
+		if (buffer == NULL) {
+			return false;
+		}
+
+		if (_buffer == NULL) {
+			buffer[0] = '\0';
+		}
+
+		_buffer = buffer;
+		return true;
+	}
+
+	bool concat(const char* text, unsigned int length) {
+		if (!reserve(_length + length)) {
+			return false;
+		}
+
+		memcpy(_buffer + _length, text, length);
+		_length += length;
+		_buffer[_length] = '\0';
+		return true;
+	}
+	bool concat(const char* text) { return concat(text, strlen(text)); }
+	bool concat(const String &other) { return concat(other.c_str(), other._length); }
+	bool concat(char c) { return concat(&c, 1); }
+	String& operator+=(const char* text) { concat(text); return *this; }
+	String& operator+=(const String &other) { concat(other); return *this; }
+	String& operator+=(char c) { concat(c); return *this; }
+
+	void replace(const char* find, const char* with) {
+		size_t findLength = strlen(find);
+		if (findLength == 0 || _length == 0) {
+			return;
+		}
+
+		String result;
+		const char* rest = _buffer;
+		const char* match;
+		while ((match = strstr(rest, find)) != NULL) {
+			result.concat(rest, match - rest);
+			result.concat(with);
+			rest = match + findLength;
+		}
+
+		result.concat(rest);
+		*this = result;
+	}
+
+private:
+	void copy(const char* text, unsigned int length) {
+		_length = 0;
+		concat(text, length);
+	}
+
+	char* _buffer;
+	unsigned int _length;
+};
+
+class StringSumHelper : public String
+{
+public:
+	StringSumHelper(const String &text) : String(text) {}
+	StringSumHelper(const char* text) : String(text) {}
+};
+
+inline StringSumHelper operator+(const StringSumHelper &lhs, const char* rhs) {
+	StringSumHelper result(lhs);
+	result.concat(rhs);
+	return result;
+}
+
+inline StringSumHelper operator+(const StringSumHelper &lhs, const String &rhs) {
+	StringSumHelper result(lhs);
+	result.concat(rhs);
+	return result;
+}
+
+class Print;
+
+class Printable
+{
+public:
+	virtual ~Printable() {}
+	virtual size_t printTo(Print &out) const = 0;
+};
+
+class Print
+{
+public:
+	virtual ~Print() {}
+	virtual size_t write(uint8_t c) = 0;
+
+	virtual size_t write(const uint8_t* buffer, size_t size) {
+		size_t n = 0;
+		while (size-- > 0) {
+			n += write(*buffer++);
+		}
+
+		return n;
+	}
+
+	size_t write(const char* text) { return write((const uint8_t*)text, strlen(text)); }
+	size_t write(const char* buffer, size_t size) { return write((const uint8_t*)buffer, size); }
+	virtual void flush() {}
+
+	size_t print(const char* text) { return write(text); }
+	size_t print(const __FlashStringHelper* text) { return write(reinterpret_cast<const char*>(text)); }
+	size_t print(const String &text) { return write(text.c_str()); }
+	size_t print(const Printable &value) { return value.printTo(*this); }
+	size_t print(char c) { return write((uint8_t)c); }
+	size_t print(unsigned char n, int base = DEC) { return print((unsigned long)n, base); }
+	size_t print(int n, int base = DEC) { return print((long)n, base); }
+	size_t print(unsigned int n, int base = DEC) { return print((unsigned long)n, base); }
+	size_t print(long n, int base = DEC) { return base == HEX ? printf("%lx", n) : printf("%ld", n); }
+	size_t print(unsigned long n, int base = DEC) { return base == HEX ? printf("%lx", n) : printf("%lu", n); }
+	size_t print(double n, int digits = 2) { return printf("%.*f", digits, n); }
+	size_t println() { return write("\r\n"); }
+
+	template <typename T>
+	size_t println(const T &value) {
+		size_t n = print(value);
+		return n + println();
+	}
+
+	template <typename T>
+	size_t println(const T &value, int format) {
+		size_t n = print(value, format);
+		return n + println();
+	}
+
+	size_t printf(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		char buffer[256];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(buffer, sizeof(buffer), format, args);
+		va_end(args);
+		return write(buffer);
+	}
+
+	size_t printf_P(const char* format, ...) __attribute__((format(printf, 2, 3))) {
+		char buffer[256];
+		va_list args;
+		va_start(args, format);
+		vsnprintf(buffer, sizeof(buffer), format, args);
+		va_end(args);
+		return write(buffer);
+	}
+};
+
+class Stream : public Print
+{
+public:
+	Stream() : _timeout(1000) {}
+	virtual int available() = 0;
+	virtual int read() = 0;
+	virtual int peek() { return -1; }
+
+	void setTimeout(unsigned long timeout) { _timeout = timeout; }
+
+	size_t readBytes(char* buffer, size_t length) {
+		size_t count = 0;
+		while (count < length) {
+			int c = read();
+			if (c < 0) {
+				break;
+			}
+
+			buffer[count++] = (char)c;
+		}
+
+		return count;
+	}
+	size_t readBytes(uint8_t* buffer, size_t length) { return readBytes((char*)buffer, length); }
+
+	String readString() {
+		String text;
+		int c;
+		while ((c = read()) >= 0) {
+			text += (char)c;
+		}
+
+		return text;
+	}
+
+protected:
+	unsigned long _timeout;
+};
+
+// Only moves when the test, or something calling delay(), moves it.
+inline unsigned long& hostClock() {
+	static unsigned long now = 0;
+	return now;
+}
+
+inline unsigned long millis() { return hostClock(); }
+inline unsigned long micros() { return hostClock() * 1000UL; }
+inline void delay(unsigned long ms) { hostClock() += ms; }
+inline void delayMicroseconds(unsigned int us) { (void)us; }
+inline void yield() {}
+
+inline void pinMode(uint8_t pin, uint8_t mode) { (void)pin; (void)mode; }
+inline void digitalWrite(uint8_t pin, uint8_t value) { (void)pin; (void)value; }
+inline int digitalRead(uint8_t pin) { (void)pin; return HIGH; }
+inline int digitalPinToInterrupt(uint8_t pin) { return pin; }
+inline void attachInterrupt(uint8_t pin, void (*handler)(), int mode) { (void)pin; (void)handler; (void)mode; }
+inline void detachInterrupt(uint8_t pin) { (void)pin; }
+inline void noInterrupts() {}
+inline void interrupts() {}
+
+template <typename T>
+inline T constrain(T value, T low, T high) {
+	return value < low ? low : (value > high ? high : value);
+}
+
+inline long random(long high) { return high > 0 ? ::random() % high : 0; }
+inline long random(long low, long high) { return high > low ? low + random(high - low) : low; }
+
+// Serial output goes to stdout only when echo is set, so a passing test
+// stays quiet.
+class HardwareSerial : public Stream
+{
+public:
+	bool echo = false;
+
+	void begin(unsigned long baud) { (void)baud; }
+	void setDebugOutput(bool enabled) { (void)enabled; }
+	int available() override { return 0; }
+	int read() override { return -1; }
+
+	size_t write(uint8_t c) override {
+		if (echo) {
+			fputc(c, stdout);
+		}
+
+		return 1;
+	}
+	using Print::write;
+};
+
+extern HardwareSerial Serial;
+
+// Like the ESP8266 core's: sets the zone for localtime() and mktime().
+// There is no SNTP here, the host clock is already set.
+inline void configTime(const char* tz, const char* server1, const char* server2 = NULL, const char* server3 = NULL) {
+	setenv("TZ", tz, 1);
+	tzset();
+}
+
+#include "Esp.h"
+
+#endif
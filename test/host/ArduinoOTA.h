@@ -0,0 +1,37 @@
+// Minimal stand-in for the core's ArduinoOTA. No upload ever arrives.
+#ifndef _HOST_ARDUINOOTA_H
+#define _HOST_ARDUINOOTA_H
+
+#include <functional>
+#include <Arduino.h>
+
+#define U_FLASH 0
+#define U_FS 100
+
+typedef enum {
+	OTA_AUTH_ERROR,
+	OTA_BEGIN_ERROR,
+	OTA_CONNECT_ERROR,
+	OTA_RECEIVE_ERROR,
+	OTA_END_ERROR
+} ota_error_t;
+
+class ArduinoOTAClass
+{
+public:
+	void setPort(uint16_t port) { (void)port; }
+	void setHostname(const char* hostname) { (void)hostname; }
+	void setPassword(const char* password) { (void)password; }
+	void onStart(std::function<void()> callback) { (void)callback; }
+	void onEnd(std::function<void()> callback) { (void)callback; }
+	void onProgress(std::function<void(unsigned int, unsigned int)> callback) { (void)callback; }
+	void onError(std::function<void(ota_error_t)> callback) { (void)callback; }
+	void begin() {}
+	void end() {}
+	void handle() {}
+	int getCommand() { return U_FLASH; }
+};
+
+extern ArduinoOTAClass ArduinoOTA;
+
+#endif
@@ -0,0 +1,24 @@
+// Minimal stand-in for the core's HTTP client. Every request fails.
+#ifndef _HOST_ESP8266HTTPCLIENT_H
+#define _HOST_ESP8266HTTPCLIENT_H
+
+#include <Arduino.h>
+#include <WiFiClient.h>
+
+#define HTTP_CODE_OK 200
+#define HTTPC_ERROR_CONNECTION_FAILED (-1)
+
+class HTTPClient
+{
+public:
+	void setTimeout(uint16_t timeout) { (void)timeout; }
+	bool begin(WiFiClient &client, const char* url) { _client = &client; (void)url; return true; }
+	int GET() { return HTTPC_ERROR_CONNECTION_FAILED; }
+	WiFiClient& getStream() { return *_client; }
+	void end() {}
+
+private:
+	WiFiClient *_client = NULL;
+};
+
+#endif
@@ -0,0 +1,61 @@
+// Minimal stand-in for the core's WiFi object: always associated, with a
+// fixed address and signal.
+#ifndef _HOST_ESP8266WIFI_H
+#define _HOST_ESP8266WIFI_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+#include <WiFiClient.h>
+#include <WiFiServer.h>
+
+typedef enum {
+	WL_IDLE_STATUS = 0,
+	WL_NO_SSID_AVAIL = 1,
+	WL_SCAN_COMPLETED = 2,
+	WL_CONNECTED = 3,
+	WL_CONNECT_FAILED = 4,
+	WL_CONNECTION_LOST = 5,
+	WL_DISCONNECTED = 6
+} wl_status_t;
+
+typedef enum {
+	WIFI_OFF = 0,
+	WIFI_STA = 1,
+	WIFI_AP = 2,
+	WIFI_AP_STA = 3
+} WiFiMode_t;
+
+typedef enum {
+	WIFI_NONE_SLEEP = 0,
+	WIFI_LIGHT_SLEEP = 1,
+	WIFI_MODEM_SLEEP = 2
+} WiFiSleepType_t;
+
+class ESP8266WiFiClass
+{
+public:
+	bool hostname(const char* name) { (void)name; return true; }
+	bool mode(WiFiMode_t mode) { (void)mode; return true; }
+	void persistent(bool persistent) { (void)persistent; }
+	bool disconnect(bool wifiOff = false) { (void)wifiOff; return true; }
+	bool setSleepMode(WiFiSleepType_t type) { (void)type; return true; }
+	bool config(IPAddress ip, IPAddress gateway, IPAddress subnet, IPAddress dns = IPAddress()) {
+		(void)ip; (void)gateway; (void)subnet; (void)dns;
+		return true;
+	}
+	wl_status_t begin(const char* ssid, const char* password) { (void)ssid; (void)password; return WL_CONNECTED; }
+	wl_status_t status() { return WL_CONNECTED; }
+	int8_t scanNetworks() { return 0; }
+	String SSID(uint8_t index = 0) { (void)index; return String(); }
+	int32_t RSSI(uint8_t index = 0) { (void)index; return -60; }
+	IPAddress localIP() { return IPAddress(192, 168, 0, 238); }
+	IPAddress gatewayIP() { return IPAddress(192, 168, 0, 1); }
+	IPAddress subnetMask() { return IPAddress(255, 255, 255, 0); }
+	IPAddress dnsIP(uint8_t index = 0) { (void)index; return IPAddress(192, 168, 0, 1); }
+	String macAddress() { return String("00:00:00:A1:B2:C3"); }
+	void printDiag(Print &out) { (void)out; }
+};
+
+extern ESP8266WiFiClass WiFi;
+
+#endif
@@ -0,0 +1,43 @@
+// Minimal stand-in for the core's HTTP updater. Every update fails.
+#ifndef _HOST_ESP8266HTTPUPDATE_H
+#define _HOST_ESP8266HTTPUPDATE_H
+
+#include <functional>
+#include <Arduino.h>
+#include <WiFiClient.h>
+#include <WiFiClientSecure.h>
+
+typedef enum {
+	HTTP_UPDATE_FAILED,
+	HTTP_UPDATE_NO_UPDATES,
+	HTTP_UPDATE_OK
+} HTTPUpdateResult;
+
+typedef HTTPUpdateResult t_httpUpdate_return;
+
+class UpdaterClass
+{
+public:
+	void installSignature(BearSSL::HashSHA256 *hash, BearSSL::SigningVerifier *verifier) { (void)hash; (void)verifier; }
+};
+
+extern UpdaterClass Update;
+
+class ESP8266HTTPUpdate
+{
+public:
+	void rebootOnUpdate(bool reboot) { (void)reboot; }
+	void onStart(std::function<void()> callback) { (void)callback; }
+	void onProgress(std::function<void(int, int)> callback) { (void)callback; }
+
+	t_httpUpdate_return update(WiFiClient &client, const String &url, const String &version = "") {
+		(void)client; (void)url; (void)version;
+		return HTTP_UPDATE_FAILED;
+	}
+
+	String getLastErrorString() { return String("Not available on the host"); }
+};
+
+extern ESP8266HTTPUpdate ESPhttpUpdate;
+
+#endif
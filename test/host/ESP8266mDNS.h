@@ -0,0 +1,24 @@
+// Minimal stand-in for the core's mDNS responder. Nothing is announced.
+#ifndef _HOST_ESP8266MDNS_H
+#define _HOST_ESP8266MDNS_H
+
+#include <Arduino.h>
+
+class MDNSResponder
+{
+public:
+	bool begin(const char* hostname) { (void)hostname; return true; }
+	bool end() { return true; }
+	void update() {}
+	void enableArduino(uint16_t port, bool authUpload = false) { (void)port; (void)authUpload; }
+	bool addService(const char* service, const char* protocol, uint16_t port) {
+		(void)service; (void)protocol; (void)port;
+		return true;
+	}
+	bool addServiceTxt(const char* service, const char* protocol, const char* key, const char* value) {
+		(void)service; (void)protocol; (void)key; (void)value;
+		return true;
+	}
+};
+
+#endif
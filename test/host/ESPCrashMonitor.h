@@ -0,0 +1,24 @@
+// Minimal stand-in for ESPCrashMonitor. There is no watchdog on the host
+// and never a crash to report.
+#ifndef _HOST_ESPCRASHMONITOR_H
+#define _HOST_ESPCRASHMONITOR_H
+
+#include <Arduino.h>
+
+class ESPCrashMonitorClass
+{
+public:
+	enum class ETimeout {
+		Timeout_2s
+	};
+
+	void disableWatchdog() {}
+	void enableWatchdog(ETimeout timeout) { (void)timeout; }
+	void iAmAlive() {}
+	void defer() {}
+	void dump(Print &out) { (void)out; }
+};
+
+extern ESPCrashMonitorClass ESPCrashMonitor;
+
+#endif
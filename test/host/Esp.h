@@ -0,0 +1,61 @@
+// Minimal stand-in for the ESP8266 core's EspClass. RTC memory is plain
+// RAM and the reset info always reads as a power-on.
+#ifndef _HOST_ESP_H
+#define _HOST_ESP_H
+
+#include <stdint.h>
+#include <string.h>
+
+struct rst_info {
+	uint32_t reason;
+	uint32_t exccause;
+	uint32_t epc1;
+	uint32_t epc2;
+	uint32_t epc3;
+	uint32_t excvaddr;
+	uint32_t depc;
+};
+
+enum rst_reason {
+	REASON_DEFAULT_RST = 0,
+	REASON_WDT_RST = 1,
+	REASON_EXCEPTION_RST = 2,
+	REASON_SOFT_WDT_RST = 3,
+	REASON_SOFT_RESTART = 4,
+	REASON_DEEP_SLEEP_AWAKE = 5,
+	REASON_EXT_SYS_RST = 6
+};
+
+class EspClass
+{
+public:
+	uint32_t getChipId() { return 0xA1B2C3; }
+	uint32_t getFreeHeap() { return 40000; }
+	rst_info* getResetInfoPtr() { return &_resetInfo; }
+
+	bool rtcUserMemoryRead(uint32_t offset, uint32_t *data, size_t size) {
+		if (offset * 4 + size > sizeof(_rtcMemory)) {
+			return false;
+		}
+
+		memcpy(data, (uint8_t*)_rtcMemory + offset * 4, size);
+		return true;
+	}
+
+	bool rtcUserMemoryWrite(uint32_t offset, uint32_t *data, size_t size) {
+		if (offset * 4 + size > sizeof(_rtcMemory)) {
+			return false;
+		}
+
+		memcpy((uint8_t*)_rtcMemory + offset * 4, data, size);
+		return true;
+	}
+
+private:
+	rst_info _resetInfo = {};
+	uint32_t _rtcMemory[128] = {};
+};
+
+extern EspClass ESP;
+
+#endif
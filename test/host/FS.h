@@ -0,0 +1,44 @@
+// Minimal stand-in for the core's filesystem: it never mounts, so the
+// firmware runs on its defaults and keeps nothing in flash.
+#ifndef _HOST_FS_H
+#define _HOST_FS_H
+
+#include <Arduino.h>
+
+enum SeekMode {
+	SeekSet = 0,
+	SeekCur = 1,
+	SeekEnd = 2
+};
+
+namespace fs {
+	class File : public Stream
+	{
+	public:
+		int available() override { return 0; }
+		int read() override { return -1; }
+		size_t read(uint8_t *buffer, size_t size) { (void)buffer; (void)size; return 0; }
+		size_t write(uint8_t c) override { (void)c; return 0; }
+		size_t write(const uint8_t *buffer, size_t size) override { (void)buffer; (void)size; return 0; }
+		using Print::write;
+		bool seek(uint32_t position, SeekMode mode) { (void)position; (void)mode; return false; }
+		size_t size() const { return 0; }
+		void close() {}
+		operator bool() const { return false; }
+	};
+
+	class FS
+	{
+	public:
+		bool begin() { return false; }
+		bool exists(const char* path) { (void)path; return false; }
+		File open(const char* path, const char* mode) { (void)path; (void)mode; return File(); }
+		bool remove(const char* path) { (void)path; return false; }
+	};
+}
+
+using fs::File;
+
+extern fs::FS SPIFFS;
+
+#endif
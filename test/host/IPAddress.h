@@ -0,0 +1,39 @@
+// Minimal stand-in for the core's IPAddress: four bytes, parsed from and
+// printed as dotted quads.
+#ifndef _HOST_IPADDRESS_H
+#define _HOST_IPADDRESS_H
+
+#include <Arduino.h>
+
+class IPAddress : public Printable
+{
+public:
+	IPAddress() : _address(0) {}
+	IPAddress(uint8_t a, uint8_t b, uint8_t c, uint8_t d)
+		: _address((uint32_t)a | ((uint32_t)b << 8) | ((uint32_t)c << 16) | ((uint32_t)d << 24)) {}
+	IPAddress(uint32_t address) : _address(address) {}
+
+	operator uint32_t() const { return _address; }
+	uint8_t operator[](int index) const { return (uint8_t)(_address >> (index * 8)); }
+	bool isSet() const { return _address != 0; }
+
+	bool fromString(const char* text) {
+		unsigned int a, b, c, d;
+		char end;
+		if (sscanf(text, "%u.%u.%u.%u%c", &a, &b, &c, &d, &end) != 4 || a > 255 || b > 255 || c > 255 || d > 255) {
+			return false;
+		}
+
+		*this = IPAddress(a, b, c, d);
+		return true;
+	}
+
+	size_t printTo(Print &out) const override {
+		return out.printf("%u.%u.%u.%u", (*this)[0], (*this)[1], (*this)[2], (*this)[3]);
+	}
+
+private:
+	uint32_t _address;
+};
+
+#endif
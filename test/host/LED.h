@@ -0,0 +1,27 @@
+// Minimal stand-in for ArduinoHAF's LED, which only remembers its state.
+#ifndef _HOST_LED_H
+#define _HOST_LED_H
+
+#include <Arduino.h>
+
+enum class LEDState : uint8_t {
+	LED_Off = LOW,
+	LED_On = HIGH
+};
+
+class HAF_LED
+{
+public:
+	HAF_LED(uint8_t pin, void (*callback)(LEDState)) : _state(LEDState::LED_Off) { (void)pin; (void)callback; }
+	void init() {}
+	void on() { _state = LEDState::LED_On; }
+	void off() { _state = LEDState::LED_Off; }
+	void blink(unsigned long delayMs) { (void)delayMs; }
+	void setState(LEDState state) { _state = state; }
+	bool isOn() { return _state == LEDState::LED_On; }
+
+private:
+	LEDState _state;
+};
+
+#endif
@@ -0,0 +1,175 @@
+// Stand-in for PubSubClient that is its own broker. Connects succeed,
+// publishes are kept per topic (the last payload on each), and a message
+// queued with deliver() reaches the callback on the next loop(), out of
+// the client's buffer like the real one. All of it is fixed-size, so the
+// transport never allocates on the firmware's behalf.
+#ifndef _HOST_PUBSUBCLIENT_H
+#define _HOST_PUBSUBCLIENT_H
+
+#include <Arduino.h>
+#include <Client.h>
+
+#define MQTT_CONNECTION_TIMEOUT -4
+#define MQTT_CONNECTION_LOST -3
+#define MQTT_CONNECT_FAILED -2
+#define MQTT_DISCONNECTED -1
+#define MQTT_CONNECTED 0
+#define MQTT_CONNECT_BAD_PROTOCOL 1
+#define MQTT_CONNECT_BAD_CLIENT_ID 2
+#define MQTT_CONNECT_UNAVAILABLE 3
+#define MQTT_CONNECT_BAD_CREDENTIALS 4
+#define MQTT_CONNECT_UNAUTHORIZED 5
+
+#define MQTT_CALLBACK_SIGNATURE void (*callback)(char*, uint8_t*, unsigned int)
+
+#define HOST_MQTT_TOPICS 48
+#define HOST_MQTT_TOPIC_SIZE 128
+#define HOST_MQTT_PAYLOAD_SIZE 1024
+
+class PubSubClient : public Print
+{
+public:
+	uint32_t publishCount = 0;
+
+	PubSubClient(Client &client) : _connected(false), _callback(NULL), _pending(false), _inPublish(false), _topicCount(0) {
+		(void)client;
+	}
+
+	PubSubClient& setServer(const char* host, uint16_t port) { (void)host; (void)port; return *this; }
+	PubSubClient& setClient(Client &client) { (void)client; return *this; }
+	PubSubClient& setCallback(MQTT_CALLBACK_SIGNATURE) { _callback = callback; return *this; }
+	PubSubClient& setKeepAlive(uint16_t keepAlive) { (void)keepAlive; return *this; }
+	PubSubClient& setSocketTimeout(uint16_t timeout) { (void)timeout; return *this; }
+	bool setBufferSize(uint16_t size) { return size <= sizeof(_buffer); }
+
+	bool connect(const char* id, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+		(void)id; (void)willTopic; (void)willQos; (void)willRetain; (void)willMessage;
+		_connected = true;
+		return true;
+	}
+
+	bool connect(const char* id, const char* user, const char* pass, const char* willTopic, uint8_t willQos, bool willRetain, const char* willMessage) {
+		(void)user; (void)pass;
+		return connect(id, willTopic, willQos, willRetain, willMessage);
+	}
+
+	void disconnect() { _connected = false; }
+	bool connected() { return _connected; }
+	int state() { return _connected ? MQTT_CONNECTED : MQTT_DISCONNECTED; }
+	bool subscribe(const char* topic) { (void)topic; return _connected; }
+	bool unsubscribe(const char* topic) { (void)topic; return _connected; }
+
+	bool publish(const char* topic, const char* payload, bool retained) {
+		(void)retained;
+		if (!_connected) {
+			return false;
+		}
+
+		store(topic, payload, strlen(payload));
+		return true;
+	}
+
+	bool beginPublish(const char* topic, unsigned int length, bool retained) {
+		(void)length; (void)retained;
+		if (!_connected) {
+			return false;
+		}
+
+		strlcpy(_publishTopic, topic, sizeof(_publishTopic));
+		_publishLength = 0;
+		_inPublish = true;
+		return true;
+	}
+
+	size_t write(uint8_t c) override { return write(&c, 1); }
+
+	size_t write(const uint8_t *buffer, size_t size) override {
+		if (!_inPublish) {
+			return 0;
+		}
+
+		size_t count = std::min(size, sizeof(_publishPayload) - _publishLength);
+		memcpy(_publishPayload + _publishLength, buffer, count);
+		_publishLength += count;
+		return size;
+	}
+
+	int endPublish() {
+		if (!_inPublish) {
+			return 0;
+		}
+
+		_inPublish = false;
+		store(_publishTopic, (const char*)_publishPayload, _publishLength);
+		return 1;
+	}
+
+	bool loop() {
+		if (!_connected) {
+			return false;
+		}
+
+		if (_pending && _callback != NULL) {
+			_pending = false;
+			_callback(_inboundTopic, _buffer, _inboundLength);
+		}
+
+		return true;
+	}
+
+	// Queues a message from the broker for the next loop().
+	void deliver(const char* topic, const char* payload) {
+		strlcpy(_inboundTopic, topic, sizeof(_inboundTopic));
+		_inboundLength = std::min(strlen(payload), sizeof(_buffer));
+		memcpy(_buffer, payload, _inboundLength);
+		_pending = true;
+	}
+
+	// The last payload published on the topic, or NULL if there was none.
+	const char* getPublished(const char* topic) const {
+		for (uint8_t i = 0; i < _topicCount; i++) {
+			if (strcmp(_topics[i], topic) == 0) {
+				return _payloads[i];
+			}
+		}
+
+		return NULL;
+	}
+
+private:
+	void store(const char* topic, const char* payload, size_t length) {
+		publishCount++;
+		uint8_t index = 0;
+		while (index < _topicCount && strcmp(_topics[index], topic) != 0) {
+			index++;
+		}
+
+		if (index == _topicCount) {
+			if (_topicCount == HOST_MQTT_TOPICS) {
+				return;
+			}
+
+			strlcpy(_topics[_topicCount++], topic, HOST_MQTT_TOPIC_SIZE);
+		}
+
+		length = std::min(length, (size_t)HOST_MQTT_PAYLOAD_SIZE - 1);
+		memcpy(_payloads[index], payload, length);
+		_payloads[index][length] = '\0';
+	}
+
+	bool _connected;
+	void (*_callback)(char*, uint8_t*, unsigned int);
+	uint8_t _buffer[HOST_MQTT_PAYLOAD_SIZE];
+	char _inboundTopic[HOST_MQTT_TOPIC_SIZE];
+	size_t _inboundLength;
+	bool _pending;
+	char _publishTopic[HOST_MQTT_TOPIC_SIZE];
+	uint8_t _publishPayload[HOST_MQTT_PAYLOAD_SIZE];
+	size_t _publishLength;
+	bool _inPublish;
+	char _topics[HOST_MQTT_TOPICS][HOST_MQTT_TOPIC_SIZE];
+	char _payloads[HOST_MQTT_TOPICS][HOST_MQTT_PAYLOAD_SIZE];
+	uint8_t _topicCount;
+};
+
+#endif
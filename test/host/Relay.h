@@ -0,0 +1,32 @@
+// Minimal stand-in for ArduinoHAF's Relay, which only remembers its state.
+#ifndef _HOST_RELAY_H
+#define _HOST_RELAY_H
+
+#include <Arduino.h>
+
+enum class RelayState : uint8_t {
+	RelayOpen = 0,
+	RelayClosed = 1
+};
+
+struct RelayInfo {
+	RelayState state;
+	const char* name;
+};
+
+class Relay
+{
+public:
+	Relay(uint8_t pin, void (*callback)(RelayInfo*), const char* name) : _state(RelayState::RelayOpen) {
+		(void)pin; (void)callback; (void)name;
+	}
+	void init() {}
+	void open() { _state = RelayState::RelayOpen; }
+	void close() { _state = RelayState::RelayClosed; }
+	bool isOpen() { return _state == RelayState::RelayOpen; }
+
+private:
+	RelayState _state;
+};
+
+#endif
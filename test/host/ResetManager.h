@@ -0,0 +1,17 @@
+// Minimal stand-in for ArduinoHAF's ResetManager, which only counts.
+#ifndef _HOST_RESETMANAGER_H
+#define _HOST_RESETMANAGER_H
+
+#include <stdint.h>
+
+class ResetManagerClass
+{
+public:
+	uint32_t resets = 0;
+
+	void softReset() { resets++; }
+};
+
+extern ResetManagerClass ResetManager;
+
+#endif
@@ -0,0 +1,160 @@
+// Minimal stand-in for TaskScheduler, with the parts of its timing the
+// firmware relies on: iterations, delayed enables, forced iterations, a
+// high-priority layer that runs ahead of every task, and the idle sleep
+// callback.
+#ifndef _HOST_TASKSCHEDULER_H
+#define _HOST_TASKSCHEDULER_H
+
+#include <Arduino.h>
+
+#define TASK_IMMEDIATE 0
+#define TASK_FOREVER (-1)
+#define TASK_ONCE 1
+#define TASK_MILLISECOND 1UL
+#define TASK_SECOND 1000UL
+#define TASK_MINUTE 60000UL
+#define TASK_HOUR 3600000UL
+
+typedef void (*TaskCallback)();
+typedef void (*SleepCallback)(unsigned long duration);
+
+class Scheduler;
+
+class Task
+{
+public:
+	Task(unsigned long interval, long iterations, TaskCallback callback)
+		: _interval(interval), _setIterations(iterations), _iterations(iterations), _callback(callback),
+		_enabled(false), _previous(0), _delay(0), _next(NULL) {}
+
+	bool enable() {
+		_enabled = true;
+		_iterations = _setIterations;
+		_previous = millis();
+		_delay = 0;
+		return true;
+	}
+
+	bool enableDelayed(unsigned long delay) {
+		enable();
+		_delay = delay;
+		return true;
+	}
+
+	bool restart() { return enable(); }
+	bool restartDelayed(unsigned long delay) { return enableDelayed(delay); }
+	bool disable() { bool was = _enabled; _enabled = false; return was; }
+	bool isEnabled() { return _enabled; }
+
+	void forceNextIteration() {
+		_previous = millis();
+		_delay = 0;
+	}
+
+	void setInterval(unsigned long interval) {
+		_interval = interval;
+		_previous = millis();
+		_delay = interval;
+	}
+
+private:
+	friend class Scheduler;
+
+	// Runs the callback if the task is due, and says whether it did.
+	bool run() {
+		if (!_enabled || millis() - _previous < _delay) {
+			return false;
+		}
+
+		_previous = millis();
+		_delay = _interval;
+		if (_iterations > 0) {
+			_iterations--;
+		}
+
+		if (_iterations == 0) {
+			_enabled = false;
+		}
+
+		if (_callback != NULL) {
+			_callback();
+		}
+
+		return true;
+	}
+
+	unsigned long _interval;
+	long _setIterations;
+	long _iterations;
+	TaskCallback _callback;
+	bool _enabled;
+	unsigned long _previous;
+	unsigned long _delay;
+	Task *_next;
+};
+
+class Scheduler
+{
+public:
+	Scheduler() : _first(NULL), _last(NULL), _highPriority(NULL), _allowSleep(true), _sleep(NULL) {}
+
+	void init() {
+		_first = NULL;
+		_last = NULL;
+	}
+
+	void addTask(Task &task) {
+		task._next = NULL;
+		if (_last != NULL) {
+			_last->_next = &task;
+		}
+		else {
+			_first = &task;
+		}
+
+		_last = &task;
+	}
+
+	void enableAll() {
+		for (Task *task = _first; task != NULL; task = task->_next) {
+			task->enable();
+		}
+	}
+
+	void disableAll() {
+		for (Task *task = _first; task != NULL; task = task->_next) {
+			task->disable();
+		}
+	}
+
+	void setHighPriorityScheduler(Scheduler *scheduler) { _highPriority = scheduler; }
+	void allowSleep(bool allow) { _allowSleep = allow; }
+	void setSleepMethod(SleepCallback callback) { _sleep = callback; }
+
+	// Returns true if nothing ran, like the real one.
+	bool execute() {
+		bool idle = true;
+		for (Task *task = _first; task != NULL; task = task->_next) {
+			if (_highPriority != NULL) {
+				idle = _highPriority->execute() && idle;
+			}
+
+			idle = !task->run() && idle;
+		}
+
+		if (idle && _allowSleep && _sleep != NULL) {
+			_sleep(0);
+		}
+
+		return idle;
+	}
+
+private:
+	Task *_first;
+	Task *_last;
+	Scheduler *_highPriority;
+	bool _allowSleep;
+	SleepCallback _sleep;
+};
+
+#endif
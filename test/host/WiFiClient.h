@@ -0,0 +1,25 @@
+// Minimal stand-in for the core's WiFiClient. It never reaches anything:
+// connects fail and there is never data to read.
+#ifndef _HOST_WIFICLIENT_H
+#define _HOST_WIFICLIENT_H
+
+#include <Client.h>
+
+class WiFiClient : public Client
+{
+public:
+	static void setDefaultNoDelay(bool noDelay) { (void)noDelay; }
+
+	int connect(IPAddress ip, uint16_t port) override { (void)ip; (void)port; return 0; }
+	int connect(const char* host, uint16_t port) override { (void)host; (void)port; return 0; }
+	uint8_t connected() override { return 0; }
+	void stop() override {}
+	int available() override { return 0; }
+	int read() override { return -1; }
+	size_t write(uint8_t c) override { (void)c; return 0; }
+	using Print::write;
+	void setNoDelay(bool noDelay) { (void)noDelay; }
+	operator bool() { return connected() != 0; }
+};
+
+#endif
@@ -0,0 +1,47 @@
+// Minimal stand-in for the core's BearSSL client and the types that
+// configure it. Nothing is verified and nothing connects.
+#ifndef _HOST_WIFICLIENTSECURE_H
+#define _HOST_WIFICLIENTSECURE_H
+
+#include <WiFiClient.h>
+
+namespace BearSSL {
+	class Session {};
+	class HashSHA256 {};
+
+	class PublicKey
+	{
+	public:
+		PublicKey(const char* pem) { (void)pem; }
+		bool isRSA() const { return false; }
+	};
+
+	class SigningVerifier
+	{
+	public:
+		SigningVerifier(PublicKey *key) { (void)key; }
+	};
+
+	class X509List
+	{
+	public:
+		X509List(const char* pem) { (void)pem; }
+	};
+
+	class WiFiClientSecure : public WiFiClient
+	{
+	public:
+		static bool probeMaxFragmentLength(const char* host, uint16_t port, uint16_t length) {
+			(void)host; (void)port; (void)length;
+			return false;
+		}
+
+		void setSession(Session *session) { (void)session; }
+		bool setFingerprint(const char* fingerprint) { (void)fingerprint; return true; }
+		void setTrustAnchors(const X509List *anchors) { (void)anchors; }
+		void setBufferSizes(int receive, int transmit) { (void)receive; (void)transmit; }
+		void setX509Time(time_t now) { (void)now; }
+	};
+}
+
+#endif
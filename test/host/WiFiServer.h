@@ -0,0 +1,16 @@
+// Minimal stand-in for the core's WiFiServer. No client ever arrives.
+#ifndef _HOST_WIFISERVER_H
+#define _HOST_WIFISERVER_H
+
+#include <WiFiClient.h>
+
+class WiFiServer
+{
+public:
+	WiFiServer(uint16_t port) { (void)port; }
+	void begin() {}
+	bool hasClient() { return false; }
+	WiFiClient available() { return WiFiClient(); }
+};
+
+#endif
@@ -0,0 +1,25 @@
+// Minimal stand-in for the core's WiFiUDP. No datagram ever arrives.
+#ifndef _HOST_WIFIUDP_H
+#define _HOST_WIFIUDP_H
+
+#include <Arduino.h>
+#include <IPAddress.h>
+
+class WiFiUDP : public Stream
+{
+public:
+	uint8_t begin(uint16_t port) { (void)port; return 1; }
+	void stop() {}
+	int parsePacket() { return 0; }
+	int available() override { return 0; }
+	int read() override { return -1; }
+	int read(uint8_t *buffer, size_t size) { (void)buffer; (void)size; return 0; }
+	IPAddress remoteIP() { return IPAddress(); }
+	uint16_t remotePort() { return 0; }
+	int beginPacket(IPAddress ip, uint16_t port) { (void)ip; (void)port; return 1; }
+	int endPacket() { return 1; }
+	size_t write(uint8_t c) override { (void)c; return 1; }
+	using Print::write;
+};
+
+#endif
@@ -0,0 +1,43 @@
+// Minimal stand-in for BearSSL's HMAC API. The MAC is all zeroes, which is
+// enough for code that is never handed a packet.
+#ifndef _HOST_BEARSSL_H
+#define _HOST_BEARSSL_H
+
+#include <stddef.h>
+#include <string.h>
+
+typedef struct {
+	int unused;
+} br_hash_class;
+
+typedef struct {
+	const br_hash_class *digest;
+} br_hmac_key_context;
+
+typedef struct {
+	const br_hmac_key_context *key;
+} br_hmac_context;
+
+static const br_hash_class br_sha256_vtable = { 0 };
+
+inline void br_hmac_key_init(br_hmac_key_context *kc, const br_hash_class *digest, const void* key, size_t length) {
+	(void)key; (void)length;
+	kc->digest = digest;
+}
+
+inline void br_hmac_init(br_hmac_context *ctx, const br_hmac_key_context *kc, size_t outLength) {
+	(void)outLength;
+	ctx->key = kc;
+}
+
+inline void br_hmac_update(br_hmac_context *ctx, const void* data, size_t length) {
+	(void)ctx; (void)data; (void)length;
+}
+
+inline size_t br_hmac_out(const br_hmac_context *ctx, void* out) {
+	(void)ctx;
+	memset(out, 0, 32);
+	return 32;
+}
+
+#endif
@@ -0,0 +1,193 @@
+// Host test for the firmware's control path, linked with the same malloc
+// wrapping as the huzzah_heapcheck environment. The whole firmware boots
+// through setup() against the stand-ins in this directory, with the MQTT
+// transport replaced by a broker inside PubSubClient. Control messages
+// then take the same route as on the device: the poll task hands them to
+// onMqttMessage(), they are decoded, queued, applied to the relays, and
+// the new state is published. Once warmed up, the device must run for
+// another ten (simulated) minutes of commands, rejects and housekeeping
+// without a single heap allocation outside the exempt paths.
+//
+// Needs ArduinoJson, which `pio run` fetches. Build and run from the repo
+// root (-v echoes the firmware's serial output):
+//     g++ -std=gnu++17 -O0 -DESP8266 -DENABLE_HEAP_TRACKING -Itest/host -Iinclude -I.pio/libdeps/huzzah/ArduinoJson/src test/host/control_path_test.cpp src/*.cpp -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o control_path_test
+//     ./control_path_test
+
+#include <new>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <Arduino.h>
+#include <ArduinoOTA.h>
+#include <ESP8266WiFi.h>
+#include <ESP8266httpUpdate.h>
+#include <ESPCrashMonitor.h>
+#include <FS.h>
+#include <PubSubClient.h>
+#include <Relay.h>
+#include <ResetManager.h>
+#include "HeapTracker.h"
+#include "config.h"
+
+// What the core and libraries would otherwise provide.
+HardwareSerial Serial;
+EspClass ESP;
+ESP8266WiFiClass WiFi;
+fs::FS SPIFFS;
+UpdaterClass Update;
+ESP8266HTTPUpdate ESPhttpUpdate;
+ArduinoOTAClass ArduinoOTA;
+ResetManagerClass ResetManager;
+ESPCrashMonitorClass ESPCrashMonitor;
+
+// Only the 32-bit target's operator new is wrapped. On the host, new goes
+// through malloc() instead, so it is counted all the same.
+extern "C" {
+	void* __real__Znwj(size_t size) { return malloc(size); }
+	void* __real__Znaj(size_t size) { return malloc(size); }
+}
+
+void* operator new(size_t size) {
+	void* ptr = malloc(size);
+	if (ptr == NULL) {
+		throw std::bad_alloc();
+	}
+
+	return ptr;
+}
+
+void* operator new[](size_t size) { return operator new(size); }
+void operator delete(void* ptr) noexcept { free(ptr); }
+void operator delete[](void* ptr) noexcept { free(ptr); }
+void operator delete(void* ptr, size_t size) noexcept { (void)size; free(ptr); }
+void operator delete[](void* ptr, size_t size) noexcept { (void)size; free(ptr); }
+
+// From main.cpp.
+extern config_t config;
+extern PubSubClient mqttClient;
+extern Relay outputRelays[MAX_OUTPUT_CHANNELS];
+void setup();
+void loop();
+
+// Long enough for the token buckets to refill between messages.
+#define MESSAGE_GAP_MS 250
+#define WARMUP_MS 600000UL
+#define STEADY_STATE_MS 600000UL
+
+typedef struct {
+	const char* description;
+	bool addressed;             // carries this device's client ID
+	const char* body;           // the rest of the message
+	bool active;                // whether the channel is on afterwards
+} control_step_t;
+
+// One round of what tools/heapcheck.py sends a bench device. Every step
+// but the rejected ones publishes the state it leaves the channel in.
+static const control_step_t steps[] = {
+	{ "single command", true, "\"command\":5", true },
+	{ "single command", true, "\"command\":6", false },
+	{ "batch", true, "\"commands\":[5,6,4]", true },
+	{ "channel by name", true, "\"command\":4,\"channel\":\"bell\"", false },
+	{ "channel by mask", true, "\"command\":5,\"mask\":1", true },
+	{ "status request", true, "\"command\":3", true },
+	{ "another device", false, "\"clientId\":\"CYLENCE_000000\",\"command\":6", true },
+	{ "no client ID", false, "\"command\":6", true },
+	{ "invalid command", true, "\"command\":42", true },
+	{ "invalid batch", true, "\"commands\":[5,2,6]", true },
+	{ "unknown channel", true, "\"command\":6,\"channel\":7", true },
+	{ "malformed JSON", false, "\"command\":", true },
+	{ "channel by index", true, "\"command\":6,\"channel\":0", false }
+};
+
+static int failures = 0;
+
+static void check(bool condition, const char* what, const char* step) {
+	if (!condition) {
+		printf("FAIL: %s (%s)\n", what, step);
+		failures++;
+	}
+}
+
+// Runs the main loop for a while, the way the device would.
+static void run(unsigned long ms) {
+	unsigned long start = millis();
+	while (millis() - start < ms) {
+		loop();
+		delay(1);
+	}
+}
+
+static void runRound(bool verify) {
+	char message[160];
+	char clientId[64];
+	snprintf(clientId, sizeof(clientId), "\"clientId\":\"%s\"", config.hostname);
+	for (size_t i = 0; i < sizeof(steps) / sizeof(steps[0]); i++) {
+		const control_step_t &step = steps[i];
+		if (step.addressed) {
+			snprintf(message, sizeof(message), "{\"clientId\":\"%s\",%s}", config.hostname, step.body);
+		}
+		else {
+			snprintf(message, sizeof(message), "{%s}", step.body);
+		}
+
+		uint32_t published = mqttClient.publishCount;
+		mqttClient.deliver(config.mqttTopicControl, message);
+		run(MESSAGE_GAP_MS);
+		if (!verify) {
+			continue;
+		}
+
+		check(outputRelays[0].isOpen() != step.active, "relay state", step.description);
+		const char* status = mqttClient.getPublished(config.mqttTopicStatus);
+		check(status != NULL && strstr(status, step.active ? "\"channelMask\":1" : "\"channelMask\":0") != NULL,
+			"published state", step.description);
+		check(status != NULL && strstr(status, clientId) != NULL && strstr(status, "\"lastUpdate\":\"") != NULL,
+			"complete status payload", step.description);
+		if (strncmp(step.body, "\"command\":3", 11) == 0) {
+			check(mqttClient.publishCount > published, "status published on request", step.description);
+		}
+	}
+}
+
+int main(int argc, char** argv) {
+	Serial.echo = argc > 1 && strcmp(argv[1], "-v") == 0;
+
+	setup();
+	check(mqttClient.connected(), "connected at boot", "setup");
+	check(config.channelNamesCount == 1 && strcmp(config.channelNames[0], "bell") == 0, "default channel", "setup");
+
+	// The first round checks what every message does. Warming up also
+	// lets every housekeeping task run at least once.
+	runRound(true);
+	unsigned long warmupStart = millis();
+	while (millis() - warmupStart < WARMUP_MS) {
+		runRound(false);
+	}
+
+	uint32_t allocations = HeapTracker.getAllocations();
+	uint32_t bytes = HeapTracker.getBytes();
+	uint32_t rounds = 0;
+	unsigned long start = millis();
+	while (millis() - start < STEADY_STATE_MS) {
+		runRound(true);
+		rounds++;
+	}
+
+	uint32_t steadyAllocations = HeapTracker.getAllocations() - allocations;
+	if (steadyAllocations > 0) {
+		printf("FAIL: %u heap allocations (%u bytes) in steady state\n",
+			(unsigned)steadyAllocations, (unsigned)(HeapTracker.getBytes() - bytes));
+		Serial.echo = true;
+		HeapTracker.printSummary(Serial);
+		failures++;
+	}
+
+	if (failures > 0) {
+		printf("%d failure(s)\n", failures);
+		return 1;
+	}
+
+	printf("OK (%u rounds, %u allocations during warm-up, %u exempt)\n",
+		(unsigned)rounds, (unsigned)allocations, (unsigned)HeapTracker.getExemptAllocations());
+	return 0;
+}
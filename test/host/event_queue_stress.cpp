@@ -0,0 +1,88 @@
+// Host stress test for EventQueue. One thread plays the bell ISR and
+// pushes as fast as it can, dropping on a full ring like the real
+// handler does. The main thread plays loop() and drains. Every item
+// carries its sequence number twice, so lost, duplicated, reordered or
+// torn items all show up.
+//
+// Build and run from the repo root:
+//     g++ -std=c++11 -O2 -pthread -Itest/host -Iinclude test/host/event_queue_stress.cpp -o event_queue_stress
+//     ./event_queue_stress
+
+#include <atomic>
+#include <cstdio>
+#include <thread>
+#include "EventQueue.h"
+
+typedef struct {
+	uint32_t sequence;
+	uint32_t check;     // ~sequence
+} stress_event_t;
+
+static const uint32_t ITEMS = 1000000;
+
+template <uint8_t N>
+static bool stress(bool retry) {
+	EventQueue<stress_event_t, N> queue;
+	std::atomic<bool> done(false);
+	uint32_t pushed = 0;
+	uint32_t dropped = 0;
+
+	std::thread isr([&]() {
+		for (uint32_t i = 0; i < ITEMS; i++) {
+			stress_event_t event = { i, ~i };
+			while (!queue.push(event)) {
+				if (!retry) {
+					dropped++;
+					break;
+				}
+				std::this_thread::yield();
+			}
+
+			// Vary the interleaving now and then.
+			if ((i & 0x3FF) == 0) {
+				std::this_thread::yield();
+			}
+		}
+
+		pushed = ITEMS - dropped;
+		done.store(true, std::memory_order_release);
+	});
+
+	uint32_t popped = 0;
+	uint32_t errors = 0;
+	int64_t last = -1;
+	stress_event_t event;
+	while (true) {
+		if (!queue.pop(event)) {
+			if (done.load(std::memory_order_acquire) && queue.isEmpty()) {
+				break;
+			}
+			std::this_thread::yield();
+			continue;
+		}
+
+		popped++;
+		if (event.check != ~event.sequence || (int64_t)event.sequence <= last
+				|| (retry && event.sequence != (uint32_t)(last + 1))) {
+			errors++;
+		}
+		last = event.sequence;
+	}
+
+	isr.join();
+	bool ok = errors == 0 && popped == pushed && queue.isEmpty();
+	printf("%-4s N=%-3u %-5s pushed %u, dropped %u, popped %u, bad %u\n", ok ? "OK" : "FAIL",
+		(unsigned int)N, retry ? "retry" : "drop", pushed, dropped, popped, errors);
+	return ok;
+}
+
+int main() {
+	bool ok = true;
+	ok &= stress<2>(true);
+	ok &= stress<16>(true);
+	ok &= stress<128>(true);
+	ok &= stress<2>(false);
+	ok &= stress<16>(false);
+	ok &= stress<128>(false);
+	return ok ? 0 : 1;
+}
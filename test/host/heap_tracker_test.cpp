@@ -0,0 +1,122 @@
+// Host test for HeapTracker, linked with the same malloc wrapping as the
+// huzzah_heapcheck environment. Covers arming, exemptions, call site
+// grouping and overflow, and the report the device publishes. The
+// firmware's own control path is covered by control_path_test.cpp.
+//
+// Build and run from the repo root:
+//     g++ -std=c++11 -O0 -DENABLE_HEAP_TRACKING -Itest/host -Iinclude test/host/heap_tracker_test.cpp src/HeapTracker.cpp -Wl,--wrap=malloc,--wrap=calloc,--wrap=realloc -o heap_tracker_test
+//     ./heap_tracker_test
+
+#include <stdlib.h>
+#include "HeapTracker.h"
+
+// Only the 32-bit target's operator new is wrapped. On a 64-bit host the
+// wrappers are never called, but they still need something to link to.
+extern "C" {
+	void* __real__Znwj(size_t size) { return malloc(size); }
+	void* __real__Znaj(size_t size) { return malloc(size); }
+}
+
+class StringPrint : public Print
+{
+public:
+	char text[512];
+	size_t length = 0;
+
+	size_t write(uint8_t c) override {
+		if (length + 1 < sizeof(text)) {
+			text[length++] = (char)c;
+			text[length] = '\0';
+		}
+
+		return 1;
+	}
+};
+
+static void* volatile sink;
+static int failures = 0;
+static char messages[16][96];
+
+static void check(bool condition, const char* what) {
+	if (!condition && failures < 16) {
+		snprintf(messages[failures], sizeof(messages[failures]), "%s", what);
+	}
+
+	failures += condition ? 0 : 1;
+}
+
+// Not inlined, so every call comes from the same site.
+static __attribute__((noinline)) void allocateAndFree(size_t size) {
+	sink = malloc(size);
+	free(sink);
+}
+
+int main() {
+	// Nothing counts before boot is complete.
+	allocateAndFree(16);
+	check(HeapTracker.getAllocations() == 0, "counted before arm()");
+
+	HeapTracker.arm();
+	for (int i = 0; i < 3; i++) {
+		allocateAndFree(10);
+	}
+
+	check(HeapTracker.getAllocations() == 3, "malloc() after arm() not counted once each");
+	check(HeapTracker.getBytes() == 30, "wrong byte count");
+	check(HeapTracker.takeChanged(), "takeChanged() missed new allocations");
+	check(!HeapTracker.takeChanged(), "takeChanged() reported the same allocations twice");
+
+	sink = calloc(4, 8);
+	sink = realloc(sink, 64);
+	free(sink);
+	check(HeapTracker.getAllocations() == 5, "calloc() or realloc() not counted");
+	check(HeapTracker.getBytes() == 30 + 32 + 64, "calloc() or realloc() bytes wrong");
+
+	{
+		HeapExemption exempt;
+		allocateAndFree(100);
+		{
+			HeapExemption nested;
+			allocateAndFree(100);
+		}
+		allocateAndFree(100);
+	}
+
+	check(HeapTracker.getAllocations() == 5, "exempt allocations counted as steady-state");
+	check(HeapTracker.getExemptAllocations() == 3, "exempt allocations not counted");
+
+	// The 3 calls through allocateAndFree() share one site, calloc() and
+	// realloc() add two more. Past HEAP_TRACKING_SITES, new sites land in
+	// the last entry with address 0.
+	for (uint32_t site = 1; site <= HEAP_TRACKING_SITES; site++) {
+		HeapTracker.recordAllocation(0x40200000 + site * 4, 1);
+	}
+
+	StringPrint report;
+	HeapTracker.writeReport(report, "CYLENCE_TEST");
+	size_t reportLength = HeapTracker.getReportLength("CYLENCE_TEST");
+
+	char expected[64];
+	snprintf(expected, sizeof(expected), "\"allocations\":%u,", 5 + HEAP_TRACKING_SITES);
+	check(strstr(report.text, expected) != NULL, "report allocation count wrong");
+	check(strncmp(report.text, "{\"clientId\":\"CYLENCE_TEST\"", 26) == 0, "report doesn't start with the client ID");
+	check(strcmp(report.text + report.length - 2, "]}") == 0, "report not terminated");
+	check(reportLength == report.length, "getReportLength() disagrees with writeReport()");
+	check(strstr(report.text, "\"addr\":\"0x00000000\"") != NULL, "overflowing sites not lumped together");
+
+	size_t sites = 0;
+	for (const char* p = report.text; (p = strstr(p, "\"addr\"")) != NULL; p++) {
+		sites++;
+	}
+
+	check(sites == HEAP_TRACKING_SITES, "report site count wrong");
+
+	for (int i = 0; i < failures && i < 16; i++) {
+		printf("FAIL: %s\n", messages[i]);
+	}
+
+	printf("%s (%u steady-state, %u exempt)\n", failures == 0 ? "OK" : "FAIL",
+		(unsigned)HeapTracker.getAllocations(), (unsigned)HeapTracker.getExemptAllocations());
+	printf("%s\n", report.text);
+	return failures == 0 ? 0 : 1;
+}
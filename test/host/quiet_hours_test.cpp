@@ -0,0 +1,74 @@
+// Host test for QuietHours against the zone configTime() is given, the
+// way onSyncClock() sets it from config.clockTimezone. The same windows
+// have to move with the zone and with daylight saving.
+//
+// Build and run from the repo root:
+//     g++ -std=c++11 -O0 -Itest/host -Iinclude test/host/quiet_hours_test.cpp src/QuietHours.cpp -o quiet_hours_test
+//     ./quiet_hours_test
+
+#include "QuietHours.h"
+
+#define PACIFIC "PST8PDT,M3.2.0,M11.1.0"
+#define UTC_PLUS_ONE "<+01>-1"
+
+static int failures = 0;
+
+static void check(bool condition, const char* what) {
+	if (!condition) {
+		printf("FAIL: %s\n", what);
+		failures++;
+	}
+}
+
+// A time as read off a clock in the zone currently set.
+static time_t local(int year, int month, int day, int hour, int minute) {
+	struct tm when;
+	memset(&when, 0, sizeof(when));
+	when.tm_year = year - 1900;
+	when.tm_mon = month - 1;
+	when.tm_mday = day;
+	when.tm_hour = hour;
+	when.tm_min = minute;
+	when.tm_isdst = -1;
+	return mktime(&when);
+}
+
+int main() {
+	quiet_hours_t entries[2];
+	check(QuietHours.parse("daily 22:00-07:00", entries[0]), "parse overnight window");
+	check(QuietHours.parse("mon-fri 09:30-10:00 2", entries[1]), "parse weekday window");
+	QuietHours.begin(entries, 2);
+
+	// 2025-01-14 03:30 UTC: 22:30 the evening before in New York, 19:30
+	// in Los Angeles and 04:30 east of Greenwich.
+	const time_t instant = 1736825400;
+	configTime(CLOCK_TIMEZONE, "");
+	check(QuietHours.getActiveMask(instant, 0x3) == 0x3, "eastern: overnight window not open at 22:30");
+	check(QuietHours.getNextTransition(instant) == local(2025, 1, 14, 7, 0), "eastern: window doesn't close at 07:00");
+
+	configTime(PACIFIC, "");
+	check(QuietHours.getActiveMask(instant, 0x3) == 0, "pacific: window open at 19:30");
+	check(QuietHours.getNextTransition(instant) == instant + 150 * 60, "pacific: window doesn't open at 22:00");
+
+	configTime(UTC_PLUS_ONE, "");
+	check(QuietHours.getActiveMask(instant, 0x3) == 0x3, "UTC+1: window not open at 04:30");
+	check(QuietHours.getNextTransition(instant) == instant + 150 * 60, "UTC+1: window doesn't close at 07:00");
+
+	// Weekday window on Tuesday morning, local time on either coast.
+	configTime(PACIFIC, "");
+	check(QuietHours.getActiveMask(local(2025, 1, 14, 9, 45), 0x3) == 0x2, "pacific: weekday window not open at 09:45");
+	configTime(CLOCK_TIMEZONE, "");
+	check(QuietHours.getActiveMask(local(2025, 1, 14, 9, 45), 0x3) == 0x2, "eastern: weekday window not open at 09:45");
+
+	// Across the spring change the window still closes at 07:00 local,
+	// now daylight time.
+	time_t night = local(2025, 3, 8, 23, 0);
+	time_t morning = QuietHours.getNextTransition(night);
+	struct tm when;
+	localtime_r(&morning, &when);
+	check(when.tm_hour == 7 && when.tm_min == 0 && when.tm_isdst > 0, "eastern: window doesn't close at 07:00 daylight time");
+	check(morning - night == 7 * 3600, "eastern: spring change not accounted for");
+
+	printf("%s\n", failures == 0 ? "OK" : "FAIL");
+	return failures == 0 ? 0 : 1;
+}
@@ -0,0 +1,181 @@
+#!/usr/bin/env python3
+"""
+Batched command benchmark for Cylence.
+
+Sends the same command sequence (by default enable, outputs on or off,
+request status) once as a "commands" array in a single control message
+and once as one message per command, sent back to back the way an
+automation script would. For each mode it reports:
+
+  done        from the first publish until the status report showing the
+              sequence's final state arrives (p50 and worst)
+  messages    control messages published per sequence
+  reports     status reports the device published per sequence
+
+The device is one of fleetsim's virtual devices unless --client-id names
+a real one on the broker. A real device rate-limits inbound messages, so
+keep --interval above its refill time.
+
+Example:
+    tools/batchbench.py --broker localhost --rounds 50
+    tools/batchbench.py --broker 192.168.0.5 --client-id CYLENCE_A1B2C3
+
+Requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import json
+import os
+import random
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import fleetsim
+
+MODES = ("batched", "single")
+
+
+class Bench:
+    def __init__(self, args):
+        self.args = args
+        sim_args = fleetsim.build_parser().parse_args([
+            "--broker", args.broker, "--port", str(args.port), "--devices", "0" if args.client_id else "1",
+            "--control-topic", args.control_topic, "--status-topic", args.status_topic,
+            "--heartbeat", "0", "--request-interval", "0", "--clock-skew", "0",
+        ])
+        self.sim = fleetsim.Simulator(sim_args)
+        self.host = (args.client_id or self.sim.devices[0].hostname).upper()
+        self.reports = []
+        self.subscribed = False
+        self.client = fleetsim.make_client("batchbench-%d" % random.randint(0, 1 << 30))
+        self.client.on_connect = self.on_connect
+        self.client.on_subscribe = self.on_subscribe
+        self.client.on_message = self.on_message
+        self.sim.loop.attach(self.client)
+        self.client.connect(args.broker, args.port)
+
+    def on_connect(self, client, userdata, flags, rc):
+        if rc == 0:
+            client.subscribe(self.args.status_topic)
+
+    def on_subscribe(self, client, userdata, mid, granted_qos):
+        self.subscribed = True
+
+    def on_message(self, client, userdata, message):
+        if message.retain:
+            return
+        try:
+            doc = json.loads(message.payload)
+        except ValueError:
+            return
+        if str(doc.get("clientId", "")).upper() == self.host:
+            self.reports.append((time.monotonic(), doc.get("silencerState")))
+
+    def pump(self, done, timeout):
+        deadline = time.monotonic() + timeout
+        while not done():
+            if time.monotonic() > deadline:
+                return False
+            self.sim.loop.run_once(0.001)
+            for device in self.sim.devices:
+                device.tick()
+        return True
+
+    def setup(self):
+        if not self.pump(lambda: self.subscribed, self.args.timeout):
+            sys.exit("error: could not subscribe at %s:%d" % (self.args.broker, self.args.port))
+
+        # A status request is answered once the device is listening.
+        if not self.pump(lambda: self.request_status(), self.args.timeout):
+            sys.exit("error: %s did not answer a status request" % self.host)
+
+    def request_status(self):
+        self.reports.clear()
+        self.send([fleetsim.REQUEST_STATUS])
+        return self.pump(lambda: bool(self.reports), 0.5)
+
+    def send(self, commands):
+        if len(commands) == 1:
+            doc = {"clientId": self.host, "command": commands[0]}
+        else:
+            doc = {"clientId": self.host, "commands": commands}
+        self.client.publish(self.args.control_topic, json.dumps(doc))
+
+    def run(self, mode, commands):
+        want = "ON" if fleetsim.OUTPUTS_ON in commands else "OFF"
+        self.reports.clear()
+        start = time.monotonic()
+        if mode == "batched":
+            self.send(commands)
+            messages = 1
+        else:
+            for command in commands:
+                self.send([command])
+            messages = len(commands)
+
+        # The sequence is done once the last message has been answered
+        # with the final state.
+        def done():
+            return len(self.reports) >= messages and self.reports[-1][1] == want
+
+        if not self.pump(done, self.args.timeout):
+            return None
+
+        # Count stray reports against this round.
+        self.pump(lambda: False, self.args.interval)
+        return self.reports[messages - 1][0] - start, messages, len(self.reports)
+
+    def close(self):
+        for device in self.sim.devices:
+            device.client.disconnect()
+        self.client.disconnect()
+        self.pump(lambda: False, 0.2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--client-id", help="real device hostname, e.g. CYLENCE_A1B2C3 (default: a virtual device)")
+    parser.add_argument("--control-topic", default="cylence/control")
+    parser.add_argument("--status-topic", default="cylence/status")
+    parser.add_argument("--rounds", type=int, default=20, help="sequences per mode")
+    parser.add_argument("--interval", type=float, default=0.5, help="seconds between sequences")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait for a sequence to finish")
+    parser.add_argument("--json", help="write raw results to this file")
+    args = parser.parse_args()
+
+    bench = Bench(args)
+    results = []
+    try:
+        bench.setup()
+        print("%-8s  %10s  %10s  %9s  %8s" % ("mode", "done p50", "done max", "messages", "reports"))
+        print("%-8s  %10s  %10s  %9s  %8s" % ("", "ms", "ms", "", ""))
+        for mode in MODES:
+            rounds = []
+            for i in range(args.rounds):
+                output = fleetsim.OUTPUTS_ON if i % 2 == 0 else fleetsim.OUTPUTS_OFF
+                result = bench.run(mode, [fleetsim.ENABLE, output, fleetsim.REQUEST_STATUS])
+                if result is None:
+                    sys.exit("error: %s did not finish a %s sequence" % (bench.host, mode))
+                rounds.append(result)
+
+            done = [r[0] for r in rounds]
+            results.append({"mode": mode, "doneMs": [d * 1000 for d in done],
+                            "messages": [r[1] for r in rounds], "reports": [r[2] for r in rounds]})
+            print("%-8s  %10.1f  %10.1f  %9.1f  %8.1f" % (
+                mode, fleetsim.percentile(done, 50) * 1000, max(done) * 1000,
+                sum(r[1] for r in rounds) / float(len(rounds)), sum(r[2] for r in rounds) / float(len(rounds))))
+    finally:
+        bench.close()
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(results, out, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
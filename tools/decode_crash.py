@@ -0,0 +1,109 @@
+#!/usr/bin/env python3
+"""
+Decodes a Cylence crash report (as published to cylence/<host>/diagnostics)
+against the firmware ELF, resolving every code address it contains to a
+function and source line.
+
+Usage:
+    mosquitto_sub -h <broker> -t 'cylence/+/diagnostics' -C 1 | tools/decode_crash.py
+    tools/decode_crash.py report.json --elf .pio/build/huzzah/firmware.elf
+"""
+
+import argparse
+import glob
+import json
+import os
+import re
+import shutil
+import subprocess
+import sys
+
+DEFAULT_ELF = os.path.join(".pio", "build", "huzzah", "firmware.elf")
+ADDR2LINE = "xtensa-lx106-elf-addr2line"
+REGISTERS = ("epc1", "epc2", "epc3", "excvaddr", "depc")
+RESET_REASONS = {
+    0: "power on",
+    1: "hardware watchdog",
+    2: "exception",
+    3: "software watchdog",
+    4: "software restart",
+    5: "deep sleep wake",
+    6: "external reset",
+}
+
+# Code lives in IRAM (0x401xxxxx) or mapped flash (0x402xxxxx).
+CODE_ADDRESS = re.compile(r"\b(?:0x)?(40[0-2][0-9a-fA-F]{5})\b")
+
+
+def find_addr2line(explicit):
+    if explicit:
+        return explicit
+
+    found = shutil.which(ADDR2LINE)
+    if found:
+        return found
+
+    pattern = os.path.expanduser(os.path.join("~", ".platformio", "packages", "toolchain-xtensa*", "bin", ADDR2LINE))
+    matches = sorted(glob.glob(pattern))
+    if matches:
+        return matches[-1]
+
+    sys.exit("error: %s not found. Pass --addr2line." % ADDR2LINE)
+
+
+def decode(addr2line, elf, addresses):
+    if not addresses:
+        return {}
+
+    output = subprocess.run(
+        [addr2line, "-aipfC", "-e", elf] + ["0x" + a for a in addresses],
+        check=True, capture_output=True, text=True).stdout
+
+    decoded = {}
+    for line in output.splitlines():
+        address, _, location = line.partition(": ")
+        decoded[address.lower().replace("0x", "").lstrip("0").rjust(8, "0")] = location
+
+    return decoded
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("report", nargs="?", help="crash report JSON file (default: stdin)")
+    parser.add_argument("--elf", default=DEFAULT_ELF, help="firmware ELF (default: %(default)s)")
+    parser.add_argument("--addr2line", help="path to %s" % ADDR2LINE)
+    args = parser.parse_args()
+
+    with (open(args.report) if args.report else sys.stdin) as source:
+        report = json.load(source)
+
+    if not os.path.exists(args.elf):
+        sys.exit("error: ELF not found: %s" % args.elf)
+
+    registers = {name: report[name].lower().replace("0x", "").rjust(8, "0") for name in REGISTERS if name in report}
+    stack = [a.lower() for a in CODE_ADDRESS.findall(report.get("dump", ""))]
+    wanted = list(dict.fromkeys(list(registers.values()) + stack))
+    decoded = decode(find_addr2line(args.addr2line), args.elf, [a for a in wanted if a.startswith("40")])
+
+    reason = report.get("reason")
+    print("Device:     %s" % report.get("clientId", "?"))
+    print("Reset:      %s (%s)" % (reason, RESET_REASONS.get(reason, "unknown")))
+    print("Exception:  %s" % report.get("exccause", "?"))
+    print("Stage:      %s (last task: %s)" % (report.get("stage", "?"), report.get("lastTask", "?")))
+    print("Max loop:   %s ms" % report.get("maxLoopMs", "?"))
+    print("Commands:   %s" % report.get("commands", []))
+    print()
+    print("Registers:")
+    for name, address in registers.items():
+        print("  %-9s 0x%s  %s" % (name, address, decoded.get(address, "")))
+
+    if stack:
+        print()
+        print("Stack:")
+        for address in dict.fromkeys(stack):
+            if address in decoded:
+                print("  0x%s  %s" % (address, decoded[address]))
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,598 @@
+#!/usr/bin/env python3
+"""
+Fleet simulator for Cylence.
+
+Runs N virtual Cylence devices in one process against a (local) MQTT
+broker. Each device has its own config, hostname and virtual clock, and
+mirrors the firmware's MQTT behaviour: control topic handling (including
+batches and clientId filtering), status publishing (combined JSON and/or
+per-field sub-topics), Last Will/availability, heartbeat, discovery and
+the reconnect cadence of the check-MQTT task. Devices can also join
+group topics (cylence/group/<name>/control) and change membership at
+runtime through cylence/<host>/groups/set.
+
+A controller client drives the fleet with status requests, can inject
+command storms, and can restart the broker through a shell command. At
+the end the simulator reports per-device command latency, reconnect
+convergence time and total message volume.
+
+All firmware intervals are in virtual seconds; --speed sets how many
+virtual seconds pass per real second.
+
+Example:
+    tools/fleetsim.py --devices 500 --duration 120 --speed 10 \\
+        --storm-at 30 --storm-rate 500 --storm-duration 5 \\
+        --restart-at 60 --restart-cmd "docker restart mosquitto"
+
+Requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import collections
+import json
+import random
+import selectors
+import subprocess
+import sys
+import time
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.exit("error: paho-mqtt is required (pip install paho-mqtt)")
+
+FIRMWARE_VERSION = "1.0"
+DEVICE_CLASS = "cylence"
+GROUP_PREFIX = "cylence/group/"
+GROUP_CONTROL_SUFFIX = "/control"
+MAX_GROUPS = 4
+GROUP_NAME_SIZE = 24
+
+# Mirrors ControlCommand in TelemetryHelper.h.
+DISABLE, ENABLE, REBOOT, REQUEST_STATUS, ACTIVATE, OUTPUTS_ON, OUTPUTS_OFF = range(7)
+MAX_COMMAND = OUTPUTS_OFF
+MAX_BATCH_COMMANDS = 8
+
+# Mirrors SystemState in TelemetryHelper.h.
+NORMAL, DISABLED = 1, 3
+
+
+def make_client(client_id):
+    if hasattr(mqtt, "CallbackAPIVersion"):
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id=client_id, clean_session=True)
+    return mqtt.Client(client_id=client_id, clean_session=True)
+
+
+def group_topic(name):
+    return GROUP_PREFIX + name + GROUP_CONTROL_SUFFIX
+
+
+def fnv1a(text):
+    value = 2166136261
+    for byte in text.encode():
+        value = ((value ^ byte) * 16777619) & 0xFFFFFFFF
+    return value
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(pct / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+class EventLoop:
+    """Single selector driving every client's socket (paho external loop)."""
+
+    def __init__(self):
+        self.selector = selectors.DefaultSelector()
+        self.clients = []
+
+    def attach(self, client):
+        client.on_socket_open = self._on_open
+        client.on_socket_close = self._on_close
+        client.on_socket_register_write = self._on_register_write
+        client.on_socket_unregister_write = self._on_unregister_write
+        self.clients.append(client)
+
+    def _on_open(self, client, userdata, sock):
+        self.selector.register(sock, selectors.EVENT_READ, client)
+
+    def _on_close(self, client, userdata, sock):
+        try:
+            self.selector.unregister(sock)
+        except (KeyError, ValueError):
+            pass
+
+    def _on_register_write(self, client, userdata, sock):
+        self.selector.modify(sock, selectors.EVENT_READ | selectors.EVENT_WRITE, client)
+
+    def _on_unregister_write(self, client, userdata, sock):
+        try:
+            self.selector.modify(sock, selectors.EVENT_READ, client)
+        except (KeyError, ValueError):
+            pass
+
+    def run_once(self, timeout):
+        if self.selector.get_map():
+            events = self.selector.select(timeout)
+        else:
+            time.sleep(timeout)
+            events = []
+
+        for key, mask in events:
+            client = key.data
+            if mask & selectors.EVENT_READ:
+                client.loop_read()
+            if mask & selectors.EVENT_WRITE:
+                client.loop_write()
+
+        for client in self.clients:
+            client.loop_misc()
+
+
+class Stats:
+    def __init__(self):
+        self.published = collections.Counter()
+        self.received = collections.Counter()
+        self.latencies = collections.defaultdict(list)
+        self.pending = collections.defaultdict(collections.deque)
+        self.connects = collections.Counter()
+        self.restart_times = []
+        self.convergence = []
+        self.lost = 0
+
+    def total_received(self):
+        return sum(self.received.values())
+
+
+class VirtualDevice:
+    def __init__(self, sim, index):
+        self.sim = sim
+        args = sim.args
+        self.hostname = "%s_%06X" % (DEVICE_CLASS.upper(), index)
+        self.clock_offset = random.uniform(-args.clock_skew, args.clock_skew)
+        self.config = {
+            "mqttTopicControl": args.control_topic,
+            "mqttTopicStatus": args.status_topic,
+            "mqttTopicDiscovery": args.discovery_topic,
+            "mqttStatusFields": args.status_fields,
+            "mqttStatusLegacy": not args.no_legacy_status,
+            "heartbeatInterval": args.heartbeat,
+            "groups": [name for name in args.groups.split(",") if name][:MAX_GROUPS],
+        }
+        self.sys_state = NORMAL
+        self.channels = args.channels.split(",")
+        self.state = 0
+        self.field_cache = {}
+        self.connected = False
+        self.client = make_client(self.hostname)
+        self.client.on_connect = self.on_connect
+        self.client.on_disconnect = self.on_disconnect
+        self.client.on_message = self.on_message
+        self.client.will_set(self.topic("availability"), "offline", qos=0, retain=True)
+        sim.loop.attach(self.client)
+
+        # Stagger the first check like real devices booting at different times.
+        now = sim.virtual_now()
+        self.next_check_mqtt = now + random.uniform(0, 1)
+        self.next_heartbeat = now + args.heartbeat if args.heartbeat > 0 else None
+
+    def virtual_time(self):
+        return self.sim.virtual_now() + self.clock_offset
+
+    def topic(self, suffix):
+        return "%s/%s/%s" % (DEVICE_CLASS, self.hostname, suffix)
+
+    def publish(self, topic, payload, retain=False):
+        self.client.publish(topic, payload, qos=0, retain=retain)
+        self.sim.stats.published["device"] += 1
+
+    def try_connect(self):
+        try:
+            self.client.connect(self.sim.args.broker, self.sim.args.port, keepalive=self.sim.args.keepalive)
+        except OSError:
+            pass
+
+    def tick(self):
+        now = self.sim.virtual_now()
+        if now >= self.next_check_mqtt:
+            # onCheckMqtt(): the only place the firmware retries MQTT.
+            self.next_check_mqtt = now + self.sim.args.check_mqtt_interval
+            if not self.connected:
+                self.try_connect()
+            else:
+                # Discovery is retained from connect time; nothing to resend.
+                self.publish_system_state()
+                self.sim.stats.published["discovery_skipped"] += 1
+
+        if self.next_heartbeat is not None and now >= self.next_heartbeat:
+            self.next_heartbeat = now + self.config["heartbeatInterval"]
+            if self.connected:
+                payload = json.dumps({"uptime": int(now - self.sim.virtual_start), "rssi": -60, "heap": 30000})
+                self.publish(self.topic("heartbeat"), payload)
+
+    def on_connect(self, client, userdata, flags, rc):
+        if rc != 0:
+            return
+        self.connected = True
+        self.sim.stats.connects[self.hostname] += 1
+        self.sim.device_connected(self)
+        client.subscribe(self.config["mqttTopicControl"])
+        client.subscribe(self.topic("groups/set"))
+        for name in self.config["groups"]:
+            client.subscribe(group_topic(name))
+        self.publish_groups()
+        self.publish(self.topic("availability"), "online", retain=True)
+        self.field_cache.clear()
+        self.publish_discovery()
+        self.publish_system_state()
+
+    def on_disconnect(self, client, userdata, rc):
+        self.connected = False
+
+    def on_message(self, client, userdata, message):
+        self.sim.stats.received["device"] += 1
+        try:
+            doc = json.loads(message.payload)
+        except ValueError:
+            return
+
+        if message.topic == self.topic("groups/set"):
+            self.set_groups(doc)
+            return
+
+        if not isinstance(doc, dict):
+            return
+
+        # Group messages are addressed by their topic alone.
+        in_group = any(message.topic == group_topic(name) for name in self.config["groups"])
+        if not in_group and str(doc.get("clientId", "")).upper() != self.hostname:
+            return
+
+        if "commands" in doc:
+            cmds = doc["commands"]
+            if not isinstance(cmds, list) or not 0 < len(cmds) <= MAX_BATCH_COMMANDS:
+                return
+            if any(not isinstance(c, int) or c < 0 or c > MAX_COMMAND for c in cmds):
+                return
+            if REBOOT in cmds[:-1]:
+                return
+        elif "command" in doc:
+            cmds = [doc["command"]]
+        else:
+            return
+
+        mask = self.parse_target(doc)
+        if mask is None:
+            return
+
+        # Like the firmware, the channels switch once the whole batch is applied.
+        state = self.state
+        for cmd in cmds:
+            state = self.apply(cmd, mask, state)
+        self.state = state
+
+        self.publish_system_state()
+
+    def set_groups(self, doc):
+        groups = doc.get("groups") if isinstance(doc, dict) else None
+        if not isinstance(groups, list) or len(groups) > MAX_GROUPS:
+            return
+        if any(not isinstance(name, str) or not 0 < len(name) < GROUP_NAME_SIZE or any(c in name for c in "/+#")
+               for name in groups):
+            return
+        for name in self.config["groups"]:
+            self.client.unsubscribe(group_topic(name))
+        self.config["groups"] = groups
+        for name in groups:
+            self.client.subscribe(group_topic(name))
+        self.publish_groups()
+
+    def publish_groups(self):
+        self.publish(self.topic("groups"), json.dumps({"clientId": self.hostname, "groups": self.config["groups"]}),
+                     retain=True)
+
+    def parse_target(self, doc):
+        all_mask = (1 << len(self.channels)) - 1
+        if "mask" in doc:
+            mask = doc["mask"]
+            if not isinstance(mask, int) or mask <= 0 or mask & ~all_mask:
+                return None
+            return mask
+        if "channel" in doc:
+            channel = doc["channel"]
+            if isinstance(channel, str):
+                names = [name.lower() for name in self.channels]
+                if channel.lower() not in names:
+                    return None
+                return 1 << names.index(channel.lower())
+            if isinstance(channel, int) and 0 <= channel < len(self.channels):
+                return 1 << channel
+            return None
+        return all_mask
+
+    def apply(self, cmd, mask, state):
+        if self.sys_state == DISABLED and cmd != ENABLE:
+            return state
+        if cmd == ENABLE:
+            self.sys_state = NORMAL
+        elif cmd == DISABLE:
+            self.sys_state = DISABLED
+        elif cmd == ACTIVATE:
+            state = state & ~mask if state & mask else state | mask
+        elif cmd == OUTPUTS_ON:
+            state |= mask
+        elif cmd == OUTPUTS_OFF:
+            state &= ~mask
+        return state
+
+    def status_fields(self):
+        return {
+            "clientId": self.hostname,
+            "firmwareVersion": FIRMWARE_VERSION,
+            "systemState": str(self.sys_state),
+            "silencerState": "ON" if self.state else "OFF",
+            "channelMask": str(self.state),
+            "lastUpdate": time.asctime(time.localtime(self.virtual_time())),
+        }
+
+    def publish_system_state(self):
+        if not self.connected:
+            return
+
+        fields = self.status_fields()
+        if self.config["mqttStatusLegacy"]:
+            doc = dict(fields)
+            doc["systemState"] = self.sys_state
+            doc["channelMask"] = self.state
+            self.publish(self.config["mqttTopicStatus"], json.dumps(doc), retain=True)
+
+        if self.config["mqttStatusFields"]:
+            for name, value in fields.items():
+                if self.field_cache.get(name) != value:
+                    self.publish(self.topic("status/" + name), value, retain=True)
+                    self.field_cache[name] = value
+
+    def publish_discovery(self):
+        body = '"name":"%s","class":"%s","statusTopic":"%s","controlTopic":"%s","channels":[%s]' % (
+            self.hostname, DEVICE_CLASS, self.config["mqttTopicStatus"], self.config["mqttTopicControl"],
+            ",".join('"%s"' % name for name in self.channels))
+        payload = '{%s,"version":"%08x"}' % (body, fnv1a(body))
+        self.publish("%s/%s" % (self.config["mqttTopicDiscovery"], self.hostname), payload, retain=True)
+        self.sim.stats.published["discovery"] += 1
+
+
+class Controller:
+    """Stands in for openHAB: sends commands and watches status come back."""
+
+    def __init__(self, sim):
+        self.sim = sim
+        self.client = make_client("fleetsim-controller-%d" % random.randint(0, 1 << 30))
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+        self.connected = False
+        sim.loop.attach(self.client)
+
+    def start(self):
+        self.client.connect(self.sim.args.broker, self.sim.args.port, keepalive=self.sim.args.keepalive)
+
+    def on_connect(self, client, userdata, flags, rc):
+        if rc != 0:
+            return
+        self.connected = True
+        args = self.sim.args
+        # One answer per status publish: the combined document if devices
+        # send it, otherwise the lastUpdate field (which always changes).
+        if args.no_legacy_status:
+            client.subscribe("%s/+/status/lastUpdate" % DEVICE_CLASS)
+        else:
+            client.subscribe(args.status_topic)
+        client.subscribe("$SYS/broker/messages/#")
+
+    def on_message(self, client, userdata, message):
+        stats = self.sim.stats
+        if message.topic.startswith("$SYS/"):
+            try:
+                self.sim.sys_counters[message.topic] = int(message.payload)
+            except ValueError:
+                pass
+            return
+
+        stats.received["controller"] += 1
+        if message.retain:
+            return
+
+        if message.topic == self.sim.args.status_topic:
+            try:
+                host = json.loads(message.payload).get("clientId")
+            except ValueError:
+                return
+        elif message.topic.endswith("/status/lastUpdate"):
+            host = message.topic.split("/")[1]
+        else:
+            return
+
+        pending = stats.pending.get(host)
+        if pending:
+            stats.latencies[host].append(time.monotonic() - pending.popleft())
+
+    def send(self, device, commands):
+        if not self.connected:
+            return
+        doc = {"clientId": device.hostname}
+        if len(commands) == 1:
+            doc["command"] = commands[0]
+        else:
+            doc["commands"] = commands
+        self.sim.stats.pending[device.hostname].append(time.monotonic())
+        self.client.publish(self.sim.args.control_topic, json.dumps(doc), qos=0)
+        self.sim.stats.published["controller"] += 1
+
+
+class Simulator:
+    def __init__(self, args):
+        self.args = args
+        self.loop = EventLoop()
+        self.stats = Stats()
+        self.sys_counters = {}
+        self.real_start = time.monotonic()
+        self.virtual_start = time.time()
+        self.pending_restart = None
+        self.controller = Controller(self)
+        self.devices = [VirtualDevice(self, i) for i in range(args.devices)]
+
+    def virtual_now(self):
+        return self.virtual_start + (time.monotonic() - self.real_start) * self.args.speed
+
+    def elapsed(self):
+        return time.monotonic() - self.real_start
+
+    def device_connected(self, device):
+        # Anything sent while the device was offline was never delivered.
+        pending = self.stats.pending[device.hostname]
+        self.stats.lost += len(pending)
+        pending.clear()
+
+        if self.pending_restart is not None and all(d.connected for d in self.devices):
+            self.stats.convergence.append(time.monotonic() - self.pending_restart)
+            self.pending_restart = None
+
+    def restart_broker(self):
+        print("[%7.2fs] restarting broker: %s" % (self.elapsed(), self.args.restart_cmd), flush=True)
+        self.stats.restart_times.append(self.elapsed())
+        self.pending_restart = time.monotonic()
+        subprocess.run(self.args.restart_cmd, shell=True, check=False)
+
+    def run(self):
+        args = self.args
+        self.controller.start()
+        next_request = 0.0
+        storm_credit = 0.0
+        restarted = False
+        last = time.monotonic()
+
+        while self.elapsed() < args.duration:
+            self.loop.run_once(0.005)
+            now = time.monotonic()
+            dt = now - last
+            last = now
+
+            if not self.controller.connected and int(self.elapsed() * 10) % 10 == 0:
+                try:
+                    self.controller.client.reconnect()
+                except OSError:
+                    pass
+
+            for device in self.devices:
+                device.tick()
+
+            if args.restart_cmd and not restarted and self.elapsed() >= args.restart_at:
+                restarted = True
+                self.restart_broker()
+
+            if args.request_interval > 0 and self.elapsed() >= next_request:
+                next_request = self.elapsed() + args.request_interval
+                self.controller.send(random.choice(self.devices), [REQUEST_STATUS])
+
+            in_storm = args.storm_rate > 0 and args.storm_at <= self.elapsed() < args.storm_at + args.storm_duration
+            if in_storm:
+                storm_credit += args.storm_rate * dt
+                while storm_credit >= 1:
+                    storm_credit -= 1
+                    batch = [random.choice([REQUEST_STATUS, ACTIVATE]) for _ in range(random.randint(1, args.storm_batch))]
+                    self.controller.send(random.choice(self.devices), batch)
+
+        self.report()
+
+    def report(self):
+        stats = self.stats
+        all_latencies = [v for values in stats.latencies.values() for v in values]
+        lost = stats.lost + sum(len(q) for q in stats.pending.values())
+
+        print()
+        print("Devices:                %d (%d connected at end)" % (len(self.devices), sum(d.connected for d in self.devices)))
+        print("Duration:               %.1fs real, %.1fs virtual" % (self.elapsed(), self.elapsed() * self.args.speed))
+        print("Commands answered:      %d (%d unanswered)" % (len(all_latencies), lost))
+        if all_latencies:
+            print("Latency ms p50/p95/max: %.1f / %.1f / %.1f" % (
+                percentile(all_latencies, 50) * 1000, percentile(all_latencies, 95) * 1000, max(all_latencies) * 1000))
+        print("Messages published:     %d (devices %d, controller %d)" % (
+            stats.published["device"] + stats.published["controller"], stats.published["device"], stats.published["controller"]))
+        print("Discovery:              %d published, %d periodic republishes avoided" % (
+            stats.published["discovery"], stats.published["discovery_skipped"]))
+        print("Messages delivered:     %d (to devices %d, to controller %d)" % (
+            stats.total_received(), stats.received["device"], stats.received["controller"]))
+        for topic in sorted(self.sys_counters):
+            print("%-23s %d" % (topic.replace("$SYS/broker/", "") + ":", self.sys_counters[topic]))
+        for at, took in zip(stats.restart_times, stats.convergence):
+            print("Reconnect convergence:  %.2fs after restart at %.1fs" % (took, at))
+        if len(stats.convergence) < len(stats.restart_times):
+            print("Reconnect convergence:  not reached before end of run")
+
+        if self.args.per_device:
+            print()
+            print("%-16s %6s %9s %9s %9s %8s" % ("device", "cmds", "p50 ms", "p95 ms", "max ms", "connects"))
+            for device in self.devices:
+                values = stats.latencies.get(device.hostname, [])
+                print("%-16s %6d %9.1f %9.1f %9.1f %8d" % (
+                    device.hostname, len(values), percentile(values, 50) * 1000, percentile(values, 95) * 1000,
+                    (max(values) if values else 0) * 1000, stats.connects[device.hostname]))
+
+        if self.args.json:
+            with open(self.args.json, "w") as out:
+                json.dump({
+                    "devices": len(self.devices),
+                    "latencies": {host: values for host, values in stats.latencies.items()},
+                    "unanswered": lost,
+                    "published": dict(stats.published),
+                    "received": dict(stats.received),
+                    "broker": self.sys_counters,
+                    "restarts": stats.restart_times,
+                    "convergence": stats.convergence,
+                }, out, indent=2)
+
+
+def build_parser():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--devices", type=int, default=100)
+    parser.add_argument("--duration", type=float, default=60, help="real seconds to run")
+    parser.add_argument("--speed", type=float, default=1.0, help="virtual seconds per real second")
+    parser.add_argument("--keepalive", type=int, default=15, help="MQTT keepalive (PubSubClient default: 15)")
+    parser.add_argument("--clock-skew", type=float, default=5.0, help="max per-device clock offset (s)")
+    parser.add_argument("--control-topic", default="cylence/control")
+    parser.add_argument("--status-topic", default="cylence/status")
+    parser.add_argument("--discovery-topic", default="redqueen/config")
+    parser.add_argument("--status-fields", action="store_true", help="publish per-field status sub-topics")
+    parser.add_argument("--no-legacy-status", action="store_true", help="don't publish the combined status JSON")
+    parser.add_argument("--channels", default="bell", help="comma-separated output channel names per device")
+    parser.add_argument("--groups", default="", help="comma-separated groups every device joins")
+    parser.add_argument("--heartbeat", type=int, default=60, help="heartbeat interval (virtual s, 0 = off)")
+    parser.add_argument("--check-mqtt-interval", type=float, default=300, help="CHECK_MQTT_INTERVAL (virtual s)")
+    parser.add_argument("--request-interval", type=float, default=0.05, help="real s between status requests")
+    parser.add_argument("--storm-at", type=float, default=0, help="real s at which the command storm starts")
+    parser.add_argument("--storm-rate", type=float, default=0, help="commands per real second during the storm")
+    parser.add_argument("--storm-duration", type=float, default=5)
+    parser.add_argument("--storm-batch", type=int, default=3, help="max commands per storm message")
+    parser.add_argument("--restart-at", type=float, default=0, help="real s at which to restart the broker")
+    parser.add_argument("--restart-cmd", help="shell command that restarts the broker")
+    parser.add_argument("--per-device", action="store_true", help="print a per-device table")
+    parser.add_argument("--json", help="write raw results to this file")
+    parser.add_argument("--seed", type=int)
+    return parser
+
+
+def main():
+    args = build_parser().parse_args()
+
+    if args.seed is not None:
+        random.seed(args.seed)
+
+    Simulator(args).run()
+
+
+if __name__ == "__main__":
+    main()
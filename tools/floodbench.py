@@ -0,0 +1,175 @@
+#!/usr/bin/env python3
+"""
+Control topic flood benchmark for Cylence.
+
+Floods the control topic with status requests addressed to one device,
+then checks that the device keeps up. The benchmark scrapes the device's
+Prometheus endpoint (ENABLE_METRICS_HTTP) once per second and watches
+the retained throttled flag. Each scrape resets the device's control poll
+gap, so every sample is the longest the control path went unserviced in
+the past second. That is the loop latency this test is about.
+
+The run passes if the worst gap stays under --max-gap and the firmware
+logged no loop stalls.
+
+Example:
+    tools/floodbench.py --broker localhost --device 192.168.0.238 \\
+        --client-id CYLENCE_A1B2C3 --rate 500 --duration 30
+
+Requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import json
+import re
+import sys
+import threading
+import time
+import urllib.request
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.exit("error: paho-mqtt is required (pip install paho-mqtt)")
+
+REQUEST_STATUS = 3
+SAMPLE_LINE = re.compile(r'^([a-z_]+)(\{[^}]*\})?\s+([0-9.]+)$')
+
+
+def make_client(client_id):
+    if hasattr(mqtt, "CallbackAPIVersion"):
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id=client_id)
+    return mqtt.Client(client_id=client_id)
+
+
+def scrape(url, timeout):
+    """Returns {"family{labels}": value} or None if the device didn't answer."""
+    try:
+        with urllib.request.urlopen(url, timeout=timeout) as response:
+            body = response.read().decode()
+    except OSError:
+        return None
+
+    samples = {}
+    for line in body.splitlines():
+        match = SAMPLE_LINE.match(line.strip())
+        if match:
+            samples[match.group(1) + (match.group(2) or "")] = float(match.group(3))
+    return samples
+
+
+def delta(after, before, name):
+    return after.get(name, 0) - before.get(name, 0)
+
+
+class Flooder(threading.Thread):
+    def __init__(self, args):
+        super().__init__(daemon=True)
+        self.args = args
+        self.sent = 0
+        self.stop = threading.Event()
+        self.client = make_client("cylence-flood")
+        self.client.connect(args.broker, args.port)
+        self.client.loop_start()
+
+    def run(self):
+        payload = json.dumps({"clientId": self.args.client_id, "command": REQUEST_STATUS})
+        interval = 1.0 / self.args.rate
+        next_send = time.perf_counter()
+        while not self.stop.is_set():
+            self.client.publish(self.args.control_topic, payload)
+            self.sent += 1
+            next_send += interval
+            delay = next_send - time.perf_counter()
+            if delay > 0:
+                time.sleep(delay)
+
+    def close(self):
+        self.stop.set()
+        self.join()
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+class ThrottleWatcher:
+    def __init__(self, args):
+        self.transitions = []
+        self.client = make_client("cylence-flood-watch")
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.port)
+        self.client.subscribe("cylence/%s/throttled" % args.client_id)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, message):
+        self.transitions.append((time.time(), message.payload.decode()))
+
+    def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--device", required=True, help="device address for the metrics endpoint")
+    parser.add_argument("--metrics-port", type=int, default=9100)
+    parser.add_argument("--client-id", required=True, help="device hostname, e.g. CYLENCE_A1B2C3")
+    parser.add_argument("--control-topic", default="cylence/control")
+    parser.add_argument("--rate", type=float, default=500, help="messages per second")
+    parser.add_argument("--duration", type=float, default=30, help="seconds to flood")
+    parser.add_argument("--settle", type=float, default=10, help="seconds to watch after the flood")
+    parser.add_argument("--max-gap", type=float, default=100, help="worst acceptable control poll gap (ms)")
+    args = parser.parse_args()
+
+    url = "http://%s:%d/metrics" % (args.device, args.metrics_port)
+    before = scrape(url, 2)
+    if before is None:
+        sys.exit("error: no metrics from %s" % url)
+
+    watcher = ThrottleWatcher(args)
+    flooder = Flooder(args)
+    start = time.time()
+    flooder.start()
+    gaps, missed = [], 0
+    end = start + args.duration + args.settle
+    while time.time() < end:
+        if flooder.is_alive() and time.time() - start >= args.duration:
+            flooder.close()
+        time.sleep(1)
+        sample = scrape(url, 2)
+        if sample is None:
+            missed += 1
+            continue
+        gap = sample.get("cylence_control_poll_gap_max_milliseconds", 0)
+        gaps.append(gap)
+        print("t=%5.1fs  gap max=%5.0f ms  dropped=%6d  duty=%3.0f%%" % (
+            time.time() - start, gap,
+            delta(sample, before, 'cylence_mqtt_messages_rejected_total{reason="rate_limited"}'),
+            sample.get("cylence_loop_duty_cycle_percent", 0)))
+    if flooder.is_alive():
+        flooder.close()
+    watcher.close()
+
+    after = scrape(url, 2) or {}
+    received = delta(after, before, "cylence_mqtt_messages_received_total")
+    dropped = delta(after, before, 'cylence_mqtt_messages_rejected_total{reason="rate_limited"}')
+    accepted = delta(after, before, "cylence_mqtt_messages_accepted_total")
+    stalls = delta(after, before, "cylence_loop_stalls_total")
+    overruns = delta(after, before, "cylence_loop_overruns_total")
+    worst = max(gaps) if gaps else float("inf")
+
+    print()
+    print("sent %d, device received %d, accepted %d, rate limited %d" % (flooder.sent, received, accepted, dropped))
+    print("loop overruns %d, stalls %d, missed scrapes %d" % (overruns, stalls, missed))
+    print("worst control poll gap %.0f ms (limit %.0f ms)" % (worst, args.max_gap))
+    for when, value in watcher.transitions:
+        print("throttled=%s at t=%.1fs" % (value, when - start))
+
+    ok = worst <= args.max_gap and stalls == 0 and missed == 0
+    print("PASS" if ok else "FAIL")
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
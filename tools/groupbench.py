@@ -0,0 +1,178 @@
+#!/usr/bin/env python3
+"""
+Group addressing benchmark for Cylence.
+
+Measures how long it takes to silence N devices, from the controller's
+first publish until every device has reported the new state, when each
+device is sent its own message and when one message goes to a group
+topic. Devices are fleetsim's virtual devices. They start out in no
+group and are moved into the benchmark group at runtime through
+cylence/<host>/groups/set, the same as a real device would be.
+
+Every device is subscribed to the shared control topic, so one message
+per device means N * N deliveries for the broker and N messages to parse
+on every device. A group publish is delivered N times in total.
+
+Example:
+    tools/groupbench.py --broker localhost --sizes 10,50,100,250 --rounds 5
+
+Requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import json
+import os
+import random
+import sys
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import fleetsim
+
+MODES = ("per-device", "group")
+
+
+class Bench:
+    def __init__(self, args, count):
+        self.args = args
+        sim_args = fleetsim.build_parser().parse_args([
+            "--broker", args.broker, "--port", str(args.port), "--devices", str(count),
+            "--control-topic", args.control_topic, "--status-topic", args.status_topic,
+            "--heartbeat", "0", "--request-interval", "0", "--clock-skew", "0",
+        ])
+        self.sim = fleetsim.Simulator(sim_args)
+        self.hosts = [device.hostname for device in self.sim.devices]
+        self.reported = {}
+        self.groups = {}
+        self.subscribed = 0
+        self.client = fleetsim.make_client("groupbench-%d" % random.randint(0, 1 << 30))
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+        self.client.on_subscribe = self.on_subscribe
+        self.sim.loop.attach(self.client)
+        self.client.connect(args.broker, args.port)
+
+    def on_connect(self, client, userdata, flags, rc):
+        if rc == 0:
+            client.subscribe(self.args.status_topic)
+            client.subscribe("%s/+/groups" % fleetsim.DEVICE_CLASS)
+
+    def on_subscribe(self, client, userdata, mid, granted_qos):
+        self.subscribed += 1
+
+    def on_message(self, client, userdata, message):
+        try:
+            doc = json.loads(message.payload)
+        except ValueError:
+            return
+        if message.retain:
+            # Left over from an earlier run.
+            return
+        if message.topic.endswith("/groups"):
+            self.groups[doc.get("clientId")] = doc.get("groups", [])
+        else:
+            self.reported[doc.get("clientId")] = (time.monotonic(), doc.get("silencerState"))
+
+    def pump(self, done, timeout, devices=True):
+        deadline = time.monotonic() + timeout
+        while not done():
+            if time.monotonic() > deadline:
+                return False
+            self.sim.loop.run_once(0.001)
+            if devices:
+                for device in self.sim.devices:
+                    device.tick()
+        return True
+
+    def setup(self):
+        # Listening before any device connects, so no announcement is missed.
+        if not self.pump(lambda: self.subscribed == 2, self.args.timeout, devices=False):
+            sys.exit("error: could not subscribe at %s:%d" % (self.args.broker, self.args.port))
+
+        # Devices announce their groups once subscribed, so after this
+        # they are listening.
+        if not self.pump(lambda: all(h in self.groups for h in self.hosts), self.args.timeout):
+            sys.exit("error: not every device connected within %.0fs" % self.args.timeout)
+
+        # Joined at runtime, not from config.
+        for host in self.hosts:
+            topic = "%s/%s/groups/set" % (fleetsim.DEVICE_CLASS, host)
+            self.client.publish(topic, json.dumps({"groups": [self.args.group]}))
+        if not self.pump(lambda: all(self.args.group in self.groups.get(h, []) for h in self.hosts), self.args.timeout):
+            sys.exit("error: not every device joined group %s" % self.args.group)
+
+    def silence(self, mode, command):
+        want = "ON" if command == fleetsim.OUTPUTS_ON else "OFF"
+        self.reported.clear()
+        delivered = self.sim.stats.received["device"]
+        start = time.monotonic()
+        if mode == "group":
+            self.client.publish(fleetsim.group_topic(self.args.group), json.dumps({"command": command}))
+        else:
+            for host in self.hosts:
+                self.client.publish(self.args.control_topic, json.dumps({"clientId": host, "command": command}))
+
+        def done():
+            return all(self.reported.get(host, (0, None))[1] == want for host in self.hosts)
+
+        if not self.pump(done, self.args.timeout):
+            return None
+
+        # Let stray deliveries land so they are counted against this round.
+        self.pump(lambda: False, self.args.settle)
+        latencies = [self.reported[h][0] - start for h in self.hosts]
+        return max(latencies), fleetsim.percentile(latencies, 50), self.sim.stats.received["device"] - delivered
+
+    def close(self):
+        for device in self.sim.devices:
+            device.client.disconnect()
+        self.client.disconnect()
+        self.pump(lambda: False, 0.2)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--sizes", default="10,50,100", help="comma-separated fleet sizes")
+    parser.add_argument("--rounds", type=int, default=5, help="silences per mode and size")
+    parser.add_argument("--group", default="bench")
+    parser.add_argument("--control-topic", default="cylence/control")
+    parser.add_argument("--status-topic", default="cylence/status")
+    parser.add_argument("--timeout", type=float, default=30.0, help="seconds to wait for a fleet to respond")
+    parser.add_argument("--settle", type=float, default=0.2, help="seconds to wait after each round")
+    parser.add_argument("--json", help="write raw results to this file")
+    args = parser.parse_args()
+
+    results = []
+    print("%7s  %-10s  %10s  %10s  %10s  %11s" % ("devices", "mode", "done ms", "p50 ms", "worst ms", "deliveries"))
+    for count in [int(size) for size in args.sizes.split(",")]:
+        bench = Bench(args, count)
+        try:
+            bench.setup()
+            for mode in MODES:
+                rounds = []
+                for i in range(args.rounds):
+                    result = bench.silence(mode, fleetsim.OUTPUTS_ON if i % 2 == 0 else fleetsim.OUTPUTS_OFF)
+                    if result is None:
+                        sys.exit("error: %d devices did not all respond in %s mode" % (count, mode))
+                    rounds.append(result)
+                done = [r[0] for r in rounds]
+                results.append({"devices": count, "mode": mode, "doneMs": [d * 1000 for d in done],
+                                "p50Ms": [r[1] * 1000 for r in rounds], "deliveries": [r[2] for r in rounds]})
+                print("%7d  %-10s  %10.1f  %10.1f  %10.1f  %11d" % (
+                    count, mode, fleetsim.percentile(done, 50) * 1000,
+                    fleetsim.percentile([r[1] for r in rounds], 50) * 1000, max(done) * 1000,
+                    fleetsim.percentile([r[2] for r in rounds], 50)))
+        finally:
+            bench.close()
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(results, out, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
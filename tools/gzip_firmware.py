@@ -0,0 +1,54 @@
+# PlatformIO post-build script: writes a gzip-compressed copy of the
+# firmware image next to firmware.bin. The ESP8266 bootloader unpacks
+# compressed images itself, so firmware.bin.gz can be served for HTTP pull
+# updates or pushed with espota as-is.
+#
+# HTTP pull updates only accept signed images. When private.key (or the
+# file named by CYLENCE_SIGNING_KEY) exists, firmware.bin.gz is signed
+# with it the way the core's signing.py does: an RSA SHA-256 signature
+# and its 32-bit length are appended to the image. Put the matching
+# public key in HTTP_UPDATE_SIGNING_KEY (config.h). To make a key pair:
+#
+#     openssl genrsa -out private.key 2048
+#     openssl rsa -in private.key -outform PEM -pubout -out public.key
+
+import gzip
+import os
+import shutil
+import struct
+import subprocess
+
+Import("env")  # noqa: F821 (provided by PlatformIO)
+
+
+def sign_image(path, key):
+    with open(path, "rb") as f:
+        image = f.read()
+    signature = subprocess.run(["openssl", "dgst", "-sha256", "-sign", key], input=image,
+                               stdout=subprocess.PIPE, check=True).stdout
+    with open(path, "ab") as f:
+        f.write(signature)
+        f.write(struct.pack("<I", len(signature)))
+
+
+def gzip_firmware(source, target, env):
+    image = str(target[0])
+    compressed = image + ".gz"
+    with open(image, "rb") as src, gzip.open(compressed, "wb", compresslevel=9) as dst:
+        shutil.copyfileobj(src, dst)
+
+    before = os.path.getsize(image)
+    after = os.path.getsize(compressed)
+    print("Compressed %s: %d -> %d bytes (%.0f%%)" % (
+        os.path.basename(image), before, after, 100.0 * after / before if before else 0))
+
+    key = os.environ.get("CYLENCE_SIGNING_KEY") or os.path.join(env.subst("$PROJECT_DIR"), "private.key")
+    if os.path.isfile(key):
+        sign_image(compressed, key)
+        print("Signed %s with %s" % (os.path.basename(compressed), key))
+    else:
+        print("WARNING: %s not found, %s is unsigned and devices will refuse to pull it" % (
+            key, os.path.basename(compressed)))
+
+
+env.AddPostAction("$BUILD_DIR/${PROGNAME}.bin", gzip_firmware)  # noqa: F821
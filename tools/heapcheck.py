@@ -0,0 +1,222 @@
+#!/usr/bin/env python3
+"""
+Steady-state heap check for Cylence.
+
+Drives a device built with the huzzah_heapcheck environment through the
+control path: single commands, batches, channel targeting, status
+requests and messages that get rejected for each reason. It can also use
+direct LAN control if a key is given. The device must not make a single
+heap allocation outside the exempt paths (connecting, NTP, flash I/O,
+the metrics server) while this runs. The count is read from the
+heapAllocs metric the device publishes every METRICS_PUBLISH_INTERVAL,
+and call sites come from the retained cylence/<host>/heap report.
+
+Exits non-zero on any allocation, so it can gate a hardware-in-the-loop
+job on a bench device:
+
+    pio run -e huzzah_heapcheck -t upload
+    tools/heapcheck.py --broker localhost --client-id CYLENCE_A1B2C3 \\
+        --elf .pio/build/huzzah_heapcheck/firmware.elf
+
+Hosted CI has no device. It runs the tracker's host test
+(test/host/heap_tracker_test.cpp) and drives the same control messages
+through the firmware on the host (test/host/control_path_test.cpp), with
+the transport stubbed out. Neither sees the real network stack, so a
+bench run is still worth doing before a release.
+
+Requires paho-mqtt (pip install paho-mqtt). Call sites are decoded with
+the toolchain's addr2line when --elf is given.
+"""
+
+import argparse
+import json
+import os
+import queue
+import sys
+import time
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.exit("error: paho-mqtt is required (pip install paho-mqtt)")
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+# Mirrors ControlCommand in TelemetryHelper.h.
+ENABLE, REQUEST_STATUS, ACTIVATE, OUTPUTS_ON, OUTPUTS_OFF = 1, 3, 4, 5, 6
+
+
+def make_client(client_id):
+    if hasattr(mqtt, "CallbackAPIVersion"):
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id=client_id)
+    return mqtt.Client(client_id=client_id)
+
+
+class Device:
+    def __init__(self, args):
+        self.args = args
+        self.metrics = queue.Queue()
+        self.status = queue.Queue()
+        self.heap_report = None
+        base = "cylence/%s/" % args.client_id
+        self.topics = {base + "metrics": self.metrics.put, args.status_topic: self.status.put,
+                       base + "heap": self.set_heap_report}
+        self.client = make_client("cylence-heapcheck")
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.port)
+        for topic in self.topics:
+            self.client.subscribe(topic)
+        self.client.loop_start()
+
+    def set_heap_report(self, payload):
+        self.heap_report = payload
+
+    def on_message(self, client, userdata, message):
+        try:
+            payload = json.loads(message.payload)
+        except ValueError:
+            return
+        handler = self.topics.get(message.topic)
+        if handler:
+            handler(payload)
+
+    def next_metrics(self, timeout):
+        # Drop anything already queued so the sample is taken after now.
+        while not self.metrics.empty():
+            self.metrics.get_nowait()
+        try:
+            return self.metrics.get(timeout=timeout)
+        except queue.Empty:
+            sys.exit("error: no metrics from %s within %.0fs" % (self.args.client_id, timeout))
+
+    def send(self, payload, expect_status=True):
+        while not self.status.empty():
+            self.status.get_nowait()
+        raw = payload if isinstance(payload, str) else json.dumps(payload)
+        self.client.publish(self.args.control_topic, raw)
+        time.sleep(self.args.interval)
+        if not expect_status:
+            return True
+        try:
+            self.status.get(timeout=self.args.timeout)
+            return True
+        except queue.Empty:
+            return False
+
+    def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def control_script(client_id):
+    """(description, payload, expects a status publish)"""
+    me = {"clientId": client_id}
+    return [
+        ("status request", dict(me, command=REQUEST_STATUS), True),
+        ("outputs on", dict(me, command=OUTPUTS_ON), True),
+        ("outputs off", dict(me, command=OUTPUTS_OFF), True),
+        ("activate", dict(me, command=ACTIVATE), True),
+        ("activate again", dict(me, command=ACTIVATE), True),
+        ("batch", dict(me, commands=[OUTPUTS_ON, REQUEST_STATUS, OUTPUTS_OFF]), True),
+        ("by mask", dict(me, command=OUTPUTS_ON, mask=1), True),
+        ("by channel index", dict(me, command=OUTPUTS_OFF, channel=0), True),
+        ("enable", dict(me, command=ENABLE), True),
+        ("lower-case client id", {"clientId": client_id.lower(), "command": REQUEST_STATUS}, True),
+        ("invalid command", dict(me, command=99), False),
+        ("invalid batch", dict(me, commands=[]), False),
+        ("invalid mask", dict(me, command=OUTPUTS_ON, mask=0), False),
+        ("unknown channel", dict(me, command=OUTPUTS_ON, channel="nope"), False),
+        ("other client", {"clientId": "SOMEONE_ELSE", "command": REQUEST_STATUS}, False),
+        ("no client id", {"command": REQUEST_STATUS}, False),
+        ("malformed JSON", "{\"clientId\":", False),
+    ]
+
+
+def drive_direct(args, rounds):
+    from lanctl import DirectClient
+    client = DirectClient(args.direct_host, args.direct_port, args.key.encode(), args.timeout)
+    failures = 0
+    for _ in range(rounds):
+        for command in (OUTPUTS_ON, OUTPUTS_OFF, REQUEST_STATUS):
+            status, _ = client.send(command)
+            failures += status != 0
+            time.sleep(0.6)
+    return failures
+
+
+def print_sites(report, elf, addr2line):
+    sites = report.get("sites", [])
+    decoded = {}
+    if elf and sites:
+        from decode_crash import decode, find_addr2line
+        addresses = [site["addr"][2:].lower() for site in sites if site["addr"] != "0x00000000"]
+        decoded = decode(find_addr2line(addr2line), elf, addresses)
+    for site in sites:
+        address = site["addr"][2:].lower()
+        print("  %s  x%-5d %6d bytes  %s" % (site["addr"], site["count"], site["bytes"],
+                                             "(other sites)" if address == "00000000" else decoded.get(address, "")))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--client-id", required=True, help="device hostname, e.g. CYLENCE_A1B2C3")
+    parser.add_argument("--control-topic", default="cylence/control")
+    parser.add_argument("--status-topic", default="cylence/status")
+    parser.add_argument("--rounds", type=int, default=5, help="times to run the control script")
+    parser.add_argument("--interval", type=float, default=0.25,
+                        help="seconds between messages (stay under the inbound rate limit)")
+    parser.add_argument("--timeout", type=float, default=3.0, help="seconds to wait for a status publish")
+    parser.add_argument("--metrics-timeout", type=float, default=90.0,
+                        help="seconds to wait for the device's periodic metrics")
+    parser.add_argument("--direct-host", help="also drive direct LAN control at this address")
+    parser.add_argument("--direct-port", type=int, default=4210)
+    parser.add_argument("--key", help="directControlKey, required with --direct-host")
+    parser.add_argument("--elf", help="firmware ELF for decoding call sites")
+    parser.add_argument("--addr2line", help="path to xtensa-lx106-elf-addr2line")
+    args = parser.parse_args()
+    if args.direct_host and not args.key:
+        sys.exit("error: --key is required with --direct-host")
+
+    device = Device(args)
+    try:
+        print("waiting for a baseline metrics sample...")
+        before = device.next_metrics(args.metrics_timeout)
+        if before.get("heapAllocsExempt", 0) == 0:
+            # Connecting always allocates, so a tracking build never reports 0.
+            sys.exit("error: no exempt allocations reported. Is this a huzzah_heapcheck build?")
+
+        missing = 0
+        script = control_script(args.client_id)
+        for _ in range(args.rounds):
+            for name, payload, expect_status in script:
+                if not device.send(payload, expect_status):
+                    print("no status after: %s" % name)
+                    missing += 1
+
+        direct_failures = drive_direct(args, args.rounds) if args.direct_host else 0
+        sent = args.rounds * len(script)
+        print("sent %d control messages%s, waiting for the next metrics sample..." % (
+            sent, " and %d direct commands" % (args.rounds * 3) if args.direct_host else ""))
+        after = device.next_metrics(args.metrics_timeout)
+    finally:
+        device.close()
+
+    allocations = after.get("heapAllocs", 0) - before.get("heapAllocs", 0)
+    allocated = after.get("heapAllocBytes", 0) - before.get("heapAllocBytes", 0)
+    exempt = after.get("heapAllocsExempt", 0) - before.get("heapAllocsExempt", 0)
+    print("steady-state allocations: %d (%d bytes), exempt: %d" % (allocations, allocated, exempt))
+    if missing or direct_failures:
+        print("commands without a response: %d, direct failures: %d" % (missing, direct_failures))
+    if allocations and device.heap_report:
+        print("call sites since boot:")
+        print_sites(device.heap_report, args.elf, args.addr2line)
+
+    ok = allocations == 0 and missing == 0 and direct_failures == 0
+    print("PASS" if ok else "FAIL")
+    return 0 if ok else 1
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,123 @@
+#!/usr/bin/env python3
+"""
+Activation journal reader for Cylence.
+
+Pages through a device's journal of state changes over MQTT, newest
+first, and prints the daily totals the device keeps alongside it.
+
+Examples:
+    # The last 50 changes.
+    tools/journal.py --broker localhost --client-id CYLENCE_A1B2C3 --count 50
+
+    # Everything still in the journal, as CSV.
+    tools/journal.py --broker localhost --client-id CYLENCE_A1B2C3 --all --csv > journal.csv
+
+Requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import csv
+import json
+import queue
+import sys
+import time
+
+try:
+    import paho.mqtt.client as mqtt
+except ImportError:
+    sys.exit("error: paho-mqtt is required (pip install paho-mqtt)")
+
+# Mirrors ControlCommand in TelemetryHelper.h.
+COMMAND_NAMES = {0: "disable", 1: "enable", 2: "reboot", 3: "status", 4: "activate",
+                 5: "outputs_on", 6: "outputs_off", 7: "update"}
+FIELDS = ("seq", "time", "src", "cmd", "mask", "disabled", "durMs")
+
+
+def make_client(client_id):
+    if hasattr(mqtt, "CallbackAPIVersion"):
+        return mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id=client_id)
+    return mqtt.Client(client_id=client_id)
+
+
+class JournalClient:
+    def __init__(self, args):
+        self.args = args
+        self.pages = queue.Queue()
+        base = "cylence/%s/journal" % args.client_id
+        self.request_topic = base + "/get"
+        self.client = make_client("cylence-journal")
+        self.client.on_message = lambda client, userdata, message: self.pages.put(message.payload)
+        self.client.connect(args.broker, args.port)
+        self.client.subscribe(base)
+        self.client.loop_start()
+        time.sleep(0.2)
+
+    def fetch(self, before):
+        self.client.publish(self.request_topic, json.dumps({"before": before}))
+        try:
+            return json.loads(self.pages.get(timeout=self.args.timeout))
+        except queue.Empty:
+            sys.exit("error: no reply from %s (is it online?)" % self.args.client_id)
+
+    def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def format_time(entry):
+    if "ts" in entry:
+        return time.strftime("%Y-%m-%d %H:%M:%S", time.localtime(entry["ts"]))
+    return "uptime+%ds" % entry["uptime"]
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--client-id", required=True, help="device hostname, e.g. CYLENCE_A1B2C3")
+    parser.add_argument("--count", type=int, default=20, help="number of entries to fetch")
+    parser.add_argument("--all", action="store_true", help="fetch the whole journal")
+    parser.add_argument("--csv", action="store_true", help="write entries as CSV")
+    parser.add_argument("--timeout", type=float, default=5.0, help="seconds to wait for each page")
+    args = parser.parse_args()
+
+    client = JournalClient(args)
+    entries, before, first = [], 0, None
+    try:
+        while args.all or len(entries) < args.count:
+            page = client.fetch(before)
+            first = first or page
+            entries.extend(page["entries"])
+            before = page["next"]
+            if before == 0:
+                break
+    finally:
+        client.close()
+
+    if not args.all:
+        entries = entries[:args.count]
+
+    if args.csv:
+        writer = csv.writer(sys.stdout)
+        writer.writerow(FIELDS)
+        for entry in entries:
+            writer.writerow([entry["seq"], format_time(entry), entry["src"], COMMAND_NAMES.get(entry["cmd"], entry["cmd"]),
+                             entry["mask"], int(entry["disabled"]), entry["durMs"]])
+        return 0
+
+    for entry in entries:
+        print("%6d  %-19s  %-10s  %-11s  mask=%-2d%s%s" % (
+            entry["seq"], format_time(entry), entry["src"], COMMAND_NAMES.get(entry["cmd"], entry["cmd"]),
+            entry["mask"], "  disabled" if entry["disabled"] else "",
+            "  silenced %.0fs" % (entry["durMs"] / 1000.0) if entry["durMs"] else ""))
+
+    print()
+    for day in first["days"] if first else []:
+        print("%s  silenced %6ds  activations %d" % (day["day"], day["silencedSec"], day["activations"]))
+    if first and first["activeSec"]:
+        print("currently silenced for %ds" % first["activeSec"])
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,241 @@
+#!/usr/bin/env python3
+"""
+Direct LAN control client for Cylence.
+
+Sends authenticated control datagrams straight to a device (see
+ENABLE_DIRECT_CONTROL), so it can be silenced while the broker is down.
+The device advertises the endpoint over mDNS as _cylence._udp.
+
+Examples:
+    # Silence the bell without going through the broker.
+    tools/lanctl.py --host 192.168.0.238 --key secret send 5
+
+    # Compare direct and broker-mediated round trips.
+    tools/lanctl.py --host 192.168.0.238 --key secret bench --count 200 \\
+        --broker localhost --client-id CYLENCE_A1B2C3
+
+The benchmark measures three things:
+  direct ack     datagram out -> signed reply (command queued on the device)
+  direct status  datagram out -> status published on the broker
+  broker status  control message published -> status published on the broker
+The last two cover the same work on the device, so they compare the paths
+like for like. REQUEST_STATUS (3) is used since it has no side effects.
+
+The broker modes require paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import hashlib
+import hmac
+import json
+import socket
+import statistics
+import struct
+import sys
+import threading
+import time
+
+PORT = 4210
+MAGIC = b"CY"
+VERSION = 1
+HEADER = struct.Struct("!2sBBBBII")
+MAC_SIZE = 32
+
+# Mirrors DirectStatus in main.cpp.
+STATUS_NAMES = {0: "accepted", 1: "replay", 2: "invalid", 3: "queue full"}
+
+# Mirrors ControlCommand in TelemetryHelper.h.
+REQUEST_STATUS = 3
+
+
+class Sequencer:
+    """(timestamp, sequence) pairs the device accepts as strictly newer."""
+
+    def __init__(self):
+        self.last = (0, 0)
+
+    def next(self):
+        now = int(time.time())
+        # Microseconds keep separate senders sharing a key roughly ordered.
+        sequence = int(time.time() * 1000000) % 1000000
+        if (now, sequence) <= self.last:
+            now, sequence = self.last[0], self.last[1] + 1
+        self.last = (now, sequence)
+        return now, sequence
+
+
+def sign(key, header):
+    return hmac.new(key, header, hashlib.sha256).digest()
+
+
+def build_packet(key, command, mask, timestamp, sequence):
+    header = HEADER.pack(MAGIC, VERSION, command, mask, 0, timestamp, sequence)
+    return header + sign(key, header)
+
+
+def parse_reply(key, data):
+    """Returns (status, timestamp, sequence) or None if not a valid reply."""
+    if len(data) != HEADER.size + MAC_SIZE:
+        return None
+    header, mac = data[:HEADER.size], data[HEADER.size:]
+    if not hmac.compare_digest(sign(key, header), mac):
+        return None
+    magic, version, _command, _mask, status, timestamp, sequence = HEADER.unpack(header)
+    if magic != MAGIC or version != VERSION:
+        return None
+    return status, timestamp, sequence
+
+
+class DirectClient:
+    def __init__(self, host, port, key, timeout):
+        self.address = (host, port)
+        self.key = key
+        self.sequencer = Sequencer()
+        self.sock = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        self.sock.settimeout(timeout)
+
+    def send(self, command, mask=0):
+        """Returns (status, round trip seconds), or (None, None) on timeout."""
+        timestamp, sequence = self.sequencer.next()
+        packet = build_packet(self.key, command, mask, timestamp, sequence)
+        start = time.perf_counter()
+        self.sock.sendto(packet, self.address)
+        while True:
+            try:
+                data, _ = self.sock.recvfrom(256)
+            except socket.timeout:
+                return None, None
+            reply = parse_reply(self.key, data)
+            if reply and reply[1:] == (timestamp, sequence):
+                return reply[0], time.perf_counter() - start
+
+
+class StatusWatcher:
+    """Times how long after a trigger the device publishes its status."""
+
+    def __init__(self, args):
+        try:
+            import paho.mqtt.client as mqtt
+        except ImportError:
+            sys.exit("error: paho-mqtt is required for broker modes (pip install paho-mqtt)")
+
+        self.args = args
+        self.event = threading.Event()
+        if hasattr(mqtt, "CallbackAPIVersion"):
+            self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id="lanctl-bench")
+        else:
+            self.client = mqtt.Client(client_id="lanctl-bench")
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.broker_port)
+        self.client.subscribe(args.status_topic)
+        self.client.loop_start()
+        # Let the retained status arrive before timing anything.
+        time.sleep(0.5)
+
+    def on_message(self, client, userdata, message):
+        try:
+            doc = json.loads(message.payload)
+        except ValueError:
+            return
+        if isinstance(doc, dict) and str(doc.get("clientId", "")).upper() == self.args.client_id.upper():
+            self.event.set()
+
+    def time_trigger(self, trigger):
+        self.event.clear()
+        start = time.perf_counter()
+        trigger()
+        if not self.event.wait(self.args.timeout):
+            return None
+        return time.perf_counter() - start
+
+    def publish_command(self, command):
+        payload = json.dumps({"clientId": self.args.client_id, "command": command})
+        self.client.publish(self.args.control_topic, payload)
+
+    def stop(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def summarize(name, samples, attempts):
+    if not samples:
+        print("%-14s no replies (%d sent)" % (name, attempts))
+        return
+    ms = sorted(s * 1000.0 for s in samples)
+    p95 = ms[min(len(ms) - 1, int(round(0.95 * (len(ms) - 1))))]
+    print("%-14s n=%-5d lost=%-4d min=%7.2f median=%7.2f p95=%7.2f max=%7.2f ms" % (
+        name, len(ms), attempts - len(ms), ms[0], statistics.median(ms), p95, ms[-1]))
+
+
+def cmd_send(args, client):
+    status, rtt = client.send(args.command, args.mask)
+    if status is None:
+        print("no reply (timeout, bad key, rate limited or clock not set)")
+        return 1
+    print("%s in %.2f ms" % (STATUS_NAMES.get(status, "status %d" % status), rtt * 1000.0))
+    return 0 if status == 0 else 1
+
+
+def cmd_bench(args, client):
+    acks = []
+    for _ in range(args.count):
+        status, rtt = client.send(REQUEST_STATUS)
+        if status == 0:
+            acks.append(rtt)
+        time.sleep(args.interval)
+    summarize("direct ack", acks, args.count)
+
+    if not args.broker:
+        return 0
+    if not args.client_id:
+        sys.exit("error: --client-id is required with --broker")
+
+    watcher = StatusWatcher(args)
+    direct, broker = [], []
+    try:
+        for _ in range(args.count):
+            rtt = watcher.time_trigger(lambda: client.send(REQUEST_STATUS))
+            if rtt is not None:
+                direct.append(rtt)
+            time.sleep(args.interval)
+            rtt = watcher.time_trigger(lambda: watcher.publish_command(REQUEST_STATUS))
+            if rtt is not None:
+                broker.append(rtt)
+            time.sleep(args.interval)
+    finally:
+        watcher.stop()
+
+    summarize("direct status", direct, args.count)
+    summarize("broker status", broker, args.count)
+    return 0
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--host", required=True, help="device address or hostname.local")
+    parser.add_argument("--port", type=int, default=PORT)
+    parser.add_argument("--key", required=True, help="directControlKey from the device config")
+    parser.add_argument("--timeout", type=float, default=1.0, help="seconds to wait for a reply")
+    sub = parser.add_subparsers(dest="mode", required=True)
+
+    send = sub.add_parser("send", help="send one command")
+    send.add_argument("command", type=int, help="ControlCommand value")
+    send.add_argument("--mask", type=int, default=0, help="channel mask (0 = all channels)")
+
+    bench = sub.add_parser("bench", help="measure round trips")
+    bench.add_argument("--count", type=int, default=100)
+    bench.add_argument("--interval", type=float, default=0.6,
+                       help="seconds between commands (stay under the device's rate limit)")
+    bench.add_argument("--broker", help="also benchmark the broker path through this broker")
+    bench.add_argument("--broker-port", type=int, default=1883)
+    bench.add_argument("--client-id", help="device hostname, e.g. CYLENCE_A1B2C3")
+    bench.add_argument("--control-topic", default="cylence/control")
+    bench.add_argument("--status-topic", default="cylence/status")
+
+    args = parser.parse_args()
+    client = DirectClient(args.host, args.port, args.key.encode(), args.timeout)
+    return cmd_send(args, client) if args.mode == "send" else cmd_bench(args, client)
+
+
+if __name__ == "__main__":
+    sys.exit(main())
@@ -0,0 +1,71 @@
+#!/usr/bin/env bash
+# Sets up a throwaway TLS mosquitto broker for testing mqttUseTls.
+#
+# Usage: tools/mosquitto_tls.sh <broker-host-or-ip> [dir]
+#
+# Generates a CA and a server certificate for the given host, writes a
+# mosquitto.conf with a TLS listener on 8883 and prints the values to put
+# in config.json (either the fingerprint or the CA file, which must be
+# uploaded to SPIFFS with 'pio run -t uploadfs'). Then run:
+#
+#   mosquitto -c <dir>/mosquitto.conf -v
+#
+# Handshake time and heap use are reported by the device itself in the
+# connMs/connHeap metrics after every (re)connect. Compare a first connect
+# against a reconnect to see what session resumption saves. The s_client
+# checks printed at the end confirm, from the host, that the broker resumes
+# sessions and accepts the max fragment length the firmware asks for.
+
+set -euo pipefail
+
+HOST="${1:?usage: $0 <broker-host-or-ip> [dir]}"
+DIR="${2:-./mosquitto-tls}"
+DAYS=825
+
+mkdir -p "$DIR"
+cd "$DIR"
+
+if [[ "$HOST" =~ ^[0-9.]+$ ]]; then
+    SAN="IP:$HOST"
+else
+    SAN="DNS:$HOST"
+fi
+
+openssl req -x509 -newkey rsa:2048 -nodes -days "$DAYS" \
+    -keyout ca.key -out ca.crt -subj "/CN=Cylence Test CA" 2>/dev/null
+
+# RSA 2048 keeps the handshake within what the ESP8266 manages in a few
+# hundred milliseconds. EC certificates are faster still if the broker's
+# OpenSSL build and the device's cipher list agree.
+openssl req -newkey rsa:2048 -nodes -keyout server.key -out server.csr \
+    -subj "/CN=$HOST" 2>/dev/null
+openssl x509 -req -in server.csr -CA ca.crt -CAkey ca.key -CAcreateserial \
+    -days "$DAYS" -out server.crt -extfile <(printf "subjectAltName=%s" "$SAN") 2>/dev/null
+rm -f server.csr
+
+cat > mosquitto.conf <<CONF
+listener 8883
+cafile $(pwd)/ca.crt
+certfile $(pwd)/server.crt
+keyfile $(pwd)/server.key
+tls_version tlsv1.2
+allow_anonymous true
+CONF
+
+FINGERPRINT=$(openssl x509 -in server.crt -noout -fingerprint -sha1 | cut -d= -f2 | tr ':' ' ')
+
+echo "Broker files written to $(pwd)"
+echo
+echo "config.json (pinned fingerprint):"
+echo "    \"mqttPort\": 8883,"
+echo "    \"mqttUseTls\": true,"
+echo "    \"mqttFingerprint\": \"$FINGERPRINT\","
+echo
+echo "config.json (CA instead, copy ca.crt to data/):"
+echo "    \"mqttPort\": 8883,"
+echo "    \"mqttUseTls\": true,"
+echo "    \"mqttCaFile\": \"/ca.crt\","
+echo
+echo "Host-side checks once mosquitto is running:"
+echo "    openssl s_client -connect $HOST:8883 -CAfile $(pwd)/ca.crt -reconnect </dev/null | grep -E '^(New|Reused)'"
+echo "    openssl s_client -connect $HOST:8883 -CAfile $(pwd)/ca.crt -maxfraglen 1024 </dev/null | grep -i 'fragment'"
@@ -0,0 +1,306 @@
+#!/usr/bin/env python3
+"""
+Network profile benchmark for Cylence.
+
+Measures what each network profile (the networkProfile setting) costs in
+command latency and in how long a dead link goes unnoticed. For every
+profile it reports:
+
+  round trip  from publishing an outputs on/off command until the
+              device's status report arrives (p50, p95 and worst)
+  offline     from the link dying until the broker publishes the
+              device's "offline" will, i.e. the broker noticed
+  reconnect   from the link dying until the device opens a new
+              connection, i.e. the device noticed
+  online      from the link dying until the device is back online
+
+The device reaches the broker through a TCP relay run by this tool, so
+point the device's mqttBroker at this host and mqttPort at --listen. To
+kill the link the relay stops forwarding in both directions but keeps
+both sockets open, like an AP dropping out upstream. Neither side gets a
+FIN, so only the MQTT keepalive can tell them.
+
+With --serial the profiles are switched through the console's line mode
+(set, save, resume). Without it only the device's current profile is
+measured, labelled with --label.
+
+Example:
+    tools/netbench.py --broker localhost --listen 1884 \\
+        --client-id CYLENCE_A1B2C3 --serial /dev/ttyUSB0 --rounds 50 --drops 3
+
+Requires paho-mqtt (pip install paho-mqtt), and pyserial for --serial.
+"""
+
+import argparse
+import json
+import os
+import selectors
+import socket
+import sys
+import threading
+import time
+
+sys.path.insert(0, os.path.dirname(os.path.abspath(__file__)))
+
+import fleetsim
+import provision
+
+# Mirrors NETWORK_PROFILE_* in config.h.
+PROFILES = {"low-power": 0, "low-latency": 1}
+
+
+class Link:
+    def __init__(self, device, broker):
+        self.device = device
+        self.broker = broker
+        self.live = True
+
+
+class Relay:
+    """Forwards device connections to the broker until told to go silent."""
+
+    def __init__(self, listen, broker, port):
+        self.upstream = (broker, port)
+        self.server = socket.create_server(("", listen))
+        self.selector = selectors.DefaultSelector()
+        self.selector.register(self.server, selectors.EVENT_READ)
+        self.lock = threading.Lock()
+        self.links = []
+        self.accepts = []
+        thread = threading.Thread(target=self.run, daemon=True)
+        thread.start()
+
+    def run(self):
+        while True:
+            events = self.selector.select(0.05)
+            with self.lock:
+                for key, _ in events:
+                    if key.fileobj is self.server:
+                        self.accept()
+                    else:
+                        self.forward(*key.data)
+
+    def accept(self):
+        device, _ = self.server.accept()
+        try:
+            broker = socket.create_connection(self.upstream, timeout=5)
+        except OSError:
+            device.close()
+            return
+        device.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        broker.setsockopt(socket.IPPROTO_TCP, socket.TCP_NODELAY, 1)
+        link = Link(device, broker)
+        self.links.append(link)
+        self.accepts.append(time.monotonic())
+        self.selector.register(device, selectors.EVENT_READ, (link, broker))
+        self.selector.register(broker, selectors.EVENT_READ, (link, device))
+
+    def forward(self, link, peer):
+        source = link.broker if peer is link.device else link.device
+        try:
+            data = source.recv(4096)
+        except OSError:
+            data = b""
+        if data and link.live:
+            try:
+                peer.sendall(data)
+                return
+            except OSError:
+                data = b""
+        if data:
+            # Silent: read and drop, so neither side sees a full window.
+            return
+
+        # A dead link only closes the side that hung up. The other side has
+        # to find out by itself, as it would if the path were really gone.
+        self.close(link, source)
+        if link.live:
+            self.close(link, peer)
+
+    def close(self, link, sock):
+        if sock.fileno() < 0:
+            return
+        self.selector.unregister(sock)
+        sock.close()
+        if link.device.fileno() < 0 and link.broker.fileno() < 0:
+            self.links.remove(link)
+
+    def kill(self):
+        with self.lock:
+            for link in self.links:
+                link.live = False
+            return len(self.accepts)
+
+    def accepted_since(self, count):
+        with self.lock:
+            return self.accepts[count] if len(self.accepts) > count else None
+
+
+class Bench:
+    def __init__(self, args):
+        self.args = args
+        self.lock = threading.Condition()
+        self.status = []
+        self.availability = []
+        self.availability_topic = "%s/%s/availability" % (fleetsim.DEVICE_CLASS, args.client_id)
+        self.client = fleetsim.make_client("cylence-netbench")
+        self.client.on_message = self.on_message
+        self.client.connect(args.broker, args.port)
+        self.client.subscribe(args.status_topic)
+        self.client.subscribe(self.availability_topic)
+        self.client.loop_start()
+
+    def on_message(self, client, userdata, message):
+        if message.retain:
+            return
+        now = time.monotonic()
+        with self.lock:
+            if message.topic == self.availability_topic:
+                self.availability.append((now, message.payload.decode(errors="replace")))
+            else:
+                try:
+                    doc = json.loads(message.payload)
+                except ValueError:
+                    return
+                if doc.get("clientId", "").upper() == self.args.client_id.upper():
+                    self.status.append((now, doc.get("silencerState")))
+            self.lock.notify_all()
+
+    def wait_for(self, events, since, match, timeout):
+        deadline = time.monotonic() + timeout
+        with self.lock:
+            while True:
+                for stamp, value in events:
+                    if stamp >= since and match(value):
+                        return stamp
+                remaining = deadline - time.monotonic()
+                if remaining <= 0:
+                    return None
+                self.lock.wait(remaining)
+
+    def round_trip(self, command):
+        want = "ON" if command == fleetsim.OUTPUTS_ON else "OFF"
+        start = time.monotonic()
+        self.client.publish(self.args.control_topic, json.dumps({"clientId": self.args.client_id, "command": command}))
+        stamp = self.wait_for(self.status, start, lambda state: state == want, self.args.timeout)
+        return None if stamp is None else stamp - start
+
+    def drop(self, relay):
+        # Let the device settle into its keepalive cycle first.
+        time.sleep(self.args.settle)
+        accepts = relay.kill()
+        start = time.monotonic()
+        offline = self.wait_for(self.availability, start, lambda value: value == "offline", self.args.drop_timeout)
+        online = self.wait_for(self.availability, start, lambda value: value == "online", self.args.drop_timeout)
+        reconnect = relay.accepted_since(accepts)
+        return tuple(None if stamp is None else stamp - start for stamp in (offline, reconnect, online))
+
+    def close(self):
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def switch_profile(args, relay, bench, name):
+    accepts = len(relay.accepts)
+    start = time.monotonic()
+    results = {}
+    options = argparse.Namespace(timeout=args.timeout, show=False, resume=True)
+    provision.provision(provision.SerialLink(args.serial, args.baud), ["set net.profile=%d" % PROFILES[name]],
+                        options, results)
+    status, _, detail = results[args.serial]
+    if status != "ok":
+        sys.exit("error: could not switch to %s: %s" % (name, detail))
+
+    # Saving a changed profile reconnects MQTT before the console resumes.
+    # An unchanged one doesn't.
+    if relay.accepted_since(accepts) is not None \
+            and bench.wait_for(bench.availability, start, lambda value: value == "online", args.timeout) is None:
+        sys.exit("error: device did not come back online after switching to %s" % name)
+
+
+def fmt(value, scale=1.0):
+    return "%9s" % ("-" if value is None else "%.1f" % (value * scale))
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--broker", default="localhost")
+    parser.add_argument("--port", type=int, default=1883)
+    parser.add_argument("--listen", type=int, default=1884, help="relay port the device connects to")
+    parser.add_argument("--client-id", required=True, help="device hostname, e.g. CYLENCE_A1B2C3")
+    parser.add_argument("--control-topic", default="cylence/control")
+    parser.add_argument("--status-topic", default="cylence/status")
+    parser.add_argument("--serial", help="console port, to switch profiles between runs")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--profiles", default=",".join(PROFILES), help="profiles to measure, with --serial")
+    parser.add_argument("--label", default="current", help="name for the profile measured without --serial")
+    parser.add_argument("--rounds", type=int, default=50, help="commands per profile")
+    parser.add_argument("--interval", type=float, default=0.25,
+                        help="seconds between commands (stay under the inbound rate limit)")
+    parser.add_argument("--drops", type=int, default=3, help="dead links per profile")
+    parser.add_argument("--settle", type=float, default=2.0, help="seconds online before each dead link")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait for a status report")
+    parser.add_argument("--drop-timeout", type=float, default=120.0, help="seconds to wait for a dead link to recover")
+    parser.add_argument("--json", help="write raw results to this file")
+    args = parser.parse_args()
+
+    if args.serial:
+        profiles = [name.strip() for name in args.profiles.split(",")]
+        unknown = [name for name in profiles if name not in PROFILES]
+        if unknown:
+            sys.exit("error: unknown profile %s (choose from %s)" % (unknown[0], ", ".join(PROFILES)))
+    else:
+        profiles = [args.label]
+
+    relay = Relay(args.listen, args.broker, args.port)
+    bench = Bench(args)
+    print("waiting for %s to connect through port %d..." % (args.client_id, args.listen))
+    if bench.wait_for(bench.availability, 0, lambda value: value == "online", args.drop_timeout) is None \
+            and relay.accepted_since(0) is None:
+        sys.exit("error: %s never connected through the relay" % args.client_id)
+
+    results = []
+    print("%-12s  %9s  %9s  %9s  %9s  %9s  %9s" % (
+        "profile", "rtt p50", "rtt p95", "rtt max", "offline", "reconnect", "online"))
+    print("%-12s  %9s  %9s  %9s  %9s  %9s  %9s" % ("", "ms", "ms", "ms", "s", "s", "s"))
+    try:
+        for name in profiles:
+            if args.serial:
+                switch_profile(args, relay, bench, name)
+
+            # The device announces itself online just before subscribing.
+            time.sleep(args.settle)
+            trips = []
+            lost = 0
+            for i in range(args.rounds):
+                trip = bench.round_trip(fleetsim.OUTPUTS_ON if i % 2 == 0 else fleetsim.OUTPUTS_OFF)
+                if trip is None:
+                    lost += 1
+                else:
+                    trips.append(trip)
+                time.sleep(args.interval)
+
+            drops = [bench.drop(relay) for _ in range(args.drops)]
+            results.append({"profile": name, "roundTripMs": [t * 1000 for t in trips], "lost": lost,
+                            "drops": [dict(zip(("offline", "reconnect", "online"), d)) for d in drops]})
+
+            def median(column):
+                values = [d[column] for d in drops if d[column] is not None]
+                return fleetsim.percentile(values, 50) if values else None
+
+            print("%-12s  %s  %s  %s  %s  %s  %s" % (
+                name, fmt(fleetsim.percentile(trips, 50), 1000), fmt(fleetsim.percentile(trips, 95), 1000),
+                fmt(max(trips) if trips else None, 1000), fmt(median(0)), fmt(median(1)), fmt(median(2))))
+            if lost:
+                print("    %d of %d commands got no status report" % (lost, args.rounds))
+    finally:
+        bench.close()
+
+    if args.json:
+        with open(args.json, "w") as out:
+            json.dump(results, out, indent=2)
+    return 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())
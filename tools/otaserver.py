@@ -0,0 +1,352 @@
+#!/usr/bin/env python3
+"""
+Local update server for Cylence HTTP pull updates.
+
+Serves an update manifest and a signed firmware image (the
+firmware.bin.gz written by gzip_firmware.py) over HTTP, and logs every
+image download with its size, duration and throughput. Devices pull the
+manifest from their configured updateManifestUrl when they receive the
+UPDATE control command, so point that setting at the manifest URL this
+server prints. Devices refuse images that aren't signed with their key.
+
+With --broker, the server also runs the rollout. It sends UPDATE to
+every target device and follows its events and availability topics until
+each device has updated and come back online. It then reports how long
+the rollout took. Targets come from --hosts or from the retained
+discovery announcements.
+
+Without devices at hand, --simulate N starts N local clients that pull
+the manifest and image the way the firmware does, with the same jitter.
+This measures raw server throughput and rollout time. --throttle caps
+each download to roughly what an ESP8266 sustains over WiFi.
+
+Examples:
+    tools/otaserver.py --image .pio/build/huzzah/firmware.bin.gz --version 1.1 --simulate 50
+    tools/otaserver.py --image .pio/build/huzzah/firmware.bin.gz --version 1.1 \\
+        --advertise 192.168.0.10 --broker 192.168.0.5 --discover 5
+
+Rollout mode requires paho-mqtt (pip install paho-mqtt).
+"""
+
+import argparse
+import hashlib
+import json
+import os
+import random
+import socket
+import sys
+import threading
+import time
+import urllib.request
+from http.server import BaseHTTPRequestHandler, ThreadingHTTPServer
+
+DEVICE_CLASS = "cylence"
+
+# Mirrors ControlCommand::UPDATE in TelemetryHelper.h.
+UPDATE = 7
+
+# Mirrors HTTP_UPDATE_JITTER in config.h (ms).
+DEFAULT_JITTER_MS = 5000
+
+
+def percentile(values, pct):
+    if not values:
+        return 0.0
+    ordered = sorted(values)
+    index = min(len(ordered) - 1, int(round(pct / 100.0 * (len(ordered) - 1))))
+    return ordered[index]
+
+
+class UpdateServer:
+    def __init__(self, args):
+        self.args = args
+        with open(args.image, "rb") as f:
+            self.image = f.read()
+        self.image_name = os.path.basename(args.image)
+        self.md5 = hashlib.md5(self.image).hexdigest()
+        self.base_url = "http://%s:%d" % (args.advertise, args.port)
+        self.manifest = json.dumps({
+            "version": args.version,
+            "url": "%s/%s" % (self.base_url, self.image_name),
+        }).encode()
+        self.lock = threading.Lock()
+        self.downloads = []
+        self.manifest_requests = 0
+
+        server = self
+
+        class Handler(BaseHTTPRequestHandler):
+            protocol_version = "HTTP/1.0"
+
+            def log_message(self, fmt, *fmt_args):
+                pass
+
+            def do_GET(self):
+                if self.path == "/manifest.json":
+                    with server.lock:
+                        server.manifest_requests += 1
+                    self.send_body(server.manifest, "application/json")
+                elif self.path == "/" + server.image_name:
+                    server.send_image(self)
+                else:
+                    self.send_error(404)
+
+            def send_body(self, body, content_type, extra=None):
+                self.send_response(200)
+                self.send_header("Content-Type", content_type)
+                self.send_header("Content-Length", str(len(body)))
+                for key, value in (extra or {}).items():
+                    self.send_header(key, value)
+                self.end_headers()
+                self.wfile.write(body)
+
+        self.httpd = ThreadingHTTPServer(("", args.port), Handler)
+        self.httpd.daemon_threads = True
+
+    def send_image(self, handler):
+        # ESP8266httpUpdate verifies the image against x-MD5 when present.
+        start = time.time()
+        handler.send_response(200)
+        handler.send_header("Content-Type", "application/octet-stream")
+        handler.send_header("Content-Length", str(len(self.image)))
+        handler.send_header("x-MD5", self.md5)
+        handler.end_headers()
+        ok = True
+        chunk = 1460
+        delay = chunk / (self.args.throttle * 1024.0) if self.args.throttle > 0 else 0
+        try:
+            for offset in range(0, len(self.image), chunk):
+                handler.wfile.write(self.image[offset:offset + chunk])
+                if delay:
+                    time.sleep(delay)
+        except OSError:
+            ok = False
+
+        elapsed = time.time() - start
+        client = handler.headers.get("x-ESP8266-STA-MAC") or handler.client_address[0]
+        with self.lock:
+            self.downloads.append({
+                "client": client,
+                "bytes": len(self.image),
+                "seconds": elapsed,
+                "finished": time.time(),
+                "ok": ok,
+            })
+
+    def start(self):
+        threading.Thread(target=self.httpd.serve_forever, daemon=True).start()
+        print("Serving %s (%d bytes, md5 %s) as version %s" % (
+            self.image_name, len(self.image), self.md5, self.args.version))
+        print("Manifest: %s/manifest.json" % self.base_url)
+
+    def stop(self):
+        self.httpd.shutdown()
+
+
+def simulate(server, count, jitter_ms):
+    """Stand-in devices: jittered manifest fetch, then the image."""
+    manifest_url = server.base_url.replace(server.args.advertise, "127.0.0.1") + "/manifest.json"
+    results = []
+    lock = threading.Lock()
+
+    def device(index):
+        time.sleep(random.uniform(0, jitter_ms / 1000.0))
+        try:
+            with urllib.request.urlopen(manifest_url, timeout=10) as response:
+                manifest = json.loads(response.read())
+            url = manifest["url"].replace(server.args.advertise, "127.0.0.1")
+            with urllib.request.urlopen(url, timeout=60) as response:
+                size = len(response.read())
+            ok = size == len(server.image)
+        except (OSError, ValueError, KeyError):
+            ok = False
+        with lock:
+            results.append((index, ok, time.time()))
+
+    start = time.time()
+    threads = [threading.Thread(target=device, args=(i,)) for i in range(count)]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    # The server logs a download just after the client has read all of it.
+    deadline = time.time() + 2
+    while len(server.downloads) < sum(1 for r in results if r[1]) and time.time() < deadline:
+        time.sleep(0.05)
+
+    return start, {index: finished for index, ok, finished in results if ok}, sum(1 for r in results if not r[1])
+
+
+class Rollout:
+    """Triggers UPDATE over MQTT and follows each device until it is back."""
+
+    def __init__(self, server, args):
+        try:
+            import paho.mqtt.client as mqtt
+        except ImportError:
+            sys.exit("error: paho-mqtt is required for rollout mode (pip install paho-mqtt)")
+
+        self.server = server
+        self.args = args
+        self.targets = set(h.upper() for h in args.hosts.split(",")) if args.hosts else set()
+        self.completed = {}
+        self.failed = {}
+        self.online = {}
+        self.device_rates = []
+        self.triggered_at = None
+        if hasattr(mqtt, "CallbackAPIVersion"):
+            self.client = mqtt.Client(mqtt.CallbackAPIVersion.VERSION1, client_id="otaserver-%d" % random.randint(0, 1 << 30))
+        else:
+            self.client = mqtt.Client(client_id="otaserver-%d" % random.randint(0, 1 << 30))
+        self.client.on_connect = self.on_connect
+        self.client.on_message = self.on_message
+
+    def on_connect(self, client, userdata, flags, rc):
+        client.subscribe("%s/+/events" % DEVICE_CLASS)
+        client.subscribe("%s/+/availability" % DEVICE_CLASS)
+        if not self.targets:
+            client.subscribe(self.args.discovery_topic + "/#")
+
+    def on_message(self, client, userdata, message):
+        parts = message.topic.split("/")
+        if message.topic.startswith(self.args.discovery_topic + "/"):
+            if message.payload and self.triggered_at is None:
+                self.targets.add(parts[-1].upper())
+            return
+
+        if len(parts) != 3 or self.triggered_at is None:
+            return
+
+        host = parts[1].upper()
+        now = time.time()
+        if parts[2] == "availability":
+            if message.payload == b"online" and host in self.completed:
+                self.online.setdefault(host, now)
+            return
+
+        try:
+            event = json.loads(message.payload)
+        except ValueError:
+            return
+
+        if event.get("event") == "updateComplete":
+            self.completed.setdefault(host, now)
+            if event.get("bytesPerSec"):
+                self.device_rates.append(event["bytesPerSec"])
+        elif event.get("event") == "updateFailed":
+            self.failed[host] = event.get("error", "unknown")
+
+    def run(self):
+        self.client.connect(self.args.broker, self.args.broker_port)
+        self.client.loop_start()
+        if not self.targets:
+            print("Discovering devices for %.0fs..." % self.args.discover)
+            time.sleep(self.args.discover)
+
+        if not self.targets:
+            sys.exit("error: no devices to update")
+
+        self.triggered_at = time.time()
+        for host in sorted(self.targets):
+            payload = json.dumps({"clientId": host, "command": UPDATE})
+            self.client.publish(self.args.control_topic, payload)
+        print("Triggered %d devices" % len(self.targets))
+
+        deadline = self.triggered_at + self.args.timeout
+        while time.time() < deadline:
+            done = set(self.online) | set(self.failed)
+            if self.targets <= done:
+                break
+            time.sleep(0.2)
+
+        self.client.loop_stop()
+        self.client.disconnect()
+
+
+def report(server, start, rollout=None, finished=None, failures=0):
+    downloads = [d for d in server.downloads if d["ok"]]
+    rates = [d["bytes"] / d["seconds"] / 1024.0 for d in downloads if d["seconds"] > 0]
+    print()
+    print("Manifest requests:      %d" % server.manifest_requests)
+    print("Image downloads:        %d ok, %d aborted" % (len(downloads), len(server.downloads) - len(downloads)))
+    if rates:
+        print("Server KiB/s p50/min/max: %.1f / %.1f / %.1f" % (percentile(rates, 50), min(rates), max(rates)))
+    if downloads:
+        print("Last download done:     %.2fs after start" % (max(d["finished"] for d in downloads) - start))
+
+    if finished is not None:
+        print("Simulated devices:      %d updated, %d failed" % (len(finished), failures))
+        if finished:
+            print("Rollout time:           %.2fs" % (max(finished.values()) - start))
+
+    if rollout is not None:
+        print("Devices:                %d targeted, %d updated, %d failed, %d back online" % (
+            len(rollout.targets), len(rollout.completed), len(rollout.failed), len(rollout.online)))
+        if rollout.device_rates:
+            rates = [r / 1024.0 for r in rollout.device_rates]
+            print("Device KiB/s p50/min/max: %.1f / %.1f / %.1f" % (percentile(rates, 50), min(rates), max(rates)))
+        if rollout.completed:
+            print("Last update complete:   %.2fs after trigger" % (max(rollout.completed.values()) - start))
+        if rollout.online:
+            print("Rollout time:           %.2fs (last device back online)" % (max(rollout.online.values()) - start))
+        for host, error in sorted(rollout.failed.items()):
+            print("  %s failed: %s" % (host, error))
+        missing = rollout.targets - set(rollout.online) - set(rollout.failed)
+        for host in sorted(missing):
+            print("  %s did not finish" % host)
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("--image", required=True, help="firmware.bin or firmware.bin.gz")
+    parser.add_argument("--version", required=True, help="version string put in the manifest")
+    parser.add_argument("--port", type=int, default=8000)
+    parser.add_argument("--advertise", help="address devices use to reach this server (default: this host's IP)")
+    parser.add_argument("--throttle", type=float, default=0, help="cap each download at this many KiB/s (0 = off)")
+    parser.add_argument("--simulate", type=int, default=0, help="run N local stand-in devices instead of real ones")
+    parser.add_argument("--jitter", type=int, default=DEFAULT_JITTER_MS, help="stand-in start jitter (ms)")
+    parser.add_argument("--broker", help="MQTT broker; triggers a rollout over MQTT")
+    parser.add_argument("--broker-port", type=int, default=1883)
+    parser.add_argument("--control-topic", default="cylence/control")
+    parser.add_argument("--discovery-topic", default="redqueen/config")
+    parser.add_argument("--hosts", help="comma-separated hostnames to update (default: discover)")
+    parser.add_argument("--discover", type=float, default=5, help="seconds to collect discovery announcements")
+    parser.add_argument("--timeout", type=float, default=600, help="seconds to wait for the rollout")
+    args = parser.parse_args()
+
+    if not args.advertise:
+        probe = socket.socket(socket.AF_INET, socket.SOCK_DGRAM)
+        try:
+            probe.connect(("10.255.255.255", 1))
+            args.advertise = probe.getsockname()[0]
+        except OSError:
+            args.advertise = "127.0.0.1"
+        finally:
+            probe.close()
+
+    server = UpdateServer(args)
+    server.start()
+    try:
+        if args.simulate > 0:
+            start, finished, failures = simulate(server, args.simulate, args.jitter)
+            report(server, start, finished=finished, failures=failures)
+        elif args.broker:
+            rollout = Rollout(server, args)
+            rollout.run()
+            report(server, rollout.triggered_at, rollout=rollout)
+        else:
+            print("Serving until interrupted (Ctrl+C)...")
+            start = time.time()
+            try:
+                while True:
+                    time.sleep(1)
+            except KeyboardInterrupt:
+                pass
+            report(server, start)
+    finally:
+        server.stop()
+
+
+if __name__ == "__main__":
+    main()
@@ -0,0 +1,335 @@
+#!/usr/bin/env python3
+"""
+Bulk provisioning over the serial console's line mode.
+
+Interrupts each device into the console, switches to line mode and sends
+a settings file, then saves and reboots. Several ports are provisioned in
+parallel. Settings files are either:
+
+  *.json   a config.json style object, sent as 'import' lines
+  other    one 'key=value' per line (config.json keys or short names
+           like mqtt.broker), '#' starts a comment
+
+Per-device values can be given with --set, e.g. a hostname per port:
+
+    tools/provision.py --port /dev/ttyUSB0 --port /dev/ttyUSB1 \\
+        --baud 115200 site.json --set mqtt.control=site1/control
+
+--simulate runs the same exchange against an in-process model of the
+firmware's line mode instead of real hardware, which is handy for
+checking a settings file before touching devices:
+
+    tools/provision.py --simulate site.json
+
+Real ports require pyserial (pip install pyserial).
+"""
+
+import argparse
+import json
+import os
+import queue
+import sys
+import threading
+import time
+
+MENU_PROMPT = "Enter command choice"
+READY = "READY"
+IMPORT_LINE_LIMIT = 200
+
+# Mirrors the alias column of CONFIG_FIELDS in config.h.
+ALIASES = {
+    "net.hostname": "hostname", "net.dhcp": "useDhcp", "net.ip": "ip", "net.gw": "gateway",
+    "net.sm": "subnetmask", "net.dns": "dnsServer", "wifi.ssid": "wifiSSID",
+    "wifi.password": "wifiPassword", "mqtt.broker": "mqttBroker", "mqtt.port": "mqttPort",
+    "mqtt.backups": "mqttBackupBrokers", "mqtt.groups": "groups", "mqtt.username": "mqttUsername",
+    "mqtt.password": "mqttPassword", "mqtt.control": "mqttControlTopic",
+    "mqtt.status": "mqttStatusTopic", "mqtt.discovery": "mqttDiscoveryTopic",
+    "mqtt.tls": "mqttUseTls", "mqtt.fingerprint": "mqttFingerprint", "mqtt.ca": "mqttCaFile",
+    "mqtt.backupFingerprints": "mqttBackupFingerprints",
+    "ota.port": "otaPort", "ota.password": "otaPassword", "ota.manifest": "updateManifestUrl",
+    "control.key": "directControlKey", "outputs.channels": "outputChannels", "outputs.quiet": "quietHours",
+    "clock.timezone": "timezone", "mqtt.fields": "mqttStatusFields", "mqtt.legacy": "mqttStatusLegacy",
+    "mqtt.heartbeat": "heartbeatInterval", "power.idle": "idleSleepMs", "power.light": "idleLightSleep",
+    "net.profile": "networkProfile",
+}
+SECRETS = ("wifiPassword", "mqttPassword", "otaPassword", "directControlKey")
+
+
+class ProvisionError(Exception):
+    pass
+
+
+def load_commands(path, overrides):
+    """Turns a settings file plus --set overrides into console lines."""
+    commands = []
+    if path.endswith(".json"):
+        with open(path) as f:
+            settings = json.load(f)
+        if not isinstance(settings, dict):
+            raise ProvisionError("%s: expected a JSON object" % path)
+
+        # Several short imports rather than one long line, to stay well
+        # inside the device's serial receive buffer.
+        batch = {}
+        for key, value in settings.items():
+            candidate = dict(batch, **{key: value})
+            if batch and len(json.dumps(candidate, separators=(",", ":"))) > IMPORT_LINE_LIMIT:
+                commands.append("import " + json.dumps(batch, separators=(",", ":")))
+                candidate = {key: value}
+            batch = candidate
+        if batch:
+            commands.append("import " + json.dumps(batch, separators=(",", ":")))
+    else:
+        with open(path) as f:
+            for number, line in enumerate(f, 1):
+                line = line.split("#", 1)[0].strip()
+                if not line:
+                    continue
+                if "=" not in line:
+                    raise ProvisionError("%s:%d: expected key=value" % (path, number))
+                commands.append("set " + line)
+
+    commands.extend("set " + item for item in overrides)
+    return commands
+
+
+class SerialLink:
+    def __init__(self, port, baud):
+        try:
+            import serial
+        except ImportError:
+            sys.exit("error: pyserial is required (pip install pyserial)")
+        self.name = port
+        self.serial = serial.Serial(port, baud, timeout=0.1)
+
+    def write(self, text):
+        self.serial.write(text.encode())
+
+    def readline(self, timeout):
+        deadline = time.time() + timeout
+        data = b""
+        while time.time() < deadline:
+            data += self.serial.readline()
+            if data.endswith(b"\n"):
+                return data.decode(errors="replace").rstrip("\r\n")
+        return None if not data else data.decode(errors="replace")
+
+    def close(self):
+        self.serial.close()
+
+
+class SimulatedDevice:
+    """Models the firmware's menu and line mode closely enough for a dry run."""
+
+    def __init__(self, name, config_path):
+        self.name = name
+        with open(config_path) as f:
+            self.config = json.load(f)
+        self.saved = None
+        self.inbox = queue.Queue()
+        self.outbox = queue.Queue()
+        self.buffer = ""
+        self.thread = threading.Thread(target=self.run, daemon=True)
+        self.thread.start()
+
+    # Host side.
+    def write(self, text):
+        for char in text:
+            self.inbox.put(char)
+
+    def readline(self, timeout):
+        try:
+            return self.outbox.get(timeout=timeout)
+        except queue.Empty:
+            return None
+
+    def close(self):
+        pass
+
+    # Device side.
+    def println(self, text=""):
+        self.outbox.put(text)
+
+    def read_char(self):
+        return self.inbox.get()
+
+    def read_line(self):
+        line = ""
+        while True:
+            char = self.read_char()
+            if char == "\n":
+                return line.strip()
+            if char != "\r":
+                line += char
+
+    def run(self):
+        while self.read_char() != "i":
+            pass
+        self.println("ERROR: Entering failsafe (config) mode...")
+        self.println(MENU_PROMPT + " (r/c/m/a/s/n/w/e/g/f/z/l): ")
+        while self.read_char() != "l":
+            self.println("WARN: Unrecognized command.")
+        self.println("Line mode. Commands: set <key>=<value>, import <json>, show, describe [key], save, reboot, resume, menu")
+        while True:
+            self.println(READY)
+            line = self.read_line()
+            if not line:
+                continue
+            if line in ("reboot", "resume"):
+                self.println("OK")
+                return
+            self.println("OK" if self.run_command(line) else "FAIL")
+
+    def run_command(self, line):
+        if line.startswith("set "):
+            key, sep, value = line[4:].partition("=")
+            if not sep:
+                return False
+            key = ALIASES.get(key.strip().lower(), key.strip())
+            return self.set_value(key, value.strip())
+        if line.startswith("import "):
+            try:
+                doc = json.loads(line[7:])
+            except ValueError as error:
+                self.println("ERROR: Invalid import document: %s" % error)
+                return False
+            unknown = [key for key in doc if key not in self.config]
+            if unknown:
+                self.println("ERROR: Unknown setting: %s" % unknown[0])
+                return False
+            self.config.update(doc)
+            return True
+        if line == "show":
+            shown = {k: ("********" if k in SECRETS and v else v) for k, v in self.config.items()}
+            self.println(json.dumps(shown, separators=(",", ":")))
+            return True
+        if line == "save":
+            self.println("INFO: Saving configuration to: /config.json ... ")
+            self.saved = dict(self.config)
+            self.println("DONE")
+            return True
+        self.println("ERROR: Unknown command: %s" % line)
+        return False
+
+    def set_value(self, key, value):
+        if key not in self.config:
+            self.println("ERROR: Unknown setting: %s" % key)
+            return False
+        current = self.config[key]
+        if isinstance(current, bool):
+            if value.lower() not in ("true", "false"):
+                self.println("ERROR: Expected true or false.")
+                return False
+            self.config[key] = value.lower() == "true"
+        elif isinstance(current, list):
+            self.config[key] = [item.strip() for item in value.split(",") if item.strip()]
+        elif isinstance(current, int):
+            try:
+                self.config[key] = int(value)
+            except ValueError:
+                self.println("ERROR: Expected a number.")
+                return False
+        else:
+            self.config[key] = value
+        return True
+
+
+def expect(link, wanted, timeout, log):
+    deadline = time.time() + timeout
+    while time.time() < deadline:
+        line = link.readline(max(0.05, deadline - time.time()))
+        if line is None:
+            continue
+        log.append(line)
+        for index, token in enumerate(wanted):
+            if line == token or line.startswith(token):
+                return index, line
+    raise ProvisionError("%s: timed out waiting for %s" % (link.name, " or ".join(wanted)))
+
+
+def provision(link, commands, args, results):
+    log = []
+    start = time.time()
+    try:
+        # The console only notices the interrupt between loop passes, so
+        # keep nudging until the menu shows up.
+        deadline = time.time() + args.timeout
+        while True:
+            link.write("i")
+            try:
+                expect(link, [MENU_PROMPT], 1.0, log)
+                break
+            except ProvisionError:
+                if time.time() > deadline:
+                    raise
+        link.write("l\n")
+        expect(link, [READY], args.timeout, log)
+
+        for command in commands + ["save"]:
+            link.write(command + "\n")
+            index, _ = expect(link, ["OK", "FAIL"], args.timeout, log)
+            if index == 1:
+                detail = [line for line in log[-5:] if line.startswith("ERROR:")]
+                raise ProvisionError("%s: '%s' failed%s" % (
+                    link.name, command, (": " + detail[-1][7:]) if detail else ""))
+            expect(link, [READY], args.timeout, log)
+
+        if args.show:
+            link.write("show\n")
+            expect(link, ["{"], args.timeout, log)
+            results[link.name] = ("ok", time.time() - start, log[-1])
+        else:
+            results[link.name] = ("ok", time.time() - start, None)
+        link.write(("resume" if args.resume else "reboot") + "\n")
+    except ProvisionError as error:
+        results[link.name] = ("failed", time.time() - start, str(error))
+    finally:
+        link.close()
+
+
+def main():
+    parser = argparse.ArgumentParser(description=__doc__, formatter_class=argparse.RawDescriptionHelpFormatter)
+    parser.add_argument("settings", help="settings file (.json or key=value lines)")
+    parser.add_argument("--port", action="append", default=[], help="serial port (repeat for several devices)")
+    parser.add_argument("--baud", type=int, default=115200)
+    parser.add_argument("--set", action="append", default=[], metavar="KEY=VALUE", help="extra setting")
+    parser.add_argument("--timeout", type=float, default=10.0, help="seconds to wait for each reply")
+    parser.add_argument("--resume", action="store_true", help="resume instead of rebooting when done")
+    parser.add_argument("--show", action="store_true", help="print each device's config when done")
+    parser.add_argument("--simulate", type=int, nargs="?", const=1, default=0, metavar="N",
+                        help="provision N simulated devices instead of serial ports")
+    parser.add_argument("--base-config", default=os.path.join(os.path.dirname(__file__), "..", "data", "config.json"),
+                        help="starting config for simulated devices")
+    args = parser.parse_args()
+
+    try:
+        commands = load_commands(args.settings, args.set)
+    except (OSError, ValueError, ProvisionError) as error:
+        sys.exit("error: %s" % error)
+
+    if args.simulate:
+        links = [SimulatedDevice("sim%d" % i, args.base_config) for i in range(args.simulate)]
+    elif args.port:
+        links = [SerialLink(port, args.baud) for port in args.port]
+    else:
+        sys.exit("error: give at least one --port, or --simulate")
+
+    results = {}
+    threads = [threading.Thread(target=provision, args=(link, commands, args, results)) for link in links]
+    for thread in threads:
+        thread.start()
+    for thread in threads:
+        thread.join()
+
+    failed = 0
+    for link in links:
+        status, elapsed, detail = results[link.name]
+        print("%-16s %-7s %6.2fs %d commands" % (link.name, status, elapsed, len(commands) + 1))
+        if detail:
+            print("    " + detail)
+        failed += status != "ok"
+    return 1 if failed else 0
+
+
+if __name__ == "__main__":
+    sys.exit(main())